@@ -1385,11 +1385,13 @@ namespace spades {
 		
 		spades::ui::RadioButton@ driverOpenAL;
 		spades::ui::RadioButton@ driverYSR;
+		spades::ui::RadioButton@ driverSW;
 		spades::ui::RadioButton@ driverNull;
 		
 		spades::ui::TextViewer@ helpView;
 		StartupScreenConfigView@ configViewOpenAL;
 		StartupScreenConfigView@ configViewYSR;
+		StartupScreenConfigView@ configViewSW;
 		
 		private ConfigItem s_audioDriver("s_audioDriver");
 		private ConfigItem s_eax("s_eax");
@@ -1441,9 +1443,21 @@ namespace spades {
 			}
 			{
 				spades::ui::RadioButton e(Manager);
-				e.Caption = _Tr("StartupScreen", "Null");
+				e.Caption = _Tr("StartupScreen", "Software");
 				e.Bounds = AABB2(320.f, 0.f, 100.f, 24.f);
 				e.GroupName = "driver";
+				HelpHandler(helpView, 
+					_Tr("StartupScreen", "Mixes sound on the CPU without any additional "
+					"library. Sounds are panned in stereo, but no reverb is applied.")).Watch(e);
+				@e.Activated = EventHandler(this.OnDriverSW);
+				AddChild(e);
+				@driverSW = e;
+			}
+			{
+				spades::ui::RadioButton e(Manager);
+				e.Caption = _Tr("StartupScreen", "Null");
+				e.Bounds = AABB2(430.f, 0.f, 100.f, 24.f);
+				e.GroupName = "driver";
 				HelpHandler(helpView, 
 					_Tr("StartupScreen", "Disables audio output.")).Watch(e);
 				@e.Activated = EventHandler(this.OnDriverNull);
@@ -1494,6 +1508,23 @@ namespace spades {
 				@configViewYSR = cfg;
 			}
 			
+			{
+				StartupScreenConfigView cfg(Manager);
+				
+				cfg.AddRow(StartupScreenConfigSliderItemEditor(ui, 
+					StartupScreenConfig(ui, "s_maxPolyphonics"), 16.0, 256.0, 8.0,
+					_Tr("StartupScreen", "Polyphonics"), _Tr("StartupScreen", 
+					"Specifies how many sounds can be played simultaneously. "
+					"When the limit is reached, the oldest sound is stopped."),
+					ConfigNumberFormatter(0, " poly")));
+				
+				cfg.Finalize();
+				cfg.SetHelpTextHandler(HelpTextHandler(this.HandleHelpText));
+				cfg.Bounds = AABB2(0.f, 30.f, mainWidth, size.y - 30.f);
+				AddChild(cfg);
+				@configViewSW = cfg;
+			}
+			
 		}
 		
 		private void HandleHelpText(string text) {
@@ -1502,6 +1533,7 @@ namespace spades {
 		
 		private void OnDriverOpenAL(spades::ui::UIElement@){ s_audioDriver.StringValue = "openal"; LoadConfig(); }
 		private void OnDriverYSR(spades::ui::UIElement@){ s_audioDriver.StringValue = "ysr"; LoadConfig(); }
+		private void OnDriverSW(spades::ui::UIElement@){ s_audioDriver.StringValue = "sw"; LoadConfig(); }
 		private void OnDriverNull(spades::ui::UIElement@){ s_audioDriver.StringValue = "null"; LoadConfig(); }
 		
 		void LoadConfig() {
@@ -1509,20 +1541,30 @@ namespace spades {
 				driverYSR.Check();
 				configViewOpenAL.Visible = false;
 				configViewYSR.Visible = true;
+				configViewSW.Visible = false;
 			}else if(s_audioDriver.StringValue == "openal"){
 				driverOpenAL.Check();
 				configViewOpenAL.Visible = true;
 				configViewYSR.Visible = false;
+				configViewSW.Visible = false;
+			}else if(s_audioDriver.StringValue == "sw"){
+				driverSW.Check();
+				configViewOpenAL.Visible = false;
+				configViewYSR.Visible = false;
+				configViewSW.Visible = true;
 			}else if(s_audioDriver.StringValue == "null"){
 				driverNull.Check();
 				configViewOpenAL.Visible = false;
 				configViewYSR.Visible = false;
+				configViewSW.Visible = false;
 			}
 			driverOpenAL.Enable = ui.helper.CheckConfigCapability("s_audioDriver", "openal").length == 0;
 			driverYSR.Enable = ui.helper.CheckConfigCapability("s_audioDriver", "ysr").length == 0;
+			driverSW.Enable = ui.helper.CheckConfigCapability("s_audioDriver", "sw").length == 0;
 			driverNull.Enable = ui.helper.CheckConfigCapability("s_audioDriver", "null").length == 0;
 			configViewOpenAL.LoadConfig();
 			configViewYSR.LoadConfig();
+			configViewSW.LoadConfig();
 			
 		}
 		
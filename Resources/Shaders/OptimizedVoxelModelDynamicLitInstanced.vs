@@ -0,0 +1,75 @@
+/*
+ Copyright (c) 2013 yvt
+ 
+ This file is part of OpenSpades.
+ 
+ OpenSpades is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ 
+ OpenSpades is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with OpenSpades.  If not, see <http://www.gnu.org/licenses/>.
+ 
+ */
+
+
+
+uniform mat4 projectionViewMatrix;
+uniform mat4 viewMatrix;
+uniform vec3 modelOrigin;
+uniform float fogDistance;
+uniform vec2 texScale;
+
+// [x, y, z]
+attribute vec3 positionAttribute;
+
+// [u, v]
+attribute vec2 textureCoordAttribute;
+
+// [x, y, z]
+attribute vec3 normalAttribute;
+
+// per-instance
+attribute mat4 modelMatrixAttribute;
+attribute vec3 customColorAttribute;
+
+varying vec2 textureCoord;
+varying vec3 fogDensity;
+varying vec3 customColor;
+//varying vec2 detailCoord;
+
+void PrepareForDynamicLightNoBump(vec3 vertexCoord, vec3 normal);
+vec4 FogDensity(float poweredLength);
+
+void main() {
+	
+	vec4 vertexPos = vec4(positionAttribute.xyz, 1.);
+	
+	vertexPos.xyz += modelOrigin;
+	
+	vec4 worldPos = modelMatrixAttribute * vertexPos;
+	
+	gl_Position = projectionViewMatrix * worldPos;
+	
+	textureCoord = textureCoordAttribute.xy * texScale.xy;
+	
+	customColor = customColorAttribute;
+	
+	vec4 viewPos = viewMatrix * worldPos;
+	float distance = dot(viewPos.xyz, viewPos.xyz);
+	fogDensity = FogDensity(distance).xyz;
+	
+	// compute normal
+	vec3 normal = normalAttribute;
+	normal = (modelMatrixAttribute * vec4(normal, 0.)).xyz;
+	normal = normalize(normal);
+	
+	PrepareForDynamicLightNoBump(worldPos.xyz, normal);
+}
+
@@ -20,6 +20,7 @@
 
 #include "ALDevice.h"
 #include "ALFuncs.h"
+#include "AudioOcclusion.h"
 #include <exception>
 #include <stdio.h>
 #include <Client/IAudioChunk.h>
@@ -55,10 +56,6 @@ namespace spades {
 			return MakeVector3(v.x, v.y, v.z);
 		}
 		
-		static float NextRandom() {
-			return (float)rand() /(float)RAND_MAX;
-		}
-		
 		class ALAudioChunk: public client::IAudioChunk {
 			ALuint handle;
 			ALuint format;
@@ -149,7 +146,7 @@ namespace spades {
 			ALuint obstructionFilter;
 			
 			client::GameMap *map;
-			
+			AudioOcclusion occlusion;
 			
 			struct ALSrc {
 				Internal *internal;
@@ -266,8 +263,22 @@ namespace spades {
 				void UpdateObstruction() {
 					SPADES_MARK_FUNCTION();
 					
-					// update stereo source's volume (not spatialized by AL)
-					// FIXME: move to another function?
+					UpdateStereoGain();
+					
+					if(!internal->useEAX)
+						return;
+					
+					AudioOcclusion::Query query;
+					bool enableObstruction = false;
+					if(GetObstructionQuery(query))
+						enableObstruction = internal->occlusion.IsOccluded(query.eye, query.pos);
+					ApplyObstruction(enableObstruction);
+				}
+				
+				// update stereo source's volume (not spatialized by AL)
+				void UpdateStereoGain() {
+					SPADES_MARK_FUNCTION();
+					
 					if(stereo && !local){
 						ALfloat v3[3];
 						al::qalGetListenerfv(AL_POSITION, v3);
@@ -285,47 +296,36 @@ namespace spades {
 						al::qalSourcef(handle, AL_GAIN, param.volume * dist);
 						ALCheckError();
 					}
-					
-					if(!internal->useEAX)
-						return;
+				}
+				
+				/** @return false if the source is never obstructed. */
+				bool GetObstructionQuery(AudioOcclusion::Query& query) {
+					SPADES_MARK_FUNCTION();
 					
 					ALint value;
 					
 					al::qalGetSourcei(handle, AL_SOURCE_RELATIVE, &value);
 					ALCheckErrorPrecise();
 					
-					bool enableObstruction = true;
 					if(value)
-						enableObstruction = false;
+						return false;
+					if(internal->map == NULL)
+						return false;
 					
-					// raytrace
-					client::GameMap *map = internal->map;
-					if(map && enableObstruction){
-						ALfloat v3[3];
-						al::qalGetListenerfv(AL_POSITION, v3);
-						Vector3 eye = {v3[0], v3[1], v3[2]};
-						ALCheckErrorPrecise();
-						al::qalGetSourcefv(handle, AL_POSITION, v3);
-						Vector3 pos = {v3[0], v3[1], v3[2]};
-						ALCheckErrorPrecise();
-						Vector3 checkPos;
-						eye = TransformVectorFromAL(eye);
-						pos = TransformVectorFromAL(pos);
-						for(int x = -1; x <= 1; x++)
-							for(int y = -1; y <= 1; y++)
-								for(int z = -1; z <= 1; z++){
-									IntVector3 hitPos;
-									checkPos.x = pos.x + (float)x * .2f;
-									checkPos.y = pos.y + (float)y * .2f;
-									checkPos.z = pos.z + (float)z * .2f;
-									if(!map->CastRay(eye, (checkPos-eye).Normalize(),
-													(checkPos-eye).GetLength(), hitPos)){
-										enableObstruction = false;
-									}
-								}
-					}else{
-						enableObstruction = false;
-					}
+					ALfloat v3[3];
+					al::qalGetListenerfv(AL_POSITION, v3);
+					Vector3 eye = {v3[0], v3[1], v3[2]};
+					ALCheckErrorPrecise();
+					al::qalGetSourcefv(handle, AL_POSITION, v3);
+					Vector3 pos = {v3[0], v3[1], v3[2]};
+					ALCheckErrorPrecise();
+					query.eye = TransformVectorFromAL(eye);
+					query.pos = TransformVectorFromAL(pos);
+					return true;
+				}
+				
+				void ApplyObstruction(bool enableObstruction) {
+					SPADES_MARK_FUNCTION();
 					
 					ALuint fx = AL_EFFECTSLOT_NULL;
 					ALuint flt = AL_FILTER_NULL;
@@ -643,30 +643,16 @@ namespace spades {
 					}else{
 						// do raycast
 						Vector3 rayFrom = TransformVectorFromAL(eye);
-						Vector3 rayTo;
+						const int numRays = 4;
+						float distances[numRays];
+						float feedbacks[numRays];
+						occlusion.ProbeRoom(rayFrom, maxDistance, numRays,
+											distances, feedbacks);
 						
-						for(int rays = 0; rays < 4; rays++){
-							rayTo.x = NextRandom() - NextRandom();
-							rayTo.y = NextRandom() - NextRandom();
-							rayTo.z = NextRandom() - NextRandom();
-							rayTo = rayTo.Normalize();
-							
-							IntVector3 hitPos;
-							bool hit = map->CastRay(rayFrom, rayTo, maxDistance, hitPos);
-							if(hit){
-								Vector3 hitPosf = {(float)hitPos.x, (float)hitPos.y, (float)hitPos.z};
-								roomHistory[roomHistoryPos] = (hitPosf - rayFrom).GetLength();
-							}else{
-								roomHistory[roomHistoryPos] = maxDistance * 2.f;
-							}
-							
-							if(hit){
-								bool hit2 = map->CastRay(rayFrom, -rayTo, maxDistance, hitPos);
-								if(hit2)
-									roomFeedbackHistory[roomHistoryPos] = 1.f;
-								else
-									roomFeedbackHistory[roomHistoryPos] = 0.f;
-							}
+						for(int rays = 0; rays < numRays; rays++){
+							roomHistory[roomHistoryPos] = distances[rays];
+							if(distances[rays] < maxDistance * 2.f)
+								roomFeedbackHistory[roomHistoryPos] = feedbacks[rays];
 							
 							roomHistoryPos++;
 							if(roomHistoryPos == (int)roomHistory.size())
@@ -738,11 +724,31 @@ namespace spades {
 					ALCheckError();
 				}
 				
+				// occlusion tests of all sources are done at once
+				std::vector<ALSrc *> querySrcs;
+				std::vector<AudioOcclusion::Query> queries;
 				for(size_t i = 0; i < srcs.size(); i++){
 					ALSrc *s = srcs[i];
-					if((rand() % 8 == 0) && s->IsPlaying())
-						s->UpdateObstruction();
+					if((rand() % 8 == 0) && s->IsPlaying()){
+						s->UpdateStereoGain();
+						if(!useEAX)
+							continue;
+						
+						AudioOcclusion::Query query;
+						if(s->GetObstructionQuery(query)){
+							querySrcs.push_back(s);
+							queries.push_back(query);
+						}else{
+							s->ApplyObstruction(false);
+						}
+					}
 				}
+				
+				occlusion.Resolve(queries);
+				for(size_t i = 0; i < querySrcs.size(); i++)
+					querySrcs[i]->ApplyObstruction(queries[i].occluded);
+				
+				occlusion.FrameDone();
 			}
 			
 		};
@@ -843,6 +849,7 @@ namespace spades {
 			SPADES_MARK_FUNCTION_DEBUG();
             client::GameMap *oldMap = d->map;
 			d->map = mp;
+			d->occlusion.SetGameMap(mp);
             if(mp) mp->AddRef();
             if(oldMap) oldMap->Release();
 		}
@@ -0,0 +1,359 @@
+/*
+ Copyright (c) 2013 yvt
+ 
+ This file is part of OpenSpades.
+ 
+ OpenSpades is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ 
+ OpenSpades is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with OpenSpades.  If not, see <http://www.gnu.org/licenses/>.
+ 
+ */
+
+#include "AudioOcclusion.h"
+#include <Client/GameMap.h>
+#include <Core/Debug.h>
+#include <Core/Settings.h>
+#include <Core/RefCountedObject.h>
+#include <algorithm>
+#include <stdlib.h>
+
+SPADES_SETTING(s_occlusionCache, "1");
+SPADES_SETTING(s_debugOcclusion, "0");
+
+namespace spades {
+	namespace audio {
+		
+		enum {
+			/** the cache is flushed when it grows beyond this. */
+			MaxEntries = 4096,
+			/** number of frames between statistics reports. */
+			ReportInterval = 300
+		};
+		
+		static float NextRandom() {
+			return (float)rand() /(float)RAND_MAX;
+		}
+		
+		AudioOcclusion::AudioOcclusion():
+		map(NULL), generation(0), numFrames(0) {
+			SPADES_MARK_FUNCTION();
+			ResetStatistics();
+		}
+		
+		AudioOcclusion::~AudioOcclusion() {
+			SPADES_MARK_FUNCTION();
+			SetGameMap(NULL);
+		}
+		
+		void AudioOcclusion::SetGameMap(client::GameMap *mp) {
+			SPADES_MARK_FUNCTION();
+			
+			client::GameMap *oldMap;
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				oldMap = map;
+				if(oldMap == mp)
+					return;
+				map = mp;
+				entries.clear();
+				generation++;
+			}
+			
+			if(mp){
+				mp->AddRef();
+				mp->AddListener(this);
+			}
+			if(oldMap){
+				oldMap->RemoveListener(this);
+				oldMap->Release();
+			}
+		}
+		
+		uint64_t AudioOcclusion::MakeKey(const IntVector3& eyeCell,
+										 const IntVector3& posCell) {
+			// 10 bits for each coordinate; positions never differ by
+			// more than the map size, so the key doesn't collide in practice
+			uint64_t key = 0;
+			key |= (uint64_t)(eyeCell.x & 1023);
+			key |= (uint64_t)(eyeCell.y & 1023) << 10;
+			key |= (uint64_t)((eyeCell.z + 256) & 1023) << 20;
+			key |= (uint64_t)(posCell.x & 1023) << 30;
+			key |= (uint64_t)(posCell.y & 1023) << 40;
+			key |= (uint64_t)((posCell.z + 256) & 1023) << 50;
+			return key;
+		}
+		
+		bool AudioOcclusion::Contains(const Entry& entry, int x, int y, int z) {
+			if(z < entry.boundsMin.z || z > entry.boundsMax.z)
+				return false;
+			
+			// bounds are in the unwrapped coordinate
+			const int w = client::GameMap::DefaultWidth;
+			const int h = client::GameMap::DefaultHeight;
+			bool inX = false, inY = false;
+			for(int i = -1; i <= 1; i++){
+				int xx = x + i * w;
+				if(xx >= entry.boundsMin.x && xx <= entry.boundsMax.x)
+					inX = true;
+				int yy = y + i * h;
+				if(yy >= entry.boundsMin.y && yy <= entry.boundsMax.y)
+					inY = true;
+			}
+			return inX && inY;
+		}
+		
+		bool AudioOcclusion::ComputeOcclusion(client::GameMap *map,
+											  const Vector3& eye,
+											  const Vector3& pos,
+											  uint64_t& numRays) {
+			SPADES_MARK_FUNCTION_DEBUG();
+			
+			// the sound is obstructed only when all of the rays to
+			// the points around the source hit something, so we can
+			// stop at the first ray that doesn't hit.
+			// the center is tested first since it's most likely to be clear.
+			static const int order[] = {0, -1, 1};
+			Vector3 checkPos;
+			for(int ix = 0; ix < 3; ix++)
+				for(int iy = 0; iy < 3; iy++)
+					for(int iz = 0; iz < 3; iz++){
+						IntVector3 hitPos;
+						checkPos.x = pos.x + (float)order[ix] * .2f;
+						checkPos.y = pos.y + (float)order[iy] * .2f;
+						checkPos.z = pos.z + (float)order[iz] * .2f;
+						numRays++;
+						if(!map->CastRay(eye, (checkPos-eye).Normalize(),
+										 (checkPos-eye).GetLength(), hitPos)){
+							return false;
+						}
+					}
+			return true;
+		}
+		
+		void AudioOcclusion::Store(uint64_t key, const Vector3& eye,
+								   const Vector3& pos, bool occluded,
+								   uint64_t gen) {
+			// a cached result is used for any pair of positions in
+			// the same blocks, and the rays are offset by .2 from the
+			// source, so one block of margin is added
+			IntVector3 eyeCell = eye.Floor();
+			IntVector3 posCell = pos.Floor();
+			Entry entry;
+			entry.occluded = occluded;
+			entry.boundsMin.x = std::min(eyeCell.x, posCell.x) - 1;
+			entry.boundsMin.y = std::min(eyeCell.y, posCell.y) - 1;
+			entry.boundsMin.z = std::min(eyeCell.z, posCell.z) - 1;
+			entry.boundsMax.x = std::max(eyeCell.x, posCell.x) + 1;
+			entry.boundsMax.y = std::max(eyeCell.y, posCell.y) + 1;
+			entry.boundsMax.z = std::max(eyeCell.z, posCell.z) + 1;
+			
+			// the map was changed while the rays were being cast
+			if(gen != generation)
+				return;
+			if(entries.size() >= MaxEntries)
+				entries.clear();
+			entries[key] = entry;
+		}
+		
+		bool AudioOcclusion::IsOccluded(const Vector3& eye, const Vector3& pos) {
+			SPADES_MARK_FUNCTION_DEBUG();
+			
+			std::vector<Query> queries(1);
+			queries[0].eye = eye;
+			queries[0].pos = pos;
+			Resolve(queries);
+			return queries[0].occluded;
+		}
+		
+		void AudioOcclusion::Resolve(std::vector<Query>& queries) {
+			SPADES_MARK_FUNCTION_DEBUG();
+			
+			if(queries.empty())
+				return;
+			
+			bool useCache = s_occlusionCache;
+			
+			// index of the query whose result is copied, or -1 if the
+			// query has to be tested by itself.
+			std::vector<int> sources(queries.size(), -1);
+			std::vector<uint64_t> keys(queries.size());
+			std::vector<size_t> misses;
+			std::unordered_map<uint64_t, int> pending;
+			Handle<client::GameMap> m;
+			uint64_t gen;
+			
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				if(map == NULL){
+					for(size_t i = 0; i < queries.size(); i++)
+						queries[i].occluded = false;
+					return;
+				}
+				m.Set(map, true);
+				gen = generation;
+				
+				stats.numQueries += queries.size();
+				for(size_t i = 0; i < queries.size(); i++){
+					Query& q = queries[i];
+					if(!useCache){
+						misses.push_back(i);
+						continue;
+					}
+					
+					uint64_t key = MakeKey(q.eye.Floor(), q.pos.Floor());
+					keys[i] = key;
+					
+					auto it = entries.find(key);
+					if(it != entries.end()){
+						q.occluded = it->second.occluded;
+						stats.numHits++;
+						continue;
+					}
+					
+					auto it2 = pending.find(key);
+					if(it2 != pending.end()){
+						sources[i] = it2->second;
+						stats.numHits++;
+						continue;
+					}
+					
+					pending[key] = (int)i;
+					misses.push_back(i);
+				}
+			}
+			
+			if(misses.empty())
+				return;
+			
+			uint64_t numRays = 0;
+			for(size_t i = 0; i < misses.size(); i++){
+				Query& q = queries[misses[i]];
+				q.occluded = ComputeOcclusion(m, q.eye, q.pos, numRays);
+			}
+			
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				stats.numRays += numRays;
+				if(useCache && (client::GameMap *)m == map){
+					for(size_t i = 0; i < misses.size(); i++){
+						const Query& q = queries[misses[i]];
+						Store(keys[misses[i]], q.eye, q.pos, q.occluded, gen);
+					}
+				}
+			}
+			
+			for(size_t i = 0; i < queries.size(); i++){
+				if(sources[i] != -1)
+					queries[i].occluded = queries[sources[i]].occluded;
+			}
+		}
+		
+		void AudioOcclusion::ProbeRoom(const Vector3& eye, float maxDistance,
+									   int numRays, float *distances,
+									   float *feedbacks) {
+			SPADES_MARK_FUNCTION_DEBUG();
+			
+			Handle<client::GameMap> m;
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				m.Set(map, true);
+			}
+			SPAssert(m);
+			
+			uint64_t numCasts = 0;
+			Vector3 rayTo;
+			for(int i = 0; i < numRays; i++){
+				rayTo.x = NextRandom() - NextRandom();
+				rayTo.y = NextRandom() - NextRandom();
+				rayTo.z = NextRandom() - NextRandom();
+				rayTo = rayTo.Normalize();
+				
+				IntVector3 hitPos;
+				bool hit = m->CastRay(eye, rayTo, maxDistance, hitPos);
+				numCasts++;
+				if(hit){
+					Vector3 hitPosf = {(float)hitPos.x, (float)hitPos.y, (float)hitPos.z};
+					distances[i] = (hitPosf - eye).GetLength();
+				}else{
+					distances[i] = maxDistance * 2.f;
+				}
+				
+				if(hit){
+					bool hit2 = m->CastRay(eye, -rayTo, maxDistance, hitPos);
+					numCasts++;
+					if(hit2)
+						feedbacks[i] = 1.f;
+					else
+						feedbacks[i] = 0.f;
+				}
+			}
+			
+			std::lock_guard<std::mutex> lock(mutex);
+			stats.numRays += numCasts;
+		}
+		
+		void AudioOcclusion::FrameDone() {
+			if(!s_debugOcclusion){
+				numFrames = 0;
+				return;
+			}
+			
+			numFrames++;
+			if(numFrames < ReportInterval)
+				return;
+			numFrames = 0;
+			
+			Statistics s = GetStatistics();
+			ResetStatistics();
+			size_t numEntries;
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				numEntries = entries.size();
+			}
+			SPLog("Audio occlusion: %llu queries, %.1f%% hit, %llu invalidated, "
+				  "%llu rays (%.1f rays/frame), %d cached",
+				  (unsigned long long)s.numQueries,
+				  s.numQueries ? (double)s.numHits * 100. / (double)s.numQueries : 0.,
+				  (unsigned long long)s.numInvalidations,
+				  (unsigned long long)s.numRays,
+				  (double)s.numRays / (double)ReportInterval,
+				  (int)numEntries);
+		}
+		
+		AudioOcclusion::Statistics AudioOcclusion::GetStatistics() {
+			std::lock_guard<std::mutex> lock(mutex);
+			return stats;
+		}
+		
+		void AudioOcclusion::ResetStatistics() {
+			std::lock_guard<std::mutex> lock(mutex);
+			stats.numQueries = 0;
+			stats.numHits = 0;
+			stats.numInvalidations = 0;
+			stats.numRays = 0;
+		}
+		
+		void AudioOcclusion::GameMapChanged(int x, int y, int z,
+											client::GameMap *) {
+			std::lock_guard<std::mutex> lock(mutex);
+			generation++;
+			for(auto it = entries.begin(); it != entries.end();){
+				if(Contains(it->second, x, y, z)){
+					it = entries.erase(it);
+					stats.numInvalidations++;
+				}else{
+					++it;
+				}
+			}
+		}
+	}
+}
@@ -0,0 +1,118 @@
+/*
+ Copyright (c) 2013 yvt
+ 
+ This file is part of OpenSpades.
+ 
+ OpenSpades is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ 
+ OpenSpades is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with OpenSpades.  If not, see <http://www.gnu.org/licenses/>.
+ 
+ */
+
+#pragma once
+
+#include "../Core/Math.h"
+#include "../Client/IGameMapListener.h"
+#include <vector>
+#include <unordered_map>
+#include <mutex>
+#include <stdint.h>
+
+namespace spades {
+	namespace client {
+		class GameMap;
+	}
+	namespace audio {
+		
+		/** Ray casting service shared by the audio devices.
+		 * Results of occlusion tests are cached for each pair of
+		 * (listener block, source block) and the cached results are
+		 * invalidated when a block within the region the rays might
+		 * pass through is changed.
+		 * Occlusion tests can be called from any thread. */
+		class AudioOcclusion: public client::IGameMapListener {
+		public:
+			struct Query {
+				Vector3 eye;
+				Vector3 pos;
+				/** set by Resolve. */
+				bool occluded;
+			};
+			
+			struct Statistics {
+				uint64_t numQueries;
+				uint64_t numHits;
+				uint64_t numInvalidations;
+				uint64_t numRays;
+			};
+		
+		private:
+			struct Entry {
+				bool occluded;
+				/** inclusive range of blocks the rays might pass through. */
+				IntVector3 boundsMin, boundsMax;
+			};
+			
+			client::GameMap *map;
+			
+			std::mutex mutex;
+			std::unordered_map<uint64_t, Entry> entries;
+			/** incremented every time the cache is invalidated, so that
+			 * results computed before that are not stored. */
+			uint64_t generation;
+			Statistics stats;
+			int numFrames;
+			
+			static uint64_t MakeKey(const IntVector3& eyeCell,
+									const IntVector3& posCell);
+			static bool Contains(const Entry&, int x, int y, int z);
+			
+			static bool ComputeOcclusion(client::GameMap *,
+										 const Vector3& eye, const Vector3& pos,
+										 uint64_t& numRays);
+			void Store(uint64_t key, const Vector3& eye, const Vector3& pos,
+					   bool occluded, uint64_t gen);
+		
+		public:
+			AudioOcclusion();
+			~AudioOcclusion();
+			
+			void SetGameMap(client::GameMap *);
+			
+			/** @return true if a sound at `pos` is obstructed from `eye`. */
+			bool IsOccluded(const Vector3& eye, const Vector3& pos);
+			
+			/** tests all of the queries at once. queries with the same
+			 * cache key are tested only once. */
+			void Resolve(std::vector<Query>&);
+			
+			/** casts random rays from `eye` to estimate the shape of
+			 * the room the listener is in.
+			 * @param distances receives the distance to the hit point,
+			 *        or `maxDistance * 2` if nothing was hit.
+			 * @param feedbacks receives 1 if the ray cast in the opposite
+			 *        direction also hit something, 0 if not. not written
+			 *        if the first ray didn't hit. */
+			void ProbeRoom(const Vector3& eye, float maxDistance,
+						   int numRays, float *distances, float *feedbacks);
+			
+			/** should be called once a frame. reports the statistics
+			 * periodically if s_debugOcclusion is set. */
+			void FrameDone();
+			
+			Statistics GetStatistics();
+			void ResetStatistics();
+			
+			virtual void GameMapChanged(int x, int y, int z, client::GameMap *);
+		};
+	}
+}
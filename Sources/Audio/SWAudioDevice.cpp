@@ -0,0 +1,686 @@
+/*
+ Copyright (c) 2013 yvt
+ 
+ This file is part of OpenSpades.
+ 
+ OpenSpades is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ 
+ OpenSpades is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with OpenSpades.  If not, see <http://www.gnu.org/licenses/>.
+ 
+ */
+
+#include "SWAudioDevice.h"
+#include <Client/IAudioChunk.h>
+#include <Client/GameMap.h>
+#include <Core/Debug.h>
+#include <Core/Exception.h>
+#include <Core/Settings.h>
+#include <Core/FileManager.h>
+#include <Core/IAudioStream.h>
+#include <Core/WavAudioStream.h>
+#include <Core/Stopwatch.h>
+#include "../Imports/SDL.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#if defined(__AVX__)
+#define ENABLE_AUDIO_AVX	1
+#endif
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define ENABLE_AUDIO_SSE	1
+#endif
+
+#ifndef ENABLE_AUDIO_AVX
+#define ENABLE_AUDIO_AVX 0
+#endif
+#ifndef ENABLE_AUDIO_SSE
+#define ENABLE_AUDIO_SSE 0
+#endif
+
+#if ENABLE_AUDIO_AVX
+#include <immintrin.h>
+#endif
+#if ENABLE_AUDIO_SSE
+#include <xmmintrin.h>
+#endif
+
+SPADES_SETTING(s_maxPolyphonics, "");
+SPADES_SETTING(s_swAudioBufferSize, "1024");
+SPADES_SETTING(s_swAudioBenchmark, "0");
+
+namespace spades {
+	namespace audio {
+		
+		class SWAudioChunk: public client::IAudioChunk {
+		protected:
+			virtual ~SWAudioChunk() {}
+		public:
+			/** interleaved. one extra frame of silence is appended so that
+			 * the interpolation can read beyond the last frame. */
+			std::vector<float> samples;
+			int numChannels;
+			int numFrames;
+			
+			SWAudioChunk(const float *src, int numChannels, int numFrames,
+						 double srcRate, double dstRate):
+			numChannels(numChannels) {
+				SPADES_MARK_FUNCTION();
+				
+				if(numChannels < 1 || numChannels > 2)
+					SPRaise("Unsupported channel count: %d", numChannels);
+				
+				if(std::fabs(srcRate - dstRate) < 1.e-3){
+					this->numFrames = numFrames;
+					samples.assign(src, src + numFrames * numChannels);
+				}else{
+					// converted once here so that most of the sounds, which are
+					// played at their original pitch, can be mixed without
+					// interpolation
+					double step = srcRate / dstRate;
+					this->numFrames = (int)std::ceil((double)numFrames / step);
+					samples.resize((size_t)this->numFrames * numChannels);
+					for(int i = 0; i < this->numFrames; i++){
+						double pos = (double)i * step;
+						int idx = (int)pos;
+						float frac = (float)(pos - (double)idx);
+						for(int ch = 0; ch < numChannels; ch++){
+							float a = src[idx * numChannels + ch];
+							float b = idx + 1 < numFrames ? src[(idx + 1) * numChannels + ch] : 0.f;
+							samples[i * numChannels + ch] = a + (b - a) * frac;
+						}
+					}
+				}
+				
+				samples.resize(samples.size() + numChannels, 0.f);
+			}
+			
+			static SWAudioChunk *Load(IAudioStream *stream, double dstRate) {
+				SPADES_MARK_FUNCTION();
+				
+				int numChannels = stream->GetNumChannels();
+				if(stream->GetNumSamples() > 128 * 1024 * 1024) {
+					SPRaise("Audio data too long");
+				}
+				int numFrames = static_cast<int>(stream->GetNumSamples());
+				size_t numSamples = (size_t)numFrames * numChannels;
+				
+				std::vector<float> data(numSamples);
+				stream->SetPosition(0);
+				switch(stream->GetSampleFormat()) {
+					case IAudioStream::UnsignedByte:
+					{
+						std::vector<uint8_t> buf(numSamples);
+						stream->Read(buf.data(), buf.size());
+						for(size_t i = 0; i < numSamples; i++)
+							data[i] = ((float)buf[i] - 128.f) * (1.f / 128.f);
+						break;
+					}
+					case IAudioStream::SignedShort:
+					{
+						std::vector<int16_t> buf(numSamples);
+						stream->Read(buf.data(), buf.size() * 2);
+						for(size_t i = 0; i < numSamples; i++)
+							data[i] = (float)buf[i] * (1.f / 32768.f);
+						break;
+					}
+					case IAudioStream::SingleFloat:
+						stream->Read(data.data(), data.size() * 4);
+						break;
+					default:
+						SPRaise("Unsupported audio format");
+				}
+				
+				return new SWAudioChunk(data.data(), numChannels, numFrames,
+										stream->GetSamplingFrequency(), dstRate);
+			}
+		};
+		
+		struct SWAudioDevice::Voice {
+			Handle<SWAudioChunk> chunk;
+			PlayMode mode;
+			Vector3 origin;
+			client::AudioParam param;
+			uint64_t id;
+			
+			double position;
+			bool occluded;
+			/** gains used at the end of the last Render, ramped from there
+			 * to the new gains to avoid clicks. */
+			float gainL, gainR;
+			bool started;
+		};
+		
+		struct SWAudioDevice::OutputDevice {
+			SDL_AudioDeviceID id;
+			SDL_AudioSpec spec;
+			
+			OutputDevice(SWAudioDevice *device): id(0) {
+				SDL_AudioSpec desired;
+				std::memset(&desired, 0, sizeof(desired));
+				desired.callback = reinterpret_cast<SDL_AudioCallback>(RenderCallback);
+				desired.userdata = device;
+				desired.format = AUDIO_F32SYS;
+				desired.freq = 44100;
+				desired.samples = (int)s_swAudioBufferSize;
+				desired.channels = 2;
+				
+				SDL_InitSubSystem(SDL_INIT_AUDIO);
+				id = SDL_OpenAudioDevice(nullptr, SDL_FALSE, &desired, &spec,
+										 SDL_AUDIO_ALLOW_FREQUENCY_CHANGE);
+				if(id == 0){
+					SPRaise("Failed to initialize the audio device: %s", SDL_GetError());
+				}
+			}
+			
+			~OutputDevice() {
+				if(id != 0)
+					SDL_CloseAudioDevice(id);
+			}
+		};
+
+#pragma mark - Mixing Kernels
+
+		/** adds `src` (mono) to `out` (stereo), ramping the gains by
+		 * `dl` and `dr` for each frame. */
+		static void MixMono(float *out, const float *src, int numFrames,
+							float gl, float gr, float dl, float dr) {
+			int i = 0;
+#if ENABLE_AUDIO_AVX
+			{
+				__m256 g = _mm256_setr_ps(gl, gr, gl + dl, gr + dr,
+										  gl + dl * 2.f, gr + dr * 2.f,
+										  gl + dl * 3.f, gr + dr * 3.f);
+				__m256 dg = _mm256_setr_ps(dl * 4.f, dr * 4.f, dl * 4.f, dr * 4.f,
+										   dl * 4.f, dr * 4.f, dl * 4.f, dr * 4.f);
+				for(; i + 4 <= numFrames; i += 4){
+					__m128 s = _mm_loadu_ps(src + i);
+					__m256 d = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_unpacklo_ps(s, s)),
+													_mm_unpackhi_ps(s, s), 1);
+					__m256 o = _mm256_loadu_ps(out + i * 2);
+					o = _mm256_add_ps(o, _mm256_mul_ps(d, g));
+					_mm256_storeu_ps(out + i * 2, o);
+					g = _mm256_add_ps(g, dg);
+				}
+			}
+#elif ENABLE_AUDIO_SSE
+			{
+				__m128 g = _mm_setr_ps(gl, gr, gl + dl, gr + dr);
+				__m128 dg = _mm_setr_ps(dl * 2.f, dr * 2.f, dl * 2.f, dr * 2.f);
+				for(; i + 4 <= numFrames; i += 4){
+					__m128 s = _mm_loadu_ps(src + i);
+					__m128 o1 = _mm_loadu_ps(out + i * 2);
+					__m128 o2 = _mm_loadu_ps(out + i * 2 + 4);
+					o1 = _mm_add_ps(o1, _mm_mul_ps(_mm_unpacklo_ps(s, s), g));
+					g = _mm_add_ps(g, dg);
+					o2 = _mm_add_ps(o2, _mm_mul_ps(_mm_unpackhi_ps(s, s), g));
+					g = _mm_add_ps(g, dg);
+					_mm_storeu_ps(out + i * 2, o1);
+					_mm_storeu_ps(out + i * 2 + 4, o2);
+				}
+			}
+#endif
+			for(; i < numFrames; i++){
+				float s = src[i];
+				out[i * 2] += s * (gl + dl * (float)i);
+				out[i * 2 + 1] += s * (gr + dr * (float)i);
+			}
+		}
+		
+		/** adds `src` (stereo) to `out` (stereo). */
+		static void MixStereo(float *out, const float *src, int numFrames,
+							  float gl, float gr, float dl, float dr) {
+			int i = 0;
+#if ENABLE_AUDIO_AVX
+			{
+				__m256 g = _mm256_setr_ps(gl, gr, gl + dl, gr + dr,
+										  gl + dl * 2.f, gr + dr * 2.f,
+										  gl + dl * 3.f, gr + dr * 3.f);
+				__m256 dg = _mm256_setr_ps(dl * 4.f, dr * 4.f, dl * 4.f, dr * 4.f,
+										   dl * 4.f, dr * 4.f, dl * 4.f, dr * 4.f);
+				for(; i + 4 <= numFrames; i += 4){
+					__m256 s = _mm256_loadu_ps(src + i * 2);
+					__m256 o = _mm256_loadu_ps(out + i * 2);
+					o = _mm256_add_ps(o, _mm256_mul_ps(s, g));
+					_mm256_storeu_ps(out + i * 2, o);
+					g = _mm256_add_ps(g, dg);
+				}
+			}
+#elif ENABLE_AUDIO_SSE
+			{
+				__m128 g = _mm_setr_ps(gl, gr, gl + dl, gr + dr);
+				__m128 dg = _mm_setr_ps(dl * 2.f, dr * 2.f, dl * 2.f, dr * 2.f);
+				for(; i + 2 <= numFrames; i += 2){
+					__m128 s = _mm_loadu_ps(src + i * 2);
+					__m128 o = _mm_loadu_ps(out + i * 2);
+					o = _mm_add_ps(o, _mm_mul_ps(s, g));
+					_mm_storeu_ps(out + i * 2, o);
+					g = _mm_add_ps(g, dg);
+				}
+			}
+#endif
+			for(; i < numFrames; i++){
+				out[i * 2] += src[i * 2] * (gl + dl * (float)i);
+				out[i * 2 + 1] += src[i * 2 + 1] * (gr + dr * (float)i);
+			}
+		}
+		
+		static void ClampOutput(float *out, int numSamples) {
+			int i = 0;
+#if ENABLE_AUDIO_AVX
+			{
+				__m256 lo = _mm256_set1_ps(-1.f), hi = _mm256_set1_ps(1.f);
+				for(; i + 8 <= numSamples; i += 8){
+					__m256 o = _mm256_loadu_ps(out + i);
+					o = _mm256_min_ps(_mm256_max_ps(o, lo), hi);
+					_mm256_storeu_ps(out + i, o);
+				}
+			}
+#elif ENABLE_AUDIO_SSE
+			{
+				__m128 lo = _mm_set1_ps(-1.f), hi = _mm_set1_ps(1.f);
+				for(; i + 4 <= numSamples; i += 4){
+					__m128 o = _mm_loadu_ps(out + i);
+					o = _mm_min_ps(_mm_max_ps(o, lo), hi);
+					_mm_storeu_ps(out + i, o);
+				}
+			}
+#endif
+			for(; i < numSamples; i++){
+				out[i] = std::min(std::max(out[i], -1.f), 1.f);
+			}
+		}
+
+#pragma mark - SWAudioDevice
+
+		SWAudioDevice::SWAudioDevice():
+		samplingRate(44100.) {
+			SPADES_MARK_FUNCTION();
+			
+			Init();
+			
+			outputDevice.reset(new OutputDevice(this));
+			samplingRate = static_cast<double>(outputDevice->spec.freq);
+			SPLog("Software audio mixer initialized: %d Hz, %d frames/buffer, "
+				  "AVX: %s, SSE: %s",
+				  outputDevice->spec.freq, (int)outputDevice->spec.samples,
+				  ENABLE_AUDIO_AVX ? "yes" : "no",
+				  ENABLE_AUDIO_SSE ? "yes" : "no");
+			
+			SDL_PauseAudioDevice(outputDevice->id, 0);
+			
+			if((int)s_swAudioBenchmark > 0)
+				RunBenchmark(s_swAudioBenchmark);
+		}
+		
+		SWAudioDevice::SWAudioDevice(double samplingRate):
+		samplingRate(samplingRate) {
+			SPADES_MARK_FUNCTION();
+			
+			Init();
+		}
+		
+		void SWAudioDevice::Init() {
+			nextVoiceId = 0;
+			maxVoices = (int)s_maxPolyphonics;
+			if(maxVoices <= 0)
+				maxVoices = 96;
+			voices.reserve(maxVoices);
+			
+			listenerPosition = MakeVector3(0, 0, 0);
+			listenerFront = MakeVector3(0, 0, 1);
+			listenerRight = MakeVector3(1, 0, 0);
+			
+			stats.numVoices = 0;
+			stats.numDroppedVoices = 0;
+			stats.numFrames = 0;
+			stats.mixTime = 0.;
+		}
+		
+		SWAudioDevice::~SWAudioDevice() {
+			SPADES_MARK_FUNCTION();
+			
+			// stop the callback first
+			outputDevice.reset();
+			
+			voices.clear();
+			for(auto it = chunks.begin(); it != chunks.end(); ++it)
+				it->second->Release();
+		}
+		
+		void SWAudioDevice::RenderCallback(SWAudioDevice *self,
+										   uint8_t *stream, int numBytes) {
+			self->Render(reinterpret_cast<float *>(stream), numBytes / 8);
+		}
+		
+		client::IAudioChunk *SWAudioDevice::CreateChunk(const float *samples,
+														int numChannels,
+														int numFrames,
+														double rate) {
+			SPADES_MARK_FUNCTION();
+			return new SWAudioChunk(samples, numChannels, numFrames,
+									rate, samplingRate);
+		}
+		
+		client::IAudioChunk *SWAudioDevice::RegisterSound(const char *name) {
+			SPADES_MARK_FUNCTION();
+			
+			auto it = chunks.find(name);
+			if(it == chunks.end()){
+				IStream *stream = FileManager::OpenForReading(name);
+				std::unique_ptr<IAudioStream> as;
+				try{
+					as.reset(new WavAudioStream(stream, true));
+				}catch(...){
+					delete stream;
+					throw;
+				}
+				
+				SWAudioChunk *c = SWAudioChunk::Load(as.get(), samplingRate);
+				chunks[name] = c;
+				c->AddRef();
+				return c;
+			}
+			it->second->AddRef();
+			return it->second;
+		}
+		
+		void SWAudioDevice::SetGameMap(client::GameMap *map) {
+			SPADES_MARK_FUNCTION();
+			occlusion.SetGameMap(map);
+		}
+		
+		void SWAudioDevice::AddVoice(client::IAudioChunk *c,
+									 const Vector3& origin,
+									 const client::AudioParam& param,
+									 PlayMode mode) {
+			SPADES_MARK_FUNCTION();
+			
+			auto *chunk = dynamic_cast<SWAudioChunk *>(c);
+			if(chunk == nullptr) SPRaise("Invalid chunk: null or invalid type.");
+			
+			Voice voice;
+			voice.chunk.Set(chunk, true);
+			voice.mode = mode;
+			voice.origin = origin;
+			voice.param = param;
+			voice.position = 0.;
+			voice.occluded = false;
+			voice.gainL = voice.gainR = 0.f;
+			voice.started = false;
+			
+			if(mode == AbsoluteMode){
+				Vector3 eye;
+				{
+					std::lock_guard<std::mutex> lock(mutex);
+					eye = listenerPosition;
+				}
+				voice.occluded = occlusion.IsOccluded(eye, origin);
+			}
+			
+			std::lock_guard<std::mutex> lock(mutex);
+			voice.id = nextVoiceId++;
+			if((int)voices.size() >= maxVoices){
+				// drop the oldest one
+				voices.erase(voices.begin());
+				stats.numDroppedVoices++;
+			}
+			voices.push_back(voice);
+		}
+		
+		void SWAudioDevice::Play(client::IAudioChunk *c, const Vector3& origin,
+								 const client::AudioParam& param) {
+			AddVoice(c, origin, param, AbsoluteMode);
+		}
+		
+		void SWAudioDevice::PlayLocal(client::IAudioChunk *c, const Vector3& origin,
+									  const client::AudioParam& param) {
+			AddVoice(c, origin, param, RelativeMode);
+		}
+		
+		void SWAudioDevice::PlayLocal(client::IAudioChunk *c,
+									  const client::AudioParam& param) {
+			AddVoice(c, MakeVector3(0, 0, 0), param, LocalMode);
+		}
+		
+		void SWAudioDevice::Respatialize(const Vector3& eye,
+										 const Vector3& front,
+										 const Vector3& up) {
+			SPADES_MARK_FUNCTION();
+			
+			std::vector<uint64_t> ids;
+			std::vector<AudioOcclusion::Query> queries;
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				listenerPosition = eye;
+				listenerFront = front;
+				listenerRight = Vector3::Cross(front, up).Normalize();
+				
+				for(size_t i = 0; i < voices.size(); i++){
+					const Voice& v = voices[i];
+					if(v.mode != AbsoluteMode)
+						continue;
+					AudioOcclusion::Query q;
+					q.eye = eye;
+					q.pos = v.origin;
+					ids.push_back(v.id);
+					queries.push_back(q);
+				}
+			}
+			
+			// rays are cast without blocking the mixer
+			occlusion.Resolve(queries);
+			
+			{
+				// both are sorted by id
+				std::lock_guard<std::mutex> lock(mutex);
+				size_t j = 0;
+				for(size_t i = 0; i < voices.size() && j < ids.size(); i++){
+					Voice& v = voices[i];
+					while(j < ids.size() && ids[j] < v.id)
+						j++;
+					if(j < ids.size() && ids[j] == v.id)
+						v.occluded = queries[j].occluded;
+				}
+			}
+			
+			occlusion.FrameDone();
+		}
+		
+		/** same as AL_INVERSE_DISTANCE_CLAMPED with the rolloff factor 1. */
+		static float DistanceAttenuation(float dist, float referenceDistance) {
+			return referenceDistance / std::max(dist, referenceDistance);
+		}
+		
+		void SWAudioDevice::ComputeGains(const Voice& v, float& left,
+										 float& right) {
+			float gain = v.param.volume;
+			float pan = 0.f;
+			bool stereo = v.chunk->numChannels == 2;
+			switch(v.mode){
+				case AbsoluteMode:
+				{
+					Vector3 rel = v.origin - listenerPosition;
+					float dist = rel.GetLength();
+					gain *= DistanceAttenuation(dist, v.param.referenceDistance);
+					if(dist > 1.e-4f)
+						pan = Vector3::Dot(rel, listenerRight) / dist;
+					if(v.occluded)
+						gain *= 0.4f;
+					break;
+				}
+				case RelativeMode:
+				{
+					// the origin is relative to the listener
+					float dist = v.origin.GetLength();
+					gain *= DistanceAttenuation(dist, v.param.referenceDistance);
+					if(dist > 1.e-4f)
+						pan = v.origin.x / dist;
+					break;
+				}
+				case LocalMode:
+					break;
+			}
+			
+			if(stereo || v.mode == LocalMode){
+				// stereo sounds are not spatialized
+				left = right = gain;
+				return;
+			}
+			
+			// equal-power panning
+			float angle = (std::min(std::max(pan, -1.f), 1.f) + 1.f) *
+				static_cast<float>(M_PI) * .25f;
+			left = gain * std::cos(angle);
+			right = gain * std::sin(angle);
+		}
+		
+		void SWAudioDevice::MixVoice(Voice& v, float *output, int numFrames) {
+			float gl, gr;
+			ComputeGains(v, gl, gr);
+			if(!v.started){
+				v.gainL = gl;
+				v.gainR = gr;
+				v.started = true;
+			}
+			
+			SWAudioChunk& chunk = *v.chunk;
+			int numChannels = chunk.numChannels;
+			double step = std::max((double)v.param.pitch, 1.e-3);
+			
+			int done = 0;
+			while(done < numFrames && v.position < (double)chunk.numFrames){
+				int count = numFrames - done;
+				const float *src;
+				if(step == 1. && v.position == std::floor(v.position)){
+					size_t pos = (size_t)v.position;
+					count = std::min(count, chunk.numFrames - (int)pos);
+					src = chunk.samples.data() + pos * numChannels;
+					v.position += (double)count;
+				}else{
+					int remaining = (int)std::ceil(((double)chunk.numFrames - v.position) / step);
+					count = std::min(count, remaining);
+					resampleBuffer.resize((size_t)count * numChannels);
+					float *dst = resampleBuffer.data();
+					const float *samples = chunk.samples.data();
+					double pos = v.position;
+					for(int i = 0; i < count; i++){
+						size_t idx = (size_t)pos;
+						float frac = (float)(pos - (double)idx);
+						for(int ch = 0; ch < numChannels; ch++){
+							float a = samples[idx * numChannels + ch];
+							float b = samples[(idx + 1) * numChannels + ch];
+							*(dst++) = a + (b - a) * frac;
+						}
+						pos += step;
+					}
+					v.position = pos;
+					src = resampleBuffer.data();
+				}
+				if(count <= 0)
+					break;
+				
+				float dl = (gl - v.gainL) / (float)count;
+				float dr = (gr - v.gainR) / (float)count;
+				if(numChannels == 1)
+					MixMono(output + done * 2, src, count, v.gainL, v.gainR, dl, dr);
+				else
+					MixStereo(output + done * 2, src, count, v.gainL, v.gainR, dl, dr);
+				v.gainL = gl;
+				v.gainR = gr;
+				
+				done += count;
+			}
+		}
+		
+		void SWAudioDevice::Render(float *output, int numFrames) {
+			SPADES_MARK_FUNCTION_DEBUG();
+			
+			Stopwatch sw;
+			std::fill(output, output + numFrames * 2, 0.f);
+			
+			std::lock_guard<std::mutex> lock(mutex);
+			
+			for(size_t i = 0; i < voices.size(); i++){
+				MixVoice(voices[i], output, numFrames);
+			}
+			
+			auto it = std::remove_if(voices.begin(), voices.end(), [](const Voice& v) {
+				return v.position >= (double)v.chunk->numFrames;
+			});
+			voices.erase(it, voices.end());
+			
+			ClampOutput(output, numFrames * 2);
+			
+			stats.numVoices = (int)voices.size();
+			stats.numFrames += numFrames;
+			stats.mixTime += sw.GetTime();
+		}
+		
+		SWAudioDevice::Statistics SWAudioDevice::GetStatistics() {
+			std::lock_guard<std::mutex> lock(mutex);
+			return stats;
+		}
+		
+		void SWAudioDevice::RunBenchmark(int numSeconds) {
+			SPADES_MARK_FUNCTION();
+			
+			numSeconds = std::max(numSeconds, 1);
+			const double rate = 44100.;
+			const int bufferSize = 1024;
+			SPLog("Running software mixer benchmark (%d second(s) per voice count, "
+				  "AVX: %s, SSE: %s)", numSeconds,
+				  ENABLE_AUDIO_AVX ? "yes" : "no",
+				  ENABLE_AUDIO_SSE ? "yes" : "no");
+			
+			// long enough to keep every voice playing until the end
+			int chunkFrames = (int)rate * (numSeconds + 1) * 2;
+			std::vector<float> samples(chunkFrames);
+			for(int i = 0; i < chunkFrames; i++){
+				float t = (float)i / (float)rate;
+				samples[i] = .3f * std::sin(t * 2765.f) + .1f * std::sin(t * 7351.f);
+			}
+			
+			std::vector<float> output(bufferSize * 2);
+			for(int numVoices = 1; numVoices <= 256; numVoices *= 4){
+				Handle<SWAudioDevice> dev(new SWAudioDevice(rate), false);
+				dev->maxVoices = numVoices;
+				Handle<client::IAudioChunk> chunk(dev->CreateChunk(samples.data(), 1,
+																   chunkFrames, rate),
+												  false);
+				
+				// spread around the listener. every fourth voice goes
+				// through the interpolator.
+				for(int i = 0; i < numVoices; i++){
+					client::AudioParam param;
+					param.volume = 1.f / (float)numVoices;
+					if((i & 3) == 3)
+						param.pitch = 1.25f;
+					float angle = (float)i * 2.4f;
+					float dist = 1.f + (float)(i % 20);
+					dev->Play(chunk, MakeVector3(std::cos(angle) * dist,
+												 std::sin(angle) * dist, 0.f),
+							  param);
+				}
+				
+				int numFrames = (int)rate * numSeconds;
+				for(int done = 0; done < numFrames; done += bufferSize)
+					dev->Render(output.data(), std::min(bufferSize, numFrames - done));
+				
+				Statistics stats = dev->GetStatistics();
+				double perSecond = stats.mixTime / (double)numSeconds;
+				SPLog("  %3d voice(s) %8.3fms per second of audio (%.0fx realtime)",
+					  numVoices, perSecond * 1000., 1. / std::max(perSecond, 1.e-9));
+			}
+		}
+	}
+}
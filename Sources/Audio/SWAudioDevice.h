@@ -0,0 +1,133 @@
+/*
+ Copyright (c) 2013 yvt
+ 
+ This file is part of OpenSpades.
+ 
+ OpenSpades is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ 
+ OpenSpades is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with OpenSpades.  If not, see <http://www.gnu.org/licenses/>.
+ 
+ */
+
+#pragma once
+
+#include <Client/IAudioDevice.h>
+#include <Core/RefCountedObject.h>
+#include "AudioOcclusion.h"
+#include <map>
+#include <memory>
+#include <vector>
+#include <mutex>
+#include <stdint.h>
+
+namespace spades {
+	class IAudioStream;
+	namespace audio {
+		
+		class SWAudioChunk;
+		
+		/** Audio device that mixes the sounds by itself.
+		 * Sounds are converted to float samples at the output sampling
+		 * rate when registered, and are spatialized with inverse distance
+		 * attenuation and equal-power panning.
+		 *
+		 * When constructed with a sampling rate, no output device is
+		 * opened and the output has to be pulled by calling Render. */
+		class SWAudioDevice: public client::IAudioDevice {
+		public:
+			struct Statistics {
+				int numVoices;
+				int numDroppedVoices;
+				uint64_t numFrames;
+				/** time spent in Render, in seconds. */
+				double mixTime;
+			};
+		
+		private:
+			struct OutputDevice;
+			struct Voice;
+			
+			enum PlayMode {
+				AbsoluteMode,
+				RelativeMode,
+				LocalMode
+			};
+			
+			double samplingRate;
+			std::unique_ptr<OutputDevice> outputDevice;
+			
+			std::map<std::string, SWAudioChunk *> chunks;
+			
+			/** protects voices, listener and stats. */
+			std::mutex mutex;
+			std::vector<Voice> voices;
+			uint64_t nextVoiceId;
+			int maxVoices;
+			
+			Vector3 listenerPosition;
+			Vector3 listenerFront;
+			Vector3 listenerRight;
+			AudioOcclusion occlusion;
+			
+			Statistics stats;
+			
+			/** voices played at non-default pitch are resampled here. */
+			std::vector<float> resampleBuffer;
+			
+			void Init();
+			void AddVoice(client::IAudioChunk *, const Vector3& origin,
+						  const client::AudioParam&, PlayMode);
+			void ComputeGains(const Voice&, float& left, float& right);
+			void MixVoice(Voice&, float *output, int numFrames);
+			
+			static void RenderCallback(SWAudioDevice *, uint8_t *, int);
+		
+		protected:
+			virtual ~SWAudioDevice();
+		
+		public:
+			/** opens the default output device. */
+			SWAudioDevice();
+			/** offline mode. */
+			explicit SWAudioDevice(double samplingRate);
+			
+			double GetSamplingRate() const { return samplingRate; }
+			
+			/** mixes the playing sounds.
+			 * @param output receives `numFrames` interleaved stereo frames. */
+			void Render(float *output, int numFrames);
+			
+			/** creates a chunk from interleaved float samples. */
+			client::IAudioChunk *CreateChunk(const float *samples,
+											 int numChannels, int numFrames,
+											 double samplingRate);
+			
+			Statistics GetStatistics();
+			
+			/** mixes 1, 4, 16, 64 and 256 voices in the offline mode for
+			 * `numSeconds` seconds each, and logs the time taken. */
+			static void RunBenchmark(int numSeconds);
+			
+			virtual client::IAudioChunk *RegisterSound(const char *name);
+			
+			virtual void SetGameMap(client::GameMap *);
+			
+			virtual void Play(client::IAudioChunk *, const Vector3& origin, const client::AudioParam&);
+			virtual void PlayLocal(client::IAudioChunk *, const Vector3& origin, const client::AudioParam&);
+			virtual void PlayLocal(client::IAudioChunk *, const client::AudioParam&);
+			
+			virtual void Respatialize(const Vector3& eye,
+									  const Vector3& front,
+									  const Vector3& up);
+		};
+	}
+}
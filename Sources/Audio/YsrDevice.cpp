@@ -457,22 +457,10 @@ namespace spades {
 			
 			// check obstruction
 			if(gameMap) {
-				Vector3 eye = listenerPosition;
-				Vector3 pos = origin;
-				Vector3 checkPos;
-				result.directGain = 0.4f;
-				for(int x = -1; x <= 1; x++)
-					for(int y = -1; y <= 1; y++)
-						for(int z = -1; z <= 1; z++){
-							IntVector3 hitPos;
-							checkPos.x = pos.x + (float)x * .2f;
-							checkPos.y = pos.y + (float)y * .2f;
-							checkPos.z = pos.z + (float)z * .2f;
-							if(!gameMap->CastRay(eye, (checkPos-eye).Normalize(),
-												 (checkPos-eye).GetLength(), hitPos)){
-								result.directGain = 1.f;
-							}
-						}
+				if(occlusion.IsOccluded(listenerPosition, origin))
+					result.directGain = 0.4f;
+				else
+					result.directGain = 1.f;
 			} else {
 				result.directGain = 1.f;
 			}
@@ -521,14 +509,11 @@ namespace spades {
 			SPADES_MARK_FUNCTION();
 			auto *old = this->gameMap;
 			this->gameMap = gameMap;
+			occlusion.SetGameMap(gameMap);
 			if(this->gameMap) this->gameMap->AddRef();
 			if(old) old->Release();
 		}
 		
-		static float NextRandom() {
-			return (float)std::rand() /(float)RAND_MAX;
-		}
-		
 		void YsrDevice::Respatialize(const spades::Vector3 &eye,
 									 const spades::Vector3 &front,
 									 const spades::Vector3 &up) {
@@ -551,31 +536,16 @@ namespace spades {
 				roomSize = 10.f;
 			}else{
 				// do raycast
-				Vector3 rayFrom = eye;
-				Vector3 rayTo;
+				const int numRays = 4;
+				float distances[numRays];
+				float feedbacks[numRays];
+				occlusion.ProbeRoom(eye, maxDistance, numRays,
+									distances, feedbacks);
 				
-				for(int rays = 0; rays < 4; rays++){
-					rayTo.x = NextRandom() - NextRandom();
-					rayTo.y = NextRandom() - NextRandom();
-					rayTo.z = NextRandom() - NextRandom();
-					rayTo = rayTo.Normalize();
-					
-					IntVector3 hitPos;
-					bool hit = map->CastRay(rayFrom, rayTo, maxDistance, hitPos);
-					if(hit){
-						Vector3 hitPosf = {(float)hitPos.x, (float)hitPos.y, (float)hitPos.z};
-						roomHistory[roomHistoryPos] = (hitPosf - rayFrom).GetLength();
-					}else{
-						roomHistory[roomHistoryPos] = maxDistance * 2.f;
-					}
-					
-					if(hit){
-						bool hit2 = map->CastRay(rayFrom, -rayTo, maxDistance, hitPos);
-						if(hit2)
-							roomFeedbackHistory[roomHistoryPos] = 1.f;
-						else
-							roomFeedbackHistory[roomHistoryPos] = 0.f;
-					}
+				for(int rays = 0; rays < numRays; rays++){
+					roomHistory[roomHistoryPos] = distances[rays];
+					if(distances[rays] < maxDistance * 2.f)
+						roomFeedbackHistory[roomHistoryPos] = feedbacks[rays];
 					
 					roomHistoryPos++;
 					if(roomHistoryPos == (int)roomHistory.size())
@@ -625,6 +595,8 @@ namespace spades {
 			reverbParam.roomVolume = roomVolume;
 			
 			driver->Respatialize(eye, front, up, reverbParam);
+			
+			occlusion.FrameDone();
 		}
 		
 		static YsrContext::PlayParam TranslateParam(const client::AudioParam& base) {
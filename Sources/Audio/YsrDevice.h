@@ -21,6 +21,7 @@
 #pragma once
 
 #include <Client/IAudioDevice.h>
+#include "AudioOcclusion.h"
 #include <map>
 #include <memory>
 #include <array>
@@ -37,6 +38,7 @@ namespace spades {
 			client::GameMap *gameMap;
 			std::unique_ptr<SdlAudioDevice> sdlAudioDevice;
 			Vector3 listenerPosition;
+			AudioOcclusion occlusion;
 			
 			int roomHistoryPos;
 			enum { RoomHistorySize = 128 };
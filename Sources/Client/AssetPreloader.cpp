@@ -0,0 +1,312 @@
+/*
+ Copyright (c) 2013 yvt
+ 
+ This file is part of OpenSpades.
+ 
+ OpenSpades is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ 
+ OpenSpades is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with OpenSpades.  If not, see <http://www.gnu.org/licenses/>.
+ 
+ */
+
+#include "AssetPreloader.h"
+#include "IRenderer.h"
+#include "IAudioDevice.h"
+#include "../Core/Bitmap.h"
+#include "../Core/VoxelModel.h"
+#include "../Core/FileManager.h"
+#include "../Core/MemoryStream.h"
+#include "../Core/ConcurrentDispatch.h"
+#include "../Core/Stopwatch.h"
+#include "../Core/Settings.h"
+#include "../Core/Debug.h"
+#include "../Core/Exception.h"
+#include "../Core/Math.h"
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <algorithm>
+
+SPADES_SETTING(cg_preloadNumThreads, "4");
+SPADES_SETTING(cg_debugPreload, "0");
+
+namespace spades {
+	namespace client {
+		
+		/** shared state of the workers. */
+		class AssetPreloader::LoadContext {
+			std::vector<Asset>& assets;
+			
+			/** indices of the assets loaded by the workers. */
+			std::vector<size_t> jobs;
+			std::atomic<size_t> nextJob;
+			
+			std::mutex doneMutex;
+			std::condition_variable doneCond;
+			std::deque<size_t> doneJobs;
+			
+			void Load(size_t index) {
+				SPADES_MARK_FUNCTION();
+				
+				Asset& asset = assets[index];
+				try{
+					Stopwatch sw;
+					// ZipFileSystem can open any number of files at once,
+					// so files are read in parallel as well
+					std::string data = FileManager::ReadAllBytes(asset.path.c_str());
+					asset.readTime = sw.GetTime();
+					
+					sw.Reset();
+					MemoryStream stream(data.data(), data.size());
+					switch(asset.type){
+						case ImageAsset:
+							bitmaps[index].Set(Bitmap::Load(&stream, asset.path), false);
+							break;
+						case ModelAsset:
+							models[index].Set(VoxelModel::LoadKV6(&stream), false);
+							break;
+						default:
+							SPAssert(false);
+					}
+					asset.decodeTime = sw.GetTime();
+				}catch(const std::exception& ex){
+					errors[index] = ex.what();
+				}catch(...){
+					errors[index] = "(no information provided)";
+				}
+			}
+		
+		public:
+			std::vector<Handle<Bitmap>> bitmaps;
+			std::vector<Handle<VoxelModel>> models;
+			std::vector<std::string> errors;
+			
+			LoadContext(std::vector<Asset>& assets):
+			assets(assets), nextJob(0),
+			bitmaps(assets.size()), models(assets.size()),
+			errors(assets.size()) {
+				for(size_t i = 0; i < assets.size(); i++){
+					if(assets[i].type != SoundAsset)
+						jobs.push_back(i);
+				}
+			}
+			
+			size_t GetNumJobs() const { return jobs.size(); }
+			
+			void Work() {
+				SPADES_MARK_FUNCTION();
+				while(true){
+					size_t job = nextJob.fetch_add(1);
+					if(job >= jobs.size())
+						break;
+					Load(jobs[job]);
+					
+					std::lock_guard<std::mutex> lock(doneMutex);
+					doneJobs.push_back(jobs[job]);
+					doneCond.notify_one();
+				}
+			}
+			
+			/** waits until any asset is loaded.
+			 * @return index of the asset. */
+			size_t WaitForAsset() {
+				std::unique_lock<std::mutex> lock(doneMutex);
+				doneCond.wait(lock, [this] { return !doneJobs.empty(); });
+				size_t index = doneJobs.front();
+				doneJobs.pop_front();
+				return index;
+			}
+		};
+		
+		AssetPreloader::AssetPreloader(IRenderer *renderer,
+									   IAudioDevice *audioDevice):
+		renderer(renderer), audioDevice(audioDevice), totalTime(0.) {
+			SPADES_MARK_FUNCTION();
+		}
+		
+		AssetPreloader::~AssetPreloader() {
+			SPADES_MARK_FUNCTION();
+		}
+		
+		void AssetPreloader::AddAsset(AssetType type, const std::string &path) {
+			Asset asset;
+			asset.type = type;
+			asset.path = path;
+			asset.loaded = false;
+			asset.readTime = 0.;
+			asset.decodeTime = 0.;
+			asset.registerTime = 0.;
+			asset.completionTime = 0.;
+			assets.push_back(asset);
+		}
+		
+		void AssetPreloader::LoadManifest(const std::string &path) {
+			SPADES_MARK_FUNCTION();
+			
+			std::string text = FileManager::ReadAllBytes(path.c_str());
+			std::vector<std::string> lines = SplitIntoLines(text);
+			for(size_t i = 0; i < lines.size(); i++){
+				std::string line = TrimSpaces(lines[i]);
+				if(line.empty() || line[0] == '#')
+					continue;
+				
+				size_t sep = line.find_first_of(" \t");
+				if(sep == std::string::npos){
+					SPRaise("%s:%d: asset path is missing", path.c_str(), (int)i + 1);
+				}
+				std::string type = line.substr(0, sep);
+				std::string assetPath = TrimSpaces(line.substr(sep + 1));
+				if(type == "image"){
+					AddAsset(ImageAsset, assetPath);
+				}else if(type == "model"){
+					AddAsset(ModelAsset, assetPath);
+				}else if(type == "sound"){
+					AddAsset(SoundAsset, assetPath);
+				}else{
+					SPRaise("%s:%d: unknown asset type: %s",
+							path.c_str(), (int)i + 1, type.c_str());
+				}
+			}
+		}
+		
+		void AssetPreloader::Run() {
+			SPADES_MARK_FUNCTION();
+			
+			Stopwatch total;
+			
+			{
+				LoadContext ctx(assets);
+				
+				int numThreads = cg_preloadNumThreads;
+				numThreads = std::min(numThreads, (int)ctx.GetNumJobs());
+				numThreads = std::max(numThreads, ctx.GetNumJobs() > 0 ? 1 : 0);
+				
+				// declared after ctx so that the workers are joined
+				// before ctx is destroyed
+				std::vector<std::unique_ptr<ConcurrentDispatch>> workers;
+				for(int i = 0; i < numThreads; i++){
+					auto f = [&ctx]() {
+						ctx.Work();
+					};
+					workers.emplace_back(new FunctionDispatch<decltype(f)>(f));
+					workers.back()->Start();
+				}
+				
+				// hand the decoded assets to the renderer in the order
+				// of completion
+				for(size_t i = 0; i < ctx.GetNumJobs(); i++){
+					size_t index = ctx.WaitForAsset();
+					Asset& asset = assets[index];
+					if(!ctx.errors[index].empty()){
+						SPLog("Failed to preload '%s': %s",
+							  asset.path.c_str(), ctx.errors[index].c_str());
+						continue;
+					}
+					
+					Stopwatch sw;
+					try{
+						if(asset.type == ImageAsset){
+							renderer->RegisterPreloadedImage(asset.path.c_str(),
+															 ctx.bitmaps[index]);
+						}else{
+							renderer->RegisterPreloadedModel(asset.path.c_str(),
+															 ctx.models[index]);
+						}
+						asset.loaded = true;
+					}catch(const std::exception& ex){
+						SPLog("Failed to preload '%s': %s",
+							  asset.path.c_str(), ex.what());
+					}
+					asset.registerTime = sw.GetTime();
+					asset.completionTime = total.GetTime();
+					
+					// the renderer has its own copy or reference
+					ctx.bitmaps[index].Set(NULL);
+					ctx.models[index].Set(NULL);
+				}
+			}
+			
+			for(size_t i = 0; i < assets.size(); i++){
+				Asset& asset = assets[i];
+				if(asset.type != SoundAsset)
+					continue;
+				
+				Stopwatch sw;
+				try{
+					audioDevice->RegisterSound(asset.path.c_str());
+					asset.loaded = true;
+				}catch(const std::exception& ex){
+					SPLog("Failed to preload '%s': %s",
+						  asset.path.c_str(), ex.what());
+				}
+				asset.registerTime = sw.GetTime();
+				asset.completionTime = total.GetTime();
+			}
+			
+			totalTime = total.GetTime();
+			ReportTimings();
+		}
+		
+		void AssetPreloader::ReportTimings() {
+			int numLoaded = 0;
+			double readTime = 0., decodeTime = 0., registerTime = 0.;
+			const Asset *slowest = NULL;
+			double slowestTime = 0.;
+			for(size_t i = 0; i < assets.size(); i++){
+				const Asset& asset = assets[i];
+				if(!asset.loaded)
+					continue;
+				numLoaded++;
+				readTime += asset.readTime;
+				decodeTime += asset.decodeTime;
+				registerTime += asset.registerTime;
+				
+				double t = asset.readTime + asset.decodeTime + asset.registerTime;
+				if(t > slowestTime){
+					slowest = &asset;
+					slowestTime = t;
+				}
+			}
+			
+			SPLog("Preloaded %d of %d asset(s) in %.1fms "
+				  "(total read: %.1fms, decode: %.1fms, register: %.1fms)",
+				  numLoaded, (int)assets.size(), totalTime * 1000.,
+				  readTime * 1000., decodeTime * 1000., registerTime * 1000.);
+			
+			FileManager::Statistics files = FileManager::GetStatistics();
+			SPLog("File lookups: %llu (%llu by index only, %llu not found), "
+				  "%llu file system probes, %d indexed files",
+				  (unsigned long long)files.numLookups,
+				  (unsigned long long)files.numIndexedLookups,
+				  (unsigned long long)files.numNotFound,
+				  (unsigned long long)files.numProbes,
+				  (int)files.numIndexedFiles);
+			
+			if(cg_debugPreload){
+				for(size_t i = 0; i < assets.size(); i++){
+					const Asset& asset = assets[i];
+					SPLog("  %-48s read: %7.2fms decode: %7.2fms "
+						  "register: %7.2fms done at: %8.2fms%s",
+						  asset.path.c_str(),
+						  asset.readTime * 1000., asset.decodeTime * 1000.,
+						  asset.registerTime * 1000., asset.completionTime * 1000.,
+						  asset.loaded ? "" : " (failed)");
+				}
+			}else if(slowest){
+				SPLog("Slowest asset: %s (%.1fms)",
+					  slowest->path.c_str(), slowestTime * 1000.);
+			}
+		}
+	}
+}
@@ -0,0 +1,91 @@
+/*
+ Copyright (c) 2013 yvt
+ 
+ This file is part of OpenSpades.
+ 
+ OpenSpades is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ 
+ OpenSpades is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with OpenSpades.  If not, see <http://www.gnu.org/licenses/>.
+ 
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+namespace spades {
+	namespace client {
+		class IRenderer;
+		class IAudioDevice;
+		
+		/** Loads the assets listed in a preload manifest.
+		 * Images and models are read and decoded in parallel by the
+		 * worker threads, and the decoded objects are handed to the
+		 * renderer as soon as each of them is done. Sounds are
+		 * registered after that because IAudioDevice loads them by itself.
+		 *
+		 * Each line of a manifest is `<type> <path>`, where `type` is
+		 * `image`, `model`, or `sound`. Lines starting with `#` are
+		 * comments. */
+		class AssetPreloader {
+		public:
+			enum AssetType {
+				ImageAsset,
+				ModelAsset,
+				SoundAsset
+			};
+			
+			struct Asset {
+				AssetType type;
+				std::string path;
+				
+				bool loaded;
+				
+				// timings, in seconds
+				double readTime;
+				double decodeTime;
+				/** time taken by the renderer/audio device to register it. */
+				double registerTime;
+				/** time from the start of the preload to the moment it
+				 * was registered. */
+				double completionTime;
+			};
+		
+		private:
+			class LoadContext;
+			
+			IRenderer *renderer;
+			IAudioDevice *audioDevice;
+			std::vector<Asset> assets;
+			double totalTime;
+			
+			void ReportTimings();
+		
+		public:
+			AssetPreloader(IRenderer *, IAudioDevice *);
+			~AssetPreloader();
+			
+			void AddAsset(AssetType, const std::string& path);
+			
+			/** adds the assets listed in the manifest file. */
+			void LoadManifest(const std::string& path);
+			
+			/** loads all the assets added, and returns when done.
+			 * assets that failed to load are skipped with a log message. */
+			void Run();
+			
+			const std::vector<Asset>& GetAssets() const { return assets; }
+			double GetTotalTime() const { return totalTime; }
+		};
+	}
+}
@@ -26,13 +26,165 @@
 #include "../Core/AutoLocker.h"
 #include "IImage.h"
 #include "IModel.h"
+#include "../Core/Bitmap.h"
+#include "../Core/VoxelModel.h"
+#include "../Core/Settings.h"
+#include "../Core/Stopwatch.h"
+#include "../Core/FileManager.h"
 #include <stdint.h>
+#include <cstring>
+#include <memory>
+#include <algorithm>
+
+SPADES_SETTING(r_asyncRendererFramesInFlight, "2");
+SPADES_SETTING(r_debugAsyncRenderer, "0");
 
 namespace spades {
 	namespace client {
 		
 		
 		
+#pragma mark - Proxies
+		
+		/** Image returned by AsyncRenderer. The actual image is loaded
+		 * on the render thread, and since the load is queued before any
+		 * frame that refers to the proxy, it's always resolved when
+		 * the commands are executed. */
+		class TemporaryAsyncImage: public IImage {
+			class Loader: public ConcurrentDispatch {
+				TemporaryAsyncImage& owner;
+			public:
+				Loader(TemporaryAsyncImage& owner): owner(owner) {}
+				virtual void Run() { owner.Load(); }
+			};
+			
+			IRenderer *base;
+			std::string filename;
+			Handle<Bitmap> bitmap;
+			
+			/** written by the render thread before the loader completes. */
+			IImage *image;
+			float width, height;
+			/** true if the size is available without waiting for the loader. */
+			bool sizeKnown;
+			Loader loader;
+			
+			void Load() {
+				SPADES_MARK_FUNCTION();
+				try{
+					if(bitmap){
+						image = base->CreateImage(bitmap);
+					}else{
+						image = base->RegisterImage(filename.c_str());
+						width = image->GetWidth();
+						height = image->GetHeight();
+					}
+				}catch(const std::exception& ex){
+					SPLog("Failed to load image '%s' asynchronously:\n%s",
+						  filename.c_str(), ex.what());
+					image = NULL;
+				}
+				bitmap.Set(NULL);
+			}
+		protected:
+			virtual ~TemporaryAsyncImage() {
+				loader.Join();
+				if(image) image->Release();
+			}
+		public:
+			TemporaryAsyncImage(IRenderer *base, const char *filename):
+			base(base), filename(filename), image(NULL),
+			width(0.f), height(0.f), sizeKnown(false), loader(*this) {}
+			
+			TemporaryAsyncImage(IRenderer *base, Bitmap *bmp):
+			base(base), filename("(bitmap)"), bitmap(bmp), image(NULL),
+			width((float)bmp->GetWidth()), height((float)bmp->GetHeight()),
+			sizeKnown(true), loader(*this) {}
+			
+			void StartOn(DispatchQueue *queue) { loader.StartOn(queue); }
+			
+			/** must be called by the render thread. may return NULL
+			 * if the image failed to load. */
+			IImage *GetImage() { return image; }
+			
+			// the size of an image loaded from a file isn't known
+			// until it's decoded, so the caller waits only here
+			virtual float GetWidth() {
+				if(!sizeKnown){
+					loader.Join();
+					sizeKnown = true;
+				}
+				return width;
+			}
+			virtual float GetHeight() {
+				if(!sizeKnown){
+					loader.Join();
+					sizeKnown = true;
+				}
+				return height;
+			}
+		};
+		
+		/** Model returned by AsyncRenderer. See TemporaryAsyncImage. */
+		class TemporaryAsyncModel: public IModel {
+			class Loader: public ConcurrentDispatch {
+				TemporaryAsyncModel& owner;
+			public:
+				Loader(TemporaryAsyncModel& owner): owner(owner) {}
+				virtual void Run() { owner.Load(); }
+			};
+			
+			IRenderer *base;
+			std::string filename;
+			Handle<VoxelModel> voxelModel;
+			
+			IModel *model;
+			Loader loader;
+			
+			void Load() {
+				SPADES_MARK_FUNCTION();
+				try{
+					if(voxelModel){
+						model = base->CreateModel(voxelModel);
+					}else{
+						model = base->RegisterModel(filename.c_str());
+					}
+				}catch(const std::exception& ex){
+					SPLog("Failed to load model '%s' asynchronously:\n%s",
+						  filename.c_str(), ex.what());
+					model = NULL;
+				}
+				voxelModel.Set(NULL);
+			}
+		protected:
+			virtual ~TemporaryAsyncModel() {
+				loader.Join();
+				if(model) model->Release();
+			}
+		public:
+			TemporaryAsyncModel(IRenderer *base, const char *filename):
+			base(base), filename(filename), model(NULL), loader(*this) {}
+			
+			TemporaryAsyncModel(IRenderer *base, VoxelModel *vm):
+			base(base), filename("(voxel model)"), voxelModel(vm),
+			model(NULL), loader(*this) {}
+			
+			void StartOn(DispatchQueue *queue) { loader.StartOn(queue); }
+			
+			/** must be called by the render thread. */
+			IModel *GetModel() { return model; }
+		};
+		
+		static IImage *ResolveImage(IImage *img) {
+			TemporaryAsyncImage *proxy = dynamic_cast<TemporaryAsyncImage *>(img);
+			return proxy ? proxy->GetImage() : img;
+		}
+		
+		static IModel *ResolveModel(IModel *model) {
+			TemporaryAsyncModel *proxy = dynamic_cast<TemporaryAsyncModel *>(model);
+			return proxy ? proxy->GetModel() : model;
+		}
+		
 #pragma mark - Commands
 		
 		class Command {
@@ -96,7 +248,7 @@ namespace spades {
 				virtual void Execute(IRenderer *r){
 					SPADES_MARK_FUNCTION();
 					if(img){
-						def.image = img; img = NULL;
+						def.image = ResolveImage(img); img = NULL;
 					}
 					try{
 						r->AddLight(def);
@@ -115,7 +267,8 @@ namespace spades {
 				ModelRenderParam param;
 				virtual void Execute(IRenderer *r){
 					try {
-						r->RenderModel(model, param);
+						IModel *m = ResolveModel(model);
+						if(m) r->RenderModel(m, param);
 					}catch(...){
 						model->Release(); model = NULL;
 						throw;
@@ -140,7 +293,8 @@ namespace spades {
 				virtual void Execute(IRenderer *r){
 					SPADES_MARK_FUNCTION();
 					try {
-						r->AddSprite(img, center, radius, rotation);
+						IImage *i = ResolveImage(img);
+						if(i) r->AddSprite(i, center, radius, rotation);
 					}catch(...){
 						img->Release(); img = NULL;
 						throw;
@@ -156,7 +310,8 @@ namespace spades {
 				virtual void Execute(IRenderer *r){
 					SPADES_MARK_FUNCTION();
 					try {
-						r->AddLongSprite(img, p1, p2, radius);
+						IImage *i = ResolveImage(img);
+						if(i) r->AddLongSprite(i, p1, p2, radius);
 					}catch(...){
 						img->Release(); img = NULL;
 						throw;
@@ -205,8 +360,31 @@ namespace spades {
 				virtual void Execute(IRenderer *r){
 					SPADES_MARK_FUNCTION();
 					try{
-						r->DrawImage(img, outTopLeft, outTopRight, outBottomLeft,
-									 inRect);
+						// NULL image is a solid rectangle, but a proxy that
+						// failed to load draws nothing
+						IImage *i = img ? ResolveImage(img) : NULL;
+						if(i || !img)
+							r->DrawImage(i, outTopLeft, outTopRight, outBottomLeft,
+										 inRect);
+					}catch(...){
+						if(img) img->Release(); img = NULL;
+						throw;
+					}
+					if(img) img->Release(); img = NULL;
+				}
+			};
+			class DrawImages: public Command {
+			public:
+				enum { MaxQuads = 32 };
+				IImage *img;
+				ImageQuad quads[MaxQuads];
+				int numQuads;
+				virtual void Execute(IRenderer *r){
+					SPADES_MARK_FUNCTION();
+					try{
+						IImage *i = img ? ResolveImage(img) : NULL;
+						if(i || !img)
+							r->DrawImages(i, quads, numQuads);
 					}catch(...){
 						if(img) img->Release(); img = NULL;
 						throw;
@@ -241,99 +419,218 @@ namespace spades {
 		
 #pragma mark - Command Buffer
 		
-		class AsyncRenderer::CmdBufferGenerator {
+		/** Command buffer made of fixed-size blocks. Blocks are kept
+		 * when cleared, so recording doesn't allocate memory once
+		 * the arena has grown to the size of a typical frame. */
+		class AsyncRenderer::CmdArena {
+			enum {
+				BlockSize = 64 * 1024,
+				Alignment = 16
+			};
+			struct Block {
+				std::unique_ptr<char[]> data;
+				size_t used;
+			};
+			std::vector<Block> blocks;
+			size_t currentBlock;
+			
+			int numCommands;
+			size_t numBytes;
+			
+			void AddBlock() {
+				Block b;
+				b.data.reset(new char[BlockSize]);
+				b.used = 0;
+				blocks.push_back(std::move(b));
+			}
 		public:
-			std::vector<char> buffer;
+			CmdArena(): currentBlock(0), numCommands(0), numBytes(0) {
+				AddBlock();
+			}
 			
-			void Clear(){
-				buffer.clear();
+			void Clear() {
+				for(size_t i = 0; i <= currentBlock; i++)
+					blocks[i].used = 0;
+				currentBlock = 0;
+				numCommands = 0;
+				numBytes = 0;
 			}
 			
+			bool IsEmpty() const { return numCommands == 0; }
+			int GetNumCommands() const { return numCommands; }
+			size_t GetNumBytes() const { return numBytes; }
+			size_t GetNumBlocks() const { return blocks.size(); }
+			
 			template<typename T>
 			T *AllocCommand() {
-				SPADES_MARK_FUNCTION();
+				SPADES_MARK_FUNCTION_DEBUG();
 				
-				size_t size = sizeof(T);
-				size_t pos = buffer.size();
-				buffer.resize(buffer.size() + size);
+				static_assert(sizeof(T) <= BlockSize, "Command too large");
+				size_t size = (sizeof(T) + Alignment - 1) & ~(size_t)(Alignment - 1);
+				if(blocks[currentBlock].used + size > BlockSize){
+					currentBlock++;
+					if(currentBlock == blocks.size())
+						AddBlock();
+				}
 				
-				void *dat = buffer.data() + pos;
-				T *cmd = new(dat) T;
-				cmd->cmdSize = sizeof(T);
+				Block& b = blocks[currentBlock];
+				T *cmd = new(b.data.get() + b.used) T;
+				cmd->cmdSize = static_cast<uint16_t>(size);
+				b.used += size;
+				numCommands++;
+				numBytes += size;
 				return cmd;
 			}
-		};
-		
-		class AsyncRenderer::CmdBufferReader {
-			std::vector<char> buffer;
-			size_t pos;
-		public:
-			CmdBufferReader(const std::vector<char>& buf):
-			buffer(buf), pos(0){
-			}
-			Command *NextCommand() {
-				SPADES_MARK_FUNCTION();
+			
+			/** Iterates the commands in place. */
+			class Reader {
+				const CmdArena& arena;
+				size_t block;
+				size_t pos;
+			public:
+				Reader(const CmdArena& arena):
+				arena(arena), block(0), pos(0) {}
 				
-				if(pos >= buffer.size()){
-					return NULL;
-				}
-				Command *cmd = reinterpret_cast<Command *>(buffer.data() + pos);
-				pos += cmd->cmdSize;
-				if(pos > buffer.size()) {
-					SPRaise("Truncated render command buffer");
+				Command *NextCommand() {
+					SPADES_MARK_FUNCTION_DEBUG();
+					
+					while(pos >= arena.blocks[block].used) {
+						if(block >= arena.currentBlock)
+							return NULL;
+						block++;
+						pos = 0;
+					}
+					const Block& b = arena.blocks[block];
+					Command *cmd = reinterpret_cast<Command *>(b.data.get() + pos);
+					pos += cmd->cmdSize;
+					if(pos > b.used) {
+						SPRaise("Truncated render command buffer");
+					}
+					return cmd;
 				}
-				return cmd;
-			}
+			};
 		};
 		
 		class AsyncRenderer::RenderDispatch:
 		public ConcurrentDispatch{
 			AsyncRenderer *renderer;
 		public:
-			std::vector<char> buffer;
+			CmdArena arena;
+			/** time taken to execute the commands. valid after Join. */
+			double executeTime;
 			
 			RenderDispatch(AsyncRenderer *renderer):
-			renderer(renderer){
+			renderer(renderer), executeTime(0.) {
 				
 			}
 			virtual void Run() {
 				SPADES_MARK_FUNCTION();
 				
-				CmdBufferReader reader(buffer);
+				Stopwatch sw;
+				CmdArena::Reader reader(arena);
 				Command *cmd;
 				while((cmd = reader.NextCommand()) != NULL){
 					cmd->Execute(renderer->base);
 				}
+				executeTime = sw.GetTime();
 			}
 		};
 		
 		AsyncRenderer::AsyncRenderer(IRenderer *base,
 									 DispatchQueue *queue):
-		base(base), queue(queue){
-			generator = new CmdBufferGenerator();
-			dispatch = new RenderDispatch(this);
+		base(base), queue(queue), currentDispatch(0),
+		numReportedFrames(0) {
+			// one arena is being recorded while the others are in flight
+			int framesInFlight = r_asyncRendererFramesInFlight;
+			framesInFlight = std::max(std::min(framesInFlight, 8), 1);
+			for(int i = 0; i <= framesInFlight; i++)
+				dispatches.push_back(new RenderDispatch(this));
+			generator = &dispatches[0]->arena;
+			
+			std::memset(&frameStats, 0, sizeof(frameStats));
+			std::memset(&lastFrameStats, 0, sizeof(lastFrameStats));
+			std::memset(&reportStats, 0, sizeof(reportStats));
 		}
 		
 		AsyncRenderer::~AsyncRenderer(){
 			Sync();
 			
-			delete dispatch;
-			delete generator;
+			for(size_t i = 0; i < dispatches.size(); i++)
+				delete dispatches[i];
 		}
 		
 		void AsyncRenderer::FlushCommands(){
-			if(generator->buffer.empty())
+			if(generator->IsEmpty())
 				return;
 			
-			dispatch->Join();
-			dispatch->buffer = std::move(generator->buffer);
-			generator->Clear();
-			dispatch->StartOn(queue);
+			frameStats.numCommands += generator->GetNumCommands();
+			frameStats.numBytes += generator->GetNumBytes();
+			frameStats.numFlushes++;
+			
+			dispatches[currentDispatch]->StartOn(queue);
+			currentDispatch = (currentDispatch + 1) % dispatches.size();
+			
+			// the next arena might be still in flight; wait for it
+			// so that the number of frames in flight is bounded.
+			RenderDispatch *next = dispatches[currentDispatch];
+			Stopwatch sw;
+			next->Join();
+			frameStats.waitTime += sw.GetTime();
+			frameStats.renderTime += next->executeTime;
+			next->executeTime = 0.;
+			
+			next->arena.Clear();
+			generator = &next->arena;
 		}
 		
 		void AsyncRenderer::Sync(){
 			FlushCommands();
-			dispatch->Join();
+			for(size_t i = 0; i < dispatches.size(); i++)
+				dispatches[i]->Join();
+		}
+		
+		void AsyncRenderer::FinishFrameStatistics() {
+			frameStats.frameTime = frameStopwatch.GetTime();
+			frameStopwatch.Reset();
+			lastFrameStats = frameStats;
+			
+			if(r_debugAsyncRenderer){
+				reportStats.numCommands += frameStats.numCommands;
+				reportStats.numBytes += frameStats.numBytes;
+				reportStats.numFlushes += frameStats.numFlushes;
+				reportStats.waitTime += frameStats.waitTime;
+				reportStats.renderTime += frameStats.renderTime;
+				reportStats.frameTime += frameStats.frameTime;
+				numReportedFrames++;
+				
+				if(numReportedFrames >= 60){
+					double n = (double)numReportedFrames;
+					size_t numBlocks = 0;
+					for(size_t i = 0; i < dispatches.size(); i++)
+						numBlocks += dispatches[i]->arena.GetNumBlocks();
+					// producer busy time = frame time - wait time. when the
+					// producer and the renderer overlap, the sum of busy times
+					// exceeds the frame time.
+					SPLog("AsyncRenderer: %.1f cmds, %.1f KB, %.1f flushes per frame; "
+						  "frame %.2fms, producer waited %.2fms, render %.2fms, "
+						  "overlap %.0f%% (%d frames in flight, %d arena blocks)",
+						  (double)reportStats.numCommands / n,
+						  (double)reportStats.numBytes / n / 1024.,
+						  (double)reportStats.numFlushes / n,
+						  reportStats.frameTime / n * 1000.,
+						  reportStats.waitTime / n * 1000.,
+						  reportStats.renderTime / n * 1000.,
+						  std::max(reportStats.renderTime - reportStats.waitTime, 0.) /
+						  std::max(reportStats.frameTime, 1.e-6) * 100.,
+						  (int)dispatches.size() - 1, (int)numBlocks);
+					std::memset(&reportStats, 0, sizeof(reportStats));
+					numReportedFrames = 0;
+				}
+			}else{
+				numReportedFrames = 0;
+			}
+			
+			std::memset(&frameStats, 0, sizeof(frameStats));
 		}
 		
 #pragma mark - General COmmands
@@ -341,38 +638,19 @@ namespace spades {
 		IImage *AsyncRenderer::RegisterImage(const char *filename) {
 			SPADES_MARK_FUNCTION();
 			
-			class RegisterImageDispatch: public ConcurrentDispatch {
-				IRenderer *base;
-				const char *fn;
-				IImage *result;
-				std::string error;
-			public:
-				RegisterImageDispatch(IRenderer *base, const char *fn):
-				base(base), fn(fn), result(NULL){}
-				virtual void Run(){
-					try{
-						result = base->RegisterImage(fn);
-					}catch(const std::exception& ex){
-						error = ex.what();
-					}
-				}
-				IImage *GetResult() {
-					if(!error.empty()){
-						SPRaise("Error while RegisterImageDispatch:\n%s", error.c_str());
-					}else{
-						return result;
-					}
-				}
-			};
-			
 			std::map<std::string, IImage *>::iterator it = images.find(filename);
 			if(it == images.end()) {
-				FlushCommands();
-				RegisterImageDispatch dispatch(base, filename);
-				dispatch.StartOn(queue);
-				dispatch.Join();
+				// missing files are still reported here since callers
+				// rely on it. other errors are logged by the render thread.
+				if(!FileManager::FileExists(filename)){
+					SPFileNotFound(filename);
+				}
 				
-				IImage *img = dispatch.GetResult();
+				// the loaders are queued directly, so the recorded
+				// commands (Init, for one) must be sent before them
+				FlushCommands();
+				TemporaryAsyncImage *img = new TemporaryAsyncImage(base, filename);
+				img->StartOn(queue);
 				images[filename] = img;
 				img->AddRef();
 				return img;
@@ -394,75 +672,27 @@ namespace spades {
 		IImage *AsyncRenderer::CreateImage(spades::Bitmap *bmp) {
 			SPADES_MARK_FUNCTION();
 			
-			class CreateImageDispatch: public ConcurrentDispatch {
-				IRenderer *base;
-				Bitmap *bmp;
-				IImage *result;
-				std::string error;
-			public:
-				CreateImageDispatch(IRenderer *base, Bitmap *bmp):
-				base(base), bmp(bmp), result(NULL){}
-				virtual void Run(){
-					try{
-						result = base->CreateImage(bmp);
-					}catch(const std::exception& ex){
-						error = ex.what();
-					}
-				}
-				IImage *GetResult() {
-					if(!error.empty()){
-						SPRaise("Error while CreateImageDispatch:\n%s", error.c_str());
-					}else{
-						return result;
-					}
-				}
-			};
-			
 			FlushCommands();
-			CreateImageDispatch dispatch(base, bmp);
-			dispatch.StartOn(queue);
-			dispatch.Join();
-			IImage *img = dispatch.GetResult();
+			TemporaryAsyncImage *img = new TemporaryAsyncImage(base, bmp);
+			img->StartOn(queue);
 			return img;
 		}
 		
 		IModel *AsyncRenderer::RegisterModel(const char *filename) {
 			SPADES_MARK_FUNCTION();
 			
-			class RegisterModelDispatch: public ConcurrentDispatch {
-				IRenderer *base;
-				const char *fn;
-				IModel *result;
-				std::string error;
-			public:
-				RegisterModelDispatch(IRenderer *base, const char *fn):
-				base(base), fn(fn), result(NULL){}
-				virtual void Run(){
-					try{
-						result = base->RegisterModel(fn);
-					}catch(const std::exception& ex){
-						error = ex.what();
-					}
-				}
-				IModel *GetResult() {
-					if(!error.empty()){
-						SPRaise("Error while RegisterImageDispatch:\n%s", error.c_str());
-					}else{
-						return result;
-					}
-				}
-			};
-			
 			std::map<std::string, IModel *>::iterator it = models.find(filename);
 			if(it == models.end()) {
+				if(!FileManager::FileExists(filename)){
+					SPFileNotFound(filename);
+				}
+				
 				FlushCommands();
-				RegisterModelDispatch dispatch(base, filename);
-				dispatch.StartOn(queue);
-				dispatch.Join();
-				IModel *img = dispatch.GetResult();
-				models[filename] = img;
-				img->AddRef();
-				return img;
+				TemporaryAsyncModel *model = new TemporaryAsyncModel(base, filename);
+				model->StartOn(queue);
+				models[filename] = model;
+				model->AddRef();
+				return model;
 			}
 			it->second->AddRef();
 			return it->second;
@@ -471,36 +701,71 @@ namespace spades {
 		IModel *AsyncRenderer::CreateModel(spades::VoxelModel *bmp) {
 			SPADES_MARK_FUNCTION();
 			
-			class CreateModelDispatch: public ConcurrentDispatch {
+			FlushCommands();
+			TemporaryAsyncModel *model = new TemporaryAsyncModel(base, bmp);
+			model->StartOn(queue);
+			return model;
+		}
+		
+		void AsyncRenderer::RegisterPreloadedImage(const char *filename,
+												   spades::Bitmap *bmp) {
+			SPADES_MARK_FUNCTION();
+			
+			// nothing is returned, so the caller doesn't have to wait
+			class RegisterPreloadedImageDispatch: public ConcurrentDispatch {
 				IRenderer *base;
-				VoxelModel *bmp;
-				IModel *result;
-				std::string error;
+				std::string fn;
+				Handle<Bitmap> bmp;
 			public:
-				CreateModelDispatch(IRenderer *base, VoxelModel *bmp):
-				base(base), bmp(bmp), result(NULL){}
+				RegisterPreloadedImageDispatch(IRenderer *base, const char *fn,
+											   Bitmap *bmp):
+				base(base), fn(fn), bmp(bmp){}
 				virtual void Run(){
 					try{
-						result = base->CreateModel(bmp);
+						base->RegisterPreloadedImage(fn.c_str(), bmp);
 					}catch(const std::exception& ex){
-						error = ex.what();
+						SPLog("Error while RegisterPreloadedImageDispatch:\n%s", ex.what());
 					}
 				}
-				IModel *GetResult() {
-					if(!error.empty()){
-						SPRaise("Error while CreateImageDispatch:\n%s", error.c_str());
-					}else{
-						return result;
+			};
+			
+			if(images.find(filename) != images.end())
+				return;
+			
+			FlushCommands();
+			ConcurrentDispatch *dispatch = new RegisterPreloadedImageDispatch(base, filename, bmp);
+			dispatch->StartOn(queue);
+			dispatch->Release();
+		}
+		
+		void AsyncRenderer::RegisterPreloadedModel(const char *filename,
+												   spades::VoxelModel *model) {
+			SPADES_MARK_FUNCTION();
+			
+			class RegisterPreloadedModelDispatch: public ConcurrentDispatch {
+				IRenderer *base;
+				std::string fn;
+				Handle<VoxelModel> model;
+			public:
+				RegisterPreloadedModelDispatch(IRenderer *base, const char *fn,
+											   VoxelModel *model):
+				base(base), fn(fn), model(model){}
+				virtual void Run(){
+					try{
+						base->RegisterPreloadedModel(fn.c_str(), model);
+					}catch(const std::exception& ex){
+						SPLog("Error while RegisterPreloadedModelDispatch:\n%s", ex.what());
 					}
 				}
 			};
 			
+			if(models.find(filename) != models.end())
+				return;
+			
 			FlushCommands();
-			CreateModelDispatch dispatch(base, bmp);
-			dispatch.StartOn(queue);
-			dispatch.Join();
-			IModel *img = dispatch.GetResult();
-			return img;
+			ConcurrentDispatch *dispatch = new RegisterPreloadedModelDispatch(base, filename, model);
+			dispatch->StartOn(queue);
+			dispatch->Release();
 		}
 		
 		void AsyncRenderer::SetGameMap(GameMap *gm) {
@@ -662,6 +927,23 @@ namespace spades {
 			cmd->inRect = inRect;
 		}
 		
+		void AsyncRenderer::DrawImages(client::IImage *image,
+									   const client::ImageQuad *quads,
+									   size_t numQuads) {
+			SPADES_MARK_FUNCTION();
+			
+			while(numQuads > 0) {
+				size_t count = std::min(numQuads, (size_t)rcmds::DrawImages::MaxQuads);
+				rcmds::DrawImages *cmd = generator->AllocCommand<rcmds::DrawImages>();
+				cmd->img = image;
+				if(image) image->AddRef();
+				std::copy(quads, quads + count, cmd->quads);
+				cmd->numQuads = (int)count;
+				quads += count;
+				numQuads -= count;
+			}
+		}
+		
 		void AsyncRenderer::DrawFlatGameMap(const spades::AABB2 &outRect,
 											const spades::AABB2 &inRect) {
 			SPADES_MARK_FUNCTION();
@@ -677,6 +959,7 @@ namespace spades {
 		void AsyncRenderer::Flip() {
 			generator->AllocCommand<rcmds::Flip>();
 			FlushCommands();
+			FinishFrameStatistics();
 		}
 		
 		Bitmap *AsyncRenderer::ReadBitmap() {
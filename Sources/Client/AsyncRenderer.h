@@ -21,31 +21,57 @@
 #pragma once
 
 #include "../Core/ConcurrentDispatch.h"
+#include "../Core/Stopwatch.h"
 #include "IRenderer.h"
 #include <map>
+#include <vector>
 
 namespace spades {
 	namespace client {
 		class TemporaryAsyncImage;
 		class TemporaryAsyncModel;
 		class AsyncRenderer: public IRenderer {
+		public:
+			struct FrameStatistics {
+				int numCommands;
+				size_t numBytes;
+				/** number of command buffers submitted. */
+				int numFlushes;
+				/** time the caller waited for a command buffer to be
+				 * available. */
+				double waitTime;
+				/** time the base renderer took to execute the commands. */
+				double renderTime;
+				double frameTime;
+			};
+			
+		private:
 			class RenderDispatch;
-			class CmdBufferGenerator;
-			class CmdBufferReader;
+			class CmdArena;
 			friend class TemporaryAsyncImage;
 			friend class TemporaryAsyncModel;
 			
 			IRenderer *base;
 			DispatchQueue *queue;
 			
-			RenderDispatch *dispatch;
-			CmdBufferGenerator *generator;
+			/** ring of command buffers. commands are recorded into the
+			 * arena of dispatches[currentDispatch]. */
+			std::vector<RenderDispatch *> dispatches;
+			size_t currentDispatch;
+			CmdArena *generator;
 			
 			std::map<std::string, IImage *> images;
 			std::map<std::string, IModel *> models;
 			
+			FrameStatistics frameStats;
+			FrameStatistics lastFrameStats;
+			FrameStatistics reportStats;
+			int numReportedFrames;
+			Stopwatch frameStopwatch;
+			
 			void FlushCommands();
 			void Sync();
+			void FinishFrameStatistics();
 		public:
 			AsyncRenderer(IRenderer *base,
 						  DispatchQueue *renderQueue);
@@ -60,6 +86,9 @@ namespace spades {
 			virtual IImage *CreateImage(Bitmap *);
 			virtual IModel *CreateModel(VoxelModel *);
 			
+			virtual void RegisterPreloadedImage(const char *filename, Bitmap *);
+			virtual void RegisterPreloadedModel(const char *filename, VoxelModel *);
+			
 			virtual void SetGameMap(GameMap *);
 			
 			virtual void SetFogDistance(float);
@@ -90,6 +119,7 @@ namespace spades {
 			virtual void DrawImage(IImage *, const Vector2& outTopLeft, const AABB2& inRect);
 			virtual void DrawImage(IImage *, const AABB2& outRect, const AABB2& inRect);
 			virtual void DrawImage(IImage *, const Vector2& outTopLeft, const Vector2& outTopRight, const Vector2& outBottomLeft, const AABB2& inRect);
+			virtual void DrawImages(IImage *, const ImageQuad *, size_t numQuads);
 			
 			virtual void DrawFlatGameMap(const AABB2& outRect, const AABB2& inRect);
 			
@@ -105,6 +135,8 @@ namespace spades {
 			virtual float ScreenWidth();
 			virtual float ScreenHeight();
 			
+			/** @return statistics of the last frame (up to Flip). */
+			const FrameStatistics& GetLastFrameStatistics() const { return lastFrameStats; }
 		};
 	}
 }
@@ -27,6 +27,8 @@
 #include "Fonts.h"
 #include <Core/FileManager.h>
 #include <Core/IStream.h>
+#include <Core/ConcurrentDispatch.h>
+#include <Core/FrameProfiler.h>
 #include <ctime>
 
 #include "IAudioChunk.h"
@@ -45,7 +47,9 @@
 
 #include "ILocalEntity.h"
 #include "SmokeSpriteEntity.h"
+#include "AssetPreloader.h"
 #include "Corpse.h"
+#include "SnapshotWriter.h"
 
 #include "World.h"
 #include "Weapon.h"
@@ -60,12 +64,31 @@ SPADES_SETTING(cg_chatBeep, "1");
 
 SPADES_SETTING(cg_serverAlert, "1");
 
+SPADES_SETTING(cg_overlapCorpseUpdate, "1");
+
 
 
 
 namespace spades {
 	namespace client {
 		
+		// corpse never accesses audio nor renderer, so
+		// we can do it in the separate thread
+		class Client::CorpseUpdateDispatch: public ConcurrentDispatch {
+			Client *client;
+		public:
+			float dt;
+			
+			CorpseUpdateDispatch(Client *c):
+			client(c), dt(0.f){}
+			virtual void Run(){
+				for(auto& c: client->corpses){
+					for(int i = 0; i < 4; i++)
+						c->Update(dt / 4.f);
+				}
+			}
+		};
+		
 		Client::Client(IRenderer *r, IAudioDevice *audioDev,
 					   const ServerAddress& host, std::string playerName):
 		renderer(r),
@@ -104,7 +127,9 @@ namespace spades {
 		// FIXME: preferences?
 		corpseSoftTimeLimit(30.f), // FIXME: this is not used
 		corpseSoftLimit(6),
-		corpseHardLimit(16)
+		corpseHardLimit(16),
+		overlapCorpseUpdate(false),
+		corpseUpdateDt(0.f)
 		{
 			SPADES_MARK_FUNCTION();
 			SPLog("Initializing...");
@@ -128,6 +153,8 @@ namespace spades {
 			paletteView.reset(new PaletteView(this));
 			tcView.reset(new TCProgressView(this));
 			scriptedUI.Set(new ClientUI(renderer, audioDev, textFont, this), false);
+			corpseDispatch.reset(new CorpseUpdateDispatch(this));
+			snapshotWriter.reset(new SnapshotWriter());
 			
 			
 			renderer->SetGameMap(nullptr);
@@ -202,9 +229,16 @@ namespace spades {
 		Client::~Client() {
 			SPADES_MARK_FUNCTION();
 			
+			JoinCorpseUpdate();
+			
+			// finish writing the snapshots
+			snapshotWriter.reset();
+			
 			NetLog("Disconnecting");
 			if(logStream) {
 				SPLog("Closing netlog");
+				// the writer thread might still have lines for the stream
+				AsyncLog::Flush();
 				logStream.reset();
 			}
 			
@@ -253,89 +287,15 @@ namespace spades {
 			// preload
 			SmokeSpriteEntity(this, Vector4(), 20.f);
 			
-			renderer->RegisterImage("Textures/Fluid.png");
-			renderer->RegisterImage("Textures/WaterExpl.png");
-			renderer->RegisterImage("Gfx/White.tga");
-			audioDevice->RegisterSound("Sounds/Weapons/Block/Build.wav");
-			audioDevice->RegisterSound("Sounds/Weapons/Impacts/FleshLocal1.wav");
-			audioDevice->RegisterSound("Sounds/Weapons/Impacts/FleshLocal2.wav");
-			audioDevice->RegisterSound("Sounds/Weapons/Impacts/FleshLocal3.wav");
-			audioDevice->RegisterSound("Sounds/Weapons/Impacts/FleshLocal4.wav");
-			audioDevice->RegisterSound("Sounds/Misc/SwitchMapZoom.wav");
-			audioDevice->RegisterSound("Sounds/Misc/OpenMap.wav");
-			audioDevice->RegisterSound("Sounds/Misc/CloseMap.wav");
-			audioDevice->RegisterSound("Sounds/Player/Flashlight.wav");
-			audioDevice->RegisterSound("Sounds/Player/Footstep1.wav");
-			audioDevice->RegisterSound("Sounds/Player/Footstep2.wav");
-			audioDevice->RegisterSound("Sounds/Player/Footstep3.wav");
-			audioDevice->RegisterSound("Sounds/Player/Footstep4.wav");
-			audioDevice->RegisterSound("Sounds/Player/Footstep5.wav");
-			audioDevice->RegisterSound("Sounds/Player/Footstep6.wav");
-			audioDevice->RegisterSound("Sounds/Player/Footstep7.wav");
-			audioDevice->RegisterSound("Sounds/Player/Footstep8.wav");
-			audioDevice->RegisterSound("Sounds/Player/Wade1.wav");
-			audioDevice->RegisterSound("Sounds/Player/Wade2.wav");
-			audioDevice->RegisterSound("Sounds/Player/Wade3.wav");
-			audioDevice->RegisterSound("Sounds/Player/Wade4.wav");
-			audioDevice->RegisterSound("Sounds/Player/Wade5.wav");
-			audioDevice->RegisterSound("Sounds/Player/Wade6.wav");
-			audioDevice->RegisterSound("Sounds/Player/Wade7.wav");
-			audioDevice->RegisterSound("Sounds/Player/Wade8.wav");
-			audioDevice->RegisterSound("Sounds/Player/Run1.wav");
-			audioDevice->RegisterSound("Sounds/Player/Run2.wav");
-			audioDevice->RegisterSound("Sounds/Player/Run3.wav");
-			audioDevice->RegisterSound("Sounds/Player/Run4.wav");
-			audioDevice->RegisterSound("Sounds/Player/Run5.wav");
-			audioDevice->RegisterSound("Sounds/Player/Run6.wav");
-			audioDevice->RegisterSound("Sounds/Player/Run7.wav");
-			audioDevice->RegisterSound("Sounds/Player/Run8.wav");
-			audioDevice->RegisterSound("Sounds/Player/Run9.wav");
-			audioDevice->RegisterSound("Sounds/Player/Run10.wav");
-			audioDevice->RegisterSound("Sounds/Player/Run11.wav");
-			audioDevice->RegisterSound("Sounds/Player/Run12.wav");
-			audioDevice->RegisterSound("Sounds/Player/Jump.wav");
-			audioDevice->RegisterSound("Sounds/Player/Land.wav");
-			audioDevice->RegisterSound("Sounds/Player/WaterJump.wav");
-			audioDevice->RegisterSound("Sounds/Player/WaterLand.wav");
-			audioDevice->RegisterSound("Sounds/Weapons/SwitchLocal.wav");
-			audioDevice->RegisterSound("Sounds/Weapons/Switch.wav");
-			audioDevice->RegisterSound("Sounds/Weapons/Restock.wav");
-			audioDevice->RegisterSound("Sounds/Weapons/RestockLocal.wav");
-			audioDevice->RegisterSound("Sounds/Weapons/AimDownSightLocal.wav");
-			renderer->RegisterImage("Gfx/Ball.png");
-			renderer->RegisterModel("Models/Player/Dead.kv6");
-			renderer->RegisterImage("Gfx/Spotlight.tga");
-			renderer->RegisterImage("Gfx/Glare.tga");
-			renderer->RegisterModel("Models/Weapons/Spade/Spade.kv6");
-			renderer->RegisterModel("Models/Weapons/Block/Block2.kv6");
-			renderer->RegisterModel("Models/Weapons/Grenade/Grenade.kv6");
-			renderer->RegisterModel("Models/Weapons/SMG/Weapon.kv6");
-			renderer->RegisterModel("Models/Weapons/SMG/WeaponNoMagazine.kv6");
-			renderer->RegisterModel("Models/Weapons/SMG/Magazine.kv6");
-			renderer->RegisterModel("Models/Weapons/Rifle/Weapon.kv6");
-			renderer->RegisterModel("Models/Weapons/Rifle/WeaponNoMagazine.kv6");
-			renderer->RegisterModel("Models/Weapons/Rifle/Magazine.kv6");
-			renderer->RegisterModel("Models/Weapons/Shotgun/Weapon.kv6");
-			renderer->RegisterModel("Models/Weapons/Shotgun/WeaponNoPump.kv6");
-			renderer->RegisterModel("Models/Weapons/Shotgun/Pump.kv6");
-			renderer->RegisterModel("Models/Player/Arm.kv6");
-			renderer->RegisterModel("Models/Player/UpperArm.kv6");
-			renderer->RegisterModel("Models/Player/LegCrouch.kv6");
-			renderer->RegisterModel("Models/Player/TorsoCrouch.kv6");
-			renderer->RegisterModel("Models/Player/Leg.kv6");
-			renderer->RegisterModel("Models/Player/Torso.kv6");
-			renderer->RegisterModel("Models/Player/Arms.kv6");
-			renderer->RegisterModel("Models/Player/Head.kv6");
-			renderer->RegisterModel("Models/MapObjects/Intel.kv6");
-			renderer->RegisterModel("Models/MapObjects/CheckPoint.kv6");
-			renderer->RegisterImage("Gfx/Sight.tga");
-			renderer->RegisterImage("Gfx/Bullet/7.62mm.tga");
-			renderer->RegisterImage("Gfx/Bullet/9mm.tga");
-			renderer->RegisterImage("Gfx/Bullet/12gauge.tga");
-			renderer->RegisterImage("Gfx/CircleGradient.png");
-			renderer->RegisterImage("Gfx/HurtSprite.png");
-			renderer->RegisterImage("Gfx/HurtRing2.png");
-			audioDevice->RegisterSound("Sounds/Feedback/Chat.wav");
+			{
+				AssetPreloader preloader(renderer, audioDevice);
+				try{
+					preloader.LoadManifest("Preload.txt");
+				}catch(const std::exception& ex){
+					SPLog("Failed to read the preload manifest: %s", ex.what());
+				}
+				preloader.Run();
+			}
 			
 			SPLog("Started connecting to '%s'", hostname.asString(true).c_str());
 			net.reset(new NetClient(this));
@@ -381,6 +341,7 @@ namespace spades {
 		
 		void Client::RunFrame(float dt) {
 			SPADES_MARK_FUNCTION();
+			SPADES_PROFILE_ZONE("Client::RunFrame");
 			
 			fpsCounter.MarkFrame();
 			
@@ -400,7 +361,16 @@ namespace spades {
 			
 			timeSinceInit += std::min(dt, .03f);
 			
+			ReportSnapshots();
+			
+			// corpses might have been updated in the last frame.
+			// this shouldn't happen unless the last frame was
+			// aborted by an exception
+			JoinCorpseUpdate();
+			overlapCorpseUpdate = cg_overlapCorpseUpdate;
+			
 			// update network
+			frameTimings.Begin(FrameTimings::Network);
 			try{
 				if(net->GetStatus() == NetClientStatusConnected)
 					net->DoEvents(0);
@@ -416,6 +386,7 @@ namespace spades {
 				}
 			}
 			
+			frameTimings.Begin(FrameTimings::World);
 			hurtRingView->Update(dt);
 			centerMessageView->Update(dt);
 			mapView->Update(dt);
@@ -432,11 +403,14 @@ namespace spades {
 			limbo->Update(dt);
 			
 			// CreateSceneDefinition also can be used for sounds
+			frameTimings.Begin(FrameTimings::Scene);
 			SceneDefinition sceneDef = CreateSceneDefinition();
 			lastSceneDef = sceneDef;
 			
 			// Update sounds
+			frameTimings.Begin(FrameTimings::Audio);
 			try{
+				SPADES_PROFILE_ZONE("Respatialize");
 				audioDevice->Respatialize(sceneDef.viewOrigin,
 										  sceneDef.viewAxis[2],
 										  sceneDef.viewAxis[1]);
@@ -446,19 +420,35 @@ namespace spades {
 			}
 			
 			// render scene
+			// (with cg_overlapCorpseUpdate, this starts the corpse update)
+			frameTimings.Begin(FrameTimings::DrawScene);
 			DrawScene();
 			
 			// draw 2d
+			frameTimings.Begin(FrameTimings::Draw2D);
 			Draw2D();
 			
 			// draw scripted GUI
-			scriptedUI->RunFrame(dt);
-			if(scriptedUI->WantsClientToBeClosed())
-				readyToClose = true;
+			frameTimings.Begin(FrameTimings::UI);
+			{
+				SPADES_PROFILE_ZONE("ClientUI::RunFrame");
+				scriptedUI->RunFrame(dt);
+				if(scriptedUI->WantsClientToBeClosed())
+					readyToClose = true;
+			}
 			
 			// Well done!
-			renderer->FrameDone();
-			renderer->Flip();
+			frameTimings.Begin(FrameTimings::Present);
+			{
+				SPADES_PROFILE_ZONE("Present");
+				renderer->FrameDone();
+				renderer->Flip();
+			}
+			
+			// nothing else may touch corpses until they are updated
+			frameTimings.Begin(FrameTimings::World);
+			JoinCorpseUpdate();
+			frameTimings.MarkFrame();
             
             // reset all "delayed actions" (in case we forget to reset these)
             hasDelayedReload = false;
@@ -466,6 +456,23 @@ namespace spades {
 			time += dt;
 		}
 		
+		void Client::StartCorpseUpdate() {
+			SPADES_MARK_FUNCTION();
+			
+			if(corpseUpdateDt <= 0.f)
+				return;
+			corpseDispatch->Join();
+			corpseDispatch->dt = corpseUpdateDt;
+			corpseUpdateDt = 0.f;
+			corpseDispatch->Start();
+		}
+		
+		void Client::JoinCorpseUpdate() {
+			SPADES_MARK_FUNCTION();
+			if(corpseDispatch)
+				corpseDispatch->Join();
+		}
+		
 		bool Client::IsLimboViewActive(){
 			if(world){
 				if(!world->GetLocalPlayer()){
@@ -541,31 +548,17 @@ namespace spades {
 			char buf[4096];
 			va_list va;
 			va_start(va, format);
-			vsprintf(buf, format, va);
+			int len = vsnprintf(buf, sizeof(buf), format, va);
 			va_end(va);
-			std::string str = buf;
-			
-			time_t t;
-			struct tm tm;
-			::time(&t);
-			tm = *localtime(&t);
-			
-			std::string timeStr = asctime(&tm);
-			
-			// remove '\n' in the end of the result of asctime().
-			timeStr.resize(timeStr.size()-1);
-			
-			sprintf(buf, "%s %s\n",
-					timeStr.c_str(), str.c_str());
-			
-			std::string outStr = EscapeControlCharacters(buf);
-			
-			printf("%s", outStr.c_str());
-			
-			if(logStream) {
-				logStream->Write(outStr);
-				logStream->Flush();
-			}
+			if(len < 0)
+				len = 0;
+			if(len >= (int)sizeof(buf))
+				len = (int)sizeof(buf) - 1;
+			
+			// the time stamp is formatted by the log writer thread
+			AsyncLog::Post(AsyncLog::Format::Net, LogLevel::Info,
+						   __FILE__, __LINE__, logStream.get(),
+						   buf, (size_t)len);
 		}
 		
 		
@@ -574,23 +567,16 @@ namespace spades {
 		void Client::TakeMapShot(){
 			
 			try{
-				std::string name = MapShotPath();
-				{
-					std::unique_ptr<IStream> stream(FileManager::OpenForWriting(name.c_str()));
-					try{
-						GameMap *map = GetWorld()->GetMap();
-						if(map == nullptr){
-							SPRaise("No map loaded");
-						}
-						map->Save(stream.get());
-					}catch(...){
-						throw;
-					}
+				GameMap *map = GetWorld()->GetMap();
+				if(map == nullptr){
+					SPRaise("No map loaded");
 				}
 				
-				std::string msg;
-				msg = _Tr("Client", "Map saved: {0}", name);
-				ShowAlert(msg, AlertType::Notice);
+				// the map is modified by the game while it's being written,
+				// so a copy is written
+				std::string name = MapShotPath();
+				Handle<GameMap> copy(map->Clone(), false);
+				snapshotWriter->SaveMap(copy, name);
 			}catch(const Exception& ex){
 				std::string msg;
 				msg = _Tr("Client", "Saving map failed: ");
@@ -610,10 +596,12 @@ namespace spades {
 			char buf[256];
 			for(int i = 0; i < 10000;i++){
 				sprintf(buf, "Mapshots/shot%04d.vxl", nextScreenShotIndex);
+				// the index is advanced after it's used as well because
+				// the file isn't created until snapshotWriter writes it
+				nextScreenShotIndex++;
+				if(nextScreenShotIndex >= 10000)
+					nextScreenShotIndex = 0;
 				if(FileManager::FileExists(buf)){
-					nextScreenShotIndex++;
-					if(nextScreenShotIndex >= 10000)
-						nextScreenShotIndex = 0;
 					continue;
 				}
 				
@@ -623,6 +611,36 @@ namespace spades {
 			SPRaise("No free file name");
 		}
 		
+		void Client::ReportSnapshots() {
+			if(!snapshotWriter)
+				return;
+			
+			std::vector<SnapshotWriter::Result> results = snapshotWriter->PollResults();
+			for(size_t i = 0; i < results.size(); i++){
+				const SnapshotWriter::Result& result = results[i];
+				const std::string& name = result.fileName;
+				std::string msg;
+				if(result.kind == SnapshotWriter::Kind::MapShot){
+					if(result.error.empty()){
+						msg = _Tr("Client", "Map saved: {0}", name);
+					}else{
+						msg = _Tr("Client", "Saving map failed: ");
+						msg += result.error;
+					}
+				}else{
+					if(!result.error.empty()){
+						msg = _Tr("Client", "Screenshot failed: ");
+						msg += result.error;
+					}else if(result.kind == SnapshotWriter::Kind::SceneShot){
+						msg = _Tr("Client", "Sceneshot saved: {0}", name);
+					}else{
+						msg = _Tr("Client", "Screenshot saved: {0}", name);
+					}
+				}
+				ShowAlert(msg, result.error.empty() ? AlertType::Notice : AlertType::Error);
+			}
+		}
+		
 		
 #pragma mark - Chat Messages
 		
@@ -61,6 +61,7 @@ namespace spades {
 		class ClientPlayer;
 		
 		class ClientUI;
+		class SnapshotWriter;
 		
 		class Client: public IWorldListener, public gui::View {
 			friend class ScoreboardView;
@@ -95,6 +96,45 @@ namespace spades {
 			
 			FPSCounter fpsCounter;
 			
+			/** measures the time spent in each stage of RunFrame.
+			 * averages are updated twice a second, like FPSCounter. */
+			class FrameTimings {
+			public:
+				enum Stage {
+					Network,
+					World,
+					Scene,
+					Audio,
+					DrawScene,
+					Draw2D,
+					UI,
+					Present,
+					NumStages
+				};
+			private:
+				Stopwatch stageStopwatch;
+				Stopwatch reportStopwatch;
+				Stage current;
+				double sums[NumStages];
+				double averages[NumStages];
+				int numFrames;
+			public:
+				FrameTimings();
+				/** ends the current stage and starts the given one.
+				 * a stage can be entered more than once per frame. */
+				void Begin(Stage);
+				void MarkFrame();
+				
+				double GetAverage(Stage stage) { return averages[stage]; }
+				/** network and world update. */
+				double GetSimulationTime();
+				/** building the scene and the HUD, and presenting it. */
+				double GetRenderingTime();
+				static const char *GetStageName(Stage);
+			};
+			
+			FrameTimings frameTimings;
+			
 			std::unique_ptr<NetClient> net;
 			std::string playerName;
 			std::unique_ptr<IStream> logStream;
@@ -225,10 +265,22 @@ namespace spades {
 			unsigned int corpseHardLimit;
 			void RemoveAllCorpses();
 			void RemoveInvisibleCorpses();
+			
+			// with cg_overlapCorpseUpdate, corpses are simulated for
+			// the next frame while the rest of the current frame is
+			// being built. players, grenades and the rest of the world
+			// are still simulated before the scene is built.
+			class CorpseUpdateDispatch;
+			std::unique_ptr<CorpseUpdateDispatch> corpseDispatch;
+			bool overlapCorpseUpdate;
+			float corpseUpdateDt;
+			void StartCorpseUpdate();
+			void JoinCorpseUpdate();
 			void RemoveAllLocalEntities();
 			
 			int nextScreenShotIndex;
 			int nextMapShotIndex;
+			std::unique_ptr<SnapshotWriter> snapshotWriter;
 			
 			Vector3 Project(Vector3);
 			
@@ -282,6 +334,9 @@ namespace spades {
 			std::string MapShotPath();
 			void TakeMapShot();
 			
+			/** shows the results of the snapshots written by snapshotWriter. */
+			void ReportSnapshots();
+			
 			void NetLog(const char *format, ...);
 		protected:
 			virtual ~Client();
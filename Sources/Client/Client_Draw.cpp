@@ -23,6 +23,7 @@
 #include <cstdlib>
 
 #include <Core/ConcurrentDispatch.h>
+#include <Core/FrameProfiler.h>
 #include <Core/Settings.h>
 #include <Core/Strings.h>
 #include <Core/Bitmap.h>
@@ -48,6 +49,7 @@
 #include "IFont.h"
 #include "ScoreboardView.h"
 #include "TCProgressView.h"
+#include "SnapshotWriter.h"
 
 #include "World.h"
 #include "Weapon.h"
@@ -100,23 +102,15 @@ namespace spades {
 			renderer->FrameDone();
 			
 			Handle<Bitmap> bmp(renderer->ReadBitmap(), false);
-			// force 100% opacity
-			
-			uint32_t *pixels = bmp->GetPixels();
-			for(size_t i = bmp->GetWidth() * bmp->GetHeight(); i > 0; i--) {
-				*(pixels++) |= 0xff000000UL;
-			}
 			
+			// encoded and written by the worker thread.
+			// the result is reported by ReportSnapshots.
 			try{
 				std::string name = ScreenShotPath();
-				bmp->Save(name);
-				
-				std::string msg;
-				if(sceneOnly)
-					msg = _Tr("Client", "Sceneshot saved: {0}", name);
-				else
-					msg = _Tr("Client", "Screenshot saved: {0}", name);
-				ShowAlert(msg, AlertType::Notice);
+				snapshotWriter->SaveBitmap(sceneOnly ?
+										   SnapshotWriter::Kind::SceneShot :
+										   SnapshotWriter::Kind::ScreenShot,
+										   bmp, name);
 			}catch(const Exception& ex){
 				std::string msg;
 				msg = _Tr("Client", "Screenshot failed: ");
@@ -140,12 +134,14 @@ namespace spades {
 				sprintf(bufJpeg,  "Screenshots/shot%04d.jpg", nextScreenShotIndex);
 				sprintf(bufTarga, "Screenshots/shot%04d.tga", nextScreenShotIndex);
 				sprintf(bufPng,   "Screenshots/shot%04d.png", nextScreenShotIndex);
+				// the index is advanced after it's used as well because
+				// the file isn't created until snapshotWriter writes it
+				nextScreenShotIndex++;
+				if(nextScreenShotIndex >= 10000)
+					nextScreenShotIndex = 0;
 				if(FileManager::FileExists(bufJpeg) ||
 				   FileManager::FileExists(bufTarga) ||
 				   FileManager::FileExists(bufPng)){
-					nextScreenShotIndex++;
-					if(nextScreenShotIndex >= 10000)
-						nextScreenShotIndex = 0;
 					continue;
 				}
 				
@@ -857,13 +853,45 @@ namespace spades {
 				str += buf;
 			}
 			
+			// time spent in each stage of RunFrame
+			std::string str2;
+			for(int i = 0; i < FrameTimings::NumStages; i++){
+				auto stage = static_cast<FrameTimings::Stage>(i);
+				sprintf(buf, "%s%s: %.1f", i ? ", " : "",
+						FrameTimings::GetStageName(stage),
+						frameTimings.GetAverage(stage) * 1000.);
+				str2 += buf;
+			}
+			{
+				double simTime = frameTimings.GetSimulationTime();
+				double renderTime = frameTimings.GetRenderingTime();
+				sprintf(buf, "ms (%s-bound)",
+						simTime > renderTime ? "simulation" : "rendering");
+				str2 += buf;
+			}
+			
+			// text layouts since the last frame; the texts below are
+			// counted in the next frame
+			{
+				IFont::LayoutCacheStatistics fonts = IFont::GetLayoutCacheStatistics();
+				IFont::ResetLayoutCacheStatistics();
+				sprintf(buf, ", text: %d layouts (%.1f%% cached)",
+						(int)fonts.numLookups,
+						fonts.numLookups ? (double)fonts.numHits * 100. / (double)fonts.numLookups : 0.);
+				str2 += buf;
+			}
+			
 			float scrWidth = renderer->ScreenWidth();
 			float scrHeight = renderer->ScreenHeight();
 			IFont *font = textFont;
 			float margin = 5.f;
 			
 			IRenderer *r = renderer;
-			auto size = font->Measure(str);
+			auto size1 = font->Measure(str);
+			auto size2 = font->Measure(str2);
+			Vector2 size;
+			size.x = std::max(size1.x, size2.x);
+			size.y = size1.y + size2.y;
 			size += Vector2(margin * 2.f, margin * 2.f);
 			
 			auto pos =
@@ -874,10 +902,14 @@ namespace spades {
 			font->DrawShadow(str, pos + Vector2(margin, margin), 1.f,
 							 Vector4(1.f, 1.f, 1.f, 1.f),
 							 Vector4(0.f, 0.f, 0.f, 0.5f));
+			font->DrawShadow(str2, pos + Vector2(margin, margin + size1.y), 1.f,
+							 Vector4(1.f, 1.f, 1.f, 1.f),
+							 Vector4(0.f, 0.f, 0.f, 0.5f));
 		}
 		
 		void Client::Draw2D(){
 			SPADES_MARK_FUNCTION();
+			SPADES_PROFILE_ZONE("Client::Draw2D");
 			
 			if(GetWorld()){
 				Draw2DWithWorld();
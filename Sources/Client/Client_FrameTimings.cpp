@@ -0,0 +1,83 @@
+/*
+ Copyright (c) 2013 yvt
+ based on code of pysnip (c) Mathias Kaerlev 2011-2012.
+ 
+ This file is part of OpenSpades.
+ 
+ OpenSpades is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ 
+ OpenSpades is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with OpenSpades.  If not, see <http://www.gnu.org/licenses/>.
+ 
+ */
+
+#include "Client.h"
+#include <Core/Stopwatch.h>
+
+namespace spades { namespace client {
+
+	Client::FrameTimings::FrameTimings():
+	current(NumStages),
+	numFrames(0){
+		for(int i = 0; i < NumStages; i++){
+			sums[i] = 0.0;
+			averages[i] = 0.0;
+		}
+		reportStopwatch.Reset();
+	}
+	
+	void Client::FrameTimings::Begin(Stage stage) {
+		if(current != NumStages) {
+			sums[current] += stageStopwatch.GetTime();
+		}
+		current = stage;
+		stageStopwatch.Reset();
+	}
+	
+	void Client::FrameTimings::MarkFrame() {
+		Begin(NumStages);
+		numFrames++;
+		if(reportStopwatch.GetTime() > 0.5) {
+			for(int i = 0; i < NumStages; i++){
+				averages[i] = sums[i] / static_cast<double>(numFrames);
+				sums[i] = 0.0;
+			}
+			numFrames = 0;
+			reportStopwatch.Reset();
+		}
+	}
+	
+	double Client::FrameTimings::GetSimulationTime() {
+		return averages[Network] + averages[World];
+	}
+	
+	double Client::FrameTimings::GetRenderingTime() {
+		double t = 0.0;
+		for(int i = Scene; i < NumStages; i++)
+			t += averages[i];
+		return t;
+	}
+	
+	const char *Client::FrameTimings::GetStageName(Stage stage) {
+		switch(stage) {
+			case Network: return "net";
+			case World: return "world";
+			case Scene: return "scene";
+			case Audio: return "audio";
+			case DrawScene: return "3d";
+			case Draw2D: return "2d";
+			case UI: return "ui";
+			case Present: return "present";
+			default: return "";
+		}
+	}
+	
+} }
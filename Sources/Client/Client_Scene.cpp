@@ -23,6 +23,7 @@
 #include <cstdlib>
 
 #include <Core/ConcurrentDispatch.h>
+#include <Core/FrameProfiler.h>
 #include <Core/Settings.h>
 #include <Core/Strings.h>
 
@@ -510,6 +511,7 @@ namespace spades {
 		
 		void Client::DrawScene(){
 			SPADES_MARK_FUNCTION();
+			SPADES_PROFILE_ZONE("Client::DrawScene");
 			
 			renderer->StartScene(lastSceneDef);
 			
@@ -535,6 +537,10 @@ namespace spades {
 					}
 				}
 				
+				// corpses are not accessed until the end of the frame
+				if(overlapCorpseUpdate)
+					StartCorpseUpdate();
+				
 				if( IGameMode::m_CTF == world->GetMode()->ModeType() ){
 					DrawCTFObjects();
 				} else if( IGameMode::m_TC == world->GetMode()->ModeType() ){
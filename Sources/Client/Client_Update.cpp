@@ -23,6 +23,7 @@
 #include <cstdlib>
 
 #include <Core/ConcurrentDispatch.h>
+#include <Core/FrameProfiler.h>
 #include <Core/Settings.h>
 #include <Core/Strings.h>
 
@@ -133,6 +134,7 @@ namespace spades {
 		
 		void Client::UpdateWorld(float dt) {
 			SPADES_MARK_FUNCTION();
+			SPADES_PROFILE_ZONE("Client::UpdateWorld");
 			
 			Player* player = world->GetLocalPlayer();
 			
@@ -178,23 +180,12 @@ namespace spades {
 				}
 			}
 			
-			// corpse never accesses audio nor renderer, so
-			// we can do it in the separate thread
-			class CorpseUpdateDispatch: public ConcurrentDispatch{
-				Client *client;
-				float dt;
-			public:
-				CorpseUpdateDispatch(Client *c, float dt):
-				client(c), dt(dt){}
-				virtual void Run(){
-					for(auto& c: client->corpses){
-						for(int i = 0; i < 4; i++)
-							c->Update(dt / 4.f);
-					}
-				}
-			};
-			CorpseUpdateDispatch corpseDispatch(this, dt);
-			corpseDispatch.Start();
+			// corpses are updated in the separate thread.
+			// with cg_overlapCorpseUpdate, it's started by DrawScene after
+			// the corpses are added to the scene.
+			corpseUpdateDt = dt;
+			if(!overlapCorpseUpdate)
+				StartCorpseUpdate();
 			
 			// local entities should be done in the client thread
 			{
@@ -209,7 +200,8 @@ namespace spades {
 				}
 			}
 			
-			corpseDispatch.Join();
+			if(!overlapCorpseUpdate)
+				JoinCorpseUpdate();
 			
 			if(grenadeVibration > 0.f){
 				grenadeVibration -= dt;
@@ -28,6 +28,7 @@
 #include <Core/Debug.h>
 #include <Core/FileManager.h>
 #include <algorithm>
+#include <cstring>
 #include <Core/AutoLocker.h>
 
 namespace spades {
@@ -51,6 +52,19 @@ namespace spades {
 					}
 				}
 		}
+		GameMap::GameMap(const GameMap& other):
+		listener(NULL){
+			SPADES_MARK_FUNCTION();
+			
+			std::memcpy(solidMap, other.solidMap, sizeof(solidMap));
+			std::memcpy(colorMap, other.colorMap, sizeof(colorMap));
+		}
+		
+		GameMap *GameMap::Clone() {
+			SPADES_MARK_FUNCTION();
+			return new GameMap(*this);
+		}
+		
 		GameMap::~GameMap(){
 			SPADES_MARK_FUNCTION();
 			
@@ -30,11 +30,16 @@
 #include <list>
 #include <Core/Mutex.h>
 #include <Core/AutoLocker.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
 
 namespace spades{
 	class IStream;
 	namespace client {
 		class GameMap: public RefCountedObject {
+			GameMap(const GameMap&);
+			void operator =(const GameMap&) = delete;
 		protected:
 			~GameMap();
 		public:
@@ -48,6 +53,9 @@ namespace spades{
 			
 			static GameMap *Load(IStream *);
 			
+			/** @return a copy of the voxels, without listeners. */
+			GameMap *Clone();
+			
 			void Save(IStream *);
 			
 			int Width() { return DefaultWidth; }
@@ -68,6 +76,33 @@ namespace spades{
 				return colorMap[x][y][z];
 			}
 			
+			/** @return z of the topmost solid voxel of the column,
+			 * or Depth() if the column is empty. */
+			inline int GetTopmostSolid(int x, int y) {
+				SPAssert(x >= 0); SPAssert(x < Width());
+				SPAssert(y >= 0); SPAssert(y < Height());
+				uint64_t bits = solidMap[x][y];
+				if(bits == 0)
+					return Depth();
+				// z = 0 is the top, so this finds the lowest set bit
+#if defined(__GNUC__)
+				return __builtin_ctzll(bits);
+#elif defined(_MSC_VER)
+				unsigned long idx;
+				if(_BitScanForward(&idx, static_cast<uint32_t>(bits)))
+					return static_cast<int>(idx);
+				_BitScanForward(&idx, static_cast<uint32_t>(bits >> 32));
+				return static_cast<int>(idx) + 32;
+#else
+				int z = 0;
+				while(!(bits & 1)) {
+					bits >>= 1;
+					z++;
+				}
+				return z;
+#endif
+			}
+			
 			inline uint64_t GetSolidMapWrapped(int x, int y) {
 				return solidMap[x & (Width() - 1)][y & (Height() - 1)];
 			}
@@ -102,7 +102,7 @@ namespace spades {
 				}
 			}
 			
-			SPLog("%.3f msecs to rebuild",
+			SPLogDebug("%.3f msecs to rebuild",
 				   stopwatch.GetTime() * 1000.);
 			
 		}
@@ -26,8 +26,11 @@
 #include <memory>
 #include <cstring>
 #include <Core/Exception.h>
+#include <Core/Settings.h>
 #include <Draw/SWRenderer.h> // FIXME: better way to check linear interpolation is performed
 
+SPADES_SETTING(cg_fontLayoutCache, "1");
+
 namespace spades {
 	namespace client{
 		
@@ -68,6 +71,9 @@ namespace spades {
 					  Vector2 offset, float size,
 					  Vector4 color);
 			float Measure(uint32_t unicode, float size);
+			float Layout(uint32_t unicode,
+						 Vector2 offset, float size,
+						 IFont::TextLayout&);
 			
 		};
 		
@@ -215,6 +221,20 @@ namespace spades {
 		void FallbackFontRenderer::Draw(uint32_t unicode, spades::Vector2 offset,
 										float size, spades::Vector4 color) {
 			renderer->SetColorAlphaPremultiplied(color);
+			
+			IFont::TextLayout layout;
+			Layout(unicode, offset, size, layout);
+			
+			size_t quad = 0;
+			for(size_t i = 0; i < layout.runs.size(); i++) {
+				const IFont::TextLayout::Run& run = layout.runs[i];
+				renderer->DrawImages(run.image, layout.quads.data() + quad, run.numQuads);
+				quad += run.numQuads;
+			}
+		}
+		
+		float FallbackFontRenderer::Layout(uint32_t unicode, spades::Vector2 offset,
+										   float size, IFont::TextLayout& layout) {
 			float x = offset.x;
 			float y = offset.y;
 			
@@ -222,16 +242,12 @@ namespace spades {
 			if(glyph.img == nullptr) {
 				// no glyph found! draw box in the last resort
 				IImage *img = whiteImage;
-				renderer->DrawImage(img, AABB2(x, y, size, 1.f));
-				renderer->DrawImage(img, AABB2(x, y + size - 1.f, size, 1.f));
-				renderer->DrawImage(img, AABB2(x, y + 1.f, 1.f, size - 2.f));
-				renderer->DrawImage(img, AABB2(x + size - 1.f, y + 1.f, 1.f, size - 2.f));
-				return;
-			}
-			
-			if(glyph.w == 0) {
-				// null glyph.
-				return;
+				AABB2 inRect(0, 0, img->GetWidth(), img->GetHeight());
+				layout.AddQuad(img, AABB2(x, y, size, 1.f), inRect);
+				layout.AddQuad(img, AABB2(x, y + size - 1.f, size, 1.f), inRect);
+				layout.AddQuad(img, AABB2(x, y + 1.f, 1.f, size - 2.f), inRect);
+				layout.AddQuad(img, AABB2(x + size - 1.f, y + 1.f, 1.f, size - 2.f), inRect);
+				return size + 1.f;
 			}
 			
 			float scale = size * glyph.sizeInverse;
@@ -242,6 +258,11 @@ namespace spades {
 				scale = newScale;
 			}
 			
+			if(glyph.w == 0) {
+				// null glyph.
+				return glyph.advance * scale;
+			}
+			
 			AABB2 inRect(glyph.x, glyph.y, glyph.w, glyph.h);
 			AABB2 outRect(glyph.offX, glyph.offY, glyph.w, glyph.h);
 			
@@ -264,7 +285,8 @@ namespace spades {
 			outRect.min += offset;
 			outRect.max += offset;
 			
-			renderer->DrawImage(glyph.img, outRect, inRect);
+			layout.AddQuad(glyph.img, outRect, inRect);
+			return glyph.advance * scale;
 		}
 		
 		float FallbackFontRenderer::Measure(uint32_t unicode, float size) {
@@ -282,7 +304,38 @@ namespace spades {
 			return glyph.advance * scale;
 		}
 		
-		IFont::IFont(IRenderer *r) {
+		enum {
+			/** the layout cache of a font is flushed when it grows beyond this. */
+			MaxCachedLayouts = 512
+		};
+		
+		static IFont::LayoutCacheStatistics layoutCacheStats;
+		
+		void IFont::TextLayout::AddQuad(IImage *image,
+										const AABB2& outRect,
+										const AABB2& inRect) {
+			ImageQuad quad;
+			quad.outRect = outRect;
+			quad.inRect = inRect;
+			quads.push_back(quad);
+			
+			if(runs.empty() || runs.back().image != image) {
+				Run run;
+				run.image = image;
+				run.numQuads = 0;
+				runs.push_back(run);
+			}
+			runs.back().numQuads++;
+		}
+		
+		void IFont::TextLayout::Clear() {
+			quads.clear();
+			runs.clear();
+			size = MakeVector2(0.f, 0.f);
+		}
+		
+		IFont::IFont(IRenderer *r):
+		renderer(r), numCachedLayouts(0) {
 			fallback.Set(FallbackFontManager::GetInstance()->CreateRenderer(r), false);
 		}
 		
@@ -291,6 +344,95 @@ namespace spades {
 			//---
 		}
 		
+		const IFont::TextLayout& IFont::GetLayout(const std::string& text, float scale) {
+			SPADES_MARK_FUNCTION_DEBUG();
+			
+			layoutCacheStats.numLookups++;
+			
+			if(!cg_fontLayoutCache) {
+				scratchLayout.Clear();
+				Layout(text, scale, scratchLayout);
+				return scratchLayout;
+			}
+			
+			LayoutCache *cache = NULL;
+			for(size_t i = 0; i < layoutCaches.size(); i++) {
+				if(layoutCaches[i].scale == scale) {
+					cache = &layoutCaches[i];
+					break;
+				}
+			}
+			
+			if(cache) {
+				auto it = cache->layouts.find(text);
+				if(it != cache->layouts.end()) {
+					layoutCacheStats.numHits++;
+					return it->second;
+				}
+			}
+			
+			if(numCachedLayouts >= MaxCachedLayouts) {
+				// texts with changing contents (timers, for example)
+				// fill the cache, so it's flushed entirely
+				InvalidateLayouts();
+				layoutCacheStats.numFlushes++;
+				cache = NULL;
+			}
+			if(!cache) {
+				layoutCaches.emplace_back();
+				cache = &layoutCaches.back();
+				cache->scale = scale;
+			}
+			
+			TextLayout& layout = cache->layouts[text];
+			try{
+				Layout(text, scale, layout);
+			}catch(...){
+				cache->layouts.erase(text);
+				throw;
+			}
+			numCachedLayouts++;
+			return layout;
+		}
+		
+		void IFont::InvalidateLayouts() {
+			layoutCaches.clear();
+			numCachedLayouts = 0;
+		}
+		
+		void IFont::DrawLayout(const TextLayout& layout,
+							   spades::Vector2 offset,
+							   spades::Vector4 color) {
+			SPADES_MARK_FUNCTION_DEBUG();
+			
+			renderer->SetColorAlphaPremultiplied(color);
+			
+			// the layout is shared by every position the text is drawn at
+			drawQuads.resize(layout.quads.size());
+			for(size_t i = 0; i < drawQuads.size(); i++) {
+				const ImageQuad& q = layout.quads[i];
+				drawQuads[i].outRect = AABB2(q.outRect.min + offset, q.outRect.max + offset);
+				drawQuads[i].inRect = q.inRect;
+			}
+			
+			size_t quad = 0;
+			for(size_t i = 0; i < layout.runs.size(); i++) {
+				const TextLayout::Run& run = layout.runs[i];
+				renderer->DrawImages(run.image, drawQuads.data() + quad, run.numQuads);
+				quad += run.numQuads;
+			}
+		}
+		
+		IFont::LayoutCacheStatistics IFont::GetLayoutCacheStatistics() {
+			return layoutCacheStats;
+		}
+		
+		void IFont::ResetLayoutCacheStatistics() {
+			layoutCacheStats.numLookups = 0;
+			layoutCacheStats.numHits = 0;
+			layoutCacheStats.numFlushes = 0;
+		}
+		
 		float IFont::MeasureFallback(uint32_t unicodeCodePoint, float size) {
 			return fallback->Measure(unicodeCodePoint, size);
 		}
@@ -302,6 +444,13 @@ namespace spades {
 			fallback->Draw(unicodeCodePoint, offset, size, color);
 		}
 		
+		float IFont::LayoutFallback(uint32_t unicodeCodePoint,
+									spades::Vector2 offset,
+									float size,
+									TextLayout& layout) {
+			return fallback->Layout(unicodeCodePoint, offset, size, layout);
+		}
+		
 		void IFont::DrawShadow( const std::string& message, const Vector2& offset, float scale, const Vector4& color, const Vector4& shadowColor )
 		{
 			Draw( message, offset + MakeVector2(1,1), scale, shadowColor );
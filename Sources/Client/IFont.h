@@ -22,13 +22,54 @@
 
 #include <Core/Math.h>
 #include <Core/RefCountedObject.h>
+#include "IRenderer.h"
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <stdint.h>
 
 namespace spades {
 	namespace client{
 		class FallbackFontRenderer;
-		class IRenderer;
 		class IFont: public RefCountedObject {
+		public:
+			struct LayoutCacheStatistics {
+				uint64_t numLookups;
+				uint64_t numHits;
+				uint64_t numFlushes;
+			};
+			
+			/** Glyphs of a text laid out at a specific scale.
+			 * Quads are relative to the drawing origin and are
+			 * grouped into runs that share the same image. */
+			struct TextLayout {
+				struct Run {
+					IImage *image;
+					size_t numQuads;
+				};
+				std::vector<ImageQuad> quads;
+				std::vector<Run> runs;
+				/** extents, not multiplied by the scale. */
+				Vector2 size;
+				
+				void AddQuad(IImage *, const AABB2& outRect, const AABB2& inRect);
+				void Clear();
+			};
+			
+		private:
+			IRenderer *renderer;
 			Handle<FallbackFontRenderer> fallback;
+			
+			/** cached layouts, by scale and then by text. */
+			struct LayoutCache {
+				float scale;
+				std::unordered_map<std::string, TextLayout> layouts;
+			};
+			std::vector<LayoutCache> layoutCaches;
+			size_t numCachedLayouts;
+			TextLayout scratchLayout;
+			std::vector<ImageQuad> drawQuads;
+			
 		protected:
 			virtual ~IFont();
 			
@@ -38,6 +79,26 @@ namespace spades {
 			 * @param color Premultiplied alpha color value. */
 			void DrawFallback(uint32_t unicodeCodePoint, Vector2 offset, float size, Vector4 color);
 			
+			/** Adds the quads of a unicode character drawn with fallback fonts.
+			 * @return Advance of the character. */
+			float LayoutFallback(uint32_t unicodeCodePoint, Vector2 offset, float size,
+								 TextLayout&);
+			
+			/** Lays out a text. Called when the layout is not cached. */
+			virtual void Layout(const std::string&, float scale, TextLayout&) = 0;
+			
+			/** Returns the cached layout of a text, laying it out if needed.
+			 * The returned reference is valid until the next call. */
+			const TextLayout& GetLayout(const std::string&, float scale);
+			
+			/** Discards the cached layouts. Must be called when
+			 * the metrics of the font are changed. */
+			void InvalidateLayouts();
+			
+			/** Submits the quads of a layout.
+			 * @param color Premultiplied alpha color value. */
+			void DrawLayout(const TextLayout&, Vector2 offset, Vector4 color);
+			
 		public:
 			IFont(IRenderer *);
 			virtual Vector2 Measure(const std::string&) = 0;
@@ -46,6 +107,10 @@ namespace spades {
 			 * @param color Non-premultiplied alpha color value. */
 			virtual void Draw(const std::string&, Vector2 offset, float scale, Vector4 color) = 0;
 			void DrawShadow( const std::string& message, const Vector2& offset, float scale, const Vector4& color, const Vector4& shadowColor );
+			
+			/** Statistics of the layout caches of all fonts. */
+			static LayoutCacheStatistics GetLayoutCacheStatistics();
+			static void ResetLayoutCacheStatistics();
 		};
 	}
 }
\ No newline at end of file
@@ -71,6 +71,12 @@ namespace spades {
 			}
 		};
 		
+		/** A part of an image drawn by IRenderer::DrawImages. */
+		struct ImageQuad {
+			AABB2 outRect;
+			AABB2 inRect;
+		};
+		
 		class IRenderer: public RefCountedObject {
 		protected:
 			virtual ~IRenderer(){}
@@ -87,6 +93,12 @@ namespace spades {
 			virtual IImage *CreateImage(Bitmap *) = 0;
 			virtual IModel *CreateModel(VoxelModel *) = 0;
 			
+			/** Registers an asset that was loaded in advance, so that
+			 * RegisterImage/RegisterModel with the same name don't load
+			 * it again. Does nothing if the name is already registered. */
+			virtual void RegisterPreloadedImage(const char *filename, Bitmap *) = 0;
+			virtual void RegisterPreloadedModel(const char *filename, VoxelModel *) = 0;
+			
 			virtual void SetGameMap(GameMap *) = 0;
 			
 			virtual void SetFogDistance(float) = 0;
@@ -123,6 +135,11 @@ namespace spades {
 			virtual void DrawImage(IImage *, const AABB2& outRect, const AABB2& inRect) = 0;
 			virtual void DrawImage(IImage *, const Vector2& outTopLeft, const Vector2& outTopRight, const Vector2& outBottomLeft, const AABB2& inRect) = 0;
 			
+			/** Draws parts of an image with the current color.
+			 * Same as calling DrawImage(IImage *, const AABB2&, const AABB2&)
+			 * for every quad, but the image is resolved only once. */
+			virtual void DrawImages(IImage *, const ImageQuad *, size_t numQuads) = 0;
+			
 			virtual void DrawFlatGameMap(const AABB2& outRect, const AABB2& inRect) = 0;
 			
 			/** Finalizes a frame. */
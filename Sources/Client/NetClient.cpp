@@ -26,6 +26,7 @@
 #include "NetClient.h"
 #include <Core/Debug.h>
 #include <Core/Exception.h>
+#include <Core/FrameProfiler.h>
 #include <Core/Debug.h>
 #include <Core/Math.h>
 #include "World.h"
@@ -139,7 +140,7 @@ namespace spades {
 				return (PacketType)data[0];
 			}
 			uint32_t ReadInt() {
-				SPADES_MARK_FUNCTION();
+				SPADES_MARK_FUNCTION_DEBUG();
 				
 				uint32_t value = 0;
 				if(pos + 4 > data.size()){
@@ -152,7 +153,7 @@ namespace spades {
 				return value;
 			}
 			uint16_t ReadShort() {
-				SPADES_MARK_FUNCTION();
+				SPADES_MARK_FUNCTION_DEBUG();
 				
 				uint32_t value = 0;
 				if(pos + 2 > data.size()){
@@ -163,7 +164,7 @@ namespace spades {
 				return (uint16_t)value;
 			}
 			uint8_t ReadByte() {
-				SPADES_MARK_FUNCTION();
+				SPADES_MARK_FUNCTION_DEBUG();
 				
 				if(pos >= data.size()){
 					SPRaise("Received packet truncated");
@@ -171,7 +172,7 @@ namespace spades {
 				return (uint8_t)data[pos++];
 			}
 			float ReadFloat() {
-				SPADES_MARK_FUNCTION();
+				SPADES_MARK_FUNCTION_DEBUG();
 				union {
 					float f;
 					uint32_t v;
@@ -181,7 +182,7 @@ namespace spades {
 			}
 			
 			IntVector3 ReadIntColor() {
-				SPADES_MARK_FUNCTION();
+				SPADES_MARK_FUNCTION_DEBUG();
 				IntVector3 col;
 				col.z = ReadByte();
 				col.y = ReadByte();
@@ -190,7 +191,7 @@ namespace spades {
 			}
 			
 			Vector3 ReadFloatColor() {
-				SPADES_MARK_FUNCTION();
+				SPADES_MARK_FUNCTION_DEBUG();
 				Vector3 col;
 				col.z = ReadByte() / 255.f;
 				col.y = ReadByte() / 255.f;
@@ -450,6 +451,7 @@ namespace spades {
 		
 		void NetClient::DoEvents(int timeout) {
 			SPADES_MARK_FUNCTION();
+			SPADES_PROFILE_ZONE("NetClient::DoEvents");
 			
 			if(status == NetClientStatusNotConnected)
 				return;
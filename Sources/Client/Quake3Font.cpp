@@ -74,12 +74,15 @@ namespace spades {
 		void Quake3Font::SetGlyphYRange(float yMin, float yMax) {
 			this->yMin = yMin;
 			this->yMax = yMax;
+			InvalidateLayouts();
 		}
 		
-		Vector2 Quake3Font::Measure(const std::string &txt) {
+		void Quake3Font::Layout(const std::string &txt, float scale, TextLayout& layout) {
 			SPADES_MARK_FUNCTION();
 			
-			float x = 0.f, w = 0.f, h = (float)glyphHeight;
+			float x = 0.f, y = 0.f, w = 0.f, h = (float)glyphHeight;
+			float invScale = 1.f / scale;
+			
 			for(size_t i = 0; i < txt.size();){
 				size_t chrLen = 0;
 				uint32_t ch = GetCodePointFromUTF8String(txt, i, &chrLen);
@@ -89,10 +92,10 @@ namespace spades {
 					goto fallback;
 				}
 				
-				
 				if(ch == 13 || ch == 10){
 					// new line
 					x = 0.f;
+					y += (float)glyphHeight;
 					h += (float)glyphHeight;
 					continue;
 				}
@@ -105,6 +108,8 @@ namespace spades {
 					else if(info.type == Space){
 						x += spaceWidth;
 					}else if(info.type == Image ) {
+						AABB2 rt(x * scale, y * scale, info.imageRect.GetWidth() * scale, info.imageRect.GetHeight() * scale);
+						layout.AddQuad(tex, rt, info.imageRect);
 						x += info.advance;
 					}
 					
@@ -112,19 +117,26 @@ namespace spades {
 						w = x;
 					}
 				}
-					
 				continue;
 			fallback:
-				x += MeasureFallback(ch, yMax - yMin);
+				x += LayoutFallback(ch, MakeVector2(x, y + yMin) * scale,
+									(yMax - yMin) * scale, layout) * invScale;
 				if(x > w){
 					w = x;
 				}
 			}
-			return MakeVector2(w, h);
+			layout.size = MakeVector2(w, h);
+		}
+		
+		Vector2 Quake3Font::Measure(const std::string &txt) {
+			SPADES_MARK_FUNCTION();
+			
+			// the layout is usually drawn at the same scale next
+			return GetLayout(txt, 1.f).size;
 		}
 		
 		void Quake3Font::Draw(const std::string &txt, spades::Vector2 offset, float scale, spades::Vector4 color) {
-			float x = 0.f, y = 0;
+			SPADES_MARK_FUNCTION();
 			
 			if(scale == 1.f){
 				offset.x = floorf(offset.x);
@@ -134,45 +146,8 @@ namespace spades {
 			float a = color.w;
 			color.w = 1.f;
 			color *= a;
-			renderer->SetColorAlphaPremultiplied(color);
-			
-			float invScale = 1.f / scale;
 			
-			for(size_t i = 0; i < txt.size();){
-				size_t chrLen = 0;
-				uint32_t ch = GetCodePointFromUTF8String(txt, i, &chrLen);
-				SPAssert(chrLen > 0);
-				i += chrLen;
-				if(ch >= static_cast<uint32_t>(glyphs.size())) {
-					goto fallback;
-				}
-				
-				if(ch == 13 || ch == 10){
-					// new line
-					x = 0.f;
-					y += (float)glyphHeight;
-					continue;
-				}
-				
-				{
-					const GlyphInfo& info = glyphs[ch];
-					
-					if(info.type == Invalid)
-						goto fallback;
-					else if(info.type == Space){
-						x += spaceWidth;
-					}else if(info.type == Image ) {
-						AABB2 rt(x * scale + offset.x, y * scale + offset.y, info.imageRect.GetWidth() * scale, info.imageRect.GetHeight() * scale);
-						renderer->DrawImage(tex, rt, info.imageRect);
-						x += info.advance;
-					}
-				}
-				continue;
-			fallback:
-				DrawFallback(ch, MakeVector2(x, y + yMin) * scale + offset,
-							 (yMax - yMin) * scale, color);
-				x += MeasureFallback(ch, (yMax - yMin) * scale) * invScale;
-			}
+			DrawLayout(GetLayout(txt, scale), offset, color);
 		}
 	}
 }
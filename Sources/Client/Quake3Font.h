@@ -49,6 +49,8 @@ namespace spades {
 			float yMin, yMax;
 		protected:
 			virtual ~Quake3Font();
+			
+			virtual void Layout(const std::string&, float scale, TextLayout&);
 		public:
 			Quake3Font(IRenderer *,
 					   IImage *texture,
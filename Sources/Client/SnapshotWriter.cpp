@@ -0,0 +1,154 @@
+/*
+ Copyright (c) 2013 yvt
+ 
+ This file is part of OpenSpades.
+ 
+ OpenSpades is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ 
+ OpenSpades is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with OpenSpades.  If not, see <http://www.gnu.org/licenses/>.
+ 
+ */
+
+#include "SnapshotWriter.h"
+#include "GameMap.h"
+#include <Core/Bitmap.h>
+#include <Core/ConcurrentDispatch.h>
+#include <Core/Debug.h>
+#include <Core/Exception.h>
+#include <Core/FileManager.h>
+#include <Core/IStream.h>
+#include <Core/Stopwatch.h>
+#include <memory>
+
+namespace spades {
+	namespace client {
+		
+		SnapshotWriter::SnapshotWriter():
+		working(false) {
+			SPADES_MARK_FUNCTION();
+		}
+		
+		SnapshotWriter::~SnapshotWriter() {
+			SPADES_MARK_FUNCTION();
+			Wait();
+		}
+		
+		void SnapshotWriter::SaveBitmap(Kind kind, Bitmap *bmp,
+										const std::string &fileName) {
+			SPADES_MARK_FUNCTION();
+			SPAssert(kind != Kind::MapShot);
+			
+			Job job;
+			job.kind = kind;
+			job.fileName = fileName;
+			job.bitmap.Set(bmp, true);
+			Enqueue(job);
+		}
+		
+		void SnapshotWriter::SaveMap(GameMap *map, const std::string &fileName) {
+			SPADES_MARK_FUNCTION();
+			
+			Job job;
+			job.kind = Kind::MapShot;
+			job.fileName = fileName;
+			job.map.Set(map, true);
+			Enqueue(job);
+		}
+		
+		void SnapshotWriter::Enqueue(Job& job) {
+			SPADES_MARK_FUNCTION();
+			
+			std::lock_guard<std::mutex> lock(mutex);
+			jobs.push_back(job);
+			if(working)
+				return;
+			
+			// the worker thread exits when the queue becomes empty
+			working = true;
+			auto f = [this]() {
+				Work();
+			};
+			ConcurrentDispatch *disp = new FunctionDispatch<decltype(f)>(f);
+			disp->Start();
+			disp->Release();
+		}
+		
+		void SnapshotWriter::Work() {
+			SPADES_MARK_FUNCTION();
+			
+			std::unique_lock<std::mutex> lock(mutex);
+			while(!jobs.empty()) {
+				Job job = jobs.front();
+				jobs.pop_front();
+				lock.unlock();
+				
+				Result result;
+				Process(job, result);
+				
+				// release the snapshot before the result is reported
+				job.bitmap.Set(NULL);
+				job.map.Set(NULL);
+				
+				lock.lock();
+				results.push_back(result);
+			}
+			
+			// `this` may be destroyed as soon as the lock is released
+			working = false;
+			idleCond.notify_all();
+		}
+		
+		void SnapshotWriter::Process(Job& job, Result& result) {
+			SPADES_MARK_FUNCTION();
+			
+			result.kind = job.kind;
+			result.fileName = job.fileName;
+			
+			Stopwatch sw;
+			try{
+				if(job.bitmap) {
+					// force 100% opacity
+					uint32_t *pixels = job.bitmap->GetPixels();
+					for(size_t i = job.bitmap->GetWidth() * job.bitmap->GetHeight(); i > 0; i--) {
+						*(pixels++) |= 0xff000000UL;
+					}
+					
+					job.bitmap->Save(job.fileName);
+				}else{
+					std::unique_ptr<IStream> stream(FileManager::OpenForWriting(job.fileName.c_str()));
+					job.map->Save(stream.get());
+				}
+			}catch(const Exception& ex){
+				result.error = ex.GetShortMessage();
+				SPLog("Writing %s failed: %s", job.fileName.c_str(), ex.what());
+			}catch(const std::exception& ex){
+				result.error = ex.what();
+				SPLog("Writing %s failed: %s", job.fileName.c_str(), ex.what());
+			}
+			result.time = sw.GetTime();
+		}
+		
+		std::vector<SnapshotWriter::Result> SnapshotWriter::PollResults() {
+			std::vector<Result> ret;
+			std::lock_guard<std::mutex> lock(mutex);
+			ret.swap(results);
+			return ret;
+		}
+		
+		void SnapshotWriter::Wait() {
+			SPADES_MARK_FUNCTION();
+			
+			std::unique_lock<std::mutex> lock(mutex);
+			idleCond.wait(lock, [this] { return !working; });
+		}
+	}
+}
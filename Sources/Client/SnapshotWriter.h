@@ -0,0 +1,90 @@
+/*
+ Copyright (c) 2013 yvt
+ 
+ This file is part of OpenSpades.
+ 
+ OpenSpades is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ 
+ OpenSpades is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with OpenSpades.  If not, see <http://www.gnu.org/licenses/>.
+ 
+ */
+
+#pragma once
+
+#include <Core/RefCountedObject.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+
+namespace spades {
+	class Bitmap;
+	namespace client {
+		class GameMap;
+		
+		/** Encodes and writes screenshots and mapshots on a worker
+		 * thread so that taking them doesn't stall the game.
+		 * The caller passes a snapshot that is never modified again
+		 * (the read back bitmap or a clone of the map), and polls the
+		 * results to report them. */
+		class SnapshotWriter {
+		public:
+			enum class Kind {
+				ScreenShot,
+				SceneShot,
+				MapShot
+			};
+			
+			struct Result {
+				Kind kind;
+				std::string fileName;
+				/** empty if the file was written. */
+				std::string error;
+				/** time taken to encode and write, in seconds. */
+				double time;
+			};
+		
+		private:
+			struct Job {
+				Kind kind;
+				std::string fileName;
+				Handle<Bitmap> bitmap;
+				Handle<GameMap> map;
+			};
+			
+			std::mutex mutex;
+			std::condition_variable idleCond;
+			std::deque<Job> jobs;
+			std::vector<Result> results;
+			/** true while the worker thread is running. */
+			bool working;
+			
+			void Enqueue(Job&);
+			void Work();
+			static void Process(Job&, Result&);
+		
+		public:
+			SnapshotWriter();
+			/** waits for the queued snapshots to be written. */
+			~SnapshotWriter();
+			
+			void SaveBitmap(Kind, Bitmap *, const std::string& fileName);
+			void SaveMap(GameMap *, const std::string& fileName);
+			
+			/** @return results of the snapshots written since the last call. */
+			std::vector<Result> PollResults();
+			
+			void Wait();
+		};
+	}
+}
@@ -24,6 +24,7 @@
 #include "GameMapWrapper.h"
 #include "../Core/IStream.h"
 #include "../Core/FileManager.h"
+#include "../Core/FrameProfiler.h"
 #include "../Core/Debug.h"
 #include "Player.h"
 #include "Weapon.h"
@@ -82,6 +83,7 @@ namespace spades {
 		
 		void World::Advance(float dt) {
 			SPADES_MARK_FUNCTION();
+			SPADES_PROFILE_ZONE("World::Advance");
 			
 			ApplyBlockActions();
 			
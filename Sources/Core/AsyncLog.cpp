@@ -0,0 +1,479 @@
+/*
+ Copyright (c) 2013 yvt
+ 
+ This file is part of OpenSpades.
+ 
+ OpenSpades is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ 
+ OpenSpades is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with OpenSpades.  If not, see <http://www.gnu.org/licenses/>.
+ 
+ */
+
+#include "AsyncLog.h"
+#include "IStream.h"
+#include "Math.h"
+#include "Thread.h"
+#include "ThreadLocalStorage.h"
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <vector>
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+
+namespace spades {
+	
+	enum {
+		/** size of the ring buffer of each thread. must be a power of two. */
+		RingSize = 256 * 1024,
+		/** the writer is woken up early when a ring is filled beyond this. */
+		WakeThreshold = RingSize / 2,
+		/** interval of the writer thread in milliseconds. */
+		WriterInterval = 20,
+		RecordAlignment = 8
+	};
+	
+	namespace {
+		struct Record {
+			/** size of the record including the text and the padding. */
+			uint32_t size;
+			/** zero for the padding at the end of the ring. */
+			uint8_t format;
+			uint8_t level;
+			uint16_t reserved;
+			uint32_t length;
+			int32_t line;
+			uint64_t sequence;
+			/** microseconds since the epoch. */
+			int64_t time;
+			const char *file;
+			IStream *stream;
+			
+			const char *GetText() const {
+				return reinterpret_cast<const char *>(this + 1);
+			}
+		};
+		
+		static_assert(sizeof(Record) % RecordAlignment == 0,
+					  "Record must be aligned");
+		
+		/** single-producer single-consumer ring buffer.
+		 * Positions increase monotonically and are wrapped on access. */
+		class LogRing {
+			std::unique_ptr<char[]> data;
+			std::atomic<size_t> head;
+			std::atomic<size_t> tail;
+			
+			Record *RecordAt(size_t pos) {
+				return reinterpret_cast<Record *>(data.get() + (pos & (RingSize - 1)));
+			}
+			
+		public:
+			/** set when the owner thread exits. */
+			std::atomic<bool> abandoned;
+			
+			LogRing():
+			data(new char[RingSize]), head(0), tail(0), abandoned(false) {}
+			
+			/** called by the owner thread.
+			 * @return false if the ring is full. */
+			bool Push(const Record& header, const char *text, size_t length,
+					  bool& wake) {
+				size_t size = (sizeof(Record) + length + RecordAlignment - 1) &
+				~(size_t)(RecordAlignment - 1);
+				size_t h = head.load(std::memory_order_relaxed);
+				size_t t = tail.load(std::memory_order_acquire);
+				
+				// records are contiguous; the rest of the ring is skipped
+				// when the record doesn't fit before the end
+				size_t remaining = RingSize - (h & (RingSize - 1));
+				size_t needed = size + (remaining < size ? remaining : 0);
+				if(RingSize - (h - t) < needed)
+					return false;
+				
+				if(remaining < size) {
+					Record *padding = RecordAt(h);
+					padding->size = static_cast<uint32_t>(remaining);
+					padding->format = 0;
+					h += remaining;
+				}
+				
+				Record *rec = RecordAt(h);
+				*rec = header;
+				rec->size = static_cast<uint32_t>(size);
+				rec->length = static_cast<uint32_t>(length);
+				memcpy(rec + 1, text, length);
+				head.store(h + size, std::memory_order_release);
+				
+				wake = (h + size - t) > WakeThreshold;
+				return true;
+			}
+			
+			/** called by the writer. The records stay valid
+			 * until Release is called with the returned position. */
+			template<typename F>
+			size_t Peek(F f) {
+				size_t t = tail.load(std::memory_order_relaxed);
+				size_t h = head.load(std::memory_order_acquire);
+				while(t != h) {
+					const Record *rec = RecordAt(t);
+					if(rec->format != 0)
+						f(*rec);
+					t += rec->size;
+				}
+				return t;
+			}
+			
+			void Release(size_t pos) {
+				tail.store(pos, std::memory_order_release);
+			}
+			
+			bool IsEmpty() {
+				return head.load(std::memory_order_acquire) ==
+				tail.load(std::memory_order_relaxed);
+			}
+		};
+		
+		class LogRingStorage: public ThreadLocalStorage<LogRing> {
+		public:
+			LogRingStorage(): ThreadLocalStorage<LogRing>("logRing") {}
+			void operator =(LogRing *ptr) {
+				*static_cast<ThreadLocalStorage<LogRing> *>(this) = ptr;
+			}
+			virtual void Destruct(void *v) {
+				// the writer deletes the ring after writing the rest
+				reinterpret_cast<LogRing *>(v)->abandoned = true;
+			}
+		};
+		
+		class LogWriterThread;
+		
+		struct LogState {
+			/** protects rings; taken by a producer only when it
+			 * posts its first message. */
+			std::mutex ringsMutex;
+			std::vector<LogRing *> rings;
+			LogRingStorage ringStorage;
+			
+			std::atomic<uint64_t> nextSequence;
+			std::atomic<uint64_t> numDropped;
+			std::atomic<uint64_t> numMessages;
+			uint64_t numReportedDropped;
+			uint64_t numDrains;
+			
+			std::atomic<bool> running;
+			std::atomic<bool> stopRequested;
+			std::mutex wakeMutex;
+			std::condition_variable wakeCond;
+			LogWriterThread *writer;
+			
+			/** protects the streams and the output buffers. */
+			std::mutex drainMutex;
+			IStream *systemLog;
+			bool systemLogStarted;
+			std::string accumulatedLog;
+			std::vector<const Record *> pending;
+			std::vector<std::pair<IStream *, std::string>> outputs;
+			
+			LogState():
+			nextSequence(0), numDropped(0), numMessages(0),
+			numReportedDropped(0), numDrains(0),
+			running(false), stopRequested(false), writer(NULL),
+			systemLog(NULL), systemLogStarted(false) {}
+		};
+		
+		static LogState& GetState() {
+			static LogState *state = new LogState();
+			return *state;
+		}
+		
+		static void FormatRecord(const Record& rec, std::string& out) {
+			char buf[256];
+			time_t t = static_cast<time_t>(rec.time / 1000000);
+			struct tm tm = *localtime(&t);
+			std::string text(rec.GetText(), rec.length);
+			
+			if(rec.format == static_cast<uint8_t>(AsyncLog::Format::Net) + 1) {
+				std::string timeStr = asctime(&tm);
+				// remove '\n' in the end of the result of asctime().
+				timeStr.resize(timeStr.size()-1);
+				out += EscapeControlCharacters(timeStr + " " + text + "\n");
+			}else{
+				const char *fn = rec.file ? rec.file : "";
+				const char *slash = strrchr(fn, '/');
+				if(slash)
+					fn = slash + 1;
+				//lm: using \r\n instead of \n so that some shitty windows editors (notepad f.e.) can parse this file aswell (all decent editors should ignore it anyway)
+				sprintf(buf, "%04d/%02d/%02d %02d:%02d:%02d [%s:%d] ",
+						tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday,
+						tm.tm_hour, tm.tm_min, tm.tm_sec,
+						fn, (int)rec.line);
+				out += EscapeControlCharacters(buf + text + "\r\n");
+			}
+		}
+		
+		static std::string& GetOutput(LogState& state, IStream *stream) {
+			for(size_t i = 0; i < state.outputs.size(); i++) {
+				if(state.outputs[i].first == stream)
+					return state.outputs[i].second;
+			}
+			state.outputs.emplace_back(stream, std::string());
+			return state.outputs.back().second;
+		}
+		
+		/** an I/O error (disk full, for example) must not stop the
+		 * writer thread, so it's reported on stdout instead.
+		 * @return false if the stream failed. */
+		static bool WriteToStream(IStream *stream, const std::string& str) {
+			try{
+				stream->Write(str);
+				stream->Flush();
+				return true;
+			}catch(const std::exception& ex){
+				fprintf(stdout, "Failed to write log: %s\n", ex.what());
+				return false;
+			}
+		}
+		
+		/** writes the formatted records. drainMutex must be held. */
+		static void WriteOutputs(LogState& state) {
+			for(size_t i = 0; i < state.outputs.size(); i++) {
+				IStream *stream = state.outputs[i].first;
+				std::string& str = state.outputs[i].second;
+				if(str.empty())
+					continue;
+				
+				fwrite(str.data(), 1, str.size(), stdout);
+				
+				if(stream) {
+					WriteToStream(stream, str);
+				}else if(state.systemLog) {
+					if(!WriteToStream(state.systemLog, str)) {
+						// don't try again for every message
+						fprintf(stdout, "System log is no longer written\n");
+						state.systemLog = NULL;
+					}
+				}else if(!state.systemLogStarted) {
+					state.accumulatedLog += str;
+				}
+				str.clear();
+			}
+			fflush(stdout);
+		}
+		
+		/** writes the queued messages of all threads.
+		 * drainMutex must be held. */
+		static void Drain(LogState& state) {
+			std::vector<LogRing *> rings;
+			{
+				std::lock_guard<std::mutex> lock(state.ringsMutex);
+				rings = state.rings;
+			}
+			
+			// sort the records of all threads into the posted order.
+			// the records are read in place, so the rings are released
+			// after they are formatted
+			std::vector<size_t> positions(rings.size());
+			state.pending.clear();
+			for(size_t i = 0; i < rings.size(); i++) {
+				positions[i] = rings[i]->Peek([&](const Record& rec) {
+					state.pending.push_back(&rec);
+				});
+			}
+			std::sort(state.pending.begin(), state.pending.end(),
+					  [](const Record *a, const Record *b) {
+						  return a->sequence < b->sequence;
+					  });
+			for(size_t i = 0; i < state.pending.size(); i++) {
+				const Record& rec = *state.pending[i];
+				FormatRecord(rec, GetOutput(state, rec.stream));
+			}
+			state.pending.clear();
+			for(size_t i = 0; i < rings.size(); i++)
+				rings[i]->Release(positions[i]);
+			state.numDrains++;
+			
+			uint64_t dropped = state.numDropped.load();
+			if(dropped != state.numReportedDropped) {
+				char buf[128];
+				sprintf(buf, "[%llu log message(s) dropped because the queue was full]\n",
+						(unsigned long long)(dropped - state.numReportedDropped));
+				GetOutput(state, NULL) += buf;
+				state.numReportedDropped = dropped;
+			}
+			
+			WriteOutputs(state);
+			
+			// rings of exited threads are removed once they are empty
+			std::lock_guard<std::mutex> lock(state.ringsMutex);
+			for(size_t i = 0; i < state.rings.size();) {
+				LogRing *ring = state.rings[i];
+				if(ring->abandoned && ring->IsEmpty()) {
+					delete ring;
+					state.rings.erase(state.rings.begin() + i);
+				}else{
+					i++;
+				}
+			}
+		}
+		
+		class LogWriterThread: public Thread {
+		public:
+			virtual void Run() {
+				LogState& state = GetState();
+				while(true) {
+					bool stop;
+					{
+						std::unique_lock<std::mutex> lock(state.wakeMutex);
+						state.wakeCond.wait_for(lock, std::chrono::milliseconds(WriterInterval));
+						stop = state.stopRequested;
+					}
+					{
+						std::lock_guard<std::mutex> lock(state.drainMutex);
+						Drain(state);
+					}
+					if(stop)
+						break;
+				}
+			}
+		};
+		
+		static LogRing *GetRing(LogState& state) {
+			LogRing *ring = state.ringStorage.GetPointer();
+			if(ring == NULL) {
+				ring = new LogRing();
+				state.ringStorage = ring;
+				std::lock_guard<std::mutex> lock(state.ringsMutex);
+				state.rings.push_back(ring);
+			}
+			return ring;
+		}
+	}
+	
+	void AsyncLog::Post(Format format, LogLevel level,
+						const char *file, int line,
+						IStream *stream,
+						const char *text, size_t length) {
+		LogState& state = GetState();
+		
+		Record rec;
+		rec.format = static_cast<uint8_t>(format) + 1;
+		rec.level = static_cast<uint8_t>(level);
+		rec.reserved = 0;
+		rec.line = line;
+		rec.file = file;
+		rec.stream = stream;
+		rec.time = std::chrono::duration_cast<std::chrono::microseconds>
+		(std::chrono::system_clock::now().time_since_epoch()).count();
+		rec.sequence = state.nextSequence.fetch_add(1);
+		state.numMessages.fetch_add(1, std::memory_order_relaxed);
+		
+		if(!state.running) {
+			// the writer isn't running; write it now
+			std::lock_guard<std::mutex> lock(state.drainMutex);
+			rec.length = static_cast<uint32_t>(length);
+			std::vector<char> buf(sizeof(Record) + length);
+			memcpy(buf.data(), &rec, sizeof(Record));
+			memcpy(buf.data() + sizeof(Record), text, length);
+			FormatRecord(*reinterpret_cast<Record *>(buf.data()),
+						 GetOutput(state, stream));
+			WriteOutputs(state);
+			return;
+		}
+		
+		// a single message never occupies more than a quarter of the ring
+		length = std::min<size_t>(length, RingSize / 4);
+		
+		bool wake = false;
+		if(!GetRing(state)->Push(rec, text, length, wake)) {
+			state.numDropped.fetch_add(1, std::memory_order_relaxed);
+			wake = true;
+		}
+		
+		// Stop might have done its last drain after we checked `running`
+		// above. either we see it stopped here and write the message
+		// ourselves, or its last drain sees the message.
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if(!state.running) {
+			Flush();
+			return;
+		}
+		
+		if(wake)
+			state.wakeCond.notify_one();
+	}
+	
+	void AsyncLog::Start(IStream *systemLog) {
+		LogState& state = GetState();
+		{
+			std::lock_guard<std::mutex> lock(state.drainMutex);
+			state.systemLog = systemLog;
+			state.systemLogStarted = true;
+			if(systemLog) {
+				systemLog->Write(state.accumulatedLog);
+				systemLog->Flush();
+			}
+			state.accumulatedLog.clear();
+		}
+		
+		if(state.writer == NULL) {
+			state.stopRequested = false;
+			state.writer = new LogWriterThread();
+			state.writer->Start();
+			state.running = true;
+		}
+	}
+	
+	void AsyncLog::Flush() {
+		LogState& state = GetState();
+		std::lock_guard<std::mutex> lock(state.drainMutex);
+		Drain(state);
+	}
+	
+	void AsyncLog::Stop() {
+		LogState& state = GetState();
+		if(state.writer == NULL)
+			return;
+		
+		// messages posted from now on are written synchronously
+		state.running = false;
+		{
+			std::lock_guard<std::mutex> lock(state.wakeMutex);
+			state.stopRequested = true;
+		}
+		state.wakeCond.notify_one();
+		state.writer->Join();
+		delete state.writer;
+		state.writer = NULL;
+		
+		// pairs with the fence in Post
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		Flush();
+	}
+	
+	AsyncLog::Statistics AsyncLog::GetStatistics() {
+		LogState& state = GetState();
+		Statistics stats;
+		stats.numMessages = state.numMessages.load();
+		stats.numDropped = state.numDropped.load();
+		{
+			std::lock_guard<std::mutex> lock(state.drainMutex);
+			stats.numDrains = state.numDrains;
+		}
+		return stats;
+	}
+}
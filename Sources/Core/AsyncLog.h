@@ -0,0 +1,82 @@
+/*
+ Copyright (c) 2013 yvt
+ 
+ This file is part of OpenSpades.
+ 
+ OpenSpades is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ 
+ OpenSpades is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with OpenSpades.  If not, see <http://www.gnu.org/licenses/>.
+ 
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace spades {
+	class IStream;
+	
+	enum class LogLevel {
+		Debug = 0,
+		Info,
+		Warning,
+		Error
+	};
+	
+	/** Writes log messages on a background thread.
+	 *
+	 * Each thread posts its messages into its own lock-free ring
+	 * buffer, so posting never waits for another thread or for the
+	 * disk. Messages are queued with a binary timestamp and a global
+	 * sequence number, and the writer thread formats them in the
+	 * order they were posted. When a ring buffer is full, the message
+	 * is dropped and the number of dropped messages is logged later.
+	 *
+	 * Until Start is called, messages are written synchronously. */
+	class AsyncLog {
+	public:
+		enum class Format {
+			/** "yyyy/mm/dd hh:mm:ss [file:line] text" */
+			System,
+			/** asctime followed by the text. */
+			Net
+		};
+		
+		struct Statistics {
+			uint64_t numMessages;
+			uint64_t numDropped;
+			uint64_t numDrains;
+		};
+		
+		/** Queues a message.
+		 * @param stream Receives the message in addition to the standard
+		 *               output. NULL for the system log. */
+		static void Post(Format, LogLevel,
+						 const char *file, int line,
+						 IStream *stream,
+						 const char *text, size_t length);
+		
+		/** Sets the system log stream and starts the writer thread.
+		 * The messages written so far are copied to the stream. */
+		static void Start(IStream *systemLog);
+		
+		/** Waits until the messages posted so far are written.
+		 * Must be called before a stream passed to Post is closed. */
+		static void Flush();
+		
+		/** Writes the remaining messages and stops the writer thread. */
+		static void Stop();
+		
+		static Statistics GetStatistics();
+	};
+}
@@ -88,13 +88,15 @@ namespace spades {
 		}
 	}
 	
-	Bitmap *Bitmap::Load(IStream *stream) {
+	Bitmap *Bitmap::Load(IStream *stream, const std::string& filename) {
 		std::vector<IBitmapCodec *>codecs = IBitmapCodec::GetAllCodecs();
 		auto pos = stream->GetPosition();
 		std::string errMsg;
 		for(size_t i = 0; i < codecs.size(); i++){
 			IBitmapCodec *codec = codecs[i];
-			if(codec->CanLoad()){
+			// every codec is tried when the filename is unknown
+			if(codec->CanLoad() &&
+			   (filename.empty() || codec->CheckExtension(filename))){
 				// give it a try.
 				// open error shouldn't be handled here
 				try{
@@ -109,14 +111,19 @@ namespace spades {
 			}
 		}
 		
+		const char *name = filename.empty() ? "[stream]" : filename.c_str();
 		if(errMsg.empty()){
-			SPRaise("Bitmap codec not found for stream");
+			SPRaise("Bitmap codec not found for filename: %s", name);
 		}else{
-			SPRaise("No bitmap codec could load file successfully: [stream]\n%s\n",
-					errMsg.c_str());
+			SPRaise("No bitmap codec could load file successfully: %s\n%s\n",
+					name, errMsg.c_str());
 		}
 	}
 	
+	Bitmap *Bitmap::Load(IStream *stream) {
+		return Load(stream, std::string());
+	}
+	
 	void Bitmap::Save(const std::string &filename) {
 		std::vector<IBitmapCodec *>codecs = IBitmapCodec::GetAllCodecs();
 		for(size_t i = 0; i < codecs.size(); i++){
@@ -39,6 +39,9 @@ namespace spades {
 		
 		static Bitmap *Load(const std::string&);
 		static Bitmap *Load(IStream *); // must be seekable
+		/** loads from a seekable stream with the codecs chosen by
+		 * the extension of `filename`, or with all codecs if it's empty. */
+		static Bitmap *Load(IStream *, const std::string& filename);
 		void Save(const std::string&);
 		
 		uint32_t *GetPixels() { return pixels; }
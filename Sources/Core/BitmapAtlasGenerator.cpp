@@ -36,111 +36,128 @@ namespace spades {
 		bmps.push_back(b);
 	}
 	
-	int BitmapAtlasGenerator::MinRectSize() {
-		int area = 0;
-		for(size_t i = 0; i < bmps.size(); i++){
-			Bitmap *bmp = bmps[i];
-			area += bmp->GetWidth() * bmp->GetHeight();
-		}
-		
+	static int CeilPowerOfTwo(int v) {
 		for(int b = 1; b < 16; b++){
 			int s = 1 << b;
-			if(s * s >= area)
+			if(s >= v)
 				return s;
 		}
 		SPAssert(false);
 		return 0;
 	}
 	
-	int BitmapAtlasGenerator::MinWidth() {
-		int w = 0;
-		for(size_t i = 0; i < bmps.size(); i++){
-			Bitmap *bmp = bmps[i];
-			if(bmp->GetWidth() > w) w = bmp->GetWidth();
+	static int MinRectSize(const std::vector<BitmapAtlasGenerator::Rect>& rects) {
+		int area = 0;
+		for(size_t i = 0; i < rects.size(); i++){
+			area += rects[i].w * rects[i].h;
 		}
 		
 		for(int b = 1; b < 16; b++){
 			int s = 1 << b;
-			if(s >= w)
+			if(s * s >= area)
 				return s;
 		}
 		SPAssert(false);
 		return 0;
 	}
 	
-	int BitmapAtlasGenerator::MinHeight() {
+	static int MinWidth(const std::vector<BitmapAtlasGenerator::Rect>& rects) {
 		int w = 0;
-		for(size_t i = 0; i < bmps.size(); i++){
-			Bitmap *bmp = bmps[i];
-			if(bmp->GetHeight() > w) w = bmp->GetWidth();
+		for(size_t i = 0; i < rects.size(); i++){
+			if(rects[i].w > w) w = rects[i].w;
 		}
-		
-		for(int b = 1; b < 16; b++){
-			int s = 1 << b;
-			if(s >= w)
-				return s;
+		return CeilPowerOfTwo(w);
+	}
+	
+	static int MinHeight(const std::vector<BitmapAtlasGenerator::Rect>& rects) {
+		int h = 0;
+		for(size_t i = 0; i < rects.size(); i++){
+			if(rects[i].h > h) h = rects[i].h;
 		}
-		SPAssert(false);
-		return 0;
+		return CeilPowerOfTwo(h);
 	}
 	
-	BitmapAtlasGenerator::Result BitmapAtlasGenerator::Pack() {
-		BinPack2D::ContentAccumulator<Item> items;
-		int minSize = MinRectSize();
-		int minW = MinWidth(), minH = MinHeight();
+	void BitmapAtlasGenerator::PackRects(std::vector<Rect> &rects,
+										 int &outWidth, int &outHeight) {
+		// content is the index in `rects`
+		BinPack2D::ContentAccumulator<int> items;
+		int minSize = MinRectSize(rects);
+		int minW = MinWidth(rects), minH = MinHeight(rects);
 		minSize = std::max(minSize, std::min(minW, minH));
 		int mw = minSize, mh = minSize;
 		
-		for(size_t i = 0; i < bmps.size(); i++){
-			Bitmap *b = bmps[i];
-			Item itm = {b,0,0,b->GetWidth(),b->GetHeight()};
-			items += BinPack2D::Content<Item>(itm,
-											  BinPack2D::Coord(),
-											  BinPack2D::Size(itm.w,itm.h),
-											  false );
+		for(size_t i = 0; i < rects.size(); i++){
+			const Rect& r = rects[i];
+			items += BinPack2D::Content<int>((int)i,
+											 BinPack2D::Coord(),
+											 BinPack2D::Size(r.w, r.h),
+											 false );
 		}
 		
+		// larger ones first; usually packs better
+		items.Sort();
+		
 		while(true){
 			int ww = std::max(mw, minW), hh = std::max(mh, minH);
-			BinPack2D::CanvasArray<Item> canvasArray =
-			BinPack2D::UniformCanvasArrayBuilder<Item>(ww,hh,1).Build();
+			BinPack2D::CanvasArray<int> canvasArray =
+			BinPack2D::UniformCanvasArrayBuilder<int>(ww,hh,1).Build();
 			
-			BinPack2D::ContentAccumulator<Item> remainder;
+			BinPack2D::ContentAccumulator<int> remainder;
 			
 			if(canvasArray.Place( items, remainder ) && remainder.Get().empty()){
-				BinPack2D::ContentAccumulator<Item> output;
+				BinPack2D::ContentAccumulator<int> output;
 				canvasArray.CollectContent(output);
 				
-				Bitmap *outbmp = new Bitmap(ww, hh);
-				uint32_t *outPixels = outbmp->GetPixels();
-
-				Result result;
-				for(BinPack2D::Content<Item>::Vector::iterator it =
+				for(BinPack2D::Content<int>::Vector::iterator it =
 					output.Get().begin();it != output.Get().end();it++){
-					const BinPack2D::Content<Item>& c = *it;
-					Item itm = c.content;
-					itm.x = c.coord.x;
-					itm.y = c.coord.y;
-					result.items.push_back(itm);
-					
-					Bitmap *b = itm.bitmap;
-					uint32_t *inPixels = b->GetPixels();
-					int w = itm.w, h = itm.h;
-					
-					for(int i = 0; i < h; i++){
-						memcpy(outPixels + itm.x + (itm.y + i) * ww,
-							   inPixels + i * w,
-							   w * 4);
-					}
-					
+					const BinPack2D::Content<int>& c = *it;
+					Rect& r = rects[c.content];
+					r.x = c.coord.x;
+					r.y = c.coord.y;
 				}
 				
-				result.bitmap = outbmp;
-				
-				return result;
+				outWidth = ww;
+				outHeight = hh;
+				return;
 			}
 			
 			mw <<= 1; mh <<= 1;
 		}
 	}
+	
+	BitmapAtlasGenerator::Result BitmapAtlasGenerator::Pack() {
+		std::vector<Rect> rects;
+		rects.reserve(bmps.size());
+		for(size_t i = 0; i < bmps.size(); i++){
+			Bitmap *b = bmps[i];
+			Rect r = {0, 0, b->GetWidth(), b->GetHeight()};
+			rects.push_back(r);
+		}
+		
+		int ww, hh;
+		PackRects(rects, ww, hh);
+		
+		Bitmap *outbmp = new Bitmap(ww, hh);
+		uint32_t *outPixels = outbmp->GetPixels();
+		
+		Result result;
+		for(size_t i = 0; i < bmps.size(); i++){
+			const Rect& r = rects[i];
+			Item itm = {bmps[i], r.x, r.y, r.w, r.h};
+			result.items.push_back(itm);
+			
+			uint32_t *inPixels = itm.bitmap->GetPixels();
+			int w = itm.w, h = itm.h;
+			
+			for(int j = 0; j < h; j++){
+				memcpy(outPixels + itm.x + (itm.y + j) * ww,
+					   inPixels + j * w,
+					   w * 4);
+			}
+		}
+		
+		result.bitmap = outbmp;
+		
+		return result;
+	}
 }
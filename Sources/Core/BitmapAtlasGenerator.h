@@ -35,16 +35,22 @@ namespace spades {
 			std::vector<Item> items;
 			Bitmap *bitmap;
 		};
+		struct Rect {
+			int x, y, w, h;
+		};
 	private:
 		std::vector<Bitmap *> bmps;
-		int MinRectSize();
-		int MinWidth();
-		int MinHeight();
 	public:
 		BitmapAtlasGenerator();
 		~BitmapAtlasGenerator();
 		
 		void AddBitmap(Bitmap *);
 		Result Pack();
+		
+		/** Packs rectangles without allocating bitmaps for them.
+		 * Positions are written back to `rects` (the order is preserved).
+		 * Useful when the caller stores the contents in its own buffer. */
+		static void PackRects(std::vector<Rect>& rects,
+							  int& outWidth, int& outHeight);
 	};
 }
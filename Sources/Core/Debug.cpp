@@ -20,124 +20,115 @@
 
 #include "Debug.h"
 #include "../Core/Debug.h"
-#include <map>
-#include "../Imports/SDL.h"
 #include <string>
 #include "IStream.h"
 #include "FileManager.h"
 #include <stdarg.h>
 #include <time.h>
+#include <stdlib.h>
+#include <stdio.h>
 #include "Math.h"
-
-#define SPADES_USE_TLS 1
-
-#if SPADES_USE_TLS
 #include "ThreadLocalStorage.h"
-#endif // SPADES_USE_TLS
+#include <mutex>
+#include <algorithm>
 
 namespace spades {
 	namespace reflection {
-		Function::Function(const char *n,
-						   const char *f,
-						   int l):
-		name(n), file(f), line(l){
-			
-		}
-		
-		BacktraceEntryAdder::BacktraceEntryAdder(const BacktraceEntry& entry){
-			bt = Backtrace::GetGlobalBacktrace();
-			if(bt)
-				bt->Push(entry);
-		}
-		
-		BacktraceEntryAdder::~BacktraceEntryAdder() {
-			if(bt)
-				bt->Pop();
-		}
 		
-#if SPADES_USE_TLS
+		// compiler-provided TLS; reading it is a single load, unlike
+		// ThreadLocalStorage which goes through a virtual call
+		static SPADES_THREAD_LOCAL Backtrace *currentBacktrace = NULL;
 		
-		static AutoDeletedThreadLocalStorage<Backtrace> backtraceTls("backtraceTls");
-		
-		// TLS is initialized as global constructor and
-		// some constructors are called before initialization of TLS.
+		// some constructors are called before main, and
 		// this prevents backtrace to be used until all constructors are
 		// called.
 		static bool backtraceStarted = false;
 		
-		Backtrace *Backtrace::GetGlobalBacktrace() {
-			if(!backtraceStarted)
-				return NULL;
-			Backtrace *b = backtraceTls;
-			if(!b){
-				b = new Backtrace;
-				backtraceTls = b;
-			}
-			return b;
-		}
+		/** backtraces of all threads, for the sampling profiler. */
+		struct BacktraceRegistry {
+			std::mutex mutex;
+			std::vector<Backtrace *> backtraces;
+			int nextThreadIndex;
+			
+			BacktraceRegistry(): nextThreadIndex(0) {}
+		};
 		
-		void Backtrace::ThreadExiting() {
+		static BacktraceRegistry& GetRegistry() {
+			// never destroyed since threads might exit after main
+			static BacktraceRegistry *registry = new BacktraceRegistry();
+			return *registry;
 		}
 		
-		void Backtrace::StartBacktrace(){
-			backtraceStarted = true;
+		Backtrace::Backtrace(int threadIndex):
+		depth(0), threadIndex(threadIndex) {
+			for(int i = 0; i < MaxDepth; i++)
+				entries[i].store(NULL, std::memory_order_relaxed);
 		}
 		
-#else
-		
-		static std::map<Uint32, Backtrace *> globalBacktrace;
-		static Uint32 firstThread = 0;
-		static Backtrace firstThreadBacktrace;
-		
 		Backtrace *Backtrace::GetGlobalBacktrace() {
-			Uint32 thread = SDL_ThreadID();
-			if(firstThread == 0)
-				firstThread = thread;
-			if(thread == firstThread){
-				return &firstThreadBacktrace;
-			}
-			std::map<Uint32, Backtrace *>::iterator it = globalBacktrace.find(thread);
-			if(it == globalBacktrace.end()){
-				Backtrace *t = new Backtrace();
-				globalBacktrace[thread] = t;
-				return t;
-			}else{
-				return it->second;
-			}
+			Backtrace *b = currentBacktrace;
+			if(b)
+				return b;
+			if(!backtraceStarted)
+				return NULL;
+			
+			BacktraceRegistry& registry = GetRegistry();
+			std::lock_guard<std::mutex> lock(registry.mutex);
+			b = new Backtrace(registry.nextThreadIndex++);
+			registry.backtraces.push_back(b);
+			currentBacktrace = b;
+			return b;
 		}
 		
 		void Backtrace::ThreadExiting() {
-			Uint32 thread = SDL_ThreadID();
-			if(thread == firstThread)
+			Backtrace *b = currentBacktrace;
+			if(!b)
 				return;
-			std::map<Uint32, Backtrace *>::iterator it = globalBacktrace.find(thread);
-			if(it != globalBacktrace.end()){
-				delete it->second;
-				globalBacktrace.erase(it);
-			}
-		}
-		
-		void Backtrace::StartBacktrace(){
 			
+			BacktraceRegistry& registry = GetRegistry();
+			std::lock_guard<std::mutex> lock(registry.mutex);
+			registry.backtraces.erase(std::find(registry.backtraces.begin(),
+												registry.backtraces.end(), b));
+			currentBacktrace = NULL;
+			delete b;
 		}
 		
-#endif
-		
-		void Backtrace::Push(const spades::reflection::BacktraceEntry &entry) {
-			entries.push_back(entry);
+		void Backtrace::StartBacktrace(){
+			backtraceStarted = true;
 		}
 		
-		void Backtrace::Pop() {
-			SPAssert(entries.size() > 0);
-			entries.pop_back();
+		void Backtrace::SampleAllThreads(std::vector<Sample> &out) {
+			BacktraceRegistry& registry = GetRegistry();
+			std::lock_guard<std::mutex> lock(registry.mutex);
+			
+			out.resize(registry.backtraces.size());
+			for(size_t i = 0; i < registry.backtraces.size(); i++) {
+				const Backtrace& b = *registry.backtraces[i];
+				Sample& sample = out[i];
+				sample.threadIndex = b.threadIndex;
+				
+				// the thread keeps running, so the entries might be
+				// from different moments; every entry is still a
+				// valid function
+				int d = b.depth.load(std::memory_order_acquire);
+				d = std::max(0, std::min(d, (int)MaxDepth));
+				sample.entries.resize(d);
+				for(int j = 0; j < d; j++)
+					sample.entries[j] = b.entries[j].load(std::memory_order_relaxed);
+			}
 		}
 		
-		std::vector<BacktraceEntry> Backtrace::GetAllEntries() {
-			return entries;
+		std::vector<BacktraceEntry> Backtrace::GetAllEntries() const {
+			int d = std::min(depth.load(std::memory_order_relaxed), (int)MaxDepth);
+			std::vector<BacktraceEntry> ret;
+			ret.reserve(std::max(d, 0));
+			for(int i = 0; i < d; i++)
+				ret.push_back(BacktraceEntry(entries[i].load(std::memory_order_relaxed)));
+			return ret;
 		}
 		
 		std::string Backtrace::ToString() const {
-			return BacktraceRecordToString(entries);
+			return BacktraceRecordToString(GetAllEntries());
 		}
 		std::string BacktraceRecordToString(const BacktraceRecord& entries) {
 			std::string message;
@@ -168,52 +159,59 @@ namespace spades {
 	
 #pragma mark - 
 	
-	static IStream *logStream = NULL;
-	static bool attemptedToInitializeLog = false;
-	static std::string accumlatedLog;
+	static void StopLog() {
+		AsyncLog::Stop();
+	}
 	
 	void StartLog() {
-		attemptedToInitializeLog = true;
-		logStream = FileManager::OpenForWriting("SystemMessages.log");
+		static bool stopRegistered = false;
+		if(!stopRegistered) {
+			stopRegistered = true;
+			atexit(StopLog);
+		}
+		
+		IStream *logStream;
+		try{
+			logStream = FileManager::OpenForWriting("SystemMessages.log");
+		}catch(...){
+			// keep logging to the standard output
+			AsyncLog::Start(NULL);
+			throw;
+		}
 		
-		logStream->Write(accumlatedLog);
-		accumlatedLog.clear();
+		// the messages logged so far are written to the stream, and
+		// the following ones are written by the writer thread
+		AsyncLog::Start(logStream);
+	}
+	
+	static void LogMessageV(LogLevel level, const char *file, int line,
+							const char *format, va_list va) {
+		char buf[4096];
+		int len = vsnprintf(buf, sizeof(buf), format, va);
+		if(len < 0)
+			len = 0;
+		if(len >= (int)sizeof(buf))
+			len = (int)sizeof(buf) - 1;
+		
+		// formatting the timestamp and escaping are done by the writer
+		AsyncLog::Post(AsyncLog::Format::System, level, file, line,
+					   NULL, buf, (size_t)len);
 	}
 	
 	void LogMessage(const char *file, int line,
 					const char *format, ...) {
-		char buf[4096];
 		va_list va;
 		va_start(va, format);
-		vsprintf(buf, format, va);
+		LogMessageV(LogLevel::Info, file, line, format, va);
+		va_end(va);
+	}
+	
+	void LogMessage(LogLevel level, const char *file, int line,
+					const char *format, ...) {
+		va_list va;
+		va_start(va, format);
+		LogMessageV(level, file, line, format, va);
 		va_end(va);
-		std::string str = buf;
-		std::string fn = file;
-		if(fn.rfind('/') != std::string::npos)
-			fn=fn.substr(fn.rfind('/')+1);
-		
-		time_t t;
-		struct tm tm;
-		time(&t);
-		tm = *localtime(&t);
-		
-		//lm: using \r\n instead of \n so that some shitty windows editors (notepad f.e.) can parse this file aswell (all decent editors should ignore it anyway)
-		sprintf(buf, "%04d/%02d/%02d %02d:%02d:%02d [%s:%d] %s\r\n",
-				tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec,
-				fn.c_str(), line, str.c_str());
-		
-		std::string outStr = EscapeControlCharacters(buf);
-		
-		printf("%s", outStr.c_str());
-		
-		if(logStream || !attemptedToInitializeLog) {
-			
-			if(attemptedToInitializeLog){
-				logStream->Write(outStr);
-				logStream->Flush();
-			}else
-				accumlatedLog += buf;
-		}
 	}
 	
 }
@@ -21,17 +21,26 @@
 #pragma once
 
 #include <vector>
+#include <atomic>
 #include "Exception.h"
+#include "AsyncLog.h"
+
+/** when 0, SPADES_MARK_FUNCTION compiles to nothing, and exceptions
+ * and the sampling profiler don't see the functions. */
+#ifndef SPADES_MARK_FUNCTIONS
+#define SPADES_MARK_FUNCTIONS 1
+#endif
 
 namespace spades {
 	namespace reflection {
+		/** an aggregate so that the static instances in the marked
+		 * functions are initialized at compile time and don't need
+		 * a guard variable. */
 		class Function{
+		public:
 			const char *name;
 			const char *file;
 			int line;
-		public:
-			Function(const char *name, const char *File,
-					 int line);
 			
 			const char *GetName() const { return name; }
 			const char *GetFileName() const { return file; }
@@ -41,55 +50,115 @@ namespace spades {
 		class Backtrace;
 		
 		class BacktraceEntry {
-			Function *function;
+			const Function *function;
 		public:
 			BacktraceEntry() {}
-			BacktraceEntry(Function *f):
+			BacktraceEntry(const Function *f):
 			function(f) {}
 			
 			const Function& GetFunction() const { return *function; }
 		};
 		
-		class BacktraceEntryAdder {
-			Backtrace *bt;
-		public:
-			BacktraceEntryAdder(const BacktraceEntry&);
-			~BacktraceEntryAdder();
-			
-		};
-		
 		typedef std::vector<BacktraceEntry> BacktraceRecord;
 		
+		/** Stack of the marked functions of a thread.
+		 * Entering a function only writes a pointer into a fixed-size
+		 * array, and the array can be read from other threads by the
+		 * sampling profiler. Functions deeper than MaxDepth are
+		 * counted but not recorded. */
 		class Backtrace {
-			std::vector<BacktraceEntry> entries;
 		public:
+			enum { MaxDepth = 64 };
+			
+			struct Sample {
+				int threadIndex;
+				/** outermost first. */
+				std::vector<const Function *> entries;
+			};
+			
+		private:
+			std::atomic<const Function *> entries[MaxDepth];
+			std::atomic<int> depth;
+			int threadIndex;
+			
+			Backtrace(int threadIndex);
+		public:
+			/** @return backtrace of the current thread, or NULL if
+			 * called before StartBacktrace. */
 			static Backtrace *GetGlobalBacktrace();
 			static void ThreadExiting();
 			static void StartBacktrace();
 			
-			void Push(const BacktraceEntry&);
-			void Pop();
+			/** takes a best-effort snapshot of the backtraces of
+			 * all threads. the vectors in `out` are reused. */
+			static void SampleAllThreads(std::vector<Sample>& out);
+			
+			void Push(const Function *f) {
+				int d = depth.load(std::memory_order_relaxed);
+				if(d < MaxDepth)
+					entries[d].store(f, std::memory_order_relaxed);
+				depth.store(d + 1, std::memory_order_release);
+			}
+			void Pop() {
+				depth.store(depth.load(std::memory_order_relaxed) - 1,
+							std::memory_order_release);
+			}
 			
-			BacktraceRecord GetAllEntries();
-			BacktraceRecord GetRecord() { return GetAllEntries(); }
+			void Push(const BacktraceEntry& e) { Push(&e.GetFunction()); }
+			
+			/** index of the thread, in the order of the first use. */
+			int GetThreadIndex() const { return threadIndex; }
+			
+			BacktraceRecord GetAllEntries() const;
+			BacktraceRecord GetRecord() const { return GetAllEntries(); }
 			
 			std::string ToString() const;
 		};
 		
+		class BacktraceEntryAdder {
+			Backtrace *bt;
+		public:
+			BacktraceEntryAdder(const Function *f):
+			bt(Backtrace::GetGlobalBacktrace()) {
+				if(bt)
+					bt->Push(f);
+			}
+			~BacktraceEntryAdder() {
+				if(bt)
+					bt->Pop();
+			}
+		};
+		
 		std::string BacktraceRecordToString(const BacktraceRecord&);
 	}
 	void StartLog();
 	void LogMessage(const char *file, int line,
 						   const char *format, ...);
+	void LogMessage(LogLevel level, const char *file, int line,
+					const char *format, ...);
 }
 
+/** messages below this level are removed at compile time.
+ * 0: debug, 1: info, 2: warning, 3: error */
+#ifndef SPADES_LOG_LEVEL
+#ifdef NDEBUG
+#define SPADES_LOG_LEVEL 1
+#else
+#define SPADES_LOG_LEVEL 0
+#endif
+#endif
+
 #ifdef _MSC_VER
 #define __PRETTY_FUNCTION__ __FUNCDNAME__
 #endif
 
+#if SPADES_MARK_FUNCTIONS
 #define SPADES_MARK_FUNCTION() \
-static ::spades::reflection::Function thisFunction(__PRETTY_FUNCTION__, __FILE__, __LINE__); \
-::spades::reflection::BacktraceEntryAdder backtraceEntryAdder((::spades::reflection::BacktraceEntry(&thisFunction)))
+static const ::spades::reflection::Function thisFunction = {__PRETTY_FUNCTION__, __FILE__, __LINE__}; \
+::spades::reflection::BacktraceEntryAdder backtraceEntryAdder(&thisFunction)
+#else
+#define SPADES_MARK_FUNCTION() do{}while(0)
+#endif
 
 #if NDEBUG
 #define SPADES_MARK_FUNCTION_DEBUG() do{}while(0)
@@ -104,11 +173,31 @@ static ::spades::reflection::Function thisFunction(__PRETTY_FUNCTION__, __FILE__
 #endif
 
 #ifdef _MSC_VER
-#define SPLog(format, ...) ::spades::LogMessage(__FILE__, __LINE__, format, __VA_ARGS__ )
+#define SPLogAtLevel(level, format, ...) ::spades::LogMessage(::spades::LogLevel::level, __FILE__, __LINE__, format, __VA_ARGS__ )
 #else
-#define SPLog(format, args...) ::spades::LogMessage(__FILE__, __LINE__, format, ##args )
+#define SPLogAtLevel(level, format, args...) ::spades::LogMessage(::spades::LogLevel::level, __FILE__, __LINE__, format, ##args )
 #endif
 
+#if SPADES_LOG_LEVEL <= 0
+#define SPLogDebug(...) SPLogAtLevel(Debug, __VA_ARGS__)
+#else
+#define SPLogDebug(...) do{}while(0)
+#endif
+
+#if SPADES_LOG_LEVEL <= 1
+#define SPLog(...) SPLogAtLevel(Info, __VA_ARGS__)
+#else
+#define SPLog(...) do{}while(0)
+#endif
+
+#if SPADES_LOG_LEVEL <= 2
+#define SPLogWarning(...) SPLogAtLevel(Warning, __VA_ARGS__)
+#else
+#define SPLogWarning(...) do{}while(0)
+#endif
+
+#define SPLogError(...) SPLogAtLevel(Error, __VA_ARGS__)
+
 #ifdef __GNUC__
 #define DEPRECATED(func) func __attribute__ ((deprecated))
 #elif defined(_MSC_VER)
@@ -24,6 +24,8 @@
 #include "Exception.h"
 #include <sys/stat.h>
 #include "Debug.h"
+#include <algorithm>
+#include <cstring>
 
 #ifdef WIN32
 #include <windows.h>
@@ -54,7 +56,7 @@ namespace spades {
 		// TODO: check ".."?
 		return rootPath + '/' + lg;
 	}
-	
+
 #ifdef WIN32
 	static std::wstring Utf8ToWString(const char *s) {
 		auto *ws = (WCHAR*)SDL_iconv_string("UCS-2-INTERNAL", "UTF-8", (char *)(s), SDL_strlen(s)+1);
@@ -71,7 +73,7 @@ namespace spades {
 		return ss;
 	}
 #endif
-	
+
 	std::vector<std::string> DirectoryFileSystem::EnumFiles(const char *p){
 		SPADES_MARK_FUNCTION();
 #ifdef WIN32
@@ -205,4 +207,77 @@ namespace spades {
 		return false;
 	}
 	
+	std::string DirectoryFileSystem::GetPhysicalPath(const char *fn) {
+		SPADES_MARK_FUNCTION();
+		return physicalPath(fn);
+	}
+	
+	bool DirectoryFileSystem::EnumAllFiles(std::vector<std::string>& lst) {
+		SPADES_MARK_FUNCTION();
+		EnumAllFilesInner(std::string(), lst);
+		return true;
+	}
+	
+	void DirectoryFileSystem::EnumAllFilesInner(const std::string& dir,
+												std::vector<std::string>& lst) {
+		// guard against symbolic link loops
+		if(std::count(dir.begin(), dir.end(), '/') >= 16)
+			return;
+		
+		std::string prefix = dir.empty() ? dir : dir + '/';
+#ifdef WIN32
+		WIN32_FIND_DATAW fd;
+		std::wstring path = Utf8ToWString(physicalPath(dir).c_str());
+		HANDLE h = FindFirstFileExW((path+L"\\*").c_str(),
+									FindExInfoStandard, &fd,
+									FindExSearchNameMatch,
+									NULL, 0);
+		if(h == INVALID_HANDLE_VALUE)
+			return;
+		
+		do{
+			if(!wcscmp(fd.cFileName, L".") || !wcscmp(fd.cFileName, L".."))
+				continue;
+			std::string name = prefix + Utf8FromWString(fd.cFileName);
+			if(fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY){
+				EnumAllFilesInner(name, lst);
+			}else{
+				lst.push_back(name);
+			}
+		}while(FindNextFileW(h, &fd));
+		
+		FindClose(h);
+#else
+		DIR *d = opendir(physicalPath(dir).c_str());
+		if(!d)
+			return;
+		
+		struct dirent *ent;
+		while((ent = readdir(d))){
+			if(!strcmp(ent->d_name, ".") || !strcmp(ent->d_name, ".."))
+				continue;
+			std::string name = prefix + ent->d_name;
+			
+			struct stat st;
+			if(stat(physicalPath(name).c_str(), &st) != 0)
+				continue;
+			if(S_ISDIR(st.st_mode)){
+				EnumAllFilesInner(name, lst);
+			}else{
+				lst.push_back(name);
+			}
+		}
+		
+		closedir(d);
+#endif
+	}
+	
+	bool DirectoryFileSystem::IsCaseSensitive() {
+#if defined(WIN32) || defined(__APPLE__)
+		return false;
+#else
+		return true;
+#endif
+	}
+	
 }
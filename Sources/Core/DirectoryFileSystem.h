@@ -29,6 +29,7 @@ namespace spades {
 		bool canWrite;
 		
 		std::string physicalPath(const std::string&);
+		void EnumAllFilesInner(const std::string& dir, std::vector<std::string>&);
 	public:
 		DirectoryFileSystem(const std::string& root, bool canWrite = true);
 		virtual ~DirectoryFileSystem();
@@ -38,6 +39,11 @@ namespace spades {
 		virtual IStream *OpenForReading(const char *);
 		virtual IStream *OpenForWriting(const char *);
 		virtual bool FileExists(const char *);
+		virtual std::string GetPhysicalPath(const char *);
+		
+		virtual bool EnumAllFiles(std::vector<std::string>&);
+		virtual bool IsCaseSensitive();
+		virtual bool IsWritable() { return canWrite; }
 		
 	};
 }
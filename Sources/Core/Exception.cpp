@@ -35,8 +35,8 @@ namespace spades {
 		shortMessage = message;
 	}
 	Exception::Exception(const char *file, int line, const char *format, ...) {
-		reflection::Backtrace& trace =
-		*reflection::Backtrace::GetGlobalBacktrace();
+		reflection::Backtrace *trace =
+		reflection::Backtrace::GetGlobalBacktrace();
 		
 		va_list va;
 		va_start(va, format);
@@ -45,8 +45,9 @@ namespace spades {
 		message = buf;
 		shortMessage = message;
 		
+		// no backtrace before StartBacktrace is called
 		message = Format("{0}\nat {1}:{2}\n{3}", message,
-						 file, line, trace.ToString());
+						 file, line, trace ? trace->ToString() : std::string("(none)"));
 	}
 	Exception::~Exception() throw(){}
 	const char *Exception::what() const throw() {
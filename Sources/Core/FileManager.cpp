@@ -25,34 +25,226 @@
 #include "IStream.h"
 #include "Debug.h"
 #include <set>
+#include <map>
+#include <mutex>
+#include <unordered_map>
 
 namespace spades {
 	static std::list<IFileSystem *> g_fileSystems;
+	
+	namespace {
+		struct IndexEntry {
+			/** position in g_fileSystems; smaller is searched first. */
+			int order;
+			IFileSystem *fs;
+			/** as listed by the file system, with '/' as the separator. */
+			std::string path;
+			bool caseSensitive;
+		};
+		
+		struct MountInfo {
+			int order;
+			bool indexed;
+			bool writable;
+		};
+		
+		std::mutex g_indexMutex;
+		/** lower-cased path to the file systems that have it, in
+		 * the search order. */
+		std::unordered_map<std::string, std::vector<IndexEntry>> g_index;
+		std::map<IFileSystem *, MountInfo> g_mounts;
+		int g_numUnindexed = 0;
+		/** indexed file systems that are asked on an index miss. */
+		int g_numWritable = 0;
+		int g_firstOrder = 0, g_lastOrder = 0;
+		FileManager::Statistics g_stats = {0, 0, 0, 0, 0};
+	}
+	
+	static std::string NormalizePath(const char *fn) {
+		std::string path = fn;
+		for(std::size_t i = 0; i < path.size(); i++)
+			if(path[i] == '\\') path[i] = '/';
+		return path;
+	}
+	
+	static std::string FoldPath(const std::string& path) {
+		std::string key = path;
+		for(std::size_t i = 0; i < key.size(); i++)
+			key[i] = tolower(key[i]);
+		return key;
+	}
+	
+	/** paths that aren't canonical might be found by a file system
+	 * even if they aren't in the index. */
+	static bool IsIndexablePath(const std::string& path) {
+		if(path.empty() || path[0] == '/')
+			return false;
+		if(path.find("//") != std::string::npos)
+			return false;
+		if(path == "." || path == ".." ||
+		   path.compare(0, 2, "./") == 0 || path.compare(0, 3, "../") == 0 ||
+		   path.find("/./") != std::string::npos ||
+		   path.find("/../") != std::string::npos)
+			return false;
+		return true;
+	}
+	
+	/** @return true if `entry` refers to `path`. */
+	static bool Matches(const IndexEntry& entry, const std::string& path) {
+		return !entry.caseSensitive || entry.path == path;
+	}
+	
+	/** g_indexMutex must be held. */
+	static void AddToIndex(IFileSystem *fs, const MountInfo& mount,
+						   const std::string& path) {
+		IndexEntry entry;
+		entry.order = mount.order;
+		entry.fs = fs;
+		entry.path = path;
+		entry.caseSensitive = fs->IsCaseSensitive();
+		
+		auto& entries = g_index[FoldPath(path)];
+		auto it = entries.begin();
+		while(it != entries.end() && it->order < entry.order)
+			++it;
+		for(; it != entries.end() && it->order == entry.order; ++it) {
+			if(Matches(*it, path))
+				return; // already indexed
+		}
+		entries.insert(it, entry);
+		g_stats.numIndexedFiles++;
+	}
+	
+	static void MountFileSystem(IFileSystem *fs, int order) {
+		SPADES_MARK_FUNCTION();
+		
+		std::vector<std::string> files;
+		bool indexed = fs->EnumAllFiles(files);
+		
+		std::lock_guard<std::mutex> lock(g_indexMutex);
+		MountInfo& mount = g_mounts[fs];
+		mount.order = order;
+		mount.indexed = indexed;
+		mount.writable = fs->IsWritable();
+		if(!indexed) {
+			g_numUnindexed++;
+			return;
+		}
+		if(mount.writable)
+			g_numWritable++;
+		for(size_t i = 0; i < files.size(); i++)
+			AddToIndex(fs, mount, NormalizePath(files[i].c_str()));
+	}
+	
+	/** finds the file system the file should be read from.
+	 * @return NULL if not found. */
+	static IFileSystem *Resolve(const char *fn) {
+		SPADES_MARK_FUNCTION_DEBUG();
+		
+		std::string path = NormalizePath(fn);
+		bool indexable = IsIndexablePath(path);
+		{
+			std::lock_guard<std::mutex> lock(g_indexMutex);
+			g_stats.numLookups++;
+			
+			if(indexable && g_numUnindexed == 0) {
+				auto it = g_index.find(FoldPath(path));
+				if(it != g_index.end()) {
+					for(const auto& entry: it->second) {
+						if(Matches(entry, path)) {
+							g_stats.numIndexedLookups++;
+							return entry.fs;
+						}
+					}
+				}
+				if(g_numWritable == 0) {
+					g_stats.numIndexedLookups++;
+					g_stats.numNotFound++;
+					return NULL;
+				}
+			}
+		}
+		
+		// some file systems have to be asked one by one.
+		// (g_fileSystems is only modified while mounting)
+		std::string key = FoldPath(path);
+		for(auto *fs: g_fileSystems){
+			bool inIndex = false, indexed = false, writable = false;
+			if(indexable) {
+				std::lock_guard<std::mutex> lock(g_indexMutex);
+				auto mount = g_mounts.find(fs);
+				indexed = mount != g_mounts.end() && mount->second.indexed;
+				writable = indexed && mount->second.writable;
+				if(indexed) {
+					auto it = g_index.find(key);
+					if(it != g_index.end()) {
+						for(const auto& entry: it->second) {
+							if(entry.fs == fs && Matches(entry, path))
+								inIndex = true;
+						}
+					}
+				}
+			}
+			if(indexed) {
+				if(inIndex)
+					return fs;
+				if(!writable)
+					continue;
+			}
+			
+			{
+				std::lock_guard<std::mutex> lock(g_indexMutex);
+				g_stats.numProbes++;
+			}
+			if(fs->FileExists(fn)) {
+				if(indexed) {
+					// added after it was indexed
+					std::lock_guard<std::mutex> lock(g_indexMutex);
+					AddToIndex(fs, g_mounts[fs], path);
+				}
+				return fs;
+			}
+		}
+		
+		std::lock_guard<std::mutex> lock(g_indexMutex);
+		g_stats.numNotFound++;
+		return NULL;
+	}
+	
 	IStream *FileManager::OpenForReading(const char *fn) {
 		SPADES_MARK_FUNCTION();
 		if(!fn) SPInvalidArgument("fn");
 		if(fn[0] == 0) SPFileNotFound(fn);
-		for(auto *fs: g_fileSystems){
-			if(fs->FileExists(fn))
-				return fs->OpenForReading(fn);
-		}
+		IFileSystem *fs = Resolve(fn);
+		if(fs)
+			return fs->OpenForReading(fn);
 		SPFileNotFound(fn);
 	}
 	IStream *FileManager::OpenForWriting(const char *fn) {
 		SPADES_MARK_FUNCTION();
 		if(!fn) SPInvalidArgument("fn");
 		if(fn[0] == 0) SPFileNotFound(fn);
-		for(auto *fs: g_fileSystems){
-			if(fs->FileExists(fn))
-				return fs->OpenForWriting(fn);
-		}
+		IFileSystem *fs = Resolve(fn);
+		if(fs)
+			return fs->OpenForWriting(fn);
 		
 		// create file
 		for(auto *fs: g_fileSystems){
+			IStream *stream;
 			try{
-				return fs->OpenForWriting(fn);
+				stream = fs->OpenForWriting(fn);
 			}catch(...){
+				continue;
+			}
+			
+			std::string path = NormalizePath(fn);
+			if(IsIndexablePath(path)) {
+				std::lock_guard<std::mutex> lock(g_indexMutex);
+				const MountInfo& mount = g_mounts[fs];
+				if(mount.indexed)
+					AddToIndex(fs, mount, path);
 			}
+			return stream;
 		}
 		
 		SPRaise("No filesystem is writable");
@@ -61,11 +253,17 @@ namespace spades {
 		SPADES_MARK_FUNCTION();
 		if(!fn) SPInvalidArgument("fn");
 		
-		for(auto *fs: g_fileSystems){
-			if(fs->FileExists(fn))
-				return true;
-		}
-		return false;
+		return Resolve(fn) != NULL;
+	}
+	
+	std::string FileManager::GetPhysicalPath(const char *fn) {
+		SPADES_MARK_FUNCTION();
+		if(!fn) SPInvalidArgument("fn");
+		
+		IFileSystem *fs = Resolve(fn);
+		if(fs)
+			return fs->GetPhysicalPath(fn);
+		return std::string();
 	}
 	
 	void FileManager::AddFileSystem(spades::IFileSystem *fs){
@@ -79,12 +277,27 @@ namespace spades {
 		if(!fs) SPInvalidArgument("fs");
 		
 		g_fileSystems.push_back(fs);
+		MountFileSystem(fs, ++g_lastOrder);
 	}
 	void FileManager::PrependFileSystem(spades::IFileSystem *fs){
 		SPADES_MARK_FUNCTION();
 		if(!fs) SPInvalidArgument("fs");
 		
 		g_fileSystems.push_front(fs);
+		MountFileSystem(fs, --g_firstOrder);
+	}
+	
+	FileManager::Statistics FileManager::GetStatistics() {
+		std::lock_guard<std::mutex> lock(g_indexMutex);
+		return g_stats;
+	}
+	
+	void FileManager::ResetStatistics() {
+		std::lock_guard<std::mutex> lock(g_indexMutex);
+		g_stats.numLookups = 0;
+		g_stats.numIndexedLookups = 0;
+		g_stats.numProbes = 0;
+		g_stats.numNotFound = 0;
 	}
 	
 	std::string FileManager::ReadAllBytes(const char *fn) {
@@ -22,20 +22,44 @@
 
 #include <string>
 #include <vector>
+#include <stdint.h>
 
 namespace spades {
 	class IStream;
 	class IFileSystem;
+	/** virtual file system made of the mounted file systems.
+	 * files of the file systems that support IFileSystem::EnumAllFiles
+	 * are indexed when mounted (and when written through FileManager),
+	 * so looking up a path doesn't touch the file systems.
+	 * writable file systems are still asked for the paths that aren't
+	 * in the index, so files added by other programs are found. */
 	class FileManager {
 		FileManager() {}
 	public:
+		struct Statistics {
+			uint64_t numLookups;
+			/** lookups resolved by the index alone. */
+			uint64_t numIndexedLookups;
+			/** calls to FileExists of file systems that aren't indexed,
+			 * and of writable ones on an index miss. */
+			uint64_t numProbes;
+			uint64_t numNotFound;
+			size_t numIndexedFiles;
+		};
+		
 		static IStream *OpenForReading(const char *);
 		static IStream *OpenForWriting(const char *);
 		static bool FileExists(const char *);
+		/** @return path of the file in the native file system, or an
+		 * empty string if the file found first isn't a separate file. */
+		static std::string GetPhysicalPath(const char *);
 		static void AddFileSystem(IFileSystem *);
 		static void AppendFileSystem(IFileSystem *);
 		static void PrependFileSystem(IFileSystem *);
 		static std::vector<std::string> EnumFiles(const char *);
 		static std::string ReadAllBytes(const char *);
+		
+		static Statistics GetStatistics();
+		static void ResetStatistics();
 	};
 };
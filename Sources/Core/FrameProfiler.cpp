@@ -0,0 +1,571 @@
+/*
+ Copyright (c) 2013 yvt
+ 
+ This file is part of OpenSpades.
+ 
+ OpenSpades is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ 
+ OpenSpades is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with OpenSpades.  If not, see <http://www.gnu.org/licenses/>.
+ 
+ */
+
+#include "FrameProfiler.h"
+#include "Debug.h"
+#include "IStream.h"
+#include "FileManager.h"
+#include "Settings.h"
+#include "ThreadLocalStorage.h"
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+SPADES_SETTING(core_frameProfiler, "0");
+SPADES_SETTING(core_frameProfilerTrace, "0");
+
+namespace spades {
+
+	std::atomic<bool> FrameProfiler::enabled(false);
+	
+	enum {
+		/** number of events in the ring buffer of each thread.
+		 * must be a power of two. */
+		RingSize = 8192,
+		/** number of frames between reports. */
+		ReportInterval = 300
+	};
+	
+	namespace {
+		enum EventType {
+			BeginEvent,
+			EndEvent
+		};
+		
+		struct Event {
+			/** NULL for EndEvent. */
+			const char *name;
+			/** nanoseconds of the steady clock. */
+			int64_t time;
+			/** number of zones the zone is nested in. */
+			int32_t depth;
+			int32_t type;
+		};
+		
+		struct OpenZone {
+			int node;
+			int64_t beginTime;
+		};
+		
+		struct ThreadState {
+			std::unique_ptr<Event[]> events;
+			/** written by the owner thread. */
+			std::atomic<size_t> head;
+			/** written by MarkFrame. */
+			std::atomic<size_t> tail;
+			
+			/** set when the owner thread exits. */
+			std::atomic<bool> abandoned;
+			
+			int threadIndex;
+			
+			/** used by the owner thread only. */
+			int depth;
+			
+			/** used by MarkFrame only. */
+			std::vector<OpenZone> openZones;
+			
+			ThreadState(int threadIndex):
+			events(new Event[RingSize]), head(0), tail(0),
+			abandoned(false), threadIndex(threadIndex), depth(0) {}
+		};
+		
+		/** fast path; ThreadStateStorage is only used to know when
+		 * the thread exits. */
+		static SPADES_THREAD_LOCAL ThreadState *currentThread = NULL;
+		
+		class ThreadStateStorage: public ThreadLocalStorage<ThreadState> {
+		public:
+			ThreadStateStorage(): ThreadLocalStorage<ThreadState>("frameProfilerThread") {}
+			void operator =(ThreadState *ptr) {
+				*static_cast<ThreadLocalStorage<ThreadState> *>(this) = ptr;
+			}
+			virtual void Destruct(void *v) {
+				// called by the exiting thread.
+				// MarkFrame deletes the state after reading the rest
+				currentThread = NULL;
+				reinterpret_cast<ThreadState *>(v)->abandoned = true;
+			}
+		};
+		
+		/** orders the zones by name rather than by address, since the
+		 * same literal can have different addresses in different
+		 * translation units. */
+		struct NodeKeyLess {
+			bool operator ()(const std::pair<int, const char *>& a,
+							 const std::pair<int, const char *>& b) const {
+				if(a.first != b.first)
+					return a.first < b.first;
+				return strcmp(a.second, b.second) < 0;
+			}
+		};
+		
+		/** a zone in a specific place of the hierarchy. */
+		struct Node {
+			const char *name;
+			int parent;
+			int threadIndex;
+			int depth;
+			std::vector<int> children;
+			
+			/** in the current frame. */
+			int64_t frameTime;
+			int frameCalls;
+			
+			/** in the current report interval. */
+			int numFrames;
+			int numCalls;
+			int64_t totalTime;
+			int64_t minTime;
+			int64_t maxTime;
+		};
+		
+		struct ProfilerState {
+			/** protects threads and nextThreadIndex. */
+			std::mutex threadsMutex;
+			std::vector<ThreadState *> threads;
+			int nextThreadIndex;
+			ThreadStateStorage threadStorage;
+			
+			std::atomic<uint64_t> numDropped;
+			
+			// the rest is used by MarkFrame only.
+			std::vector<Node> nodes;
+			std::map<std::pair<int, const char *>, int, NodeKeyLess> nodeMap;
+			/** nodes entered in the current frame. */
+			std::vector<int> touchedNodes;
+			
+			int mainThreadIndex;
+			int64_t lastFrameTime;
+			int numFrames;
+			int64_t totalFrameTime;
+			int64_t minFrameTime;
+			int64_t maxFrameTime;
+			uint64_t numReportedDropped;
+			
+			bool tracing;
+			int traceFramesLeft;
+			int64_t traceStartTime;
+			std::string trace;
+			std::vector<bool> tracedThreads;
+			
+			ProfilerState():
+			nextThreadIndex(0), numDropped(0),
+			mainThreadIndex(-1), lastFrameTime(0), numFrames(0),
+			totalFrameTime(0), minFrameTime(0), maxFrameTime(0),
+			numReportedDropped(0),
+			tracing(false), traceFramesLeft(0), traceStartTime(0) {}
+		};
+		
+		static ProfilerState& GetState() {
+			static ProfilerState *state = new ProfilerState();
+			return *state;
+		}
+		
+		static ThreadState *GetThreadState() {
+			ThreadState *s = currentThread;
+			if(s == NULL) {
+				ProfilerState& state = GetState();
+				{
+					std::lock_guard<std::mutex> lock(state.threadsMutex);
+					s = new ThreadState(state.nextThreadIndex++);
+					state.threads.push_back(s);
+				}
+				state.threadStorage = s;
+				currentThread = s;
+			}
+			return s;
+		}
+		
+		static int64_t GetTime() {
+			return std::chrono::duration_cast<std::chrono::nanoseconds>
+			(std::chrono::steady_clock::now().time_since_epoch()).count();
+		}
+		
+		static void PushEvent(ThreadState *s, const char *name,
+							  int32_t depth, EventType type) {
+			size_t h = s->head.load(std::memory_order_relaxed);
+			size_t t = s->tail.load(std::memory_order_acquire);
+			if(h - t >= RingSize) {
+				GetState().numDropped.fetch_add(1, std::memory_order_relaxed);
+				return;
+			}
+			Event& e = s->events[h & (RingSize - 1)];
+			e.name = name;
+			e.time = GetTime();
+			e.depth = depth;
+			e.type = type;
+			s->head.store(h + 1, std::memory_order_release);
+		}
+		
+		static int GetNode(ProfilerState& state, int parent,
+						   int threadIndex, const char *name) {
+			// roots are distinguished by the thread
+			int key = parent >= 0 ? parent : -1 - threadIndex;
+			auto it = state.nodeMap.find(std::make_pair(key, name));
+			if(it != state.nodeMap.end())
+				return it->second;
+			
+			Node node;
+			node.name = name;
+			node.parent = parent;
+			node.threadIndex = threadIndex;
+			node.depth = parent >= 0 ? state.nodes[parent].depth + 1 : 0;
+			node.frameTime = 0;
+			node.frameCalls = 0;
+			node.numFrames = 0;
+			node.numCalls = 0;
+			node.totalTime = 0;
+			node.minTime = 0;
+			node.maxTime = 0;
+			
+			int index = static_cast<int>(state.nodes.size());
+			state.nodes.push_back(node);
+			if(parent >= 0)
+				state.nodes[parent].children.push_back(index);
+			state.nodeMap[std::make_pair(key, name)] = index;
+			return index;
+		}
+		
+		static void AppendJsonString(std::string& out, const char *str) {
+			out += '"';
+			for(; *str; str++) {
+				char c = *str;
+				if(c == '"' || c == '\\') {
+					out += '\\';
+					out += c;
+				}else if(static_cast<unsigned char>(c) < 0x20) {
+					char buf[8];
+					sprintf(buf, "\\u%04x", (int)c);
+					out += buf;
+				}else{
+					out += c;
+				}
+			}
+			out += '"';
+		}
+		
+		static void TraceZone(ProfilerState& state, int threadIndex,
+							  const char *name, int64_t beginTime,
+							  int64_t endTime) {
+			// zones that began before the trace are clipped
+			beginTime = std::max(beginTime, state.traceStartTime);
+			
+			char buf[128];
+			if(!state.trace.empty())
+				state.trace += ",\n";
+			state.trace += "{\"name\":";
+			AppendJsonString(state.trace, name);
+			sprintf(buf, ",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+					threadIndex,
+					(double)(beginTime - state.traceStartTime) / 1000.,
+					(double)(endTime - beginTime) / 1000.);
+			state.trace += buf;
+			
+			if(state.tracedThreads.size() <= static_cast<size_t>(threadIndex))
+				state.tracedThreads.resize(threadIndex + 1, false);
+			state.tracedThreads[threadIndex] = true;
+		}
+		
+		static void ProcessEvent(ProfilerState& state, ThreadState& thread,
+								 const Event& e) {
+			std::vector<OpenZone>& open = thread.openZones;
+			size_t depth = static_cast<size_t>(e.depth);
+			
+			// events can be missing when the ring was full, or when
+			// the profiler was enabled while the zones were open
+			if(e.type == BeginEvent) {
+				if(open.size() > depth)
+					open.resize(depth);
+				while(open.size() < depth) {
+					OpenZone z;
+					z.node = GetNode(state, open.empty() ? -1 : open.back().node,
+									 thread.threadIndex, "(unknown)");
+					z.beginTime = e.time;
+					open.push_back(z);
+				}
+				OpenZone z;
+				z.node = GetNode(state, open.empty() ? -1 : open.back().node,
+								 thread.threadIndex, e.name);
+				z.beginTime = e.time;
+				open.push_back(z);
+			}else{
+				if(open.size() <= depth)
+					return;
+				open.resize(depth + 1);
+				OpenZone z = open.back();
+				open.pop_back();
+				
+				Node& node = state.nodes[z.node];
+				if(node.frameCalls == 0)
+					state.touchedNodes.push_back(z.node);
+				node.frameTime += e.time - z.beginTime;
+				node.frameCalls++;
+				
+				if(state.tracing)
+					TraceZone(state, thread.threadIndex, node.name,
+							  z.beginTime, e.time);
+			}
+		}
+		
+		/** reads the events of all threads. */
+		static void Collect(ProfilerState& state) {
+			std::vector<ThreadState *> threads;
+			{
+				std::lock_guard<std::mutex> lock(state.threadsMutex);
+				threads = state.threads;
+			}
+			
+			for(size_t i = 0; i < threads.size(); i++) {
+				ThreadState& thread = *threads[i];
+				// read abandoned before head so that no event is
+				// added after the last read
+				bool abandoned = thread.abandoned.load(std::memory_order_acquire);
+				size_t t = thread.tail.load(std::memory_order_relaxed);
+				size_t h = thread.head.load(std::memory_order_acquire);
+				for(; t != h; t++)
+					ProcessEvent(state, thread, thread.events[t & (RingSize - 1)]);
+				thread.tail.store(t, std::memory_order_release);
+				
+				if(abandoned) {
+					std::lock_guard<std::mutex> lock(state.threadsMutex);
+					state.threads.erase(std::find(state.threads.begin(),
+												  state.threads.end(),
+												  threads[i]));
+					delete threads[i];
+				}
+			}
+		}
+		
+		static void EndFrame(ProfilerState& state, int64_t frameTime) {
+			for(size_t i = 0; i < state.touchedNodes.size(); i++) {
+				Node& node = state.nodes[state.touchedNodes[i]];
+				if(node.numFrames == 0) {
+					node.minTime = node.maxTime = node.frameTime;
+				}else{
+					node.minTime = std::min(node.minTime, node.frameTime);
+					node.maxTime = std::max(node.maxTime, node.frameTime);
+				}
+				node.numFrames++;
+				node.numCalls += node.frameCalls;
+				node.totalTime += node.frameTime;
+				node.frameTime = 0;
+				node.frameCalls = 0;
+			}
+			state.touchedNodes.clear();
+			
+			if(state.numFrames == 0) {
+				state.minFrameTime = state.maxFrameTime = frameTime;
+			}else{
+				state.minFrameTime = std::min(state.minFrameTime, frameTime);
+				state.maxFrameTime = std::max(state.maxFrameTime, frameTime);
+			}
+			state.totalFrameTime += frameTime;
+			state.numFrames++;
+		}
+		
+		static void ResetStatistics(ProfilerState& state) {
+			for(size_t i = 0; i < state.nodes.size(); i++) {
+				Node& node = state.nodes[i];
+				node.numFrames = 0;
+				node.numCalls = 0;
+				node.totalTime = 0;
+			}
+			state.numFrames = 0;
+			state.totalFrameTime = 0;
+		}
+		
+		static void FormatNode(ProfilerState& state, int index, std::string& out) {
+			const Node& node = state.nodes[index];
+			if(node.numFrames == 0)
+				return;
+			
+			char buf[512];
+			int indent = (node.depth + 1) * 2;
+			for(int i = 0; i < indent; i++)
+				buf[i] = ' ';
+			sprintf(buf + indent, "%.200s - avg %.3fms, min %.3fms, max %.3fms, "
+					"%.1f call(s) in %d frame(s)\n",
+					node.name,
+					(double)node.totalTime / (double)node.numFrames / 1.e+6,
+					(double)node.minTime / 1.e+6,
+					(double)node.maxTime / 1.e+6,
+					(double)node.numCalls / (double)node.numFrames,
+					node.numFrames);
+			out += buf;
+			
+			for(size_t i = 0; i < node.children.size(); i++)
+				FormatNode(state, node.children[i], out);
+		}
+		
+		static void Report(ProfilerState& state) {
+			char buf[256];
+			uint64_t dropped = state.numDropped.load();
+			sprintf(buf, "Frame Profile [%d frame(s)] - avg %.3fms, min %.3fms, max %.3fms",
+					state.numFrames,
+					(double)state.totalFrameTime / (double)state.numFrames / 1.e+6,
+					(double)state.minFrameTime / 1.e+6,
+					(double)state.maxFrameTime / 1.e+6);
+			std::string out = buf;
+			if(dropped != state.numReportedDropped) {
+				sprintf(buf, " (%llu event(s) dropped)",
+						(unsigned long long)(dropped - state.numReportedDropped));
+				out += buf;
+				state.numReportedDropped = dropped;
+			}
+			out += "\n";
+			
+			// roots are sorted by the thread
+			std::vector<int> roots;
+			for(size_t i = 0; i < state.nodes.size(); i++) {
+				if(state.nodes[i].parent == -1)
+					roots.push_back(static_cast<int>(i));
+			}
+			std::stable_sort(roots.begin(), roots.end(), [&](int a, int b) {
+				return state.nodes[a].threadIndex < state.nodes[b].threadIndex;
+			});
+			int lastThread = -1;
+			for(size_t i = 0; i < roots.size(); i++) {
+				const Node& node = state.nodes[roots[i]];
+				if(node.numFrames == 0)
+					continue;
+				if(node.threadIndex != lastThread) {
+					lastThread = node.threadIndex;
+					if(lastThread == state.mainThreadIndex)
+						sprintf(buf, "Thread %d (main)\n", lastThread);
+					else
+						sprintf(buf, "Thread %d\n", lastThread);
+					out += buf;
+				}
+				FormatNode(state, roots[i], out);
+			}
+			
+			SPLog("%s", out.c_str());
+		}
+		
+		static void WriteTrace(ProfilerState& state) {
+			std::string out = "{\"traceEvents\":[\n";
+			char buf[128];
+			for(size_t i = 0; i < state.tracedThreads.size(); i++) {
+				if(!state.tracedThreads[i])
+					continue;
+				int index = static_cast<int>(i);
+				if(index == state.mainThreadIndex)
+					sprintf(buf, "Thread %d (main)", index);
+				else
+					sprintf(buf, "Thread %d", index);
+				out += "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,";
+				sprintf(buf + 64, "\"tid\":%d,\"args\":{\"name\":", index);
+				out += buf + 64;
+				AppendJsonString(out, buf);
+				out += "}},\n";
+			}
+			out += state.trace;
+			out += "\n],\"displayTimeUnit\":\"ms\"}\n";
+			
+			const char *path = "FrameTrace.json";
+			try{
+				std::unique_ptr<IStream> stream(FileManager::OpenForWriting(path));
+				stream->Write(out);
+				SPLog("Frame trace written to '%s'", path);
+			}catch(const std::exception& ex){
+				SPLog("Failed to write the frame trace to '%s': %s",
+					  path, ex.what());
+			}
+			
+			state.trace.clear();
+			state.tracedThreads.clear();
+		}
+	}
+	
+	void FrameProfiler::BeginZone(const char *name) {
+		ThreadState *s = GetThreadState();
+		PushEvent(s, name, s->depth, BeginEvent);
+		s->depth++;
+	}
+	
+	void FrameProfiler::EndZone() {
+		ThreadState *s = GetThreadState();
+		if(s->depth == 0)
+			return;
+		s->depth--;
+		PushEvent(s, NULL, s->depth, EndEvent);
+	}
+	
+	void FrameProfiler::MarkFrame() {
+		ProfilerState& state = GetState();
+		bool wasEnabled = IsEnabled();
+		int64_t now = GetTime();
+		
+		// this also deletes the states of the exited threads
+		Collect(state);
+		
+		if(wasEnabled) {
+			state.mainThreadIndex = GetThreadState()->threadIndex;
+			if(state.lastFrameTime != 0)
+				EndFrame(state, now - state.lastFrameTime);
+			
+			if(state.tracing && --state.traceFramesLeft <= 0) {
+				state.tracing = false;
+				WriteTrace(state);
+			}
+			
+			if(state.numFrames >= ReportInterval) {
+				if(core_frameProfiler)
+					Report(state);
+				ResetStatistics(state);
+			}
+		}else{
+			// zones that were open when the profiler was disabled
+			for(size_t i = 0; i < state.touchedNodes.size(); i++) {
+				Node& node = state.nodes[state.touchedNodes[i]];
+				node.frameTime = 0;
+				node.frameCalls = 0;
+			}
+			state.touchedNodes.clear();
+		}
+		
+		int numTraceFrames = core_frameProfilerTrace;
+		if(numTraceFrames > 0) {
+			// the trace is taken only once per request
+			core_frameProfilerTrace = 0;
+			if(!state.tracing) {
+				state.tracing = true;
+				state.traceFramesLeft = numTraceFrames;
+				state.traceStartTime = now;
+				SPLog("Recording a frame trace of %d frame(s)", numTraceFrames);
+			}
+		}
+		
+		bool enable = core_frameProfiler || state.tracing;
+		if(enable != wasEnabled) {
+			ResetStatistics(state);
+			enabled = enable;
+		}
+		state.lastFrameTime = enable ? now : 0;
+	}
+}
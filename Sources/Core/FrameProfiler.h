@@ -0,0 +1,75 @@
+/*
+ Copyright (c) 2013 yvt
+ 
+ This file is part of OpenSpades.
+ 
+ OpenSpades is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ 
+ OpenSpades is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with OpenSpades.  If not, see <http://www.gnu.org/licenses/>.
+ 
+ */
+
+#pragma once
+
+#include <atomic>
+
+namespace spades {
+	/** Measures the time spent in scoped zones, on any thread.
+	 *
+	 * Each thread records the beginning and the end of its zones into
+	 * its own lock-free ring buffer, so a zone costs two clock reads
+	 * and two stores while the profiler is enabled, and a single load
+	 * otherwise. MarkFrame collects the records once per frame,
+	 * builds the zone hierarchy of each thread and accumulates the
+	 * per-frame time of each zone.
+	 *
+	 * - `core_frameProfiler 1` logs the minimum, average and maximum
+	 *   time per frame of each zone every few seconds.
+	 * - `core_frameProfilerTrace N` writes the next N frames to
+	 *   FrameTrace.json, which can be loaded by chrome://tracing.
+	 *
+	 * Zones are identified by their names, which must stay valid
+	 * while the program runs; usually a string literal is used. */
+	class FrameProfiler {
+		static std::atomic<bool> enabled;
+	
+	public:
+		class Zone {
+			bool active;
+		public:
+			Zone(const char *name): active(IsEnabled()) {
+				if(active)
+					BeginZone(name);
+			}
+			~Zone() {
+				if(active)
+					EndZone();
+			}
+		};
+		
+		static bool IsEnabled() {
+			return enabled.load(std::memory_order_relaxed);
+		}
+		
+		/** prefer Zone unless the zone doesn't fit a scope.
+		 * EndZone must be called on the same thread. */
+		static void BeginZone(const char *name);
+		static void EndZone();
+		
+		/** must be called by the main loop at the end of each frame.
+		 * also applies the changes to the settings. */
+		static void MarkFrame();
+	};
+}
+
+#define SPADES_PROFILE_ZONE(name) \
+::spades::FrameProfiler::Zone profileZone(name)
@@ -32,5 +32,20 @@ namespace spades {
 		virtual IStream *OpenForWriting(const char *) = 0;
 		virtual bool FileExists(const char *) = 0;
 		
+		/** @return path of the file in the native file system,
+		 * or an empty string if it's not stored as a separate file. */
+		virtual std::string GetPhysicalPath(const char *) { return std::string(); }
+		
+		/** lists the paths of all files, for FileManager's path index.
+		 * @return false if the file system can't be indexed, in which
+		 * case FileExists is called for every lookup. */
+		virtual bool EnumAllFiles(std::vector<std::string>&) { return false; }
+		/** whether paths only differing in case refer to different files. */
+		virtual bool IsCaseSensitive() { return true; }
+		/** files of a writable file system can also be added by other
+		 * programs while it's mounted, so FileManager asks it when a
+		 * path isn't in the index. */
+		virtual bool IsWritable() { return false; }
+		
 	};
 }
@@ -0,0 +1,130 @@
+/*
+ Copyright (c) 2013 yvt
+ 
+ This file is part of OpenSpades.
+ 
+ OpenSpades is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ 
+ OpenSpades is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with OpenSpades.  If not, see <http://www.gnu.org/licenses/>.
+ 
+ */
+
+#include "MappedFile.h"
+#include "Debug.h"
+#include "Exception.h"
+
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#endif
+
+namespace spades {
+#ifdef WIN32
+	MappedFile::MappedFile(const std::string& path):
+	data(NULL), size(0), fileHandle(NULL), mappingHandle(NULL) {
+		SPADES_MARK_FUNCTION();
+		
+		int len = MultiByteToWideChar(CP_UTF8, 0, path.c_str(), -1, NULL, 0);
+		std::wstring wpath(len, L'\0');
+		MultiByteToWideChar(CP_UTF8, 0, path.c_str(), -1, &wpath[0], len);
+		
+		HANDLE file = CreateFileW(wpath.c_str(), GENERIC_READ, FILE_SHARE_READ,
+								  NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+		if(file == INVALID_HANDLE_VALUE) {
+			SPRaise("Failed to open %s for mapping: error %d",
+					path.c_str(), (int)GetLastError());
+		}
+		fileHandle = file;
+		
+		LARGE_INTEGER fileSize;
+		if(!GetFileSizeEx(file, &fileSize)) {
+			CloseHandle(file);
+			SPRaise("Failed to get the size of %s", path.c_str());
+		}
+		size = static_cast<size_t>(fileSize.QuadPart);
+		if(size == 0) {
+			// empty files can't be mapped
+			return;
+		}
+		
+		HANDLE mapping = CreateFileMappingW(file, NULL, PAGE_READONLY, 0, 0, NULL);
+		if(mapping == NULL) {
+			CloseHandle(file);
+			SPRaise("Failed to map %s: error %d", path.c_str(), (int)GetLastError());
+		}
+		mappingHandle = mapping;
+		
+		data = static_cast<const unsigned char *>
+		(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+		if(data == NULL) {
+			CloseHandle(mapping);
+			CloseHandle(file);
+			SPRaise("Failed to map %s: error %d", path.c_str(), (int)GetLastError());
+		}
+	}
+	
+	MappedFile::~MappedFile() {
+		SPADES_MARK_FUNCTION();
+		if(data)
+			UnmapViewOfFile(data);
+		if(mappingHandle)
+			CloseHandle(mappingHandle);
+		if(fileHandle)
+			CloseHandle(fileHandle);
+	}
+#else
+	MappedFile::MappedFile(const std::string& path):
+	data(NULL), size(0) {
+		SPADES_MARK_FUNCTION();
+		
+		int fd = open(path.c_str(), O_RDONLY);
+		if(fd < 0) {
+			SPRaise("Failed to open %s for mapping: %s",
+					path.c_str(), strerror(errno));
+		}
+		
+		struct stat st;
+		if(fstat(fd, &st) != 0) {
+			int err = errno;
+			close(fd);
+			SPRaise("Failed to get the size of %s: %s",
+					path.c_str(), strerror(err));
+		}
+		size = static_cast<size_t>(st.st_size);
+		if(size == 0) {
+			// empty files can't be mapped
+			close(fd);
+			return;
+		}
+		
+		void *ptr = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+		// the mapping stays valid after the descriptor is closed
+		close(fd);
+		if(ptr == MAP_FAILED) {
+			SPRaise("Failed to map %s: %s", path.c_str(), strerror(errno));
+		}
+		data = static_cast<const unsigned char *>(ptr);
+	}
+	
+	MappedFile::~MappedFile() {
+		SPADES_MARK_FUNCTION();
+		if(data)
+			munmap(const_cast<unsigned char *>(data), size);
+	}
+#endif
+}
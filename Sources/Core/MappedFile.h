@@ -0,0 +1,45 @@
+/*
+ Copyright (c) 2013 yvt
+ 
+ This file is part of OpenSpades.
+ 
+ OpenSpades is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ 
+ OpenSpades is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with OpenSpades.  If not, see <http://www.gnu.org/licenses/>.
+ 
+ */
+
+#pragma once
+
+#include <string>
+#include <stddef.h>
+
+namespace spades {
+	/** read-only memory mapping of a whole file. */
+	class MappedFile {
+		const unsigned char *data;
+		size_t size;
+#ifdef WIN32
+		void *fileHandle;
+		void *mappingHandle;
+#endif
+	public:
+		/** @param path physical path of the file in UTF-8. */
+		MappedFile(const std::string& path);
+		MappedFile(const MappedFile&) = delete;
+		void operator =(const MappedFile&) = delete;
+		~MappedFile();
+		
+		const unsigned char *GetData() const { return data; }
+		size_t GetSize() const { return size; }
+	};
+}
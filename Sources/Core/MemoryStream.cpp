@@ -85,7 +85,7 @@ namespace spades {
 	
 	void MemoryStream::WriteByte(int byte) {
 		SPADES_MARK_FUNCTION();
-		if(canWrite){
+		if(!canWrite){
 			SPRaise("Write prohibited");
 		}
 		if(position >= length){
@@ -97,7 +97,7 @@ namespace spades {
 	
 	void MemoryStream::Write(const void *data, size_t bytes) {
 		SPADES_MARK_FUNCTION();
-		if(canWrite){
+		if(!canWrite){
 			SPRaise("Write prohibited");
 		}
 		if(position + (uint64_t)bytes > length ||
@@ -107,6 +107,7 @@ namespace spades {
 			memcpy(memory + (size_t)position,
 				   data,
 				   bytes);
+			position += (uint64_t)bytes;
 		}
 	}
 	
@@ -20,6 +20,7 @@
  */
 
 #include "MiniHeap.h"
+#include <algorithm>
 
 namespace spades {
 	bool MiniHeap::Validate() {
@@ -69,4 +70,23 @@ namespace spades {
 		}
 		return true;
 	}
+	
+	MiniHeap::Statistics MiniHeap::GetStatistics() {
+		Statistics stats;
+		stats.size = buffer.size();
+		stats.freeBytes = 0;
+		stats.numFreeRegions = 0;
+		stats.largestFreeRegion = 0;
+		
+		Ref fl = firstFreeRegion;
+		while(fl != NoFreeRegion) {
+			auto *f = Dereference<FreeRegion>(fl);
+			stats.freeBytes += f->len;
+			stats.numFreeRegions++;
+			stats.largestFreeRegion = std::max(stats.largestFreeRegion,
+											   static_cast<size_t>(f->len));
+			fl = f->next;
+		}
+		return stats;
+	}
 }
@@ -121,6 +121,14 @@ namespace spades {
 		}
 		
 	public:
+		struct Statistics {
+			/** size of the buffer, in bytes. */
+			size_t size;
+			size_t freeBytes;
+			size_t numFreeRegions;
+			size_t largestFreeRegion;
+		};
+		
 		MiniHeap(size_t initialSize) {
 			if(initialSize < sizeof(FreeRegion)) initialSize = sizeof(FreeRegion);
 			buffer.resize(initialSize);
@@ -141,6 +149,7 @@ namespace spades {
 			SPAssert(Validate());
 		}
 		bool Validate();
+		Statistics GetStatistics();
 		void Reserve(size_t bytes) {
 			size_t newSize = buffer.size();
 			while(newSize < bytes)
@@ -17,30 +17,222 @@
  along with OpenSpades.  If not, see <http://www.gnu.org/licenses/>.
  
  */
+#include <atomic>
+#include <condition_variable>
 #include <cstring>
 #include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <zlib.h>
 
 #include "IBitmapCodec.h"
 #include "Bitmap.h"
+#include "ConcurrentDispatch.h"
+#include "Debug.h"
+#include "Exception.h"
 #include "IStream.h"
+#include "Settings.h"
 
-#include "pnglite.h"
+// 0 (fastest, no compression) - 9 (smallest)
+SPADES_SETTING(core_pngLevel, "6");
+SPADES_SETTING(core_pngNumThreads, "4");
 
 namespace {
-	unsigned WriteCallback(void* input, std::size_t size, std::size_t numel, void* user_ptr) {
-		auto stream = static_cast<spades::IStream*>(user_ptr);
-		stream->Write(input, size * numel);
-		return size * numel;
+	enum {
+		/** each band costs a few bytes and loses the dictionary at
+		 * its start, so bands aren't made smaller than this. */
+		MinRowsPerBand = 64,
+		MaxBands = 32
+	};
+
+	enum {
+		FilterNone = 0,
+		FilterSub = 1,
+		FilterUp = 2,
+		FilterAverage = 3,
+		FilterPaeth = 4
+	};
+
+	const std::size_t BytesPerPixel = 4;
+
+	inline std::uint8_t Paeth(int a, int b, int c) {
+		int p = a + b - c;
+		int pa = std::abs(p - a);
+		int pb = std::abs(p - b);
+		int pc = std::abs(p - c);
+		if(pa <= pb && pa <= pc) return static_cast<std::uint8_t>(a);
+		if(pb <= pc) return static_cast<std::uint8_t>(b);
+		return static_cast<std::uint8_t>(c);
+	}
+
+	/** @param prev previous row, or a row of zeros for the first row. */
+	void FilterRow(int filter, const std::uint8_t *row, const std::uint8_t *prev,
+				   std::size_t len, std::uint8_t *out) {
+		const std::size_t bpp = BytesPerPixel;
+		switch(filter) {
+			case FilterNone:
+				std::memcpy(out, row, len);
+				break;
+			case FilterSub:
+				for(std::size_t i = 0; i < len; i++)
+					out[i] = row[i] - (i >= bpp ? row[i - bpp] : 0);
+				break;
+			case FilterUp:
+				for(std::size_t i = 0; i < len; i++)
+					out[i] = row[i] - prev[i];
+				break;
+			case FilterAverage:
+				for(std::size_t i = 0; i < len; i++)
+					out[i] = row[i] - static_cast<std::uint8_t>
+					(((i >= bpp ? row[i - bpp] : 0) + prev[i]) >> 1);
+				break;
+			case FilterPaeth:
+				for(std::size_t i = 0; i < len; i++)
+					out[i] = row[i] - (i >= bpp ?
+									   Paeth(row[i - bpp], prev[i], prev[i - bpp]) :
+									   Paeth(0, prev[i], 0));
+				break;
+		}
+	}
+
+	/** heuristic recommended by the PNG specification: the filter
+	 * whose output has the smallest sum of absolute values (as
+	 * signed bytes) tends to compress best. */
+	unsigned int FilterCost(const std::uint8_t *data, std::size_t len) {
+		unsigned int cost = 0;
+		for(std::size_t i = 0; i < len; i++)
+			cost += static_cast<unsigned int>(std::abs(static_cast<std::int8_t>(data[i])));
+		return cost;
+	}
+
+	/** rows [minY, maxY) of the image, filtered and deflated
+	 * independently of the other bands. */
+	struct Band {
+		int minY, maxY;
+		std::vector<std::uint8_t> data;
+		uLong adler;
+		uLong length;
+		std::string error;
+	};
+
+	void CompressBand(Band& band, spades::Bitmap *bmp, int level, bool last) {
+		const int w = bmp->GetWidth();
+		const int h = bmp->GetHeight();
+		const std::size_t rowBytes = static_cast<std::size_t>(w) * BytesPerPixel;
+		const std::uint8_t *pixels = reinterpret_cast<const std::uint8_t *>(bmp->GetPixels());
+		// bitmaps are bottom-up
+		auto getRow = [&](int y) {
+			return pixels + static_cast<std::size_t>(h - 1 - y) * rowBytes;
+		};
+
+		std::vector<std::uint8_t> zeros(rowBytes, 0);
+		std::vector<std::uint8_t> filtered((rowBytes + 1) * (band.maxY - band.minY));
+		std::vector<std::uint8_t> scratch(rowBytes);
+		std::uint8_t *out = filtered.data();
+		for(int y = band.minY; y < band.maxY; y++) {
+			const std::uint8_t *row = getRow(y);
+			const std::uint8_t *prev = y > 0 ? getRow(y - 1) : zeros.data();
+
+			int filter;
+			if(level == 0) {
+				filter = FilterNone;
+			}else if(level <= 3) {
+				// cheap and works well for rendered images
+				filter = FilterUp;
+			}else{
+				filter = FilterNone;
+				FilterRow(FilterNone, row, prev, rowBytes, out + 1);
+				unsigned int bestCost = FilterCost(out + 1, rowBytes);
+				for(int f = FilterSub; f <= FilterPaeth; f++) {
+					FilterRow(f, row, prev, rowBytes, scratch.data());
+					unsigned int cost = FilterCost(scratch.data(), rowBytes);
+					if(cost < bestCost) {
+						bestCost = cost;
+						filter = f;
+						std::memcpy(out + 1, scratch.data(), rowBytes);
+					}
+				}
+				out[0] = static_cast<std::uint8_t>(filter);
+				out += rowBytes + 1;
+				continue;
+			}
+
+			out[0] = static_cast<std::uint8_t>(filter);
+			FilterRow(filter, row, prev, rowBytes, out + 1);
+			out += rowBytes + 1;
+		}
+
+		band.length = static_cast<uLong>(filtered.size());
+		band.adler = adler32(adler32(0, Z_NULL, 0), filtered.data(), static_cast<uInt>(filtered.size()));
+
+		z_stream zs;
+		std::memset(&zs, 0, sizeof(zs));
+		// raw deflate; the zlib header and trailer are written by Save
+		if(deflateInit2(&zs, level, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+			band.error = "deflateInit2 failed";
+			return;
+		}
+
+		// deflateBound doesn't count the empty block of the sync flush
+		band.data.resize(deflateBound(&zs, band.length) + 16);
+		zs.next_in = filtered.data();
+		zs.avail_in = static_cast<uInt>(filtered.size());
+		zs.next_out = band.data.data();
+		zs.avail_out = static_cast<uInt>(band.data.size());
+
+		// the sync flush ends the band at a byte boundary without
+		// marking the final block, so the bands can be concatenated
+		// into a single deflate stream.
+		int ret = deflate(&zs, last ? Z_FINISH : Z_SYNC_FLUSH);
+		if(ret != (last ? Z_STREAM_END : Z_OK) || zs.avail_in != 0) {
+			band.error = "deflate failed";
+		}
+		band.data.resize(zs.total_out);
+		deflateEnd(&zs);
 	}
+
+	void WriteUInt32(std::uint8_t *p, std::uint32_t v) {
+		p[0] = static_cast<std::uint8_t>(v >> 24);
+		p[1] = static_cast<std::uint8_t>(v >> 16);
+		p[2] = static_cast<std::uint8_t>(v >> 8);
+		p[3] = static_cast<std::uint8_t>(v);
+	}
+
+	class ChunkWriter {
+		spades::IStream *stream;
+		uLong crc;
+	public:
+		ChunkWriter(spades::IStream *stream, const char *type, std::uint32_t length):
+		stream(stream) {
+			std::uint8_t header[8];
+			WriteUInt32(header, length);
+			std::memcpy(header + 4, type, 4);
+			stream->Write(header, 8);
+			crc = crc32(crc32(0, Z_NULL, 0), header + 4, 4);
+		}
+
+		void Write(const void *data, std::size_t len) {
+			stream->Write(data, len);
+			crc = crc32(crc, static_cast<const Bytef *>(data), static_cast<uInt>(len));
+		}
+
+		void End() {
+			std::uint8_t buf[4];
+			WriteUInt32(buf, static_cast<std::uint32_t>(crc));
+			stream->Write(buf, 4);
+		}
+	};
 }
 
 namespace spades {
+	/** PNG encoder that splits the image into horizontal bands, and
+	 * filters and deflates them on separate threads. */
 	class PngWriter : public IBitmapCodec {
 	public:
-		PngWriter() : IBitmapCodec() {
-			png_init(nullptr, nullptr);
-		}
-
 		virtual bool CanLoad(){
 			return false;
 		}
@@ -54,7 +246,7 @@ namespace spades {
 		}
 
 		virtual std::string GetName(){
-			static std::string name("libpng exporter");
+			static std::string name("PNG exporter");
 			return name;
 		}
 
@@ -67,27 +259,124 @@ namespace spades {
 		virtual void Save(IStream *stream, Bitmap *bmp){
 			SPADES_MARK_FUNCTION();
 
-			int err;
+			int level = core_pngLevel;
+			level = std::max(std::min(level, 9), 0);
+
+			const int w = bmp->GetWidth();
+			const int h = bmp->GetHeight();
+			if(w <= 0 || h <= 0) {
+				SPRaise("Cannot save an empty image as PNG");
+			}
+
+			int numBands = core_pngNumThreads;
+			numBands = std::min(numBands, h / MinRowsPerBand);
+			numBands = std::max(std::min(numBands, (int)MaxBands), 1);
+
+			std::vector<Band> bands(numBands);
+			for(int i = 0; i < numBands; i++) {
+				bands[i].minY = h * i / numBands;
+				bands[i].maxY = h * (i + 1) / numBands;
+			}
+
+			// Save itself can be run by a dispatch thread (see
+			// SnapshotWriter), so the helpers might never start while
+			// we wait. the caller takes the bands as well, and only
+			// waits for the bands a helper has actually taken.
+			struct State {
+				std::atomic<int> next;
+				std::atomic<int> done;
+				std::mutex mutex;
+				std::condition_variable cond;
+			};
+			auto state = std::make_shared<State>();
+			state->next = 0;
+			state->done = 0;
 
-			png_t png_s;
-			if((err = png_open_write(&png_s, &WriteCallback, stream))){
-				SPRaise("Error while png_open_write: %s", png_error_string(err));
+			Band *bandsPtr = bands.data();
+			auto work = [state, bandsPtr, numBands, bmp, level]() {
+				int count = 0;
+				int i;
+				while((i = state->next.fetch_add(1)) < numBands) {
+					// an exception must not leave the caller waiting
+					try{
+						CompressBand(bandsPtr[i], bmp, level, i == numBands - 1);
+					}catch(const std::exception& ex){
+						bandsPtr[i].error = ex.what();
+					}
+					count++;
+				}
+				if(count > 0 && state->done.fetch_add(count) + count == numBands) {
+					std::lock_guard<std::mutex> lock(state->mutex);
+					state->cond.notify_all();
+				}
+			};
+			for(int i = 1; i < numBands; i++) {
+				auto *dispatch = new FunctionDispatch<decltype(work)>(work);
+				dispatch->Start();
+				dispatch->Release();
 			}
+			work();
 
-			// Create flipped buffer
-			std::vector<std::uint8_t> buf(bmp->GetWidth() * bmp->GetHeight() * 4);
 			{
-				std::uint32_t *pixels = bmp->GetPixels();
-				auto width = bmp->GetWidth();
-				auto rowLengthBytes = width * sizeof(std::uint8_t) * 4;
+				std::unique_lock<std::mutex> lock(state->mutex);
+				state->cond.wait(lock, [&] { return state->done == numBands; });
+			}
 
-				for(long y = bmp->GetHeight() - 1; y >= 0; --y) {
-					std::memcpy(&buf[y*rowLengthBytes], pixels, rowLengthBytes);
-					pixels += width;
+			std::uint64_t idatLength = 2 + 4;
+			uLong adler = bands[0].adler;
+			for(int i = 0; i < numBands; i++) {
+				if(!bands[i].error.empty()) {
+					SPRaise("Error while encoding PNG: %s", bands[i].error.c_str());
 				}
+				idatLength += bands[i].data.size();
+				if(i > 0)
+					adler = adler32_combine(adler, bands[i].adler, bands[i].length);
+			}
+			if(idatLength > 0x7fffffff) {
+				SPRaise("Image is too large to be saved as PNG");
+			}
+
+			static const std::uint8_t signature[] = {
+				0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'
+			};
+			stream->Write(signature, sizeof(signature));
+
+			{
+				std::uint8_t ihdr[13];
+				WriteUInt32(ihdr, static_cast<std::uint32_t>(w));
+				WriteUInt32(ihdr + 4, static_cast<std::uint32_t>(h));
+				ihdr[8] = 8; // bit depth
+				ihdr[9] = 6; // truecolor with alpha
+				ihdr[10] = 0; // deflate
+				ihdr[11] = 0; // adaptive filtering
+				ihdr[12] = 0; // no interlace
+				ChunkWriter chunk(stream, "IHDR", sizeof(ihdr));
+				chunk.Write(ihdr, sizeof(ihdr));
+				chunk.End();
 			}
-			if((err = png_set_data(&png_s, bmp->GetWidth(), bmp->GetHeight(), 8, PNG_TRUECOLOR_ALPHA, buf.data()))){
-				SPRaise("Error while png_set_data: %s", png_error_string(err));
+
+			{
+				// zlib header. FLEVEL is only informative, but is set
+				// to match the level.
+				std::uint8_t header[2] = {0x78, 0x9c};
+				if(level < 2) header[1] = 0x01;
+				else if(level < 6) header[1] = 0x5e;
+				else if(level > 6) header[1] = 0xda;
+
+				std::uint8_t trailer[4];
+				WriteUInt32(trailer, static_cast<std::uint32_t>(adler));
+
+				ChunkWriter chunk(stream, "IDAT", static_cast<std::uint32_t>(idatLength));
+				chunk.Write(header, 2);
+				for(int i = 0; i < numBands; i++)
+					chunk.Write(bands[i].data.data(), bands[i].data.size());
+				chunk.Write(trailer, 4);
+				chunk.End();
+			}
+
+			{
+				ChunkWriter chunk(stream, "IEND", 0);
+				chunk.End();
 			}
 		}
 	};
@@ -0,0 +1,149 @@
+/*
+ Copyright (c) 2013 yvt
+ 
+ This file is part of OpenSpades.
+ 
+ OpenSpades is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ 
+ OpenSpades is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with OpenSpades.  If not, see <http://www.gnu.org/licenses/>.
+ 
+ */
+
+#include "SamplingProfiler.h"
+#include "Debug.h"
+#include "Thread.h"
+#include "IStream.h"
+#include "FileManager.h"
+#include "Stopwatch.h"
+#include "../Imports/SDL.h"
+#include <atomic>
+#include <map>
+#include <memory>
+#include <vector>
+#include <algorithm>
+#include <stdint.h>
+
+namespace spades {
+	
+	namespace {
+		typedef std::vector<const reflection::Function *> Stack;
+		
+		class SamplerThread: public Thread {
+			int intervalMs;
+			std::vector<reflection::Backtrace::Sample> samples;
+			
+		public:
+			std::atomic<bool> stopRequested;
+			
+			/** number of samples of each stack, by thread index. */
+			std::map<std::pair<int, Stack>, uint64_t> counts;
+			uint64_t numSamples;
+			double samplingTime;
+			
+			SamplerThread(int intervalMs):
+			intervalMs(intervalMs), stopRequested(false),
+			numSamples(0), samplingTime(0.) {}
+			
+			virtual void Run() {
+				reflection::Backtrace *self = reflection::Backtrace::GetGlobalBacktrace();
+				int selfIndex = self ? self->GetThreadIndex() : -1;
+				
+				while(!stopRequested) {
+					SDL_Delay(intervalMs);
+					
+					Stopwatch sw;
+					reflection::Backtrace::SampleAllThreads(samples);
+					for(size_t i = 0; i < samples.size(); i++) {
+						const reflection::Backtrace::Sample& sample = samples[i];
+						// threads outside of any marked functions are
+						// not doing anything interesting
+						if(sample.entries.empty() || sample.threadIndex == selfIndex)
+							continue;
+						counts[std::make_pair(sample.threadIndex, sample.entries)]++;
+					}
+					numSamples++;
+					samplingTime += sw.GetTime();
+				}
+			}
+		};
+		
+		static SamplerThread *sampler = NULL;
+		
+		/** frame names can't contain ';', which separates frames. */
+		static std::string MakeFrameName(const reflection::Function *f) {
+			std::string name = f ? f->GetName() : "(unknown)";
+			std::replace(name.begin(), name.end(), ';', ':');
+			return name;
+		}
+	}
+	
+	void SamplingProfiler::Start(int intervalMs) {
+		SPADES_MARK_FUNCTION();
+		
+		if(sampler)
+			return;
+		
+#if !SPADES_MARK_FUNCTIONS
+		SPLogWarning("Sampling profiler is enabled, but SPADES_MARK_FUNCTION is "
+					 "disabled in this build; the profile will be empty");
+#endif
+		
+		intervalMs = std::max(intervalMs, 1);
+		sampler = new SamplerThread(intervalMs);
+		sampler->Start();
+		SPLog("Sampling profiler started (interval: %dms)", intervalMs);
+	}
+	
+	bool SamplingProfiler::IsRunning() {
+		return sampler != NULL;
+	}
+	
+	void SamplingProfiler::Stop(const std::string& path) {
+		SPADES_MARK_FUNCTION();
+		
+		if(!sampler)
+			return;
+		
+		std::unique_ptr<SamplerThread> s(sampler);
+		sampler = NULL;
+		s->stopRequested = true;
+		s->Join();
+		
+		SPLog("Sampling profiler stopped: %llu samples, %d stacks, "
+			  "%.3fms per sample",
+			  (unsigned long long)s->numSamples, (int)s->counts.size(),
+			  s->numSamples ? s->samplingTime * 1000. / (double)s->numSamples : 0.);
+		
+		std::string out;
+		char buf[64];
+		for(auto it = s->counts.begin(); it != s->counts.end(); ++it) {
+			sprintf(buf, "thread %d", it->first.first);
+			out += buf;
+			const Stack& stack = it->first.second;
+			for(size_t i = 0; i < stack.size(); i++) {
+				out += ';';
+				out += MakeFrameName(stack[i]);
+			}
+			sprintf(buf, " %llu\n", (unsigned long long)it->second);
+			out += buf;
+		}
+		
+		try{
+			std::unique_ptr<IStream> stream(FileManager::OpenForWriting(path.c_str()));
+			stream->Write(out);
+			SPLog("Sampling profile written to '%s'", path.c_str());
+		}catch(const std::exception& ex){
+			SPLog("Failed to write the sampling profile to '%s': %s",
+				  path.c_str(), ex.what());
+		}
+	}
+}
@@ -0,0 +1,48 @@
+/*
+ Copyright (c) 2013 yvt
+ 
+ This file is part of OpenSpades.
+ 
+ OpenSpades is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ 
+ OpenSpades is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with OpenSpades.  If not, see <http://www.gnu.org/licenses/>.
+ 
+ */
+
+#pragma once
+
+#include <string>
+
+namespace spades {
+	/** Periodically samples the stacks of the functions marked with
+	 * SPADES_MARK_FUNCTION in all threads.
+	 *
+	 * The profile is written in the "folded stacks" format
+	 * (`thread;outer;...;inner count` per line), which can be turned
+	 * into a flame graph by flamegraph.pl and similar tools.
+	 *
+	 * Only marked functions are seen, so the time spent in unmarked
+	 * callees (including waiting for a lock) is attributed to the
+	 * innermost marked caller. */
+	class SamplingProfiler {
+	public:
+		/** starts the sampler thread.
+		 * @param intervalMs Sampling interval in milliseconds. */
+		static void Start(int intervalMs);
+		
+		/** stops the sampler thread and writes the profile.
+		 * does nothing when the profiler isn't running. */
+		static void Stop(const std::string& path);
+		
+		static bool IsRunning();
+	};
+}
@@ -23,6 +23,15 @@
 #include "Exception.h"
 #include <string>
 
+/** compiler-provided TLS for plain pointers. Unlike ThreadLocalStorage,
+ * reading it is a single load, but the value isn't destructed when
+ * the thread exits. */
+#ifdef _MSC_VER
+#define SPADES_THREAD_LOCAL __declspec(thread)
+#else
+#define SPADES_THREAD_LOCAL __thread
+#endif
+
 namespace spades {
 	
 	class ThreadLocalStorageImpl {
@@ -19,367 +19,266 @@
  */
 
 #include "ZipFileSystem.h"
-#include "../unzip/unzip.h"
-#include "../unzip/ioapi.h"
 #include "../Core/Debug.h"
 #include "../Core/Exception.h"
 #include "IStream.h"
+#include "MemoryStream.h"
+#include "MappedFile.h"
+#include <zlib.h>
 #include <string.h>
-#include "DynamicMemoryStream.h"
+#include <algorithm>
 
 namespace spades {
-	class ZipFileSystem::ZipFileInputStream: public IStream {
-		ZipFileSystem *fs;
-		unzFile zip;
-		uint64_t pos;
+	enum {
+		LocalFileHeaderSignature = 0x04034b50,
+		CentralDirectorySignature = 0x02014b50,
+		EndOfCentralDirectorySignature = 0x06054b50,
 		
-		bool streaming;
+		LocalFileHeaderSize = 30,
+		CentralDirectoryEntrySize = 46,
+		EndOfCentralDirectorySize = 22,
+		MaxCommentSize = 65535,
 		
-		// unzip library doesn't support opening multiple
-		// file, but ZipFileSystem has to.
-		// so when second file is open, the contents of
-		// first file is read and is closed in unzip level.
-		// read contents are stored in remainingData.
-		// streaming becomes false.
-		std::vector<unsigned char> remainingData;
-		size_t remDataPos;
-	public:
-		
-		ZipFileInputStream(ZipFileSystem *fs, unzFile zf):
-		streaming(true),zip(zf),fs(fs){
-			SPADES_MARK_FUNCTION();
-		}
-		
-		virtual ~ZipFileInputStream(){
-			SPADES_MARK_FUNCTION();
-			if(streaming){
-				unzCloseCurrentFile(zip);
-				SPAssert(this == fs->currentStream);
-				fs->currentStream = NULL;
-			}
-		}
-		
-		void ForceCloseUnzipFile() {
-			SPADES_MARK_FUNCTION();
-			if(streaming){
-				streaming = false;
-				unsigned char buf[1024];
-				int bytes;
-				while((bytes = unzReadCurrentFile(zip, buf, sizeof(buf))) > 0) {
-					remainingData.insert(remainingData.end(), buf, buf+bytes);
-				}
-				remDataPos = 0;
-				
-				int ret = unzCloseCurrentFile(zip);
-				if(ret != UNZ_OK) {
-					SPRaise("Zip file close error: 0x%08x", ret);
-				}
-				
-				SPAssert(this == fs->currentStream);
-				fs->currentStream = NULL;
-			}
-		}
-		
-		virtual int ReadByte(){
-			SPADES_MARK_FUNCTION();
-			int byte;
-			if(streaming) {
-				unsigned char b;
-				int bytes = unzReadCurrentFile(zip, &b, 1);
-				if(bytes < 0){
-					SPRaise("Unzip error: 0x%08x", bytes);
-				}else if(bytes == 0){
-					byte = -1;
-				}else{
-					byte = b;
-					pos++;
-				}
-			}else{
-				if(remDataPos >= remainingData.size()){
-					return -1;
-				}else{
-					pos++;
-					byte = remainingData[remDataPos];
-					remDataPos++;
-				}
-			}
-			return byte;
-		}
-		virtual size_t Read(void *buf, size_t bytes){
-			SPADES_MARK_FUNCTION();
-			size_t outBytes;
-			if(streaming){
-				int out = unzReadCurrentFile(zip, buf, bytes);
-				if(out < 0){
-					SPRaise("Unzip error: 0x%08x", bytes);
-				}
-				outBytes = (size_t)out;
-			}else{
-				outBytes = bytes;
-				size_t rem = remainingData.size() - remDataPos;
-				if(outBytes > rem)
-					outBytes = rem;
-				memcpy(buf, remainingData.data() + remDataPos, outBytes);
-				
-				remDataPos += outBytes;
-			}
-			
-			pos += outBytes;
-			return outBytes;
-		}
-		
-		virtual void WriteByte(int){
-			SPADES_MARK_FUNCTION();
-			SPNotImplemented();
-		}
-		virtual void Write(const void *, size_t bytes){
-			SPADES_MARK_FUNCTION();
-			SPNotImplemented();
-		}
-		virtual void Write(const std::string&){
-			SPADES_MARK_FUNCTION();
-			SPNotImplemented();
-		}
+		StoredMethod = 0,
+		DeflatedMethod = 8,
 		
-		virtual uint64_t GetPosition(){
-			return pos;
-		}
-		virtual void SetPosition(uint64_t){
-			SPADES_MARK_FUNCTION();
-			SPNotImplemented();
-		}
-		
-		virtual uint64_t GetLength(){
-			SPADES_MARK_FUNCTION();
-			ForceCloseUnzipFile();
-			return pos + remainingData.size() - remDataPos;
-		}
-		virtual void SetLength(uint64_t){
-			SPADES_MARK_FUNCTION();
-			SPNotImplemented();
-		}
+		EncryptedFlag = 1
 	};
 	
-#pragma mark - Interface between ZipFileSystem and unzip
+	static inline uint16_t ReadUInt16(const unsigned char *p) {
+		return static_cast<uint16_t>(p[0] | (p[1] << 8));
+	}
 	
-	class ZipFileSystem::ZipFileHandle {
-		ZipFileSystem *fs;
-		uint64_t pos;
-		
-		void ValidateCursor() {
-			SPADES_MARK_FUNCTION();
-			if(fs->cursorPos != pos) {
-				fs->cursorPos = pos;
-				fs->baseStream->SetPosition(pos);
-			}
-		}
+	static inline uint32_t ReadUInt32(const unsigned char *p) {
+		return static_cast<uint32_t>(p[0]) |
+		(static_cast<uint32_t>(p[1]) << 8) |
+		(static_cast<uint32_t>(p[2]) << 16) |
+		(static_cast<uint32_t>(p[3]) << 24);
+	}
+	
+	/** contents of the whole archive. never changed once created. */
+	class ZipFileSystem::Archive {
+		std::unique_ptr<MappedFile> mapped;
+		std::string contents;
 	public:
-		ZipFileHandle(ZipFileSystem *fs):fs(fs){
-			pos = 0;
-		}
-		
-		uint32_t Read(void *buf, uint32_t size) {
+		Archive(const std::string& path):
+		mapped(new MappedFile(path)) {}
+		Archive(IStream *stream) {
 			SPADES_MARK_FUNCTION();
-			ValidateCursor();
-			size_t ret = fs->baseStream->Read(buf, size);
-			pos += ret;
-			fs->cursorPos += ret;
-			return (uint32_t)ret;
+			stream->SetPosition(0);
+			contents = stream->ReadAllBytes();
 		}
 		
-		uint32_t Write(void *buf, uint32_t size) {
-			SPADES_MARK_FUNCTION();
-			ValidateCursor();
-			try{
-				fs->baseStream->Write(buf, size);
-			}catch(...){
-				// how many bytes written?
-				size_t written = fs->baseStream->GetPosition() - pos;
-				fs->cursorPos += written;
-				pos += written;
-				return pos;
-			}
-			pos += size;
-			fs->cursorPos += size;
-			return (uint32_t)size;
+		const unsigned char *GetData() const {
+			if(mapped)
+				return mapped->GetData();
+			return reinterpret_cast<const unsigned char *>(contents.data());
 		}
-		
-		long Tell() {
-			return (long)pos;
-		}
-		
-		long Seek(int32_t offset, int origin) {
-			switch(origin){
-				case ZLIB_FILEFUNC_SEEK_CUR:
-					break;
-				case ZLIB_FILEFUNC_SEEK_END:
-					pos = fs->baseStream->GetLength();
-					break;
-				case ZLIB_FILEFUNC_SEEK_SET:
-					pos = 0;
-					break;
-			}
-			pos += offset;
-			return 0; // (long)pos;
-		}
-		
-		int TestError() {
-			return 0; // ??
+		size_t GetSize() const {
+			if(mapped)
+				return mapped->GetSize();
+			return contents.size();
 		}
 	};
 	
-	ZipFileSystem::ZipFileHandle *ZipFileSystem::InternalOpen(spades::ZipFileSystem *fs,
-															  const char *fn, int mode) {
+	/** keeps the memory the stream reads from alive. */
+	class ZipFileSystem::EntryStream: public MemoryStream {
+		std::shared_ptr<Archive> archive;
+		std::unique_ptr<char[]> buffer;
+	public:
+		/** view of a stored file. */
+		EntryStream(const std::shared_ptr<Archive>& archive,
+					const unsigned char *data, size_t length):
+		MemoryStream(reinterpret_cast<const char *>(data), length),
+		archive(archive) {}
+		/** inflated file. */
+		EntryStream(std::unique_ptr<char[]> buf, size_t length):
+		MemoryStream(const_cast<const char *>(buf.get()), length),
+		buffer(std::move(buf)) {}
+	};
+
+#pragma mark - Zip file
+
+	ZipFileSystem::ZipFileSystem(IStream *stream, bool autoClose) {
 		SPADES_MARK_FUNCTION();
-		return new ZipFileHandle(fs);
-	}
-	
-	uint32_t ZipFileSystem::InternalRead(spades::ZipFileSystem *fs,
-										 spades::ZipFileSystem::ZipFileHandle *h,
-										 void *buf,
-										 uint32_t size) {
-		SPADES_MARK_FUNCTION_DEBUG();
-		return h->Read(buf, size);
-	}
-	
-	uint32_t ZipFileSystem::InternalWrite(spades::ZipFileSystem *fs,
-										  spades::ZipFileSystem::ZipFileHandle *h,
-										  void *buf,
-										  uint32_t size) {
-		SPADES_MARK_FUNCTION_DEBUG();
-		return h->Write(buf, size);
-	}
-	
-	long ZipFileSystem::InternalTell(spades::ZipFileSystem *fs,
-									 spades::ZipFileSystem::ZipFileHandle *h) {
-		SPADES_MARK_FUNCTION_DEBUG();
-		return h->Tell();
-	}
-	
-	long ZipFileSystem::InternalSeek(spades::ZipFileSystem *fs,
-									 spades::ZipFileSystem::ZipFileHandle *h,
-									 int32_t offset,
-									 int origin) {
-		SPADES_MARK_FUNCTION_DEBUG();
-		return h->Seek(offset, origin);
+		
+		try{
+			archive = std::make_shared<Archive>(stream);
+		}catch(...){
+			if(autoClose)
+				delete stream;
+			throw;
+		}
+		if(autoClose)
+			delete stream;
+		
+		ReadCentralDirectory();
 	}
 	
-	int ZipFileSystem::InternalClose(spades::ZipFileSystem *fs,
-									 spades::ZipFileSystem::ZipFileHandle *h) {
+	ZipFileSystem::ZipFileSystem(const std::string& path):
+	archive(std::make_shared<Archive>(path)) {
 		SPADES_MARK_FUNCTION();
-		delete h;
-		return 0;
+		
+		ReadCentralDirectory();
 	}
 	
-	int ZipFileSystem::InternalTestError(spades::ZipFileSystem *fs,
-										 spades::ZipFileSystem::ZipFileHandle *h) {
-		SPADES_MARK_FUNCTION_DEBUG();
-		return h->TestError();
+	ZipFileSystem::~ZipFileSystem() {
+		SPADES_MARK_FUNCTION();
+		// streams that are still open keep the archive alive
 	}
 	
-	zlib_filefunc_def ZipFileSystem::CreateZLibFileFunc() {
-		zlib_filefunc_def def;
-		def.opaque = this;
-		def.zopen_file = (open_file_func)InternalOpen;
-		def.zclose_file = (close_file_func)InternalClose;
-		def.zread_file = (read_file_func)InternalRead;
-		def.zwrite_file = (write_file_func)InternalWrite;
-		def.ztell_file = (tell_file_func)InternalTell;
-		def.zseek_file = (seek_file_func)InternalSeek;
-		def.zerror_file = (testerror_file_func)InternalTestError;
-		return def;
+	std::string ZipFileSystem::MakeKey(const char *fn) {
+		std::string f = fn;
+		for(std::size_t i = 0; i < f.size(); i++) {
+			if(f[i] == '\\') f[i] = '/';
+			else f[i] = tolower(f[i]);
+		}
+		return f;
 	}
 	
-#pragma mark - Zip file
-	
-	ZipFileSystem::ZipFileSystem(IStream *stream, bool autoClose):
-	baseStream(stream), autoClose(autoClose){
+	void ZipFileSystem::ReadCentralDirectory() {
 		SPADES_MARK_FUNCTION();
 		
-		cursorPos = stream->GetPosition();
-		zlib_filefunc_def def = CreateZLibFileFunc();
-		zip = unzOpen2("ZipFile.zip", &def);
-		if(!zip){
-			SPRaise("Failed to open ZIP stream.");
+		const unsigned char *data = archive->GetData();
+		size_t size = archive->GetSize();
+		
+		// the end of central directory record is followed by a comment
+		// of variable length, so it has to be searched from the end
+		if(size < EndOfCentralDirectorySize) {
+			SPRaise("Failed to open ZIP stream: file is too small.");
+		}
+		const unsigned char *eocd = NULL;
+		size_t minPos = size > EndOfCentralDirectorySize + MaxCommentSize ?
+		size - EndOfCentralDirectorySize - MaxCommentSize : 0;
+		for(size_t pos = size - EndOfCentralDirectorySize + 1; pos-- > minPos;) {
+			if(ReadUInt32(data + pos) == EndOfCentralDirectorySignature) {
+				eocd = data + pos;
+				break;
+			}
+		}
+		if(!eocd) {
+			SPRaise("Failed to open ZIP stream: end of central directory not found.");
 		}
 		
-		currentStream = NULL;
-		
-		if(unzGoToFirstFile(zip) != UNZ_OK) {
-			SPRaise("There was a problem while seeking the zip file to the first file.");
+		size_t numEntries = ReadUInt16(eocd + 10);
+		size_t dirSize = ReadUInt32(eocd + 12);
+		size_t dirOffset = ReadUInt32(eocd + 16);
+		if(dirOffset > size || dirSize > size - dirOffset) {
+			SPRaise("Failed to open ZIP stream: central directory is out of range.");
 		}
 		
-		// create list of files
-		do{
-			char buf[513];
-			buf[512] = 0;
-			unzGetCurrentFileInfo(zip, nullptr,
-								  buf, 512, nullptr, 0, nullptr, 0);
-			
-			for(char *ptr = buf; *ptr; ptr++) {
-				if(*ptr == '\\') *ptr = '/';
-				else
-					*ptr = tolower(*ptr);
+		entries.reserve(numEntries);
+		const unsigned char *ptr = data + dirOffset;
+		const unsigned char *end = ptr + dirSize;
+		for(size_t i = 0; i < numEntries; i++) {
+			if(end - ptr < CentralDirectoryEntrySize ||
+			   ReadUInt32(ptr) != CentralDirectorySignature) {
+				SPRaise("Failed to open ZIP stream: central directory is corrupted.");
 			}
-			
-			unz_file_pos pos;
-			if(unzGetFilePos(zip, &pos) != UNZ_OK) {
-				SPRaise("unzGetFilePos failed");
+			size_t nameLen = ReadUInt16(ptr + 28);
+			size_t extraLen = ReadUInt16(ptr + 30);
+			size_t commentLen = ReadUInt16(ptr + 32);
+			size_t entrySize = CentralDirectoryEntrySize + nameLen + extraLen + commentLen;
+			if(static_cast<size_t>(end - ptr) < entrySize) {
+				SPRaise("Failed to open ZIP stream: central directory is corrupted.");
 			}
-			files.insert(std::make_pair(buf, pos));
-		}while(unzGoToNextFile(zip) == UNZ_OK);
+			
+			Entry entry;
+			entry.flags = ReadUInt16(ptr + 8);
+			entry.method = ReadUInt16(ptr + 10);
+			entry.crc = ReadUInt32(ptr + 16);
+			entry.compressedSize = ReadUInt32(ptr + 20);
+			entry.uncompressedSize = ReadUInt32(ptr + 24);
+			entry.localHeaderOffset = ReadUInt32(ptr + 42);
+			entry.name.assign(reinterpret_cast<const char *>(ptr + CentralDirectoryEntrySize),
+							  nameLen);
+			entry.key = MakeKey(entry.name.c_str());
+			entries.push_back(std::move(entry));
+			
+			ptr += entrySize;
+		}
 		
+		std::stable_sort(entries.begin(), entries.end(),
+						 [](const Entry& a, const Entry& b) {
+							 return a.key < b.key;
+						 });
 	}
 	
-	ZipFileSystem::~ZipFileSystem() {
-		SPADES_MARK_FUNCTION();
-		if(currentStream){
-			currentStream->ForceCloseUnzipFile();
-		}
-		
-		unzClose(zip);
+	const ZipFileSystem::Entry *ZipFileSystem::FindEntry(const char *fn) const {
+		std::string key = MakeKey(fn);
+		auto it = std::lower_bound(entries.begin(), entries.end(), key,
+								   [](const Entry& e, const std::string& k) {
+									   return e.key < k;
+								   });
+		if(it == entries.end() || it->key != key)
+			return NULL;
+		return &*it;
 	}
 	
 	IStream *ZipFileSystem::OpenForReading(const char *fn) {
 		SPADES_MARK_FUNCTION();
 		
-		if(currentStream){
-			currentStream->ForceCloseUnzipFile();
+		const Entry *entry = FindEntry(fn);
+		if(!entry) {
+			SPFileNotFound(fn);
+		}
+		if(entry->flags & EncryptedFlag) {
+			SPRaise("%s: encrypted files are not supported", fn);
 		}
 		
-		if(!MoveToFile(fn)) {
-			SPFileNotFound(fn);
+		const unsigned char *data = archive->GetData();
+		size_t size = archive->GetSize();
+		size_t offset = entry->localHeaderOffset;
+		if(offset > size || size - offset < LocalFileHeaderSize ||
+		   ReadUInt32(data + offset) != LocalFileHeaderSignature) {
+			SPRaise("%s: local file header is corrupted", fn);
 		}
 		
-		unzOpenCurrentFile(zip);
-		try{
-			currentStream = new ZipFileInputStream(this, zip);
-#if 0
-			return currentStream;
-#else
-			// load all data to allow seeking
-			DynamicMemoryStream *stream;
-			stream = new DynamicMemoryStream();
-			try{
-				char buf[4096];
-				size_t rd;
-				while((rd = currentStream->Read(buf, 4096)) > 0) {
-					stream->Write(buf, rd);
-				}
-				currentStream->ForceCloseUnzipFile();
-				stream->SetPosition(0);
-				delete currentStream;
-				return stream;
-			}catch(...){
-				delete stream;
-				delete currentStream;
-				throw;
-			}
-#endif
-		}catch(...){
-			unzCloseCurrentFile(zip);
-			throw;
+		// the local header might have an extra field different from
+		// the one in the central directory
+		offset += LocalFileHeaderSize;
+		offset += ReadUInt16(data + entry->localHeaderOffset + 26);
+		offset += ReadUInt16(data + entry->localHeaderOffset + 28);
+		if(offset > size || size - offset < entry->compressedSize) {
+			SPRaise("%s: file data is out of range", fn);
+		}
+		const unsigned char *fileData = data + offset;
+		
+		switch(entry->method) {
+			case StoredMethod:
+				return new EntryStream(archive, fileData, entry->compressedSize);
+			case DeflatedMethod:
+				break;
+			default:
+				SPRaise("%s: unsupported compression method: %d",
+						fn, (int)entry->method);
 		}
+		
+		std::unique_ptr<char[]> buf(new char[std::max<size_t>(entry->uncompressedSize, 1)]);
+		
+		z_stream zs;
+		memset(&zs, 0, sizeof(zs));
+		// raw deflate stream without zlib header
+		if(inflateInit2(&zs, -MAX_WBITS) != Z_OK) {
+			SPRaise("%s: inflateInit2 failed", fn);
+		}
+		zs.next_in = const_cast<Bytef *>(fileData);
+		zs.avail_in = entry->compressedSize;
+		zs.next_out = reinterpret_cast<Bytef *>(buf.get());
+		zs.avail_out = entry->uncompressedSize;
+		int ret = inflate(&zs, Z_FINISH);
+		uLong outBytes = zs.total_out;
+		inflateEnd(&zs);
+		
+		if(ret != Z_STREAM_END || outBytes != entry->uncompressedSize) {
+			SPRaise("%s: inflate failed: %d", fn, ret);
+		}
+		if(crc32(crc32(0, Z_NULL, 0), reinterpret_cast<const Bytef *>(buf.get()),
+				 entry->uncompressedSize) != entry->crc) {
+			SPRaise("%s: CRC mismatch", fn);
+		}
+		
+		return new EntryStream(std::move(buf), entry->uncompressedSize);
 	}
 	
 	IStream *ZipFileSystem::OpenForWriting(const char *fn){
@@ -387,94 +286,47 @@ namespace spades {
 		SPRaise("ZIP file system doesn't support writing");
 	}
 	
-	static bool MatchesZipFile(const char *fn, const char *path) {
-		for(size_t i = 0;; i++) {
-			if(path[i] == 0){
-				return true;
-			}
-			if(fn[i] == 0) {
-				return false;
-			}
-			if((fn[i] == '/' || fn[i] == '\\') &&
-			   (path[i] == '/' || path[i] == '\\')) {
-				continue;
-			}
-			if(tolower(fn[i]) != tolower(path[i]))
-				return false;
-		}
-	}
-	
 	std::vector<std::string> ZipFileSystem::EnumFiles(const char *path) {
+		SPADES_MARK_FUNCTION();
 		
-		if(currentStream){
-			currentStream->ForceCloseUnzipFile();
-		}
-		
-		if(unzGoToFirstFile(zip) != UNZ_OK) {
-			SPRaise("There was a problem while seeking the zip file to the first file.");
-		}
-		
-		// FIXME: use `files` for faster search?
+		std::string prefix = MakeKey(path) + '/';
 		std::vector<std::string> lst;
-		size_t ln = strlen(path);
-		do{
-			char buf[513];
-			buf[512] = 0;
-			unzGetCurrentFileInfo(zip, nullptr,
-								  buf, 512, nullptr, 0, nullptr, 0);
-			
-			if(!MatchesZipFile(buf, path))
-				continue;
-			
-			if(buf[ln] != '/' && buf[ln] != '\\') {
-				// similar but bad pattern
-				// path = foo
-				// fn   = foobar\text.txt
-				continue;
-			}
-			if(strchr(buf + ln + 1, '/') ||
-			   strchr(buf + ln + 1, '\\')) {
+		auto it = std::lower_bound(entries.begin(), entries.end(), prefix,
+								   [](const Entry& e, const std::string& k) {
+									   return e.key < k;
+								   });
+		for(; it != entries.end(); ++it) {
+			const std::string& key = it->key;
+			if(key.compare(0, prefix.size(), prefix) != 0)
+				break;
+			if(key.find('/', prefix.size()) != std::string::npos) {
 				// similar but bad pattern
 				// path = foo
 				// fn   = foo\bar\text.txt
 				continue;
 			}
-			lst.push_back(buf + ln + 1);
-		}while(unzGoToNextFile(zip) == UNZ_OK);
+			lst.push_back(it->name.substr(prefix.size()));
+		}
 		
 		return lst;
 	}
 	
-	bool ZipFileSystem::MoveToFile(const char *fn) {
+	bool ZipFileSystem::FileExists(const char *fn) {
 		SPADES_MARK_FUNCTION();
 		
-		std::string f = fn;
-		for(std::size_t i = 0; i < f.size(); i++) {
-			if(f[i] == '\\') f[i] = '/';
-			else f[i] = tolower(f[i]);
-		}
-		
-		auto it = files.find(f);
-		if(it == files.end()) {
-			return false;
-		}
-		
-		if(unzGoToFilePos(zip, &it->second) != UNZ_OK) {
-			SPRaise("Failed to seek to the requested file.");
-		}
-		return true;
+		return FindEntry(fn) != NULL;
 	}
 	
-	bool ZipFileSystem::FileExists(const char *fn) {
+	bool ZipFileSystem::EnumAllFiles(std::vector<std::string>& lst) {
 		SPADES_MARK_FUNCTION();
 		
-		std::string f = fn;
-		for(std::size_t i = 0; i < f.size(); i++) {
-			if(f[i] == '\\') f[i] = '/';
-			else f[i] = tolower(f[i]);
+		lst.reserve(lst.size() + entries.size());
+		for(size_t i = 0; i < entries.size(); i++) {
+			const std::string& key = entries[i].key;
+			if(key.empty() || key[key.size() - 1] == '/')
+				continue; // directory
+			lst.push_back(key);
 		}
-		
-		return files.find(f) != files.end();
+		return true;
 	}
 }
-
@@ -22,55 +22,49 @@
 
 #include "IFileSystem.h"
 #include <stdint.h>
-#include <map>
+#include <memory>
 #include <string>
+#include <vector>
 
-extern "C"{
-	typedef void *unzFile;
-	struct zlib_filefunc_def_s;
-	typedef struct zlib_filefunc_def_s zlib_filefunc_def;
-	struct unz_file_pos_s;
-}
-	
 namespace spades {
+	class IStream;
+	
+	/** read-only file system backed by a ZIP archive.
+	 * the archive is memory-mapped (or read into memory once if it's
+	 * given as a stream) and its central directory is parsed into an
+	 * index when constructed, so files can be opened from any number
+	 * of threads at once. stored files are opened as views of the
+	 * archive without being copied, and deflated files are inflated
+	 * into a buffer of the exact size. */
 	class ZipFileSystem: public IFileSystem {
-		class ZipFileInputStream;
-		class ZipFileHandle;
-		
-		IStream *baseStream;
-		bool autoClose;
-		unzFile zip;
+		class Archive;
+		class EntryStream;
 		
-		std::map<std::string, unz_file_pos_s> files;
+		struct Entry {
+			/** lower-cased, with '/' as the separator. */
+			std::string key;
+			/** as stored in the archive. */
+			std::string name;
+			uint32_t localHeaderOffset;
+			uint32_t compressedSize;
+			uint32_t uncompressedSize;
+			uint32_t crc;
+			uint16_t method;
+			uint16_t flags;
+		};
 		
-		ZipFileInputStream *currentStream;
+		std::shared_ptr<Archive> archive;
+		/** sorted by key. */
+		std::vector<Entry> entries;
 		
-		uint64_t cursorPos;
-		
-		static ZipFileHandle *InternalOpen(ZipFileSystem *fs,
-										   const char *fn,
-										   int mode);
-		
-		static uint32_t InternalRead(ZipFileSystem *fs,
-										   ZipFileHandle *h,
-										   void *buf, uint32_t size);
-		static uint32_t InternalWrite(ZipFileSystem *fs,
-										   ZipFileHandle *h,
-										   void *buf, uint32_t size);
-		static long InternalTell(ZipFileSystem *fs,
-									  ZipFileHandle *h);
-		static long InternalSeek(ZipFileSystem *fs,
-								 ZipFileHandle *h,
-								 int32_t offset, int origin);
-		static int InternalClose(ZipFileSystem *fs,
-								 ZipFileHandle *h);
-		static int InternalTestError(ZipFileSystem *fs,
-								 ZipFileHandle *h);
-		
-		zlib_filefunc_def CreateZLibFileFunc();
-		bool MoveToFile(const char *);
+		void ReadCentralDirectory();
+		const Entry *FindEntry(const char *) const;
+		static std::string MakeKey(const char *);
 	public:
+		/** reads the whole stream into memory. */
 		ZipFileSystem(IStream *, bool autoClose = true);
+		/** memory-maps the file at the physical path. */
+		ZipFileSystem(const std::string& path);
 		virtual ~ZipFileSystem();
 		
 		virtual std::vector<std::string> EnumFiles(const char *);
@@ -78,5 +72,8 @@ namespace spades {
 		virtual IStream *OpenForReading(const char *);
 		virtual IStream *OpenForWriting(const char *);
 		virtual bool FileExists(const char *);
+		
+		virtual bool EnumAllFiles(std::vector<std::string>&);
+		virtual bool IsCaseSensitive() { return false; }
 	};
 }
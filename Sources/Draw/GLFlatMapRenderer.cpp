@@ -23,10 +23,22 @@
 #include "../Client/GameMap.h"
 #include "../Core/Debug.h"
 #include "../Core/Bitmap.h"
+#include "../Core/ConcurrentDispatch.h"
+#include "../Core/Settings.h"
 #include "GLImage.h"
+#include <algorithm>
+#include <memory>
+
+SPADES_SETTING(r_flatMapNumThreads, "4");
 
 namespace spades {
 	namespace draw {
+		enum {
+			/** bitmaps smaller than this many rows per thread are
+			 * generated by the calling thread only. */
+			MinFlatMapRowsPerThread = 32
+		};
+		
 		GLFlatMapRenderer::GLFlatMapRenderer(GLRenderer *r,
 											 client::GameMap *m):
 		renderer(r), map(m){
@@ -62,27 +74,43 @@ namespace spades {
 		Bitmap *GLFlatMapRenderer::GenerateBitmap(int mx, int my, int w, int h){
 			SPADES_MARK_FUNCTION();
 			Handle<Bitmap> bmp(new Bitmap(w, h), false);
-			try{
-				uint32_t *pixels = bmp->GetPixels();
-				
-				for(int y = 0; y < h; y++){
-					for(int x = 0; x < w; x++){
-						int px = mx + x, py = my + y;
-						for(int z = 0 ; z < 64; z++){
-							if(map->IsSolid(px, py, z)){
-								uint32_t col = map->GetColor(px, py, z);
-								col |= 0xff000000UL;
-								*pixels = col;
-								break;
-							}
-						}
-						pixels++;
+			uint32_t *pixels = bmp->GetPixels();
+			
+			int numThreads = r_flatMapNumThreads;
+			numThreads = std::min(numThreads, h / MinFlatMapRowsPerThread);
+			numThreads = std::max(numThreads, 1);
+			
+			std::vector<std::unique_ptr<ConcurrentDispatch>> workers;
+			for(int i = 1; i < numThreads; i++){
+				int y1 = h * i / numThreads;
+				int y2 = h * (i + 1) / numThreads;
+				auto f = [=]() {
+					GenerateRows(pixels, mx, my, w, y1, y2 - 1);
+				};
+				workers.emplace_back(new FunctionDispatch<decltype(f)>(f));
+				workers.back()->Start();
+			}
+			GenerateRows(pixels, mx, my, w, 0, h / numThreads - 1);
+			for(size_t i = 0; i < workers.size(); i++)
+				workers[i]->Join();
+			
+			return bmp.Unmanage();
+		}
+		
+		void GLFlatMapRenderer::GenerateRows(uint32_t *pixels, int mx, int my, int w,
+											 int minY, int maxY) {
+			const int depth = map->Depth();
+			for(int y = minY; y <= maxY; y++){
+				uint32_t *out = pixels + y * w;
+				for(int x = 0; x < w; x++){
+					int z = map->GetTopmostSolid(mx + x, my + y);
+					if(z < depth){
+						uint32_t col = map->GetColor(mx + x, my + y, z);
+						col |= 0xff000000UL;
+						out[x] = col;
 					}
 				}
-			}catch(...){
-				throw;
 			}
-			return bmp.Unmanage();
 		}
 		
 		void GLFlatMapRenderer::GameMapChanged(int x, int y, int z,
@@ -106,21 +134,44 @@ namespace spades {
 									 const AABB2& src) {
 			SPADES_MARK_FUNCTION();
 			
-			// update chunks
-			for(size_t i = 0; i < chunkInvalid.size(); i++){
-				if(!chunkInvalid[i]) continue;
-				int chunkX = ((int)i) % chunkCols;
-				int chunkY = ((int)i) / chunkCols;
-				
-				Handle<Bitmap> bmp(GenerateBitmap(chunkX * ChunkSize,
-											 chunkY * ChunkSize,
-											 ChunkSize, ChunkSize), false);
-				try{
+			// update chunks. adjacent invalid chunks are merged into
+			// rectangles so that they are generated and uploaded at once.
+			for(int chunkY = 0; chunkY < chunkRows; chunkY++){
+				for(int chunkX = 0; chunkX < chunkCols; chunkX++){
+					if(!chunkInvalid[chunkX + chunkY * chunkCols])
+						continue;
+					
+					int endX = chunkX + 1;
+					while(endX < chunkCols &&
+						  chunkInvalid[endX + chunkY * chunkCols])
+						endX++;
+					
+					int endY = chunkY + 1;
+					while(endY < chunkRows){
+						bool full = true;
+						for(int x = chunkX; x < endX; x++){
+							if(!chunkInvalid[x + endY * chunkCols]){
+								full = false;
+								break;
+							}
+						}
+						if(!full)
+							break;
+						endY++;
+					}
+					
+					for(int y = chunkY; y < endY; y++)
+						for(int x = chunkX; x < endX; x++)
+							chunkInvalid[x + y * chunkCols] = false;
+					
+					Handle<Bitmap> bmp(GenerateBitmap(chunkX * ChunkSize,
+													  chunkY * ChunkSize,
+													  (endX - chunkX) * ChunkSize,
+													  (endY - chunkY) * ChunkSize), false);
 					image->SubImage(bmp, chunkX * ChunkSize, chunkY * ChunkSize);
-				}catch(...){
-					throw;
+					
+					chunkX = endX - 1;
 				}
-				chunkInvalid[i] = false;
 			}
 			
 			renderer->DrawImage(image, dest, src);
@@ -21,6 +21,7 @@
 #pragma once
 
 #include <vector>
+#include <stdint.h>
 #include "../Core/Math.h"
 
 namespace spades {
@@ -46,6 +47,8 @@ namespace spades {
 			int chunkCols, chunkRows;
 			
 			Bitmap *GenerateBitmap(int x, int y, int w, int h);
+			void GenerateRows(uint32_t *pixels, int mx, int my, int w,
+							  int minY, int maxY);
 		public:
 			GLFlatMapRenderer(GLRenderer *renderer,
 							  client::GameMap *map);
@@ -62,6 +62,15 @@ namespace spades {
 			return it->second;
 		}
 		
+		void GLImageManager::RegisterPreloadedImage(const std::string &name,
+													Bitmap *bmp) {
+			SPADES_MARK_FUNCTION();
+			
+			if(images.find(name) != images.end())
+				return;
+			images[name] = GLImage::FromBitmap(bmp, device);
+		}
+		
 		GLImage *GLImageManager::GetWhiteImage() {
 			if(!whiteImage) {
 				whiteImage = RegisterImage("Gfx/White.tga");
@@ -25,6 +25,7 @@
 #include <map>
 
 namespace spades {
+	class Bitmap;
 	namespace draw {
 		class IGLDevice;
 		class GLImage;
@@ -41,6 +42,7 @@ namespace spades {
 			~GLImageManager();
 			
 			GLImage *RegisterImage(const std::string&);
+			void RegisterPreloadedImage(const std::string&, Bitmap *);
 			GLImage *GetWhiteImage();
 			
 			void DrawAllImages(GLRenderer *);
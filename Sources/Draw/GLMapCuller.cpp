@@ -0,0 +1,576 @@
+/*
+ Copyright (c) 2013 yvt
+ 
+ This file is part of OpenSpades.
+ 
+ OpenSpades is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ 
+ OpenSpades is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with OpenSpades.  If not, see <http://www.gnu.org/licenses/>.
+ 
+ */
+
+#include "GLMapCuller.h"
+#include "../Client/GameMap.h"
+#include "../Core/Debug.h"
+#include "../Core/Stopwatch.h"
+#include <algorithm>
+#include <cfloat>
+#include <cstring>
+
+namespace spades {
+	namespace draw {
+		
+		/** @return the smallest Z such that every block from Z to the
+		 * bottom is solid. */
+		static int GetSolidStart(uint64_t solid) {
+			uint64_t air = ~solid;
+			if(air == 0)
+				return 0;
+			int z = 63;
+			while(!((air >> z) & 1ULL))
+				z--;
+			return z + 1;
+		}
+		
+		/** @return Z coordinate of the topmost solid block, or 64. */
+		static int GetTopSolid(uint64_t solid) {
+			if(solid == 0)
+				return 64;
+			int z = 0;
+			while(!((solid >> z) & 1ULL))
+				z++;
+			return z;
+		}
+		
+		static inline int FloorDiv(int a, int b) {
+			return a >= 0 ? a / b : -((-a + b - 1) / b);
+		}
+		
+		GLMapCuller::GLMapCuller(client::GameMap *m):
+		map(m) {
+			SPADES_MARK_FUNCTION();
+			
+			numChunkWidth = map->Width() / ChunkSize;
+			numChunkHeight = map->Height() / ChunkSize;
+			numChunkDepth = map->Depth() / ChunkSize;
+			numTileWidth = map->Width() / TileSize;
+			numTileHeight = map->Height() / TileSize;
+			
+			columnTop.resize(numChunkWidth * numChunkHeight);
+			columnDirty.resize(columnTop.size(), false);
+			tileOccluder.resize(numTileWidth * numTileHeight);
+			tileDirty.resize(tileOccluder.size(), false);
+			anyDirty = false;
+			
+			chunkVisible.resize(numChunkWidth * numChunkHeight * numChunkDepth);
+			std::fill(chunkVisible.begin(), chunkVisible.end(), 1);
+			depthBuffer.resize(DepthBufferWidth * DepthBufferHeight);
+			
+			for(int y = 0; y < numTileHeight; y++)
+				for(int x = 0; x < numTileWidth; x++)
+					UpdateTile(x, y);
+			for(int y = 0; y < numChunkHeight; y++)
+				for(int x = 0; x < numChunkWidth; x++)
+					UpdateColumn(x, y);
+			
+			memset(&stats, 0, sizeof(stats));
+		}
+		
+		GLMapCuller::~GLMapCuller() {
+			SPADES_MARK_FUNCTION();
+		}
+		
+		void GLMapCuller::UpdateTile(int tx, int ty) {
+			int occluder = 0;
+			for(int y = 0; y < TileSize; y++)
+				for(int x = 0; x < TileSize; x++) {
+					uint64_t solid = map->GetSolidMapWrapped(tx * TileSize + x,
+															 ty * TileSize + y);
+					occluder = std::max(occluder, GetSolidStart(solid));
+				}
+			tileOccluder[tx + ty * numTileWidth] = (uint8_t)occluder;
+			tileDirty[tx + ty * numTileWidth] = false;
+		}
+		
+		void GLMapCuller::UpdateColumn(int cx, int cy) {
+			int top = 64;
+			for(int y = 0; y < ChunkSize; y++)
+				for(int x = 0; x < ChunkSize; x++) {
+					uint64_t solid = map->GetSolidMapWrapped(cx * ChunkSize + x,
+															 cy * ChunkSize + y);
+					top = std::min(top, GetTopSolid(solid));
+				}
+			columnTop[cx + cy * numChunkWidth] = (uint8_t)top;
+			columnDirty[cx + cy * numChunkWidth] = false;
+		}
+		
+		void GLMapCuller::UpdateDirtyRegions() {
+			if(!anyDirty)
+				return;
+			for(int y = 0; y < numTileHeight; y++)
+				for(int x = 0; x < numTileWidth; x++)
+					if(tileDirty[x + y * numTileWidth])
+						UpdateTile(x, y);
+			for(int y = 0; y < numChunkHeight; y++)
+				for(int x = 0; x < numChunkWidth; x++)
+					if(columnDirty[x + y * numChunkWidth])
+						UpdateColumn(x, y);
+			anyDirty = false;
+		}
+		
+		void GLMapCuller::GameMapChanged(int x, int y, int z, client::GameMap *) {
+			x &= map->Width() - 1;
+			y &= map->Height() - 1;
+			tileDirty[(x >> TileSizeBits) + (y >> TileSizeBits) * numTileWidth] = true;
+			
+			// a block below the topmost solid block of the chunk column
+			// doesn't move it
+			int column = (x >> ChunkSizeBits) + (y >> ChunkSizeBits) * numChunkWidth;
+			if(z <= columnTop[column])
+				columnDirty[column] = true;
+			anyDirty = true;
+		}
+		
+		int GLMapCuller::GetTileOccluder(int tx, int ty) {
+			tx &= numTileWidth - 1;
+			ty &= numTileHeight - 1;
+			return tileOccluder[tx + ty * numTileWidth];
+		}
+
+#pragma mark - Occluder Rasterization
+
+		void GLMapCuller::RasterizeOccluders(int minX, int minY, int maxX, int maxY) {
+			SPADES_MARK_FUNCTION();
+			
+			int minTX = FloorDiv(minX, TileSize), maxTX = FloorDiv(maxX - 1, TileSize);
+			int minTY = FloorDiv(minY, TileSize), maxTY = FloorDiv(maxY - 1, TileSize);
+			
+			for(int ty = minTY; ty <= maxTY; ty++) {
+				for(int tx = minTX; tx <= maxTX; tx++) {
+					int occ = GetTileOccluder(tx, ty);
+					if(occ >= 64)
+						continue;
+					
+					float x1 = (float)(tx * TileSize), x2 = x1 + (float)TileSize;
+					float y1 = (float)(ty * TileSize), y2 = y1 + (float)TileSize;
+					float z1 = (float)occ;
+					
+					// top face (visible only from above)
+					if(eye.z < z1) {
+						RasterizeQuad(MakeVector3(x1, y1, z1), MakeVector3(x2, y1, z1),
+									  MakeVector3(x2, y2, z1), MakeVector3(x1, y2, z1));
+					}
+					
+					// side faces exposed by a lower neighbor tile
+					if(eye.x < x1) {
+						int n = GetTileOccluder(tx - 1, ty);
+						if(n > occ) {
+							float z2 = (float)n;
+							RasterizeQuad(MakeVector3(x1, y1, z1), MakeVector3(x1, y2, z1),
+										  MakeVector3(x1, y2, z2), MakeVector3(x1, y1, z2));
+						}
+					}
+					if(eye.x > x2) {
+						int n = GetTileOccluder(tx + 1, ty);
+						if(n > occ) {
+							float z2 = (float)n;
+							RasterizeQuad(MakeVector3(x2, y1, z1), MakeVector3(x2, y2, z1),
+										  MakeVector3(x2, y2, z2), MakeVector3(x2, y1, z2));
+						}
+					}
+					if(eye.y < y1) {
+						int n = GetTileOccluder(tx, ty - 1);
+						if(n > occ) {
+							float z2 = (float)n;
+							RasterizeQuad(MakeVector3(x1, y1, z1), MakeVector3(x2, y1, z1),
+										  MakeVector3(x2, y1, z2), MakeVector3(x1, y1, z2));
+						}
+					}
+					if(eye.y > y2) {
+						int n = GetTileOccluder(tx, ty + 1);
+						if(n > occ) {
+							float z2 = (float)n;
+							RasterizeQuad(MakeVector3(x1, y2, z1), MakeVector3(x2, y2, z1),
+										  MakeVector3(x2, y2, z2), MakeVector3(x1, y2, z2));
+						}
+					}
+				}
+			}
+		}
+		
+		void GLMapCuller::RasterizeQuad(const Vector3 &v1, const Vector3 &v2,
+										const Vector3 &v3, const Vector3 &v4) {
+			Vector4 in[4] = {
+				projectionViewMatrix * v1,
+				projectionViewMatrix * v2,
+				projectionViewMatrix * v3,
+				projectionViewMatrix * v4
+			};
+			
+			// trivial frustum rejection
+			{
+				int outLeft = 0, outRight = 0, outBottom = 0, outTop = 0;
+				for(int i = 0; i < 4; i++) {
+					if(in[i].x < -in[i].w) outLeft++;
+					if(in[i].x > in[i].w) outRight++;
+					if(in[i].y < -in[i].w) outBottom++;
+					if(in[i].y > in[i].w) outTop++;
+				}
+				if(outLeft == 4 || outRight == 4 ||
+				   outBottom == 4 || outTop == 4)
+					return;
+			}
+			
+			// clip by the near plane
+			Vector4 out[MaxPolygonVertices];
+			int numOut = 0;
+			for(int i = 0; i < 4; i++) {
+				const Vector4& a = in[i];
+				const Vector4& b = in[(i + 1) & 3];
+				bool aIn = a.w >= zNear;
+				bool bIn = b.w >= zNear;
+				if(aIn)
+					out[numOut++] = a;
+				if(aIn != bIn) {
+					float per = (zNear - a.w) / (b.w - a.w);
+					out[numOut++] = a + (b - a) * per;
+				}
+			}
+			if(numOut < 3)
+				return;
+			
+			// use the farthest depth so that the occluder is conservative
+			float depth = out[0].w;
+			for(int i = 1; i < numOut; i++)
+				depth = std::max(depth, out[i].w);
+			
+			// the clipped quad is still convex, so it's rasterized as a
+			// whole; splitting it into triangles would leave the pixels
+			// on the diagonal uncovered by either half.
+			RasterizePolygon(out, numOut, depth);
+		}
+		
+		void GLMapCuller::RasterizePolygon(const Vector4 *v, int numVertices,
+										   float depth) {
+			SPAssert(numVertices >= 3);
+			SPAssert(numVertices <= MaxPolygonVertices);
+			
+			const float sw = (float)DepthBufferWidth * .5f;
+			const float sh = (float)DepthBufferHeight * .5f;
+			float x[MaxPolygonVertices], y[MaxPolygonVertices];
+			for(int i = 0; i < numVertices; i++) {
+				x[i] = (v[i].x / v[i].w + 1.f) * sw;
+				y[i] = (v[i].y / v[i].w + 1.f) * sh;
+			}
+			
+			float area = 0.f;
+			float minFX = x[0], maxFX = x[0], minFY = y[0], maxFY = y[0];
+			for(int i = 0; i < numVertices; i++) {
+				int j = (i + 1) % numVertices;
+				area += x[i] * y[j] - y[i] * x[j];
+				minFX = std::min(minFX, x[i]); maxFX = std::max(maxFX, x[i]);
+				minFY = std::min(minFY, y[i]); maxFY = std::max(maxFY, y[i]);
+			}
+			if(fabsf(area) < 1.e-6f)
+				return;
+			float sign = area < 0.f ? -1.f : 1.f;
+			
+			int minX = std::max((int)floorf(minFX), 0);
+			int maxX = std::min((int)ceilf(maxFX), (int)DepthBufferWidth) - 1;
+			int minY = std::max((int)floorf(minFY), 0);
+			int maxY = std::min((int)ceilf(maxFY), (int)DepthBufferHeight) - 1;
+			if(minX > maxX || minY > maxY)
+				return;
+			
+			stats.numOccluderPolygons++;
+			
+			// pixel (x, y) covers [x, x + 1] x [y, y + 1]. each edge
+			// function is evaluated at the corner of the pixel where it's
+			// the smallest, so only the pixels completely inside the
+			// polygon are written and the occluder never hides anything
+			// that is actually visible.
+			float ea[MaxPolygonVertices], eb[MaxPolygonVertices];
+			float ec[MaxPolygonVertices];
+			for(int i = 0; i < numVertices; i++) {
+				int j = (i + 1) % numVertices;
+				ea[i] = (y[i] - y[j]) * sign;
+				eb[i] = (x[j] - x[i]) * sign;
+				ec[i] = (x[i] * y[j] - y[i] * x[j]) * sign;
+				ec[i] += std::min(ea[i], 0.f) + std::min(eb[i], 0.f);
+			}
+			
+			for(int py = minY; py <= maxY; py++) {
+				float *row = depthBuffer.data() + py * DepthBufferWidth;
+				float fy = (float)py;
+				for(int px = minX; px <= maxX; px++) {
+					float fx = (float)px;
+					int i = 0;
+					while(i < numVertices &&
+						  ea[i] * fx + eb[i] * fy + ec[i] >= 0.f)
+						i++;
+					if(i < numVertices)
+						continue;
+					if(depth < row[px])
+						row[px] = depth;
+				}
+			}
+		}
+
+#pragma mark - Visibility Test
+
+		GLMapCuller::TestResult GLMapCuller::TestBox(const AABB3 &box) {
+			int outLeft = 0, outRight = 0, outBottom = 0, outTop = 0;
+			int outNear = 0, outFar = 0;
+			float minX = FLT_MAX, minY = FLT_MAX;
+			float maxX = -FLT_MAX, maxY = -FLT_MAX;
+			float minW = FLT_MAX;
+			for(int i = 0; i < 8; i++) {
+				Vector3 corner = MakeVector3((i & 1) ? box.max.x : box.min.x,
+											 (i & 2) ? box.max.y : box.min.y,
+											 (i & 4) ? box.max.z : box.min.z);
+				Vector4 v = projectionViewMatrix * corner;
+				if(v.x < -v.w) outLeft++;
+				if(v.x > v.w) outRight++;
+				if(v.y < -v.w) outBottom++;
+				if(v.y > v.w) outTop++;
+				if(v.z > v.w) outFar++;
+				if(v.w < zNear) {
+					outNear++;
+					continue;
+				}
+				float sx = v.x / v.w, sy = v.y / v.w;
+				minX = std::min(minX, sx); maxX = std::max(maxX, sx);
+				minY = std::min(minY, sy); maxY = std::max(maxY, sy);
+				minW = std::min(minW, v.w);
+			}
+			if(outLeft == 8 || outRight == 8 || outBottom == 8 ||
+			   outTop == 8 || outNear == 8 || outFar == 8)
+				return FrustumCulled;
+			
+			// the box intersects with the near plane; we cannot tell
+			if(outNear > 0)
+				return Visible;
+			
+			int px1 = (int)floorf((minX + 1.f) * ((float)DepthBufferWidth * .5f));
+			int px2 = (int)ceilf((maxX + 1.f) * ((float)DepthBufferWidth * .5f)) - 1;
+			int py1 = (int)floorf((minY + 1.f) * ((float)DepthBufferHeight * .5f));
+			int py2 = (int)ceilf((maxY + 1.f) * ((float)DepthBufferHeight * .5f)) - 1;
+			if(px2 < 0 || py2 < 0 || px1 >= DepthBufferWidth || py1 >= DepthBufferHeight)
+				return FrustumCulled;
+			
+			// occluders only write the pixels they cover completely, so
+			// the pixels touched by the rectangle are enough.
+			px1 = std::max(px1, 0);
+			py1 = std::max(py1, 0);
+			px2 = std::min(px2, (int)DepthBufferWidth - 1);
+			py2 = std::min(py2, (int)DepthBufferHeight - 1);
+			
+			for(int y = py1; y <= py2; y++) {
+				const float *row = depthBuffer.data() + y * DepthBufferWidth;
+				for(int x = px1; x <= px2; x++) {
+					if(row[x] >= minW)
+						return Visible;
+				}
+			}
+			return Occluded;
+		}
+		
+		void GLMapCuller::CullChunkColumn(int cx, int cy) {
+			int wcx = cx & (numChunkWidth - 1);
+			int wcy = cy & (numChunkHeight - 1);
+			int top = columnTop[wcx + wcy * numChunkWidth];
+			
+			stats.numChunks += numChunkDepth;
+			
+			float x1 = (float)(cx * ChunkSize), y1 = (float)(cy * ChunkSize);
+			TestResult res = TestBox(AABB3(MakeVector3(x1, y1, (float)top),
+										   MakeVector3(x1 + (float)ChunkSize,
+													   y1 + (float)ChunkSize,
+													   (float)map->Depth())));
+			if(res == FrustumCulled) {
+				stats.numFrustumCulledChunks += numChunkDepth;
+				return;
+			}else if(res == Occluded) {
+				stats.numOcclusionCulledChunks += numChunkDepth;
+				return;
+			}
+			
+			uint8_t *visible = chunkVisible.data() +
+			(wcx * numChunkHeight + wcy) * numChunkDepth;
+			for(int cz = 0; cz < numChunkDepth; cz++) {
+				int z1 = cz * ChunkSize, z2 = z1 + ChunkSize;
+				if(z2 <= top) {
+					// no solid blocks
+					stats.numEmptyChunks++;
+					continue;
+				}
+				z1 = std::max(z1, top);
+				res = TestBox(AABB3(MakeVector3(x1, y1, (float)z1),
+									MakeVector3(x1 + (float)ChunkSize,
+												y1 + (float)ChunkSize,
+												(float)z2)));
+				switch(res) {
+					case Visible:
+						visible[cz] = 1;
+						break;
+					case FrustumCulled:
+						stats.numFrustumCulledChunks++;
+						break;
+					case Occluded:
+						stats.numOcclusionCulledChunks++;
+						break;
+				}
+			}
+		}
+		
+		void GLMapCuller::Cull(const Vector3 &eye,
+							   const Matrix4 &projectionViewMatrix,
+							   float zNear, int range) {
+			SPADES_MARK_FUNCTION();
+			
+			Stopwatch sw;
+			
+			this->eye = eye;
+			this->projectionViewMatrix = projectionViewMatrix;
+			this->zNear = zNear;
+			
+			memset(&stats, 0, sizeof(stats));
+			UpdateDirtyRegions();
+			
+			std::fill(chunkVisible.begin(), chunkVisible.end(), 0);
+			std::fill(depthBuffer.begin(), depthBuffer.end(), FLT_MAX);
+			
+			// same as the drawing loop in GLMapRenderer
+			int ecx = (int)floorf(eye.x) / ChunkSize;
+			int ecy = (int)floorf(eye.y) / ChunkSize;
+			int minCX = ecx - range, maxCX = ecx + range;
+			int minCY = ecy - range, maxCY = ecy + range;
+			
+			RasterizeOccluders(minCX * ChunkSize, minCY * ChunkSize,
+							   (maxCX + 1) * ChunkSize, (maxCY + 1) * ChunkSize);
+			stats.rasterizeTime = sw.GetTime();
+			sw.Reset();
+			
+			int minGX = FloorDiv(minCX, GroupSize), maxGX = FloorDiv(maxCX, GroupSize);
+			int minGY = FloorDiv(minCY, GroupSize), maxGY = FloorDiv(maxCY, GroupSize);
+			for(int gy = minGY; gy <= maxGY; gy++) {
+				for(int gx = minGX; gx <= maxGX; gx++) {
+					int cx1 = std::max(gx * GroupSize, minCX);
+					int cx2 = std::min(gx * GroupSize + GroupSize - 1, maxCX);
+					int cy1 = std::max(gy * GroupSize, minCY);
+					int cy2 = std::min(gy * GroupSize + GroupSize - 1, maxCY);
+					
+					int top = 64;
+					for(int cy = cy1; cy <= cy2; cy++)
+						for(int cx = cx1; cx <= cx2; cx++) {
+							int idx = (cx & (numChunkWidth - 1)) +
+							(cy & (numChunkHeight - 1)) * numChunkWidth;
+							top = std::min(top, (int)columnTop[idx]);
+						}
+					
+					AABB3 box(MakeVector3((float)(cx1 * ChunkSize),
+										  (float)(cy1 * ChunkSize),
+										  (float)top),
+							  MakeVector3((float)((cx2 + 1) * ChunkSize),
+										  (float)((cy2 + 1) * ChunkSize),
+										  (float)map->Depth()));
+					TestResult res = TestBox(box);
+					if(res != Visible) {
+						int cnt = (cx2 - cx1 + 1) * (cy2 - cy1 + 1) * numChunkDepth;
+						stats.numChunks += cnt;
+						stats.numCulledGroups++;
+						if(res == FrustumCulled)
+							stats.numFrustumCulledChunks += cnt;
+						else
+							stats.numOcclusionCulledChunks += cnt;
+						continue;
+					}
+					
+					for(int cy = cy1; cy <= cy2; cy++)
+						for(int cx = cx1; cx <= cx2; cx++)
+							CullChunkColumn(cx, cy);
+				}
+			}
+			
+			stats.testTime = sw.GetTime();
+		}
+
+#pragma mark - Benchmark
+
+		void GLMapCuller::RunBenchmark(client::GameMap *map, int numFrames) {
+			SPADES_MARK_FUNCTION();
+			
+			numFrames = std::max(numFrames, 1);
+			SPLog("Running map culling benchmark (%d frame(s))", numFrames);
+			
+			Stopwatch sw;
+			GLMapCuller culler(map);
+			SPLog("  setup   %8.3fms", sw.GetTime() * 1000.);
+			
+			// same as GLRenderer::BuildProjectionMatrix with 90x60 degree FOV
+			const float zNear = .05f, zFar = 128.f;
+			const float fovX = (float)M_PI * .5f, fovY = (float)M_PI / 3.f;
+			Matrix4 proj;
+			std::fill(proj.m, proj.m + 16, 0.f);
+			proj.m[0] = 1.f / tanf(fovX * .5f);
+			proj.m[5] = 1.f / tanf(fovY * .5f);
+			proj.m[10] = -(zFar + zNear) / (zFar - zNear);
+			proj.m[11] = -1.f;
+			proj.m[14] = -(zFar * zNear * 2.f) / (zFar - zNear);
+			
+			double rasterTime = 0., testTime = 0.;
+			long long numChunks = 0, numCulled = 0, numOccluded = 0;
+			for(int i = 0; i < numFrames; i++) {
+				// walk along a circle around the center of the map,
+				// looking in every direction near the ground
+				float per = (float)i / (float)numFrames;
+				float walk = per * (float)M_PI * 2.f;
+				float yaw = walk * 7.f;
+				Vector3 eye;
+				eye.x = (float)map->Width() * .5f + cosf(walk) * 128.f;
+				eye.y = (float)map->Height() * .5f + sinf(walk) * 128.f;
+				eye.z = (float)GetTopSolid(map->GetSolidMapWrapped((int)eye.x,
+																   (int)eye.y)) - 2.f;
+				
+				Vector3 front = MakeVector3(cosf(yaw), sinf(yaw), 0.f);
+				Vector3 up = MakeVector3(0.f, 0.f, -1.f);
+				Vector3 right = -Vector3::Cross(up, front).Normalize();
+				up = -Vector3::Cross(front, right).Normalize();
+				
+				// same as GLRenderer::BuildView
+				Matrix4 view = Matrix4::Identity();
+				view.m[0] = right.x; view.m[4] = right.y; view.m[8] = right.z;
+				view.m[1] = up.x; view.m[5] = up.y; view.m[9] = up.z;
+				view.m[2] = -front.x; view.m[6] = -front.y; view.m[10] = -front.z;
+				Vector4 v = view * eye;
+				view.m[12] = -v.x;
+				view.m[13] = -v.y;
+				view.m[14] = -v.z;
+				
+				culler.Cull(eye, proj * view, zNear, 128 / ChunkSize);
+				
+				const Statistics& stats = culler.GetStatistics();
+				rasterTime += stats.rasterizeTime;
+				testTime += stats.testTime;
+				numChunks += stats.numChunks;
+				numCulled += stats.GetNumCulledChunks();
+				numOccluded += stats.numOcclusionCulledChunks;
+			}
+			
+			SPLog("  raster  %8.3fms/frame", rasterTime * 1000. / (double)numFrames);
+			SPLog("  test    %8.3fms/frame", testTime * 1000. / (double)numFrames);
+			SPLog("  %.1f%% of chunks culled (%.1f%% by occlusion)",
+				  100. * (double)numCulled / (double)std::max(numChunks, 1LL),
+				  100. * (double)numOccluded / (double)std::max(numChunks, 1LL));
+		}
+	}
+}
@@ -0,0 +1,148 @@
+/*
+ Copyright (c) 2013 yvt
+ 
+ This file is part of OpenSpades.
+ 
+ OpenSpades is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ 
+ OpenSpades is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with OpenSpades.  If not, see <http://www.gnu.org/licenses/>.
+ 
+ */
+
+#pragma once
+
+#include "../Core/Math.h"
+#include <vector>
+#include <stdint.h>
+
+namespace spades {
+	namespace client{
+		class GameMap;
+	}
+	namespace draw {
+		/** Decides which chunks of GLMapRenderer are visible.
+		 * Chunks are tested hierarchically (column group, chunk column,
+		 * chunk) against the view frustum and against a low-resolution
+		 * depth buffer into which the terrain that is known to be solid
+		 * is rasterized on the CPU.
+		 * This class doesn't depend on OpenGL so it can be driven
+		 * (and benchmarked) without a renderer. */
+		class GLMapCuller {
+		public:
+			enum {
+				ChunkSize = 16,
+				ChunkSizeBits = 4,
+				/** size of a column group, in chunks. */
+				GroupSize = 4,
+				/** size of an occluder tile, in blocks. */
+				TileSize = 8,
+				TileSizeBits = 3,
+				DepthBufferWidth = 256,
+				DepthBufferHeight = 128,
+				/** a quad clipped by the near plane has at most 5 vertices. */
+				MaxPolygonVertices = 5
+			};
+			
+			struct Statistics {
+				int numChunks;
+				int numEmptyChunks;
+				int numFrustumCulledChunks;
+				int numOcclusionCulledChunks;
+				int numCulledGroups;
+				int numOccluderPolygons;
+				double rasterizeTime;
+				double testTime;
+				
+				int GetNumCulledChunks() const {
+					return numEmptyChunks + numFrustumCulledChunks +
+					numOcclusionCulledChunks;
+				}
+			};
+		
+		private:
+			client::GameMap *map;
+			int numChunkWidth, numChunkHeight, numChunkDepth;
+			int numTileWidth, numTileHeight;
+			
+			/** Z coordinate of the topmost solid block of each chunk column. */
+			std::vector<uint8_t> columnTop;
+			/** every column in the tile is solid from this Z coordinate
+			 * to the bottom. */
+			std::vector<uint8_t> tileOccluder;
+			std::vector<bool> tileDirty;
+			std::vector<bool> columnDirty;
+			bool anyDirty;
+			
+			std::vector<uint8_t> chunkVisible;
+			std::vector<float> depthBuffer;
+			
+			Matrix4 projectionViewMatrix;
+			float zNear;
+			Vector3 eye;
+			
+			Statistics stats;
+			
+			void UpdateTile(int tx, int ty);
+			void UpdateColumn(int cx, int cy);
+			void UpdateDirtyRegions();
+			
+			int GetTileOccluder(int tx, int ty);
+			
+			void RasterizeOccluders(int minX, int minY, int maxX, int maxY);
+			void RasterizeQuad(const Vector3& v1, const Vector3& v2,
+							   const Vector3& v3, const Vector3& v4);
+			/** rasterizes a convex polygon in the clip coordinate. */
+			void RasterizePolygon(const Vector4 *v, int numVertices,
+								  float depth);
+			
+			enum TestResult {
+				Visible,
+				FrustumCulled,
+				Occluded
+			};
+			
+			/** tests a box in the unwrapped world coordinate. */
+			TestResult TestBox(const AABB3&);
+			
+			void CullChunkColumn(int cx, int cy);
+		
+		public:
+			GLMapCuller(client::GameMap *);
+			~GLMapCuller();
+			
+			void GameMapChanged(int x, int y, int z, client::GameMap *);
+			
+			/** computes visibility of chunks within `range` chunks of
+			 * the eye's chunk column.
+			 * @param projectionViewMatrix transforms the world coordinate
+			 *        into OpenGL clip coordinate. */
+			void Cull(const Vector3& eye,
+					  const Matrix4& projectionViewMatrix,
+					  float zNear, int range);
+			
+			/** @return true if the chunk was not culled by the last
+			 * call to Cull. Coordinates are wrapped. */
+			bool IsChunkVisible(int cx, int cy, int cz) const {
+				cx &= numChunkWidth - 1;
+				cy &= numChunkHeight - 1;
+				return chunkVisible[(cx * numChunkHeight + cy) *
+									numChunkDepth + cz] != 0;
+			}
+			
+			const Statistics& GetStatistics() const { return stats; }
+			
+			/** culls `numFrames` views walking around the center of
+			 * the map, and logs the time taken and the culled ratio. */
+			static void RunBenchmark(client::GameMap *, int numFrames);
+		};
+	}
+}
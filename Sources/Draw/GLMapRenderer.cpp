@@ -34,8 +34,12 @@
 #include "../Core/Settings.h"
 #include "GLDynamicLightShader.h"
 #include "GLProfiler.h"
+#include "GLMapCuller.h"
 
 SPADES_SETTING(r_physicalLighting, "0");
+SPADES_SETTING(r_mapOcclusionCulling, "1");
+SPADES_SETTING(r_debugMapCulling, "0");
+SPADES_SETTING(r_mapCullingBenchmark, "0");
 
 namespace spades {
 	namespace draw {
@@ -71,6 +75,11 @@ namespace spades {
 										   (i / numChunkDepth) % numChunkHeight,
 										   i % numChunkDepth);
 			
+			culler = new GLMapCuller(gameMap);
+			cullerActive = false;
+			
+			if((int)r_mapCullingBenchmark > 0)
+				GLMapCuller::RunBenchmark(gameMap, r_mapCullingBenchmark);
 			
 			if(r_physicalLighting)
 				basicProgram = renderer->RegisterProgram("Shaders/BasicBlockPhys.program");
@@ -100,11 +109,14 @@ namespace spades {
 				delete chunks[i];
 			delete[] chunks;
 			delete[] chunkInfos;
+			delete culler;
 			
 		}
 		void GLMapRenderer::GameMapChanged(int x, int y, int z, client::GameMap *map) {
 			SPADES_MARK_FUNCTION_DEBUG();
 			
+			culler->GameMapChanged(x, y, z, map);
+			
 			/*GetChunk(x >> GLMapChunk::SizeBits,
 					 y >> GLMapChunk::SizeBits,
 					 z >> GLMapChunk::SizeBits)->SetNeedsUpdate();*/
@@ -149,6 +161,34 @@ namespace spades {
 			}
 		}
 		
+		void GLMapRenderer::CullChunks(spades::Vector3 eye) {
+			SPADES_MARK_FUNCTION();
+			
+			// the culler assumes the non-mirrored view
+			cullerActive = r_mapOcclusionCulling && !renderer->IsRenderingMirror();
+			if(!cullerActive)
+				return;
+			
+			{
+				GLProfiler profiler(device, "Occlusion Culling");
+				culler->Cull(eye, renderer->GetProjectionViewMatrix(),
+							 renderer->GetSceneDef().zNear,
+							 128 / GLMapChunk::Size);
+			}
+			
+			if(r_debugMapCulling) {
+				const GLMapCuller::Statistics& stats = culler->GetStatistics();
+				SPLog("Map Culling: %d of %d chunk(s) culled "
+					  "(%d empty, %d frustum, %d occlusion, %d group(s)), "
+					  "%d occluder polygon(s), %.3fms raster, %.3fms test",
+					  stats.GetNumCulledChunks(), stats.numChunks,
+					  stats.numEmptyChunks, stats.numFrustumCulledChunks,
+					  stats.numOcclusionCulledChunks, stats.numCulledGroups,
+					  stats.numOccluderPolygons,
+					  stats.rasterizeTime * 1000., stats.testTime * 1000.);
+			}
+		}
+		
 		void GLMapRenderer::Prerender() {
 			SPADES_MARK_FUNCTION();
 			
@@ -238,6 +278,7 @@ namespace spades {
 			viewMatrix.SetValue(renderer->GetViewMatrix());
 			
 			RealizeChunks(eye);
+			CullChunks(eye);
 			
 			// draw from nearest to farthest
 			int cx = (int)floorf(eye.x) / GLMapChunk::Size;
@@ -355,18 +396,22 @@ namespace spades {
 			cx &= numChunkWidth -1;
 			cy &= numChunkHeight - 1;
 			for(int z = std::max(cz, 0); z < numChunkDepth; z++)
-				GetChunk(cx, cy, z)->RenderSunlightPass();
+				if(!cullerActive || culler->IsChunkVisible(cx, cy, z))
+					GetChunk(cx, cy, z)->RenderSunlightPass();
 			for(int z = std::min(cz - 1, 63); z >= 0; z--)
-				GetChunk(cx, cy, z)->RenderSunlightPass();
+				if(!cullerActive || culler->IsChunkVisible(cx, cy, z))
+					GetChunk(cx, cy, z)->RenderSunlightPass();
 		}
 		
 		void GLMapRenderer::DrawColumnDLight(int cx, int cy, int cz, spades::Vector3 eye, const std::vector<GLDynamicLight>& lights){
 			cx &= numChunkWidth -1;
 			cy &= numChunkHeight - 1;
 			for(int z = std::max(cz, 0); z < numChunkDepth; z++)
-				GetChunk(cx, cy, z)->RenderDLightPass(lights);
+				if(!cullerActive || culler->IsChunkVisible(cx, cy, z))
+					GetChunk(cx, cy, z)->RenderDLightPass(lights);
 			for(int z = std::min(cz - 1, 63); z >= 0; z--)
-				GetChunk(cx, cy, z)->RenderDLightPass(lights);
+				if(!cullerActive || culler->IsChunkVisible(cx, cy, z))
+					GetChunk(cx, cy, z)->RenderDLightPass(lights);
 		}
 		
 #pragma mark - BackFaceBlock
@@ -32,6 +32,7 @@ namespace spades {
 		class GLMapChunk;
 		class GLProgram;
 		class GLImage;
+		class GLMapCuller;
 		class GLMapRenderer{
 			
 			friend class GLMapChunk;
@@ -55,6 +56,11 @@ namespace spades {
 			GLMapChunk **chunks;
 			ChunkRenderInfo *chunkInfos;
 			
+			GLMapCuller *culler;
+			/** true if chunks culled by `culler` are skipped in
+			 * the current frame. */
+			bool cullerActive;
+			
 			client::GameMap *gameMap;
 			
 			int numChunkWidth, numChunkHeight;
@@ -69,6 +75,7 @@ namespace spades {
 			}
 			
 			void RealizeChunks(Vector3 eye);
+			void CullChunks(Vector3 eye);
 			
 			void DrawColumnSunlight(int cx, int cy, int cz, Vector3 eye);
 			void DrawColumnDLight(int cx, int cy, int cz, Vector3 eye, const std::vector<GLDynamicLight>& lights);
@@ -29,22 +29,43 @@ namespace spades {
 	namespace draw {
 		class GLModelRenderer;
 		struct GLShadowMapRenderParam;
+		
+		/** Reference to the render parameters of the instances of a model.
+		 * Usually points GLModelRenderer's frame arena, so it must not be
+		 * kept after the pass. */
+		class GLModelParamSpan {
+			const client::ModelRenderParam *params;
+			size_t count;
+		public:
+			GLModelParamSpan(): params(NULL), count(0) {}
+			GLModelParamSpan(const client::ModelRenderParam *params, size_t count):
+			params(params), count(count) {}
+			GLModelParamSpan(const std::vector<client::ModelRenderParam>& v):
+			params(v.data()), count(v.size()) {}
+			
+			size_t size() const { return count; }
+			bool empty() const { return count == 0; }
+			const client::ModelRenderParam& operator [](size_t i) const { return params[i]; }
+			const client::ModelRenderParam *begin() const { return params; }
+			const client::ModelRenderParam *end() const { return params + count; }
+		};
+		
 		class GLModel: public client::IModel {
 			friend class GLModelRenderer;
 		public:
 			GLModel();
 			
 			/** Renders for shadow map */
-			virtual void RenderShadowMapPass(std::vector<client::ModelRenderParam> params) = 0;
+			virtual void RenderShadowMapPass(GLModelParamSpan params) = 0;
 			
 			/** Renders only in depth buffer (optional) */
-			virtual void Prerender(std::vector<client::ModelRenderParam> params) {}
+			virtual void Prerender(GLModelParamSpan params) {}
 			
 			/** Renders sunlighted solid geometry */
-			virtual void RenderSunlightPass(std::vector<client::ModelRenderParam> params) = 0;
+			virtual void RenderSunlightPass(GLModelParamSpan params) = 0;
 			
 			/** Adds dynamic light */
-			virtual void RenderDynamicLightPass(std::vector<client::ModelRenderParam> params, std::vector<GLDynamicLight> lights) = 0;
+			virtual void RenderDynamicLightPass(GLModelParamSpan params, const std::vector<GLDynamicLight>& lights) = 0;
 			
 			virtual AABB3 GetBoundingBox() = 0;
 		private:
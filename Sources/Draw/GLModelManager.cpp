@@ -58,6 +58,16 @@ namespace spades {
 			return it->second;
 		}
 		
+		void GLModelManager::RegisterPreloadedModel(const char *name,
+													VoxelModel *model) {
+			SPADES_MARK_FUNCTION();
+			
+			if(models.find(std::string(name)) != models.end())
+				return;
+			GLModel *m = static_cast<GLModel *>(renderer->CreateModelOptimized(model));
+			models[name] = m;
+		}
+		
 		GLModel *GLModelManager::CreateModel(const char *name) {
 			SPADES_MARK_FUNCTION();
 			
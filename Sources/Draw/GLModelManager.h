@@ -25,6 +25,7 @@
 #include <string>
 
 namespace spades {
+	class VoxelModel;
 	namespace draw {
 		class GLModel;
 		class GLRenderer;
@@ -36,6 +37,7 @@ namespace spades {
 			GLModelManager(GLRenderer *);
 			~GLModelManager();
 			GLModel *RegisterModel(const char *);
+			void RegisterPreloadedModel(const char *, VoxelModel *);
 		};
 	}
 }
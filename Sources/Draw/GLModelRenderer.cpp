@@ -21,19 +21,53 @@
 #include "GLModel.h"
 #include "GLRenderer.h"
 #include "../Core/Debug.h"
+#include "../Core/Settings.h"
 #include "GLProfiler.h"
+#include <string.h>
+#include <algorithm>
+
+SPADES_SETTING(r_modelInstancing, "1");
 
 namespace spades {
 	namespace draw {
+		static bool HasExtension(IGLDevice *device, const char *name) {
+			const char *exts;
+			try{
+				exts = device->GetString(IGLDevice::Extensions);
+			}catch(...){
+				return false;
+			}
+			if(!exts)
+				return false;
+			size_t len = strlen(name);
+			for(const char *p = exts; (p = strstr(p, name)) != NULL; p += len){
+				if((p == exts || p[-1] == ' ') &&
+				   (p[len] == ' ' || p[len] == 0))
+					return true;
+			}
+			return false;
+		}
+		
 		GLModelRenderer::GLModelRenderer(GLRenderer *r):
 		device(r->GetGLDevice()), renderer(r){
 			SPADES_MARK_FUNCTION();
 			modelCount = 0;
+			paramsSorted = true;
+			
+			instancingSupported = HasExtension(device, "GL_ARB_instanced_arrays") &&
+			(HasExtension(device, "GL_ARB_draw_instanced") ||
+			 HasExtension(device, "GL_EXT_draw_instanced"));
+			SPLog("Instanced model rendering: %s",
+				  instancingSupported ? "supported" : "not supported");
+			instanceBuffer = 0;
+			instanceBufferSize = 0;
 		}
 		
 		GLModelRenderer::~GLModelRenderer() {
 			SPADES_MARK_FUNCTION();
 			Clear();
+			if(instanceBuffer)
+				device->DeleteBuffer(instanceBuffer);
 		}
 		
 		void GLModelRenderer::AddModel(GLModel *model,
@@ -43,11 +77,44 @@ namespace spades {
 				model->renderId = (int)models.size();
 				RenderModel m;
 				m.model = model;
+				m.firstParam = 0;
+				m.numParams = 0;
 				model->AddRef();
 				models.push_back(m);
 			}
 			modelCount++;
-			models[model->renderId].params.push_back(param);
+			models[model->renderId].numParams++;
+			addedParams.push_back(param);
+			addedModelIds.push_back(model->renderId);
+			paramsSorted = false;
+		}
+		
+		void GLModelRenderer::SortParams() {
+			SPADES_MARK_FUNCTION_DEBUG();
+			if(paramsSorted)
+				return;
+			
+			// counting sort by the model. numParams is counted again
+			// while scattering.
+			size_t first = 0;
+			for(size_t i = 0; i < models.size(); i++){
+				models[i].firstParam = first;
+				first += models[i].numParams;
+				models[i].numParams = 0;
+			}
+			params.resize(addedParams.size());
+			
+			for(size_t i = 0; i < addedParams.size(); i++){
+				RenderModel& m = models[addedModelIds[i]];
+				params[m.firstParam + m.numParams] = addedParams[i];
+				m.numParams++;
+			}
+			paramsSorted = true;
+		}
+		
+		GLModelParamSpan GLModelRenderer::GetParams(const RenderModel& m) const {
+			SPAssert(paramsSorted);
+			return GLModelParamSpan(params.data() + m.firstParam, m.numParams);
 		}
 		
 		void GLModelRenderer::RenderShadowMapPass() {
@@ -55,12 +122,14 @@ namespace spades {
 			
 			GLProfiler profiler(device, "Model [%d model(s), %d unique model type(s)]", modelCount, (int)models.size());
 			
+			SortParams();
+			
 			int numModels = 0;
 			for(size_t i = 0; i < models.size(); i++){
 				RenderModel& m = models[i];
 				GLModel *model = m.model;
-				model->RenderShadowMapPass(m.params);
-				numModels += (int)m.params.size();
+				model->RenderShadowMapPass(GetParams(m));
+				numModels += (int)m.numParams;
 			}
 #if 0
 			printf("Model types: %d, Number of models: %d\n",
@@ -78,26 +147,30 @@ namespace spades {
 			
 			GLProfiler profiler(device, "Model [%d model(s), %d unique model type(s)]", modelCount, (int)models.size());
 			
+			SortParams();
+			
 			for(size_t i = 0; i < models.size(); i++){
 				RenderModel& m = models[i];
 				GLModel *model = m.model;
 				
-				model->RenderSunlightPass(m.params);
+				model->RenderSunlightPass(GetParams(m));
 			}
 		}
 		
-		void GLModelRenderer::RenderDynamicLightPass(std::vector<GLDynamicLight> lights) {
+		void GLModelRenderer::RenderDynamicLightPass(const std::vector<GLDynamicLight>& lights) {
 			SPADES_MARK_FUNCTION();
 			
 			GLProfiler profiler(device, "Model [%d model(s), %d unique model type(s)]", modelCount, (int)models.size());
 			
 			if(!lights.empty()){
 				
+				SortParams();
+				
 				for(size_t i = 0; i < models.size(); i++){
 					RenderModel& m = models[i];
 					GLModel *model = m.model;
 					
-					model->RenderDynamicLightPass(m.params, lights);
+					model->RenderDynamicLightPass(GetParams(m), lights);
 				}
 					
 			}
@@ -113,7 +186,41 @@ namespace spades {
 			}
 			models.clear();
 			
+			// keep the capacity for the next frame
+			addedParams.clear();
+			addedModelIds.clear();
+			params.clear();
+			paramsSorted = true;
+			
 			modelCount = 0;
 		}
+		
+		bool GLModelRenderer::IsInstancingEnabled() {
+			return instancingSupported && r_modelInstancing;
+		}
+		
+		void GLModelRenderer::UploadInstances(const InstanceData *instances,
+											  size_t count) {
+			SPADES_MARK_FUNCTION_DEBUG();
+			
+			if(!instanceBuffer)
+				instanceBuffer = device->GenBuffer();
+			device->BindBuffer(IGLDevice::ArrayBuffer, instanceBuffer);
+			
+			size_t size = count * sizeof(InstanceData);
+			if(size > instanceBufferSize){
+				instanceBufferSize = std::max(size, instanceBufferSize * 2);
+				instanceBufferSize = std::max(instanceBufferSize,
+											  (size_t)(64 * sizeof(InstanceData)));
+			}
+			
+			// respecifying the storage orphans the old one, so the draws
+			// that are still reading it don't stall the upload
+			device->BufferData(IGLDevice::ArrayBuffer,
+							   (IGLDevice::Sizei)instanceBufferSize,
+							   NULL, IGLDevice::StreamDraw);
+			device->BufferSubData(IGLDevice::ArrayBuffer, 0,
+								  (IGLDevice::Sizei)size, instances);
+		}
 	}
 }
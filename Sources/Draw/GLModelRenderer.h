@@ -25,6 +25,7 @@
 #include <vector>
 #include "IGLDevice.h"
 #include "GLDynamicLight.h"
+#include "GLModel.h"
 
 namespace spades {
 	namespace draw {
@@ -33,18 +34,45 @@ namespace spades {
 		class GLSparseShadowMapRenderer;
 		class GLModelRenderer {
 			friend class GLSparseShadowMapRenderer;
+		public:
+			/** per-instance vertex attributes of the instanced draws. */
+			struct InstanceData {
+				/** model matrix in the column-major order. */
+				float modelMatrix[16];
+				float customColor[3];
+			};
 			
+		private:
 			GLRenderer *renderer;
 			IGLDevice *device;
 			
 			struct RenderModel {
 				GLModel *model;
-				std::vector<client::ModelRenderParam> params;
+				/** range in `params`, valid after SortParams. */
+				size_t firstParam;
+				size_t numParams;
 			};
 			
 			std::vector<RenderModel> models;
 			int modelCount;
 			
+			/** parameters in the order of AddModel, and the renderId
+			 * of their models. */
+			std::vector<client::ModelRenderParam> addedParams;
+			std::vector<int> addedModelIds;
+			/** frame arena; the parameters of each model are
+			 * contiguous. these are never shrunk, so nothing is
+			 * allocated in a frame once the capacity is enough. */
+			std::vector<client::ModelRenderParam> params;
+			bool paramsSorted;
+			
+			bool instancingSupported;
+			IGLDevice::UInteger instanceBuffer;
+			size_t instanceBufferSize;
+			
+			void SortParams();
+			GLModelParamSpan GetParams(const RenderModel&) const;
+			
 		public:
 			GLModelRenderer(GLRenderer *);
 			~GLModelRenderer();
@@ -56,10 +84,18 @@ namespace spades {
 			
 			void Prerender();
 			void RenderSunlightPass();
-			void RenderDynamicLightPass(std::vector<GLDynamicLight> lights);
+			void RenderDynamicLightPass(const std::vector<GLDynamicLight>& lights);
 			
 			void Clear();
 			
+			/** @return true if the models should be drawn with
+			 * UploadInstances and DrawElementsInstanced. */
+			bool IsInstancingEnabled();
+			
+			/** uploads the per-instance attributes to the instance
+			 * buffer and binds it to IGLDevice::ArrayBuffer. */
+			void UploadInstances(const InstanceData *, size_t count);
+			
 		};
 	}
 }
\ No newline at end of file
@@ -29,18 +29,40 @@
 #include "GLDynamicLightShader.h"
 #include "IGLShadowMapRenderer.h"
 #include "GLShadowMapShader.h"
+#include "GLModelRenderer.h"
 #include "CellToTriangle.h"
 #include "../Core/Exception.h"
 #include <set>
+#include <stddef.h>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <cstring>
 #include "../Core/Bitmap.h"
 #include "../Core/BitmapAtlasGenerator.h"
+#include "../Core/FileManager.h"
+#include "../Core/IStream.h"
+#include "../Core/Settings.h"
+
+SPADES_SETTING(r_optimizedVoxelModelNumThreads, "4");
+SPADES_SETTING(r_optimizedVoxelModelCache, "1");
 
 namespace spades {
 	namespace draw {
+		
+		// increment this when the output of the optimization changes
+		static const uint32_t MeshCacheVersion = 1;
+		static const uint32_t MeshCacheMagic = 0x314d564f; // "OVM1"
+		// models with the same content may be optimized concurrently
+		static std::mutex meshCacheSaveMutex;
+		
 		void GLOptimizedVoxelModel::PreloadShaders(spades::draw::GLRenderer *renderer) {
 			renderer->RegisterProgram("Shaders/OptimizedVoxelModel.program");
 			renderer->RegisterProgram("Shaders/OptimizedVoxelModelDynamicLit.program");
 			renderer->RegisterProgram("Shaders/OptimizedVoxelModelShadowMap.program");
+			renderer->RegisterProgram("Shaders/OptimizedVoxelModelInstanced.program");
+			renderer->RegisterProgram("Shaders/OptimizedVoxelModelDynamicLitInstanced.program");
+			renderer->RegisterProgram("Shaders/OptimizedVoxelModelShadowMapInstanced.program");
 			renderer->RegisterImage("Gfx/AmbientOcclusion.tga");
 		}
 		GLOptimizedVoxelModel::GLOptimizedVoxelModel(VoxelModel *m,
@@ -49,29 +71,19 @@ namespace spades {
 			
 			renderer = r;
 			device = r->GetGLDevice();
-			
-			BuildVertices(m);
-			GenerateTexture();
+			image = NULL;
+			buffer = 0;
+			idxBuffer = 0;
+			numIndices = 0;
 			
 			program = renderer->RegisterProgram("Shaders/OptimizedVoxelModel.program");
 			dlightProgram = renderer->RegisterProgram("Shaders/OptimizedVoxelModelDynamicLit.program");
 			shadowMapProgram = renderer->RegisterProgram("Shaders/OptimizedVoxelModelShadowMap.program");
+			instancedProgram = renderer->RegisterProgram("Shaders/OptimizedVoxelModelInstanced.program");
+			instancedDlightProgram = renderer->RegisterProgram("Shaders/OptimizedVoxelModelDynamicLitInstanced.program");
+			instancedShadowMapProgram = renderer->RegisterProgram("Shaders/OptimizedVoxelModelShadowMapInstanced.program");
 			aoImage = (GLImage *)renderer->RegisterImage("Gfx/AmbientOcclusion.tga");
 			
-			
-			buffer = device->GenBuffer();
-			device->BindBuffer(IGLDevice::ArrayBuffer, buffer);
-			device->BufferData(IGLDevice::ArrayBuffer,
-							   vertices.size() * sizeof(Vertex),
-							   vertices.data(), IGLDevice::StaticDraw);
-			
-			idxBuffer = device->GenBuffer();
-			device->BindBuffer(IGLDevice::ArrayBuffer, idxBuffer);
-			device->BufferData(IGLDevice::ArrayBuffer,
-							   indices.size() * sizeof(uint32_t),
-							   indices.data(), IGLDevice::StaticDraw);
-			device->BindBuffer(IGLDevice::ArrayBuffer, 0);
-			
 			origin = m->GetOrigin();
 			origin -= .5f; // (0,0,0) is center of voxel (0,0,0)
 			
@@ -90,56 +102,103 @@ namespace spades {
 			boundingBox.min = minPos;
 			boundingBox.max = maxPos;
 			
-			// clean up
-			numIndices = (unsigned int)indices.size();
-			std::vector<Vertex>().swap(vertices);
-			std::vector<uint32_t>().swap(indices);
+			// warm start: the result of the previous optimization
+			contentHash = ComputeContentHash(m);
+			bool useCache = r_optimizedVoxelModelCache;
+			if(useCache){
+				mesh.reset(LoadMeshCache(contentHash));
+			}
+			if(mesh)
+				return;
+			
+			int numWorkers = r_optimizedVoxelModelNumThreads;
+			uint64_t hash = contentHash;
+			if(numWorkers <= 1){
+				mesh.reset(BuildMesh(m, 1));
+				if(useCache){
+					// the mesh is only read until EnsureUploaded joins this
+					const MeshData *result = mesh.get();
+					auto f = [result, hash]() {
+						TrySaveMeshCache(hash, *result);
+					};
+					buildDispatch.reset(new FunctionDispatch<decltype(f)>(f));
+					buildDispatch->Start();
+				}
+				return;
+			}
+			
+			// optimize in the background so that models registered in a row
+			// are processed concurrently. the result is uploaded when
+			// the model is rendered for the first time.
+			m->AddRef();
+			auto f = [this, m, numWorkers, useCache, hash]() {
+				try{
+					mesh.reset(BuildMesh(m, numWorkers));
+					// written here so that the rendering thread doesn't wait
+					// for the disk
+					if(useCache)
+						TrySaveMeshCache(hash, *mesh);
+				}catch(const std::exception& ex){
+					buildError = ex.what();
+				}catch(...){
+					buildError = "(no information provided)";
+				}
+				m->Release();
+			};
+			buildDispatch.reset(new FunctionDispatch<decltype(f)>(f));
+			buildDispatch->Start();
 		}
 		GLOptimizedVoxelModel::~GLOptimizedVoxelModel() {
 			SPADES_MARK_FUNCTION();
 			
-			image->Release();
-			device->DeleteBuffer(idxBuffer);
-			device->DeleteBuffer(buffer);
+			if(buildDispatch)
+				buildDispatch->Join();
+			
+			if(image){
+				image->Release();
+				device->DeleteBuffer(idxBuffer);
+				device->DeleteBuffer(buffer);
+			}
 		}
 		
-		void GLOptimizedVoxelModel::GenerateTexture() {
-			BitmapAtlasGenerator atlasGen;
-			std::map<Bitmap *, int> idx;
-			std::vector<IntVector3> poss;
-			for(size_t i = 0; i < bmps.size(); i++){
-				idx[bmps[i]] = i;
-				atlasGen.AddBitmap(bmps[i]);
-			}
+		void GLOptimizedVoxelModel::EnsureUploaded() {
+			SPADES_MARK_FUNCTION();
 			
-			BitmapAtlasGenerator::Result result = atlasGen.Pack();
-			Handle<Bitmap> bmp(result.bitmap, false);
-			SPAssert(result.items.size() == bmps.size());
-			for(size_t i = 0; i < bmps.size(); i++){
-				bmps[i]->Release();
-			}
-			bmps.clear();
+			if(image)
+				return;
 			
-			poss.resize(result.items.size());
-			for(size_t i = 0; i < result.items.size(); i++){
-				const BitmapAtlasGenerator::Item& item = result.items[i];
-				int id = idx[item.bitmap];
-				poss[id] = IntVector3::Make(item.x, item.y, 0);
+			if(buildDispatch){
+				buildDispatch->Join();
+				buildDispatch.reset();
 			}
-			
-			// move vertices' texture coord
-			SPAssert(bmpIndex.size() == vertices.size());
-			for(size_t i = 0; i < bmpIndex.size(); i++){
-				int id = (int)bmpIndex[i];
-				Vertex& v = vertices[i];
-				IntVector3 p = poss[id];
-				v.u += p.x;
-				v.v += p.y;
+			if(!mesh){
+				SPRaise("Failed to optimize voxel model: %s", buildError.c_str());
 			}
 			
-			std::vector<uint16_t>().swap(bmpIndex);
-			
+			Handle<Bitmap> bmp(new Bitmap(mesh->atlas.data(),
+										  mesh->atlasWidth,
+										  mesh->atlasHeight), false);
 			image = static_cast<GLImage *>(renderer->CreateImage(bmp));
+			
+			const std::vector<Vertex>& vertices = mesh->vertices;
+			const std::vector<uint32_t>& indices = mesh->indices;
+			
+			buffer = device->GenBuffer();
+			device->BindBuffer(IGLDevice::ArrayBuffer, buffer);
+			device->BufferData(IGLDevice::ArrayBuffer,
+							   vertices.size() * sizeof(Vertex),
+							   vertices.data(), IGLDevice::StaticDraw);
+			
+			idxBuffer = device->GenBuffer();
+			device->BindBuffer(IGLDevice::ArrayBuffer, idxBuffer);
+			device->BufferData(IGLDevice::ArrayBuffer,
+							   indices.size() * sizeof(uint32_t),
+							   indices.data(), IGLDevice::StaticDraw);
+			device->BindBuffer(IGLDevice::ArrayBuffer, 0);
+			
+			// clean up
+			numIndices = (unsigned int)indices.size();
+			mesh.reset();
 		}
 		
 		uint8_t GLOptimizedVoxelModel::calcAOID(VoxelModel *m,
@@ -233,7 +292,8 @@ namespace spades {
 			(x1 - x2) * (y3 - y1);
 		}
 		
-		void GLOptimizedVoxelModel::EmitSlice(uint8_t *slice,
+		void GLOptimizedVoxelModel::EmitSlice(SliceScratch& scratch,
+											  SliceOutput& output,
 											  int usize, int vsize,
 											  int sx, int sy, int sz,
 											  int ux, int uy, int uz,
@@ -242,8 +302,17 @@ namespace spades {
 											  bool flip,
 											  VoxelModel *model) {
 			SPADES_MARK_FUNCTION();
+			uint8_t *slice = scratch.slice.data();
 			int minU = -1, minV = -1, maxU = -1, maxV = -1;
 			
+			output.firstVertex = scratch.vertices.size();
+			output.firstIndex = scratch.indices.size();
+			output.firstPixel = scratch.pixels.size();
+			output.numVertices = 0;
+			output.numIndices = 0;
+			output.bmpWidth = 0;
+			output.bmpHeight = 0;
+			
 			for(int u = 0; u < usize; u++){
 				for(int v = 0; v < vsize; v++){
 					if(slice[u * vsize + v]){
@@ -281,11 +350,11 @@ namespace spades {
 			
 			int tu = minU - 1, tv = minV - 1;
 			int bw = (maxU - minU) + 3, bh = (maxV - minV) + 3;
-			int bId = bmps.size();
-			Bitmap *bmp = new Bitmap(bw, bh);
-			bmps.push_back(bmp);
+			output.bmpWidth = bw;
+			output.bmpHeight = bh;
+			scratch.pixels.resize(output.firstPixel + bw * bh);
 			{
-				uint32_t *pixels = bmp->GetPixels();
+				uint32_t *pixels = scratch.pixels.data() + output.firstPixel;
 				IntVector3 p1 = {mx, my, mz};
 				
 				IntVector3 uu = {ux, uy, uz};
@@ -358,7 +427,8 @@ namespace spades {
 			// TODO: optimize scan range
 			auto polys = std::move(generator.ProcessArea());
 			for(std::size_t i = 0; i < polys.size(); i += 3) {
-				uint32_t idx = (uint32_t)vertices.size();
+				// index is relative to the slice's first vertex
+				uint32_t idx = (uint32_t)(scratch.vertices.size() - output.firstVertex);
 				IntVector3 pt1 = ExactPoint(polys[i + 0]);
 				IntVector3 pt2 = ExactPoint(polys[i + 1]);
 				IntVector3 pt3 = ExactPoint(polys[i + 2]);
@@ -368,6 +438,7 @@ namespace spades {
 					continue;
 				
 				Vertex vtx;
+				vtx.padding = 0; vtx.padding2 = 0;
 				vtx.nx = nx; vtx.ny = ny; vtx.nz = nz;
 				
 				vtx.x = sx + (int)pt1.x * ux + (int)pt1.y * vx;
@@ -375,186 +446,417 @@ namespace spades {
 				vtx.z = sz + (int)pt1.x * uz + (int)pt1.y * vz;
 				vtx.u = (int)pt1.x - tu;
 				vtx.v = (int)pt1.y - tv;
-				vertices.push_back(vtx);
+				scratch.vertices.push_back(vtx);
 				
 				vtx.x = sx + (int)pt2.x * ux + (int)pt2.y * vx;
 				vtx.y = sy + (int)pt2.x * uy + (int)pt2.y * vy;
 				vtx.z = sz + (int)pt2.x * uz + (int)pt2.y * vz;
 				vtx.u = (int)pt2.x - tu;
 				vtx.v = (int)pt2.y - tv;
-				vertices.push_back(vtx);
+				scratch.vertices.push_back(vtx);
 				
 				vtx.x = sx + (int)pt3.x * ux + (int)pt3.y * vx;
 				vtx.y = sy + (int)pt3.x * uy + (int)pt3.y * vy;
 				vtx.z = sz + (int)pt3.x * uz + (int)pt3.y * vz;
 				vtx.u = (int)pt3.x - tu;
 				vtx.v = (int)pt3.y - tv;
-				vertices.push_back(vtx);
+				scratch.vertices.push_back(vtx);
 				
 				if(!flip){
-					indices.push_back(idx+2);
-					indices.push_back(idx+1);
-					indices.push_back(idx);
+					scratch.indices.push_back(idx+2);
+					scratch.indices.push_back(idx+1);
+					scratch.indices.push_back(idx);
 					
 				}else{
-					indices.push_back(idx);
-					indices.push_back(idx+1);
-					indices.push_back(idx+2);
+					scratch.indices.push_back(idx);
+					scratch.indices.push_back(idx+1);
+					scratch.indices.push_back(idx+2);
 				}
-				bmpIndex.push_back(bId);
-				bmpIndex.push_back(bId);
-				bmpIndex.push_back(bId);
 			}
 			
+			output.numVertices = scratch.vertices.size() - output.firstVertex;
+			output.numIndices = scratch.indices.size() - output.firstIndex;
+		}
+		
+		int GLOptimizedVoxelModel::GetNumSlices(VoxelModel *model) {
+			// each layer has a front-facing and a back-facing slice
+			return (model->GetWidth() + model->GetHeight() +
+					model->GetDepth()) * 2;
 		}
 		
-		void GLOptimizedVoxelModel::BuildVertices(spades::VoxelModel *model) {
+		void GLOptimizedVoxelModel::BuildSlice(int sliceId,
+											   SliceScratch& scratch,
+											   SliceOutput& output,
+											   VoxelModel *model) {
 			SPADES_MARK_FUNCTION();
 			
-			SPAssert(vertices.empty());
-			SPAssert(indices.empty());
-			
 			int w = model->GetWidth();
 			int h = model->GetHeight();
 			int d = model->GetDepth();
 			
-			std::vector<uint8_t> slice;
+			// slices are numbered in the order of x, y, and z-slices
+			// so that merging them in order gives a deterministic result.
+			int layer = sliceId >> 1;
+			bool back = (sliceId & 1) != 0;
+			IntVector3 nn, uu, vv;
+			int usize, vsize;
+			bool flip;
+			if(layer < w){
+				nn = IntVector3::Make(1, 0, 0);
+				uu = IntVector3::Make(0, 1, 0);
+				vv = IntVector3::Make(0, 0, 1);
+				usize = h; vsize = d;
+				flip = back;
+			}else if(layer < w + h){
+				layer -= w;
+				nn = IntVector3::Make(0, 1, 0);
+				uu = IntVector3::Make(1, 0, 0);
+				vv = IntVector3::Make(0, 0, 1);
+				usize = w; vsize = d;
+				flip = !back;
+			}else{
+				layer -= w + h;
+				SPAssert(layer < d);
+				nn = IntVector3::Make(0, 0, 1);
+				uu = IntVector3::Make(1, 0, 0);
+				vv = IntVector3::Make(0, 1, 0);
+				usize = w; vsize = h;
+				flip = back;
+			}
 			
-			// x-slice
-			slice.resize(h * d);
-			std::fill(slice.begin(), slice.end(), 0);
-			for(int x = 0; x < w; x++){
-				for(int y = 0; y < h; y++){
-					for(int z = 0; z < d; z++){
-						uint8_t& s = slice[y * d + z];
-						if(x == 0)
-							s = model->IsSolid(x, y, z) ? 1 : 0;
-						else
-							s = (model->IsSolid(x, y, z) &&
-								 !model->IsSolid(x - 1, y, z))
-							? 1 : 0;
-					}
+			// a face is emitted where a solid voxel is adjacent to
+			// an air voxel (or the outside of the model.)
+			IntVector3 side = back ? nn : nn * -1;
+			std::vector<uint8_t>& slice = scratch.slice;
+			slice.resize(usize * vsize);
+			for(int u = 0; u < usize; u++){
+				for(int v = 0; v < vsize; v++){
+					IntVector3 p = nn * layer + uu * u + vv * v;
+					IntVector3 q = p + side;
+					slice[u * vsize + v] =
+					(model->IsSolid(p.x, p.y, p.z) &&
+					 !model->IsSolid(q.x, q.y, q.z)) ? 1 : 0;
 				}
-				EmitSlice(slice.data(), h, d,
-						  x, 0, 0,
-						  0, 1, 0,
-						  0, 0, 1,
-						  x, 0, 0,
-						  false,
-						  model);
+			}
+			
+			IntVector3 s = nn * (back ? layer + 1 : layer);
+			IntVector3 m = nn * layer;
+			EmitSlice(scratch, output,
+					  usize, vsize,
+					  s.x, s.y, s.z,
+					  uu.x, uu.y, uu.z,
+					  vv.x, vv.y, vv.z,
+					  m.x, m.y, m.z,
+					  flip,
+					  model);
+		}
+		
+		/** shared state of the workers optimizing one model.
+		 * workers take slices one by one, so the owner never has to
+		 * wait for a worker that hasn't started yet. */
+		class GLOptimizedVoxelModel::BuildContext {
+			VoxelModel *model;
+			int numSlices;
+			std::atomic<int> nextSlice;
+			
+			std::mutex doneMutex;
+			std::condition_variable doneCond;
+			int numDone;
+			std::string error;
+			
+		public:
+			std::vector<SliceOutput> outputs;
+			std::vector<SliceScratch> scratches;
+			
+			BuildContext(VoxelModel *m, int numWorkers):
+			model(m), numSlices(GetNumSlices(m)), nextSlice(0),
+			numDone(0), outputs(numSlices), scratches(numWorkers) {
+				model->AddRef();
 				
-				for(int y = 0; y < h; y++){
-					for(int z = 0; z < d; z++){
-						uint8_t& s = slice[y * d + z];
-						if(x == w - 1)
-							s = model->IsSolid(x, y, z) ? 1 : 0;
-						else
-							s = (model->IsSolid(x, y, z) &&
-								 !model->IsSolid(x + 1, y, z))
-							? 1 : 0;
-					}
+				// preallocate the scratch with the rough estimate of
+				// the model's surface area.
+				int w = m->GetWidth(), h = m->GetHeight(), d = m->GetDepth();
+				size_t maxSlice = std::max(w * h, std::max(h * d, w * d));
+				size_t area = (w * h + h * d + w * d) * 2;
+				area /= numWorkers;
+				for(size_t i = 0; i < scratches.size(); i++){
+					SliceScratch& s = scratches[i];
+					s.slice.reserve(maxSlice);
+					s.pixels.reserve(area);
+					s.vertices.reserve(area / 4);
+					s.indices.reserve(area / 4);
 				}
-				EmitSlice(slice.data(), h, d,
-						  x + 1, 0, 0,
-						  0, 1, 0,
-						  0, 0, 1,
-						  x, 0, 0,
-						  true,
-						  model);
+			}
+			~BuildContext() {
+				model->Release();
 			}
 			
-			// y-slice
-			slice.resize(w * d);
-			std::fill(slice.begin(), slice.end(), 0);
-			for(int y = 0; y < h; y++){
-				for(int x = 0; x < w; x++){
-					for(int z = 0; z < d; z++){
-						uint8_t& s = slice[x * d + z];
-						if(y == 0)
-							s = model->IsSolid(x, y, z) ? 1 : 0;
-						else
-							s = (model->IsSolid(x, y, z) &&
-								 !model->IsSolid(x, y - 1, z))
-							? 1 : 0;
+			void Work(int worker) {
+				SPADES_MARK_FUNCTION();
+				SliceScratch& scratch = scratches[worker];
+				int done = 0;
+				while(true){
+					int sliceId = nextSlice.fetch_add(1);
+					if(sliceId >= numSlices)
+						break;
+					SliceOutput& out = outputs[sliceId];
+					out.worker = worker;
+					try{
+						BuildSlice(sliceId, scratch, out, model);
+					}catch(const std::exception& ex){
+						std::lock_guard<std::mutex> lock(doneMutex);
+						error = ex.what();
 					}
+					done++;
 				}
-				EmitSlice(slice.data(), w, d,
-						  0, y, 0,
-						  1, 0, 0,
-						  0, 0, 1,
-						  0, y, 0,
-						  true,
-						  model);
 				
+				std::lock_guard<std::mutex> lock(doneMutex);
+				numDone += done;
+				if(numDone == numSlices)
+					doneCond.notify_all();
+			}
+			
+			void Wait() {
+				std::unique_lock<std::mutex> lock(doneMutex);
+				doneCond.wait(lock, [this] { return numDone == numSlices; });
+				if(!error.empty()){
+					SPRaise("%s", error.c_str());
+				}
+			}
+		};
+		
+		GLOptimizedVoxelModel::MeshData *GLOptimizedVoxelModel::BuildMesh(VoxelModel *model,
+																			int numWorkers) {
+			SPADES_MARK_FUNCTION();
+			
+			numWorkers = std::max(std::min(numWorkers, GetNumSlices(model)), 1);
+			std::shared_ptr<BuildContext> ctx =
+			std::make_shared<BuildContext>(model, numWorkers);
+			
+			for(int i = 1; i < numWorkers; i++){
+				auto f = [ctx, i]() {
+					ctx->Work(i);
+				};
+				ConcurrentDispatch *disp = new FunctionDispatch<decltype(f)>(f);
+				disp->Start();
+				disp->Release();
+			}
+			
+			ctx->Work(0);
+			ctx->Wait();
+			
+			return MergeSlices(ctx->outputs, ctx->scratches);
+		}
+		
+		GLOptimizedVoxelModel::MeshData *GLOptimizedVoxelModel::MergeSlices(const std::vector<SliceOutput>& outputs,
+																			  const std::vector<SliceScratch>& scratches) {
+			SPADES_MARK_FUNCTION();
+			
+			std::unique_ptr<MeshData> mesh(new MeshData());
+			
+			std::vector<BitmapAtlasGenerator::Rect> rects;
+			size_t numVertices = 0, numIndices = 0;
+			for(size_t i = 0; i < outputs.size(); i++){
+				const SliceOutput& out = outputs[i];
+				if(out.bmpWidth == 0)
+					continue;
+				BitmapAtlasGenerator::Rect r = {0, 0, out.bmpWidth, out.bmpHeight};
+				rects.push_back(r);
+				numVertices += out.numVertices;
+				numIndices += out.numIndices;
+			}
+			
+			BitmapAtlasGenerator::PackRects(rects, mesh->atlasWidth,
+											mesh->atlasHeight);
+			
+			int aw = mesh->atlasWidth;
+			mesh->atlas.resize(aw * mesh->atlasHeight, 0);
+			mesh->vertices.reserve(numVertices);
+			mesh->indices.reserve(numIndices);
+			
+			size_t rectId = 0;
+			for(size_t i = 0; i < outputs.size(); i++){
+				const SliceOutput& out = outputs[i];
+				if(out.bmpWidth == 0)
+					continue;
+				
+				const SliceScratch& scratch = scratches[out.worker];
+				const BitmapAtlasGenerator::Rect& r = rects[rectId++];
+				
+				const uint32_t *inPixels = scratch.pixels.data() + out.firstPixel;
+				for(int y = 0; y < r.h; y++){
+					std::memcpy(mesh->atlas.data() + r.x + (r.y + y) * aw,
+								inPixels + y * r.w,
+								r.w * 4);
+				}
+				
+				uint32_t baseIndex = (uint32_t)mesh->vertices.size();
+				for(size_t j = 0; j < out.numVertices; j++){
+					Vertex v = scratch.vertices[out.firstVertex + j];
+					v.u += r.x;
+					v.v += r.y;
+					mesh->vertices.push_back(v);
+				}
+				for(size_t j = 0; j < out.numIndices; j++){
+					mesh->indices.push_back(baseIndex +
+											scratch.indices[out.firstIndex + j]);
+				}
+			}
+			
+			return mesh.release();
+		}
+		
+#pragma mark - Cache
+		
+		uint64_t GLOptimizedVoxelModel::ComputeContentHash(VoxelModel *model) {
+			SPADES_MARK_FUNCTION();
+			
+			// FNV-1a
+			uint64_t hash = 14695981039346656037ULL;
+			auto feed = [&hash](uint32_t v) {
+				for(int i = 0; i < 4; i++){
+					hash ^= v & 0xff;
+					hash *= 1099511628211ULL;
+					v >>= 8;
+				}
+			};
+			
+			int w = model->GetWidth();
+			int h = model->GetHeight();
+			int d = model->GetDepth();
+			feed(w); feed(h); feed(d);
+			
+			for(int y = 0; y < h; y++){
 				for(int x = 0; x < w; x++){
+					uint64_t bits = model->GetSolidBitsAt(x, y);
+					feed((uint32_t)bits);
+					feed((uint32_t)(bits >> 32));
+					
+					// only the colors of the surface voxels are used
+					// (the inner ones might be undefined)
+					uint64_t inner = bits & (bits << 1) & (bits >> 1);
+					inner &= x > 0 ? model->GetSolidBitsAt(x - 1, y) : 0;
+					inner &= x < w - 1 ? model->GetSolidBitsAt(x + 1, y) : 0;
+					inner &= y > 0 ? model->GetSolidBitsAt(x, y - 1) : 0;
+					inner &= y < h - 1 ? model->GetSolidBitsAt(x, y + 1) : 0;
+					uint64_t surface = bits & ~inner;
 					for(int z = 0; z < d; z++){
-						uint8_t& s = slice[x * d + z];
-						if(y == h - 1)
-							s = model->IsSolid(x, y, z) ? 1 : 0;
-						else
-							s = (model->IsSolid(x, y, z) &&
-								 !model->IsSolid(x, y + 1, z))
-							? 1 : 0;
+						if(surface & (1ULL << z))
+							feed(model->GetColor(x, y, z) & 0xffffff);
 					}
 				}
-				EmitSlice(slice.data(), w, d,
-						  0, y + 1, 0,
-						  1, 0, 0,
-						  0, 0, 1,
-						  0, y, 0,
-						  false,
-						  model);
 			}
 			
-			// z-slice
-			slice.resize(w * h);
-			std::fill(slice.begin(), slice.end(), 0);
-			for(int z = 0; z < d; z++){
-				for(int x = 0; x < w; x++){
-					for(int y = 0; y < h; y++){
-						uint8_t& s = slice[x * h + y];
-						if(z == 0)
-							s = model->IsSolid(x, y, z) ? 1 : 0;
-						else
-							s = (model->IsSolid(x, y, z) &&
-								 !model->IsSolid(x, y, z - 1))
-							? 1 : 0;
-					}
+			return hash;
+		}
+		
+		std::string GLOptimizedVoxelModel::GetCachePath(uint64_t hash) {
+			char buf[64];
+			sprintf(buf, "Cache/Models/%016llx.ovm", (unsigned long long)hash);
+			return buf;
+		}
+		
+		GLOptimizedVoxelModel::MeshData *GLOptimizedVoxelModel::LoadMeshCache(uint64_t hash) {
+			SPADES_MARK_FUNCTION();
+			
+			std::string path = GetCachePath(hash);
+			if(!FileManager::FileExists(path.c_str()))
+				return NULL;
+			
+			try{
+				std::unique_ptr<IStream> stream(FileManager::OpenForReading(path.c_str()));
+				if(stream->ReadLittleInt() != MeshCacheMagic ||
+				   stream->ReadLittleInt() != MeshCacheVersion ||
+				   stream->ReadLittleInt() != sizeof(Vertex)){
+					// outdated; will be overwritten
+					return NULL;
 				}
-				EmitSlice(slice.data(), w, h,
-						  0, 0, z,
-						  1, 0, 0,
-						  0, 1, 0,
-						  0, 0, z,
-						  false,
-						  model);
 				
-				for(int x = 0; x < w; x++){
-					for(int y = 0; y < h; y++){
-						uint8_t& s = slice[x * h + y];
-						if(z == d - 1)
-							s = model->IsSolid(x, y, z) ? 1 : 0;
-						else
-							s = (model->IsSolid(x, y, z) &&
-								 !model->IsSolid(x, y, z + 1))
-							? 1 : 0;
+				uint32_t numVertices = stream->ReadLittleInt();
+				uint32_t numIndices = stream->ReadLittleInt();
+				uint32_t atlasWidth = stream->ReadLittleInt();
+				uint32_t atlasHeight = stream->ReadLittleInt();
+				
+				uint64_t dataSize = (uint64_t)numVertices * sizeof(Vertex) +
+				(uint64_t)numIndices * 4 +
+				(uint64_t)atlasWidth * atlasHeight * 4;
+				if(atlasWidth < 1 || atlasHeight < 1 ||
+				   atlasWidth > 8192 || atlasHeight > 8192 ||
+				   stream->GetLength() - stream->GetPosition() != dataSize){
+					SPRaise("Corrupted file");
+				}
+				
+				std::unique_ptr<MeshData> mesh(new MeshData());
+				mesh->vertices.resize(numVertices);
+				mesh->indices.resize(numIndices);
+				mesh->atlasWidth = (int)atlasWidth;
+				mesh->atlasHeight = (int)atlasHeight;
+				mesh->atlas.resize(atlasWidth * atlasHeight);
+				
+				stream->Read(mesh->vertices.data(), numVertices * sizeof(Vertex));
+				stream->Read(mesh->indices.data(), numIndices * 4);
+				stream->Read(mesh->atlas.data(), atlasWidth * atlasHeight * 4);
+				
+				for(size_t i = 0; i < mesh->indices.size(); i++){
+					if(mesh->indices[i] >= numVertices){
+						SPRaise("Corrupted file");
 					}
 				}
-				EmitSlice(slice.data(), w, h,
-						  0, 0, z + 1,
-						  1, 0, 0,
-						  0, 1, 0,
-						  0, 0, z,
-						  true,
-						  model);
+				
+				return mesh.release();
+			}catch(const std::exception& ex){
+				SPLog("Ignoring the optimized voxel model cache '%s': %s",
+					  path.c_str(), ex.what());
+				return NULL;
 			}
+		}
+		
+		void GLOptimizedVoxelModel::SaveMeshCache(uint64_t hash, const MeshData& mesh) {
+			SPADES_MARK_FUNCTION();
+			
+			std::string path = GetCachePath(hash);
+			std::unique_ptr<IStream> stream(FileManager::OpenForWriting(path.c_str()));
+			
+			// native byte order is okay because the cache is never shared
+			uint32_t header[] = {
+				MeshCacheMagic, MeshCacheVersion, (uint32_t)sizeof(Vertex),
+				(uint32_t)mesh.vertices.size(),
+				(uint32_t)mesh.indices.size(),
+				(uint32_t)mesh.atlasWidth,
+				(uint32_t)mesh.atlasHeight
+			};
+			stream->Write(header, sizeof(header));
+			stream->Write(mesh.vertices.data(), mesh.vertices.size() * sizeof(Vertex));
+			stream->Write(mesh.indices.data(), mesh.indices.size() * 4);
+			stream->Write(mesh.atlas.data(), mesh.atlas.size() * 4);
+		}
+		
+		void GLOptimizedVoxelModel::TrySaveMeshCache(uint64_t hash, const MeshData& mesh) {
+			SPADES_MARK_FUNCTION();
 			
-			printf("%d vertices emit\n", (int)indices.size());
+			std::lock_guard<std::mutex> lock(meshCacheSaveMutex);
+			try{
+				SaveMeshCache(hash, mesh);
+			}catch(const std::exception& ex){
+				SPLog("Failed to save the optimized voxel model cache: %s",
+					  ex.what());
+			}
 		}
 		
-		void GLOptimizedVoxelModel::RenderShadowMapPass(std::vector<client::ModelRenderParam> params) {
+#pragma mark - Rendering
+		
+		void GLOptimizedVoxelModel::RenderShadowMapPass(GLModelParamSpan params) {
 			SPADES_MARK_FUNCTION();
 			
+			EnsureUploaded();
+			
+			if(renderer->GetModelRenderer()->IsInstancingEnabled()){
+				// depth-hacked instances aren't drawn in the shadow map,
+				// so everything is done by the instanced draw
+				RenderShadowMapPassInstanced(params);
+				return;
+			}
+			
 			device->Enable(IGLDevice::CullFace, true);
 			device->Enable(IGLDevice::DepthTest, true);
 			
@@ -639,11 +941,19 @@ namespace spades {
 			device->BindTexture(IGLDevice::Texture2D, 0);
 		}
 		
-		void GLOptimizedVoxelModel::RenderSunlightPass(std::vector<client::ModelRenderParam> params) {
+		void GLOptimizedVoxelModel::RenderSunlightPass(GLModelParamSpan params) {
 			SPADES_MARK_FUNCTION();
 			
+			EnsureUploaded();
+			
 			bool mirror = renderer->IsRenderingMirror();
 			
+			// only the depth-hacked instances are drawn one by one
+			// when instancing is enabled
+			bool instanced = renderer->GetModelRenderer()->IsInstancingEnabled();
+			if(instanced && !RenderSunlightPassInstanced(params))
+				return;
+			
 			device->ActiveTexture(0);
 			aoImage->Bind(IGLDevice::Texture2D);
 			device->TexParamater(IGLDevice::Texture2D,
@@ -735,6 +1045,8 @@ namespace spades {
 				
 				if(mirror && param.depthHack)
 					continue;
+				if(instanced && !param.depthHack)
+					continue;
 				
 				// frustrum cull
 				float rad = radius;
@@ -797,11 +1109,19 @@ namespace spades {
 			device->BindTexture(IGLDevice::Texture2D, 0);
 		}
 		
-		void GLOptimizedVoxelModel::RenderDynamicLightPass(std::vector<client::ModelRenderParam> params, std::vector<GLDynamicLight> lights) {
+		void GLOptimizedVoxelModel::RenderDynamicLightPass(GLModelParamSpan params, const std::vector<GLDynamicLight>& lights) {
 			SPADES_MARK_FUNCTION();
 			
+			EnsureUploaded();
+			
 			bool mirror = renderer->IsRenderingMirror();
 			
+			// only the depth-hacked instances are drawn one by one
+			// when instancing is enabled
+			bool instanced = renderer->GetModelRenderer()->IsInstancingEnabled();
+			if(instanced && !RenderDynamicLightPassInstanced(params, lights))
+				return;
+			
 			device->ActiveTexture(0);
 			aoImage->Bind(IGLDevice::Texture2D);
 			device->TexParamater(IGLDevice::Texture2D,
@@ -877,6 +1197,8 @@ namespace spades {
 				
 				if(mirror && param.depthHack)
 					continue;
+				if(instanced && !param.depthHack)
+					continue;
 				
 				// frustrum cull
 				float rad = radius;
@@ -943,5 +1265,370 @@ namespace spades {
 			device->ActiveTexture(0);
 		}
 		
+#pragma mark - Instanced Rendering
+		
+		void GLOptimizedVoxelModel::MakeInstanceData(GLModelRenderer::InstanceData& out,
+													 const client::ModelRenderParam& param) {
+			std::copy(param.matrix.m, param.matrix.m + 16, out.modelMatrix);
+			out.customColor[0] = param.customColor.x;
+			out.customColor[1] = param.customColor.y;
+			out.customColor[2] = param.customColor.z;
+		}
+		
+		void GLOptimizedVoxelModel::SetupVertexAttributes(GLProgram *prg, bool enable) {
+			static GLProgramAttribute positionAttribute("positionAttribute");
+			static GLProgramAttribute textureCoordAttribute("textureCoordAttribute");
+			static GLProgramAttribute normalAttribute("normalAttribute");
+			
+			positionAttribute(prg);
+			textureCoordAttribute(prg);
+			normalAttribute(prg);
+			
+			if(enable){
+				device->BindBuffer(IGLDevice::ArrayBuffer, buffer);
+				device->VertexAttribPointer(positionAttribute(),
+											4, IGLDevice::UnsignedByte,
+											false, sizeof(Vertex),
+											(void *)0);
+				if(textureCoordAttribute() != -1){
+					device->VertexAttribPointer(textureCoordAttribute(),
+												2, IGLDevice::UnsignedShort,
+												false, sizeof(Vertex),
+												(void *)4);
+				}
+				if(normalAttribute() != -1){
+					device->VertexAttribPointer(normalAttribute(),
+												3, IGLDevice::Byte,
+												false, sizeof(Vertex),
+												(void *)8);
+				}
+				device->BindBuffer(IGLDevice::ArrayBuffer, 0);
+			}
+			
+			device->EnableVertexAttribArray(positionAttribute(), enable);
+			if(textureCoordAttribute() != -1)
+				device->EnableVertexAttribArray(textureCoordAttribute(), enable);
+			if(normalAttribute() != -1)
+				device->EnableVertexAttribArray(normalAttribute(), enable);
+		}
+		
+		void GLOptimizedVoxelModel::DrawInstances(GLProgram *prg) {
+			SPADES_MARK_FUNCTION_DEBUG();
+			
+			if(instances.empty())
+				return;
+			
+			static GLProgramAttribute modelMatrixAttribute("modelMatrixAttribute");
+			static GLProgramAttribute customColorAttribute("customColorAttribute");
+			
+			modelMatrixAttribute(prg);
+			customColorAttribute(prg);
+			
+			typedef GLModelRenderer::InstanceData InstanceData;
+			const IGLDevice::Sizei stride = sizeof(InstanceData);
+			
+			renderer->GetModelRenderer()->UploadInstances(instances.data(),
+														  instances.size());
+			
+			// a mat4 attribute occupies four consecutive locations
+			for(int i = 0; i < 4; i++){
+				IGLDevice::UInteger loc = modelMatrixAttribute() + i;
+				device->VertexAttribPointer(loc, 4, IGLDevice::FloatType,
+											false, stride,
+											(void *)(offsetof(InstanceData, modelMatrix) +
+													 i * 4 * sizeof(float)));
+				device->EnableVertexAttribArray(loc, true);
+				device->VertexAttribDivisor(loc, 1);
+			}
+			if(customColorAttribute() != -1){
+				device->VertexAttribPointer(customColorAttribute(), 3, IGLDevice::FloatType,
+											false, stride,
+											(void *)offsetof(InstanceData, customColor));
+				device->EnableVertexAttribArray(customColorAttribute(), true);
+				device->VertexAttribDivisor(customColorAttribute(), 1);
+			}
+			device->BindBuffer(IGLDevice::ArrayBuffer, 0);
+			
+			device->DrawElementsInstanced(IGLDevice::Triangles,
+										  numIndices,
+										  IGLDevice::UnsignedInt,
+										  (void *)0,
+										  (IGLDevice::Sizei)instances.size());
+			
+			for(int i = 0; i < 4; i++){
+				IGLDevice::UInteger loc = modelMatrixAttribute() + i;
+				device->VertexAttribDivisor(loc, 0);
+				device->EnableVertexAttribArray(loc, false);
+			}
+			if(customColorAttribute() != -1){
+				device->VertexAttribDivisor(customColorAttribute(), 0);
+				device->EnableVertexAttribArray(customColorAttribute(), false);
+			}
+		}
+		
+		void GLOptimizedVoxelModel::RenderShadowMapPassInstanced(GLModelParamSpan params) {
+			SPADES_MARK_FUNCTION();
+			
+			instances.clear();
+			for(size_t i = 0; i < params.size(); i++){
+				const client::ModelRenderParam& param = params[i];
+				if(param.depthHack)
+					continue;
+				
+				float rad = radius;
+				rad *= param.matrix.GetAxis(0).GetLength();
+				if(!renderer->GetShadowMapRenderer()->SphereCull(param.matrix.GetOrigin(),
+																 rad)){
+					continue;
+				}
+				
+				instances.resize(instances.size() + 1);
+				MakeInstanceData(instances.back(), param);
+			}
+			if(instances.empty())
+				return;
+			
+			device->Enable(IGLDevice::CullFace, true);
+			device->Enable(IGLDevice::DepthTest, true);
+			
+			GLProgram *prg = instancedShadowMapProgram;
+			prg->Use();
+			
+			static GLShadowMapShader shadowMapShader;
+			shadowMapShader(renderer, prg, 0);
+			
+			static GLProgramUniform modelOrigin("modelOrigin");
+			modelOrigin(prg);
+			modelOrigin.SetValue(origin.x, origin.y, origin.z);
+			
+			SetupVertexAttributes(prg, true);
+			device->BindBuffer(IGLDevice::ElementArrayBuffer, idxBuffer);
+			
+			DrawInstances(prg);
+			
+			device->BindBuffer(IGLDevice::ElementArrayBuffer, 0);
+			SetupVertexAttributes(prg, false);
+		}
+		
+		bool GLOptimizedVoxelModel::RenderSunlightPassInstanced(GLModelParamSpan params) {
+			SPADES_MARK_FUNCTION();
+			
+			bool mirror = renderer->IsRenderingMirror();
+			bool hasDepthHack = false;
+			
+			instances.clear();
+			for(size_t i = 0; i < params.size(); i++){
+				const client::ModelRenderParam& param = params[i];
+				if(param.depthHack){
+					// depth range can't be changed per instance
+					if(!mirror)
+						hasDepthHack = true;
+					continue;
+				}
+				
+				float rad = radius;
+				rad *= param.matrix.GetAxis(0).GetLength();
+				if(!renderer->SphereFrustrumCull(param.matrix.GetOrigin(),
+												 rad)){
+					continue;
+				}
+				
+				instances.resize(instances.size() + 1);
+				MakeInstanceData(instances.back(), param);
+			}
+			if(instances.empty())
+				return hasDepthHack;
+			
+			device->ActiveTexture(0);
+			aoImage->Bind(IGLDevice::Texture2D);
+			device->TexParamater(IGLDevice::Texture2D,
+								 IGLDevice::TextureMinFilter,
+								 IGLDevice::Linear);
+			
+			device->ActiveTexture(1);
+			image->Bind(IGLDevice::Texture2D);
+			device->TexParamater(IGLDevice::Texture2D,
+								 IGLDevice::TextureMinFilter,
+								 IGLDevice::Nearest);
+			device->TexParamater(IGLDevice::Texture2D,
+								 IGLDevice::TextureMagFilter,
+								 IGLDevice::Nearest);
+			
+			device->Enable(IGLDevice::CullFace, true);
+			device->Enable(IGLDevice::DepthTest, true);
+			
+			GLProgram *prg = instancedProgram;
+			prg->Use();
+			
+			static GLShadowShader shadowShader;
+			shadowShader(renderer, prg, 2);
+			
+			static GLProgramUniform fogDistance("fogDistance");
+			fogDistance(prg);
+			fogDistance.SetValue(renderer->GetFogDistance());
+			
+			static GLProgramUniform fogColor("fogColor");
+			fogColor(prg);
+			Vector3 fogCol = renderer->GetFogColorForSolidPass();
+			fogCol *= fogCol; // linearize
+			fogColor.SetValue(fogCol.x, fogCol.y, fogCol.z);
+			
+			static GLProgramUniform aoUniform("ambientOcclusionTexture");
+			aoUniform(prg);
+			aoUniform.SetValue(0);
+			
+			static GLProgramUniform modelOrigin("modelOrigin");
+			modelOrigin(prg);
+			modelOrigin.SetValue(origin.x, origin.y, origin.z);
+			
+			static GLProgramUniform texScale("texScale");
+			texScale(prg);
+			texScale.SetValue(1.f / image->GetWidth(),
+							  1.f / image->GetHeight());
+			
+			static GLProgramUniform modelTexture("modelTexture");
+			modelTexture(prg);
+			modelTexture.SetValue(1);
+			
+			static GLProgramUniform sunLightDirection("sunLightDirection");
+			sunLightDirection(prg);
+			Vector3 sunPos = MakeVector3(0, -1, -1);
+			sunPos = sunPos.Normalize();
+			sunLightDirection.SetValue(sunPos.x, sunPos.y, sunPos.z);
+			
+			static GLProgramUniform projectionViewMatrix("projectionViewMatrix");
+			projectionViewMatrix(prg);
+			projectionViewMatrix.SetValue(renderer->GetProjectionViewMatrix());
+			
+			static GLProgramUniform viewMatrix("viewMatrix");
+			viewMatrix(prg);
+			viewMatrix.SetValue(renderer->GetViewMatrix());
+			
+			SetupVertexAttributes(prg, true);
+			device->BindBuffer(IGLDevice::ElementArrayBuffer, idxBuffer);
+			
+			DrawInstances(prg);
+			
+			device->BindBuffer(IGLDevice::ElementArrayBuffer, 0);
+			SetupVertexAttributes(prg, false);
+			
+			device->ActiveTexture(1);
+			device->BindTexture(IGLDevice::Texture2D, 0);
+			device->ActiveTexture(0);
+			device->BindTexture(IGLDevice::Texture2D, 0);
+			
+			return hasDepthHack;
+		}
+		
+		bool GLOptimizedVoxelModel::RenderDynamicLightPassInstanced(GLModelParamSpan params,
+																	const std::vector<GLDynamicLight>& lights) {
+			SPADES_MARK_FUNCTION();
+			
+			bool mirror = renderer->IsRenderingMirror();
+			bool hasDepthHack = false;
+			
+			// frustum culled once for all lights
+			visibleParams.clear();
+			for(size_t i = 0; i < params.size(); i++){
+				const client::ModelRenderParam& param = params[i];
+				if(param.depthHack){
+					if(!mirror)
+						hasDepthHack = true;
+					continue;
+				}
+				
+				float rad = radius;
+				rad *= param.matrix.GetAxis(0).GetLength();
+				if(!renderer->SphereFrustrumCull(param.matrix.GetOrigin(),
+												 rad)){
+					continue;
+				}
+				visibleParams.push_back(&param);
+			}
+			if(visibleParams.empty())
+				return hasDepthHack;
+			
+			device->ActiveTexture(0);
+			aoImage->Bind(IGLDevice::Texture2D);
+			device->TexParamater(IGLDevice::Texture2D,
+								 IGLDevice::TextureMinFilter,
+								 IGLDevice::Linear);
+			
+			device->ActiveTexture(1);
+			image->Bind(IGLDevice::Texture2D);
+			device->TexParamater(IGLDevice::Texture2D,
+								 IGLDevice::TextureMinFilter,
+								 IGLDevice::Nearest);
+			device->TexParamater(IGLDevice::Texture2D,
+								 IGLDevice::TextureMagFilter,
+								 IGLDevice::Nearest);
+			
+			device->Enable(IGLDevice::CullFace, true);
+			device->Enable(IGLDevice::DepthTest, true);
+			
+			GLProgram *prg = instancedDlightProgram;
+			prg->Use();
+			
+			static GLDynamicLightShader dlightShader;
+			
+			static GLProgramUniform fogDistance("fogDistance");
+			fogDistance(prg);
+			fogDistance.SetValue(renderer->GetFogDistance());
+			
+			static GLProgramUniform modelOrigin("modelOrigin");
+			modelOrigin(prg);
+			modelOrigin.SetValue(origin.x, origin.y, origin.z);
+			
+			static GLProgramUniform texScale("texScale");
+			texScale(prg);
+			texScale.SetValue(1.f / image->GetWidth(),
+							  1.f / image->GetHeight());
+			
+			static GLProgramUniform modelTexture("modelTexture");
+			modelTexture(prg);
+			modelTexture.SetValue(1);
+			
+			static GLProgramUniform projectionViewMatrix("projectionViewMatrix");
+			projectionViewMatrix(prg);
+			projectionViewMatrix.SetValue(renderer->GetProjectionViewMatrix());
+			
+			static GLProgramUniform viewMatrix("viewMatrix");
+			viewMatrix(prg);
+			viewMatrix.SetValue(renderer->GetViewMatrix());
+			
+			SetupVertexAttributes(prg, true);
+			device->BindBuffer(IGLDevice::ElementArrayBuffer, idxBuffer);
+			
+			for(size_t i = 0; i < lights.size(); i++){
+				instances.clear();
+				for(size_t j = 0; j < visibleParams.size(); j++){
+					const client::ModelRenderParam& param = *visibleParams[j];
+					float rad = radius;
+					rad *= param.matrix.GetAxis(0).GetLength();
+					if(!GLDynamicLightShader::SphereCull(lights[i],
+														 param.matrix.GetOrigin(), rad))
+						continue;
+					
+					instances.resize(instances.size() + 1);
+					MakeInstanceData(instances.back(), param);
+				}
+				if(instances.empty())
+					continue;
+				
+				dlightShader(renderer, prg, lights[i], 2);
+				DrawInstances(prg);
+			}
+			
+			device->BindBuffer(IGLDevice::ElementArrayBuffer, 0);
+			SetupVertexAttributes(prg, false);
+			
+			device->ActiveTexture(1);
+			device->BindTexture(IGLDevice::Texture2D, 0);
+			device->ActiveTexture(0);
+			device->BindTexture(IGLDevice::Texture2D, 0);
+			
+			return hasDepthHack;
+		}
+		
 	}
 }
@@ -21,8 +21,12 @@
 #pragma once
 
 #include "GLModel.h"
+#include "GLModelRenderer.h"
 #include "../Core/VoxelModel.h"
+#include "../Core/ConcurrentDispatch.h"
 #include <vector>
+#include <memory>
+#include <string>
 #include "IGLDevice.h"
 
 namespace spades {
@@ -32,6 +36,7 @@ namespace spades {
 		class GLImage;
 		class GLOptimizedVoxelModel: public GLModel {
 			class SliceGenerator;
+			class BuildContext;
 			struct Vertex {
 				uint8_t x, y, z;
 				uint8_t padding;
@@ -45,20 +50,47 @@ namespace spades {
 				uint8_t padding2;
 			};
 			
+			/** CPU-side result of the optimization. This doesn't
+			 * depend on OpenGL, so it is built on worker threads
+			 * and can be cached on the disk. */
+			struct MeshData {
+				std::vector<Vertex> vertices;
+				std::vector<uint32_t> indices;
+				int atlasWidth, atlasHeight;
+				std::vector<uint32_t> atlas;
+			};
+			
+			/** per-worker output buffer. slices are appended to it
+			 * so the workers don't allocate a bitmap per face. */
+			struct SliceScratch {
+				std::vector<uint8_t> slice;
+				std::vector<Vertex> vertices;
+				std::vector<uint32_t> indices;
+				std::vector<uint32_t> pixels;
+			};
+			
+			/** location of a slice's output in the worker's scratch. */
+			struct SliceOutput {
+				int worker;
+				size_t firstVertex, firstIndex, firstPixel;
+				size_t numVertices, numIndices;
+				/** size of the face texture. zero if nothing was emitted. */
+				int bmpWidth, bmpHeight;
+			};
+			
 			GLRenderer *renderer;
 			IGLDevice *device;
 			GLProgram *program;
 			GLProgram *dlightProgram;
 			GLProgram *shadowMapProgram;
+			GLProgram *instancedProgram;
+			GLProgram *instancedDlightProgram;
+			GLProgram *instancedShadowMapProgram;
 			GLImage *image;
 			GLImage *aoImage;
 			
 			IGLDevice::UInteger buffer;
 			IGLDevice::UInteger idxBuffer;
-			std::vector<Vertex> vertices;
-			std::vector<uint32_t> indices;
-			std::vector<uint16_t> bmpIndex; // bmp id for vertex (not index)
-			std::vector<Bitmap *> bmps;
 			unsigned int numIndices;
 			
 			Vector3 origin;
@@ -66,25 +98,58 @@ namespace spades {
 			
 			AABB3 boundingBox;
 			
-			uint8_t calcAOID(VoxelModel *,
-							 int x, int y, int z,
-							 int ux, int uy, int uz,
-							 int vx, int vy, int vz);
-			void EmitFace(VoxelModel *,
-						  int x, int y, int z,
-						  int nx, int ny, int nz,
-						  uint32_t color);
+			uint64_t contentHash;
+			std::unique_ptr<MeshData> mesh;
+			std::string buildError;
+			std::unique_ptr<ConcurrentDispatch> buildDispatch;
+			
+			static uint8_t calcAOID(VoxelModel *,
+									int x, int y, int z,
+									int ux, int uy, int uz,
+									int vx, int vy, int vz);
 			// v major
-			void EmitSlice(uint8_t *slice,
-						   int usize, int vsize,
-						   int sx, int sy, int sz,
-						   int ux, int uy, int uz,
-						   int vx, int vy, int vz,
-						   int mx, int my, int mz,
-						   bool flip,
-						   VoxelModel *);
-			void BuildVertices(VoxelModel *);
-			void GenerateTexture();
+			static void EmitSlice(SliceScratch&, SliceOutput&,
+								  int usize, int vsize,
+								  int sx, int sy, int sz,
+								  int ux, int uy, int uz,
+								  int vx, int vy, int vz,
+								  int mx, int my, int mz,
+								  bool flip,
+								  VoxelModel *);
+			static int GetNumSlices(VoxelModel *);
+			static void BuildSlice(int sliceId, SliceScratch&,
+								   SliceOutput&, VoxelModel *);
+			static MeshData *BuildMesh(VoxelModel *, int numWorkers);
+			static MeshData *MergeSlices(const std::vector<SliceOutput>&,
+										 const std::vector<SliceScratch>&);
+			
+			static uint64_t ComputeContentHash(VoxelModel *);
+			static std::string GetCachePath(uint64_t hash);
+			static MeshData *LoadMeshCache(uint64_t hash);
+			static void SaveMeshCache(uint64_t hash, const MeshData&);
+			/** saves the cache, logging errors. may be called by any thread. */
+			static void TrySaveMeshCache(uint64_t hash, const MeshData&);
+			
+			/** waits for the background build and uploads the result
+			 * to the GPU. must be called by the rendering thread. */
+			void EnsureUploaded();
+			
+			/** scratch for the instanced draws. */
+			std::vector<GLModelRenderer::InstanceData> instances;
+			std::vector<const client::ModelRenderParam *> visibleParams;
+			
+			static void MakeInstanceData(GLModelRenderer::InstanceData&,
+										 const client::ModelRenderParam&);
+			void SetupVertexAttributes(GLProgram *, bool enable);
+			/** draws `instances` with the index buffer bound. */
+			void DrawInstances(GLProgram *);
+			
+			void RenderShadowMapPassInstanced(GLModelParamSpan params);
+			/** @return true if there are depth-hacked instances that
+			 * have to be drawn without instancing. */
+			bool RenderSunlightPassInstanced(GLModelParamSpan params);
+			bool RenderDynamicLightPassInstanced(GLModelParamSpan params,
+												 const std::vector<GLDynamicLight>& lights);
 		protected:
 			virtual ~GLOptimizedVoxelModel();
 		public:
@@ -92,11 +157,11 @@ namespace spades {
 			
 			static void PreloadShaders(GLRenderer *);
 			
-			virtual void RenderShadowMapPass(std::vector<client::ModelRenderParam> params);
+			virtual void RenderShadowMapPass(GLModelParamSpan params);
 			
-			virtual void RenderSunlightPass(std::vector<client::ModelRenderParam> params);
+			virtual void RenderSunlightPass(GLModelParamSpan params);
 			
-			virtual void RenderDynamicLightPass(std::vector<client::ModelRenderParam> params, std::vector<GLDynamicLight> lights);
+			virtual void RenderDynamicLightPass(GLModelParamSpan params, const std::vector<GLDynamicLight>& lights);
 			
 			virtual AABB3 GetBoundingBox() { return boundingBox; }
 		};
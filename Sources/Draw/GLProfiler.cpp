@@ -22,10 +22,13 @@
 #include <stdarg.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include "../Core/Stopwatch.h"
 #include "../Core/Settings.h"
 #include "../Core/Debug.h"
+#include "../Core/FrameProfiler.h"
 #include "IGLDevice.h"
+#include "GLRecordingDevice.h"
 
 SPADES_SETTING(r_debugTiming, "0");
 
@@ -35,7 +38,8 @@ namespace spades {
 		void GLProfiler::ResetLevel() {
 			levels.clear();
 		}
-		GLProfiler::GLProfiler(IGLDevice *device, const char *format, ...) {
+		GLProfiler::GLProfiler(IGLDevice *device, const char *format, ...):
+		inZone(false) {
 			if(r_debugTiming) {
 				levels.push_back(this);
 				
@@ -49,17 +53,45 @@ namespace spades {
 				
 				this->device = device;
 				device->Finish();
+				
+				recorder = dynamic_cast<GLRecordingDevice *>(device);
+				if(recorder) {
+					numDrawCalls = recorder->GetStatistics().numDrawCalls;
+					numInstances = recorder->GetStatistics().numInstances;
+				}
+				
 				watch = new Stopwatch;
 			}
+			
+			// the format is used as the name of the zone so that
+			// the same pass is aggregated regardless of its arguments.
+			// without r_debugTiming, the zone only measures the time
+			// taken to issue the commands
+			if(FrameProfiler::IsEnabled()) {
+				FrameProfiler::BeginZone(format);
+				inZone = true;
+			}
 		}
 		GLProfiler::~GLProfiler() {
-			if(r_debugTiming) {
+			bool timing = r_debugTiming;
+			if(timing) {
 				SPAssert(levels.back() == this);
 				levels.pop_back();
 				
 				timeNoFinish = watch->GetTime();
 				device->Finish();
 				time = watch->GetTime();
+			}
+			
+			if(inZone)
+				FrameProfiler::EndZone();
+			
+			if(timing) {
+				if(recorder) {
+					numDrawCalls = recorder->GetStatistics().numDrawCalls - numDrawCalls;
+					numInstances = recorder->GetStatistics().numInstances - numInstances;
+				}
+				
 				std::string out = GetProfileMessage();
 				
 				if(!levels.empty()) {
@@ -78,9 +110,15 @@ namespace spades {
 			int indent = levels.size() * 2;
 			for(int i = 0; i < indent; i++)
 				buf[i] = ' ';
-			sprintf(buf + indent, "%s - %.3fms (%.3fms w/o glFinish)\n",	name.c_str(),
-					time * 1000.,
-					timeNoFinish * 1000.);
+			int len = sprintf(buf + indent, "%s - %.3fms (%.3fms w/o glFinish)",	name.c_str(),
+							  time * 1000.,
+							  timeNoFinish * 1000.) + indent;
+			if(recorder) {
+				len += sprintf(buf + len, ", %llu draw call(s), %llu instance(s)",
+							   (unsigned long long)numDrawCalls,
+							   (unsigned long long)numInstances);
+			}
+			strcpy(buf + len, "\n");
 			delete watch;
 			
 			std::string out = buf + msg;
@@ -22,18 +22,27 @@
 
 #include <vector>
 #include <string>
+#include <stdint.h>
 
 namespace spades {
 	
 	class Stopwatch;
 	namespace draw {
 		class IGLDevice;
+		class GLRecordingDevice;
 		class GLProfiler {
 			std::string msg;
 			std::string name;
 			Stopwatch *watch;
 			IGLDevice *device;
 			double time, timeNoFinish;
+			
+			/** non-null when the calls are counted by the device. */
+			GLRecordingDevice *recorder;
+			uint64_t numDrawCalls, numInstances;
+			
+			/** true when a FrameProfiler zone was opened. */
+			bool inZone;
 		public:
 			static void ResetLevel();
 			GLProfiler(IGLDevice *, const char *format, ...);
@@ -0,0 +1,583 @@
+/*
+ Copyright (c) 2013 yvt
+ 
+ This file is part of OpenSpades.
+ 
+ OpenSpades is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ 
+ OpenSpades is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with OpenSpades.  If not, see <http://www.gnu.org/licenses/>.
+ 
+ */
+
+#include "GLRecordingDevice.h"
+#include "../Core/Debug.h"
+#include <string.h>
+
+namespace spades {
+	namespace draw {
+		
+		GLRecordingDevice::GLRecordingDevice(IGLDevice *base):
+		base(base) {
+			SPADES_MARK_FUNCTION();
+			ResetStatistics();
+		}
+		
+		GLRecordingDevice::~GLRecordingDevice() {
+			SPADES_MARK_FUNCTION();
+		}
+		
+		void GLRecordingDevice::ResetStatistics() {
+			memset(&stats, 0, sizeof(stats));
+		}
+		
+		void GLRecordingDevice::DepthRange(Float near, Float far) {
+			stats.numCalls++;
+			base->DepthRange(near, far);
+		}
+		
+		void GLRecordingDevice::Viewport(Integer x, Integer y, Sizei width, Sizei height) {
+			stats.numCalls++;
+			base->Viewport(x, y, width, height);
+		}
+		
+		void GLRecordingDevice::ClearDepth(Float depth) {
+			stats.numCalls++;
+			base->ClearDepth(depth);
+		}
+		
+		void GLRecordingDevice::ClearColor(Float r, Float g, Float b, Float a) {
+			stats.numCalls++;
+			base->ClearColor(r, g, b, a);
+		}
+		
+		void GLRecordingDevice::Clear(Enum mask) {
+			stats.numCalls++;
+			base->Clear(mask);
+		}
+		
+		void GLRecordingDevice::DepthMask(bool enabled) {
+			stats.numCalls++;
+			base->DepthMask(enabled);
+		}
+		
+		void GLRecordingDevice::ColorMask(bool r, bool g, bool b, bool a) {
+			stats.numCalls++;
+			base->ColorMask(r, g, b, a);
+		}
+		
+		void GLRecordingDevice::Finish() {
+			stats.numCalls++;
+			base->Finish();
+		}
+		
+		void GLRecordingDevice::Flush() {
+			stats.numCalls++;
+			base->Flush();
+		}
+		
+		void GLRecordingDevice::FrontFace(Enum mode) {
+			stats.numCalls++;
+			base->FrontFace(mode);
+		}
+		
+		void GLRecordingDevice::Enable(Enum state, bool enabled) {
+			stats.numCalls++;
+			base->Enable(state, enabled);
+		}
+		
+		const char *GLRecordingDevice::GetString(Enum type) {
+			stats.numCalls++;
+			return base->GetString(type);
+		}
+		
+		const char *GLRecordingDevice::GetIndexedString(Enum type, UInteger index) {
+			stats.numCalls++;
+			return base->GetIndexedString(type, index);
+		}
+		
+		IGLDevice::Integer GLRecordingDevice::GetInteger(Enum type) {
+			stats.numCalls++;
+			return base->GetInteger(type);
+		}
+		
+		void GLRecordingDevice::BlendEquation(Enum mode) {
+			stats.numCalls++;
+			base->BlendEquation(mode);
+		}
+		
+		void GLRecordingDevice::BlendEquation(Enum rgb, Enum alpha) {
+			stats.numCalls++;
+			base->BlendEquation(rgb, alpha);
+		}
+		
+		void GLRecordingDevice::BlendFunc(Enum src, Enum dest) {
+			stats.numCalls++;
+			base->BlendFunc(src, dest);
+		}
+		
+		void GLRecordingDevice::BlendFunc(Enum srcRgb, Enum destRgb, Enum srcAlpha, Enum destAlpha) {
+			stats.numCalls++;
+			base->BlendFunc(srcRgb, destRgb, srcAlpha, destAlpha);
+		}
+		
+		void GLRecordingDevice::BlendColor(Float r, Float g, Float b, Float a) {
+			stats.numCalls++;
+			base->BlendColor(r, g, b, a);
+		}
+		
+		void GLRecordingDevice::DepthFunc(Enum func) {
+			stats.numCalls++;
+			base->DepthFunc(func);
+		}
+		
+		void GLRecordingDevice::LineWidth(Float width) {
+			stats.numCalls++;
+			base->LineWidth(width);
+		}
+		
+		IGLDevice::UInteger GLRecordingDevice::GenBuffer() {
+			stats.numCalls++;
+			return base->GenBuffer();
+		}
+		
+		void GLRecordingDevice::DeleteBuffer(UInteger buffer) {
+			stats.numCalls++;
+			base->DeleteBuffer(buffer);
+		}
+		
+		void GLRecordingDevice::BindBuffer(Enum target, UInteger buffer) {
+			stats.numCalls++;
+			base->BindBuffer(target, buffer);
+		}
+		
+		void GLRecordingDevice::BufferData(Enum target, Sizei size, const void *data, Enum usage) {
+			stats.numCalls++;
+			stats.numBufferUploads++;
+			stats.bufferUploadBytes += size;
+			base->BufferData(target, size, data, usage);
+		}
+		
+		void GLRecordingDevice::BufferSubData(Enum target, Sizei offset, Sizei size, const void *data) {
+			stats.numCalls++;
+			stats.numBufferUploads++;
+			stats.bufferUploadBytes += size;
+			base->BufferSubData(target, offset, size, data);
+		}
+		
+		IGLDevice::UInteger GLRecordingDevice::GenQuery() {
+			stats.numCalls++;
+			return base->GenQuery();
+		}
+		
+		void GLRecordingDevice::DeleteQuery(UInteger query) {
+			stats.numCalls++;
+			base->DeleteQuery(query);
+		}
+		
+		void GLRecordingDevice::BeginQuery(Enum target, UInteger query) {
+			stats.numCalls++;
+			base->BeginQuery(target, query);
+		}
+		
+		void GLRecordingDevice::EndQuery(Enum target) {
+			stats.numCalls++;
+			base->EndQuery(target);
+		}
+		
+		IGLDevice::UInteger GLRecordingDevice::GetQueryObjectUInteger(UInteger query, Enum pname) {
+			stats.numCalls++;
+			return base->GetQueryObjectUInteger(query, pname);
+		}
+		
+		void GLRecordingDevice::BeginConditionalRender(UInteger query, Enum mode) {
+			stats.numCalls++;
+			base->BeginConditionalRender(query, mode);
+		}
+		
+		void GLRecordingDevice::EndConditionalRender() {
+			stats.numCalls++;
+			base->EndConditionalRender();
+		}
+		
+		void *GLRecordingDevice::MapBuffer(Enum target, Enum access) {
+			stats.numCalls++;
+			return base->MapBuffer(target, access);
+		}
+		
+		void GLRecordingDevice::UnmapBuffer(Enum target) {
+			stats.numCalls++;
+			base->UnmapBuffer(target);
+		}
+		
+		IGLDevice::UInteger GLRecordingDevice::GenTexture() {
+			stats.numCalls++;
+			return base->GenTexture();
+		}
+		
+		void GLRecordingDevice::DeleteTexture(UInteger texture) {
+			stats.numCalls++;
+			base->DeleteTexture(texture);
+		}
+		
+		void GLRecordingDevice::ActiveTexture(UInteger stage) {
+			stats.numCalls++;
+			base->ActiveTexture(stage);
+		}
+		
+		void GLRecordingDevice::BindTexture(Enum target, UInteger texture) {
+			stats.numCalls++;
+			base->BindTexture(target, texture);
+		}
+		
+		void GLRecordingDevice::TexParamater(Enum target, Enum paramater, Enum value) {
+			stats.numCalls++;
+			base->TexParamater(target, paramater, value);
+		}
+		
+		void GLRecordingDevice::TexParamater(Enum target, Enum paramater, float value) {
+			stats.numCalls++;
+			base->TexParamater(target, paramater, value);
+		}
+		
+		void GLRecordingDevice::TexImage2D(Enum target, Integer level, Enum internalFormat, Sizei width, Sizei height, Integer border, Enum format, Enum type, const void *data) {
+			stats.numCalls++;
+			stats.numTextureUploads++;
+			base->TexImage2D(target, level, internalFormat, width, height, border, format, type, data);
+		}
+		
+		void GLRecordingDevice::TexImage3D(Enum target, Integer level, Enum internalFormat, Sizei width, Sizei height, Sizei depth, Integer border, Enum format, Enum type, const void *data) {
+			stats.numCalls++;
+			stats.numTextureUploads++;
+			base->TexImage3D(target, level, internalFormat, width, height, depth, border, format, type, data);
+		}
+		
+		void GLRecordingDevice::TexSubImage2D(Enum target, Integer level, Integer x, Integer y, Sizei width, Sizei height, Enum format, Enum type, const void *data) {
+			stats.numCalls++;
+			stats.numTextureUploads++;
+			base->TexSubImage2D(target, level, x, y, width, height, format, type, data);
+		}
+		
+		void GLRecordingDevice::TexSubImage3D(Enum target, Integer level, Integer x, Integer y, Integer z, Sizei width, Sizei height, Sizei depth, Enum format, Enum type, const void *data) {
+			stats.numCalls++;
+			stats.numTextureUploads++;
+			base->TexSubImage3D(target, level, x, y, z, width, height, depth, format, type, data);
+		}
+		
+		void GLRecordingDevice::CopyTexSubImage2D(Enum target, Integer level, Integer destinationX, Integer destinationY, Integer srcX, Integer srcY, Sizei width, Sizei height) {
+			stats.numCalls++;
+			base->CopyTexSubImage2D(target, level, destinationX, destinationY, srcX, srcY, width, height);
+		}
+		
+		void GLRecordingDevice::GenerateMipmap(Enum target) {
+			stats.numCalls++;
+			base->GenerateMipmap(target);
+		}
+		
+		void GLRecordingDevice::VertexAttrib(UInteger index, Float x) {
+			stats.numCalls++;
+			base->VertexAttrib(index, x);
+		}
+		
+		void GLRecordingDevice::VertexAttrib(UInteger index, Float x, Float y) {
+			stats.numCalls++;
+			base->VertexAttrib(index, x, y);
+		}
+		
+		void GLRecordingDevice::VertexAttrib(UInteger index, Float x, Float y, Float z) {
+			stats.numCalls++;
+			base->VertexAttrib(index, x, y, z);
+		}
+		
+		void GLRecordingDevice::VertexAttrib(UInteger index, Float x, Float y, Float z, Float w) {
+			stats.numCalls++;
+			base->VertexAttrib(index, x, y, z, w);
+		}
+		
+		void GLRecordingDevice::VertexAttribPointer(UInteger index, Integer size, Enum type, bool normalized, Sizei stride, const void *pointer) {
+			stats.numCalls++;
+			base->VertexAttribPointer(index, size, type, normalized, stride, pointer);
+		}
+		
+		void GLRecordingDevice::VertexAttribIPointer(UInteger index, Integer size, Enum type, Sizei stride, const void *pointer) {
+			stats.numCalls++;
+			base->VertexAttribIPointer(index, size, type, stride, pointer);
+		}
+		
+		void GLRecordingDevice::EnableVertexAttribArray(UInteger index, bool enabled) {
+			stats.numCalls++;
+			base->EnableVertexAttribArray(index, enabled);
+		}
+		
+		void GLRecordingDevice::VertexAttribDivisor(UInteger index, UInteger divisor) {
+			stats.numCalls++;
+			base->VertexAttribDivisor(index, divisor);
+		}
+		
+		void GLRecordingDevice::DrawArrays(Enum mode, Integer first, Sizei count) {
+			stats.numCalls++;
+			stats.numDrawCalls++;
+			stats.numVertices += count;
+			base->DrawArrays(mode, first, count);
+		}
+		
+		void GLRecordingDevice::DrawElements(Enum mode, Sizei count, Enum type, const void *indices) {
+			stats.numCalls++;
+			stats.numDrawCalls++;
+			stats.numVertices += count;
+			base->DrawElements(mode, count, type, indices);
+		}
+		
+		void GLRecordingDevice::DrawArraysInstanced(Enum mode, Integer first, Sizei count, Sizei instances) {
+			stats.numCalls++;
+			stats.numDrawCalls++;
+			stats.numInstancedDrawCalls++;
+			stats.numInstances += instances;
+			stats.numVertices += (uint64_t)count * instances;
+			base->DrawArraysInstanced(mode, first, count, instances);
+		}
+		
+		void GLRecordingDevice::DrawElementsInstanced(Enum mode, Sizei count, Enum type, const void *indices, Sizei instances) {
+			stats.numCalls++;
+			stats.numDrawCalls++;
+			stats.numInstancedDrawCalls++;
+			stats.numInstances += instances;
+			stats.numVertices += (uint64_t)count * instances;
+			base->DrawElementsInstanced(mode, count, type, indices, instances);
+		}
+		
+		IGLDevice::UInteger GLRecordingDevice::CreateShader(Enum type) {
+			stats.numCalls++;
+			return base->CreateShader(type);
+		}
+		
+		void GLRecordingDevice::ShaderSource(UInteger shader, Sizei count, const char **string, const int *len) {
+			stats.numCalls++;
+			base->ShaderSource(shader, count, string, len);
+		}
+		
+		void GLRecordingDevice::CompileShader(UInteger shader) {
+			stats.numCalls++;
+			base->CompileShader(shader);
+		}
+		
+		void GLRecordingDevice::DeleteShader(UInteger shader) {
+			stats.numCalls++;
+			base->DeleteShader(shader);
+		}
+		
+		IGLDevice::Integer GLRecordingDevice::GetShaderInteger(UInteger shader, Enum param) {
+			stats.numCalls++;
+			return base->GetShaderInteger(shader, param);
+		}
+		
+		void GLRecordingDevice::GetShaderInfoLog(UInteger shader, Sizei bufferSize, Sizei *length, char *outString) {
+			stats.numCalls++;
+			base->GetShaderInfoLog(shader, bufferSize, length, outString);
+		}
+		
+		IGLDevice::Integer GLRecordingDevice::GetProgramInteger(UInteger program, Enum param) {
+			stats.numCalls++;
+			return base->GetProgramInteger(program, param);
+		}
+		
+		void GLRecordingDevice::GetProgramInfoLog(UInteger program, Sizei bufferSize, Sizei *length, char *outString) {
+			stats.numCalls++;
+			base->GetProgramInfoLog(program, bufferSize, length, outString);
+		}
+		
+		IGLDevice::UInteger GLRecordingDevice::CreateProgram() {
+			stats.numCalls++;
+			return base->CreateProgram();
+		}
+		
+		void GLRecordingDevice::AttachShader(UInteger program, UInteger shader) {
+			stats.numCalls++;
+			base->AttachShader(program, shader);
+		}
+		
+		void GLRecordingDevice::DetachShader(UInteger program, UInteger shader) {
+			stats.numCalls++;
+			base->DetachShader(program, shader);
+		}
+		
+		void GLRecordingDevice::LinkProgram(UInteger program) {
+			stats.numCalls++;
+			base->LinkProgram(program);
+		}
+		
+		void GLRecordingDevice::UseProgram(UInteger program) {
+			stats.numCalls++;
+			stats.numProgramChanges++;
+			base->UseProgram(program);
+		}
+		
+		void GLRecordingDevice::DeleteProgram(UInteger program) {
+			stats.numCalls++;
+			base->DeleteProgram(program);
+		}
+		
+		void GLRecordingDevice::ValidateProgram(UInteger program) {
+			stats.numCalls++;
+			base->ValidateProgram(program);
+		}
+		
+		IGLDevice::Integer GLRecordingDevice::GetAttribLocation(UInteger program, const char *name) {
+			stats.numCalls++;
+			return base->GetAttribLocation(program, name);
+		}
+		
+		void GLRecordingDevice::BindAttribLocation(UInteger program, UInteger index, const char *name) {
+			stats.numCalls++;
+			base->BindAttribLocation(program, index, name);
+		}
+		
+		IGLDevice::Integer GLRecordingDevice::GetUniformLocation(UInteger program, const char *name) {
+			stats.numCalls++;
+			return base->GetUniformLocation(program, name);
+		}
+		
+		void GLRecordingDevice::Uniform(Integer loc, Float x) {
+			stats.numCalls++;
+			stats.numUniforms++;
+			base->Uniform(loc, x);
+		}
+		
+		void GLRecordingDevice::Uniform(Integer loc, Float x, Float y) {
+			stats.numCalls++;
+			stats.numUniforms++;
+			base->Uniform(loc, x, y);
+		}
+		
+		void GLRecordingDevice::Uniform(Integer loc, Float x, Float y, Float z) {
+			stats.numCalls++;
+			stats.numUniforms++;
+			base->Uniform(loc, x, y, z);
+		}
+		
+		void GLRecordingDevice::Uniform(Integer loc, Float x, Float y, Float z, Float w) {
+			stats.numCalls++;
+			stats.numUniforms++;
+			base->Uniform(loc, x, y, z, w);
+		}
+		
+		void GLRecordingDevice::Uniform(Integer loc, Integer x) {
+			stats.numCalls++;
+			stats.numUniforms++;
+			base->Uniform(loc, x);
+		}
+		
+		void GLRecordingDevice::Uniform(Integer loc, Integer x, Integer y) {
+			stats.numCalls++;
+			stats.numUniforms++;
+			base->Uniform(loc, x, y);
+		}
+		
+		void GLRecordingDevice::Uniform(Integer loc, Integer x, Integer y, Integer z) {
+			stats.numCalls++;
+			stats.numUniforms++;
+			base->Uniform(loc, x, y, z);
+		}
+		
+		void GLRecordingDevice::Uniform(Integer loc, Integer x, Integer y, Integer z, Integer w) {
+			stats.numCalls++;
+			stats.numUniforms++;
+			base->Uniform(loc, x, y, z, w);
+		}
+		
+		void GLRecordingDevice::Uniform(Integer loc, bool transpose, const Matrix4& mat) {
+			stats.numCalls++;
+			stats.numUniforms++;
+			base->Uniform(loc, transpose, mat);
+		}
+		
+		IGLDevice::UInteger GLRecordingDevice::GenRenderbuffer() {
+			stats.numCalls++;
+			return base->GenRenderbuffer();
+		}
+		
+		void GLRecordingDevice::DeleteRenderbuffer(UInteger renderbuffer) {
+			stats.numCalls++;
+			base->DeleteRenderbuffer(renderbuffer);
+		}
+		
+		void GLRecordingDevice::BindRenderbuffer(Enum target, UInteger renderbuffer) {
+			stats.numCalls++;
+			base->BindRenderbuffer(target, renderbuffer);
+		}
+		
+		void GLRecordingDevice::RenderbufferStorage(Enum target, Enum internalFormat, Sizei width, Sizei height) {
+			stats.numCalls++;
+			base->RenderbufferStorage(target, internalFormat, width, height);
+		}
+		
+		void GLRecordingDevice::RenderbufferStorage(Enum target, Sizei samples, Enum internalFormat, Sizei width, Sizei height) {
+			stats.numCalls++;
+			base->RenderbufferStorage(target, samples, internalFormat, width, height);
+		}
+		
+		IGLDevice::UInteger GLRecordingDevice::GenFramebuffer() {
+			stats.numCalls++;
+			return base->GenFramebuffer();
+		}
+		
+		void GLRecordingDevice::BindFramebuffer(Enum target, UInteger framebuffer) {
+			stats.numCalls++;
+			base->BindFramebuffer(target, framebuffer);
+		}
+		
+		void GLRecordingDevice::DeleteFramebuffer(UInteger framebuffer) {
+			stats.numCalls++;
+			base->DeleteFramebuffer(framebuffer);
+		}
+		
+		void GLRecordingDevice::FramebufferTexture2D(Enum target, Enum attachment, Enum texTarget, UInteger texture, Integer level) {
+			stats.numCalls++;
+			base->FramebufferTexture2D(target, attachment, texTarget, texture, level);
+		}
+		
+		void GLRecordingDevice::FramebufferRenderbuffer(Enum target, Enum attachment, Enum renderbufferTarget, UInteger renderbuffer) {
+			stats.numCalls++;
+			base->FramebufferRenderbuffer(target, attachment, renderbufferTarget, renderbuffer);
+		}
+		
+		void GLRecordingDevice::BlitFramebuffer(Integer srcX0, Integer srcY0, Integer srcX1, Integer srcY1, Integer dstX0, Integer dstY0, Integer dstX1, Integer dstY1, UInteger mask, Enum filter) {
+			stats.numCalls++;
+			base->BlitFramebuffer(srcX0, srcY0, srcX1, srcY1, dstX0, dstY0, dstX1, dstY1, mask, filter);
+		}
+		
+		IGLDevice::Enum GLRecordingDevice::CheckFramebufferStatus(Enum target) {
+			stats.numCalls++;
+			return base->CheckFramebufferStatus(target);
+		}
+		
+		void GLRecordingDevice::ReadPixels(Integer x, Integer y, Sizei width, Sizei height, Enum format, Enum type, void *data) {
+			stats.numCalls++;
+			base->ReadPixels(x, y, width, height, format, type, data);
+		}
+		
+		IGLDevice::Integer GLRecordingDevice::ScreenWidth() {
+			stats.numCalls++;
+			return base->ScreenWidth();
+		}
+		
+		IGLDevice::Integer GLRecordingDevice::ScreenHeight() {
+			stats.numCalls++;
+			return base->ScreenHeight();
+		}
+		
+		void GLRecordingDevice::Swap() {
+			stats.numCalls++;
+			stats.numFrames++;
+			base->Swap();
+		}
+	}
+}
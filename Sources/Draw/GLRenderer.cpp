@@ -271,6 +271,18 @@ namespace spades {
 			return new GLVoxelModel(model, this);
 		}
 		
+		void GLRenderer::RegisterPreloadedImage(const char *filename,
+												spades::Bitmap *bmp) {
+			SPADES_MARK_FUNCTION();
+			imageManager->RegisterPreloadedImage(filename, bmp);
+		}
+		
+		void GLRenderer::RegisterPreloadedModel(const char *filename,
+												spades::VoxelModel *model) {
+			SPADES_MARK_FUNCTION();
+			modelManager->RegisterPreloadedModel(filename, model);
+		}
+		
 		client::IModel *GLRenderer::CreateModelOptimized(spades::VoxelModel *model) {
 			SPADES_MARK_FUNCTION();
 			if(r_optimizedVoxelModel){
@@ -1158,6 +1170,46 @@ namespace spades {
 			
 		}
 		
+		void GLRenderer::DrawImages(client::IImage *image,
+									const client::ImageQuad *quads,
+									size_t numQuads) {
+			SPADES_MARK_FUNCTION();
+			
+			GLImage *img = dynamic_cast<GLImage *>(image);
+			if(!img){
+				if(!image) {
+					img = imageManager->GetWhiteImage();
+				}else{
+					// invalid type: not GLImage.
+					SPInvalidArgument("image");
+				}
+			}
+			
+			imageRenderer->SetImage(img);
+			
+			Vector4 col = drawColorAlphaPremultiplied;
+			if(legacyColorPremultiply) {
+				col.x *= col.w;
+				col.y *= col.w;
+				col.z *= col.w;
+			}
+			
+			for(size_t i = 0; i < numQuads; i++){
+				const AABB2& outRect = quads[i].outRect;
+				const AABB2& inRect = quads[i].inRect;
+				imageRenderer->Add(outRect.GetMinX(), outRect.GetMinY(),
+								   outRect.GetMaxX(), outRect.GetMinY(),
+								   outRect.GetMaxX(), outRect.GetMaxY(),
+								   outRect.GetMinX(), outRect.GetMaxY(),
+								   inRect.GetMinX(), inRect.GetMinY(),
+								   inRect.GetMaxX(), inRect.GetMinY(),
+								   inRect.GetMaxX(), inRect.GetMaxY(),
+								   inRect.GetMinX(), inRect.GetMaxY(),
+								   col.x, col.y,
+								   col.z, col.w);
+			}
+		}
+		
 		void GLRenderer::DrawFlatGameMap(const spades::AABB2 &outRect,
 										 const spades::AABB2 &inRect){
 			void EnsureSceneNotStarted();
@@ -144,6 +144,9 @@ namespace spades {
 			virtual client::IModel *CreateModel(VoxelModel *);
 			virtual client::IModel *CreateModelOptimized(VoxelModel *);
 			
+			virtual void RegisterPreloadedImage(const char *filename, Bitmap *);
+			virtual void RegisterPreloadedModel(const char *filename, VoxelModel *);
+			
 			GLProgram *RegisterProgram(const std::string& name);
 			GLShader *RegisterShader(const std::string& name);
 			
@@ -179,6 +182,7 @@ namespace spades {
 			virtual void DrawImage(client::IImage *, const Vector2& outTopLeft, const AABB2& inRect);
 			virtual void DrawImage(client::IImage *, const AABB2& outRect, const AABB2& inRect);
 			virtual void DrawImage(client::IImage *, const Vector2& outTopLeft, const Vector2& outTopRight, const Vector2& outBottomLeft, const AABB2& inRect);
+			virtual void DrawImages(client::IImage *, const client::ImageQuad *, size_t numQuads);
 			
 			virtual void DrawFlatGameMap(const AABB2& outRect, const AABB2& inRect);
 			
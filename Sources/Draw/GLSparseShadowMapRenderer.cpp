@@ -533,7 +533,9 @@ namespace spades {
 					for(size_t y = 0; y < Tiles; y++)
 						groupMap[x][y] = NoGroup;
 				
-				const std::vector<GLModelRenderer::RenderModel>& rmodels = renderer->GetRenderer()->GetModelRenderer()->models;
+				GLModelRenderer *modelRenderer = renderer->GetRenderer()->GetModelRenderer();
+				modelRenderer->SortParams();
+				const std::vector<GLModelRenderer::RenderModel>& rmodels = modelRenderer->models;
 				allInstances.reserve(256);
 				groups.reserve(64);
 				nodes.reserve(256);
@@ -544,8 +546,9 @@ namespace spades {
 					
 					inst.model = rmodel.model;
 					OBB3 modelBounds = inst.model->GetBoundingBox();
-					for(size_t i = 0; i < rmodel.params.size(); i++) {
-						inst.param = &(rmodel.params[i]);
+					GLModelParamSpan params = modelRenderer->GetParams(rmodel);
+					for(size_t i = 0; i < params.size(); i++) {
+						inst.param = &(params[i]);
                         
                         if(inst.param->depthHack)
                             continue;
@@ -758,7 +761,7 @@ namespace spades {
 			GLModel *lastModel;
 			
 			ModelRenderer() {
-				params.resize(64);
+				params.reserve(64);
 				lastModel = NULL;
 			}
 			
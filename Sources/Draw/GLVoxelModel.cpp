@@ -266,7 +266,7 @@ namespace spades {
 			}
 		}
 		
-		void GLVoxelModel::RenderShadowMapPass(std::vector<client::ModelRenderParam> params) {
+		void GLVoxelModel::RenderShadowMapPass(GLModelParamSpan params) {
 			SPADES_MARK_FUNCTION();
 			
 			device->Enable(IGLDevice::CullFace, true);
@@ -353,7 +353,7 @@ namespace spades {
 			device->BindTexture(IGLDevice::Texture2D, 0);
 		}
 		
-		void GLVoxelModel::RenderSunlightPass(std::vector<client::ModelRenderParam> params) {
+		void GLVoxelModel::RenderSunlightPass(GLModelParamSpan params) {
 			SPADES_MARK_FUNCTION();
 			
 			
@@ -495,7 +495,7 @@ namespace spades {
 			device->BindTexture(IGLDevice::Texture2D, 0);
 		}
 		
-		void GLVoxelModel::RenderDynamicLightPass(std::vector<client::ModelRenderParam> params, std::vector<GLDynamicLight> lights) {
+		void GLVoxelModel::RenderDynamicLightPass(GLModelParamSpan params, const std::vector<GLDynamicLight>& lights) {
 			SPADES_MARK_FUNCTION();
 			
 			device->ActiveTexture(0);
@@ -80,11 +80,11 @@ namespace spades {
 			
 			static void PreloadShaders(GLRenderer *);
 			
-			virtual void RenderShadowMapPass(std::vector<client::ModelRenderParam> params);
+			virtual void RenderShadowMapPass(GLModelParamSpan params);
 			
-			virtual void RenderSunlightPass(std::vector<client::ModelRenderParam> params);
+			virtual void RenderSunlightPass(GLModelParamSpan params);
 			
-			virtual void RenderDynamicLightPass(std::vector<client::ModelRenderParam> params, std::vector<GLDynamicLight> lights);
+			virtual void RenderDynamicLightPass(GLModelParamSpan params, const std::vector<GLDynamicLight>& lights);
 			
 			virtual AABB3 GetBoundingBox() { return boundingBox; }
 		};
@@ -32,13 +32,27 @@
 #include "../Client/GameMap.h"
 #include "../Core/ConcurrentDispatch.h"
 #include <stdlib.h>
-#include "../kiss_fft130/kiss_fft.h"
 #include "GLProfiler.h"
 #include "../Core/Settings.h"
+#include "../Core/Stopwatch.h"
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <memory>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define ENABLE_WAVE_SSE 1
+#else
+#define ENABLE_WAVE_SSE 0
+#endif
 
 SPADES_SETTING(r_water, "2");
 SPADES_SETTING(r_maxAnisotropy, "8");
 SPADES_SETTING(r_occlusionQuery, "0");
+SPADES_SETTING(r_waterResolution, "128");
+SPADES_SETTING(r_waterNumThreads, "2");
+SPADES_SETTING(r_waterBenchmark, "0");
 
 namespace spades {
 	namespace draw {
@@ -49,6 +63,7 @@ namespace spades {
 		protected:
 			float dt;
 			int size, samples;
+			float slopeScale;
 		private:
 			uint32_t *bitmap;
 			
@@ -65,7 +80,7 @@ namespace spades {
 			
 			uint32_t MakeBitmapPixel(float dx, float dy, float h){
 				float x = dx, y = dy, z = 0.04f;
-				float scale = 200.f;
+				float scale = slopeScale;
 				x *= scale; y *= scale; z *= scale;
 				
 				uint32_t out;
@@ -91,7 +106,7 @@ namespace spades {
 			}
 			
 		public:
-			IWaveTank(int size):size(size) {
+			IWaveTank(int size):size(size), slopeScale(200.f) {
 				
 				bitmap = new uint32_t[size*size];
 				
@@ -114,18 +129,17 @@ namespace spades {
 			}
 			
 			void MakeBitmap(float *height){
-				MakeBitmapRow(height + (size-1) * size,
-							  height,
-							  height + size,
-							  bitmap);
-				MakeBitmapRow(height + (size-2) * size,
-							  height + (size-1) * size,
-							  height,
-							  bitmap + (size-1)*size);
-				for(int y = 1; y < size - 1; y++){
-					MakeBitmapRow(height + (y - 1) * size,
+				MakeBitmapRows(height, 0, size);
+			}
+			
+			/** builds rows `minY`...`maxY - 1` of the bitmap. */
+			void MakeBitmapRows(float *height, int minY, int maxY){
+				for(int y = minY; y < maxY; y++){
+					int y1 = (y + size - 1) % size;
+					int y3 = (y + 1) % size;
+					MakeBitmapRow(height + y1 * size,
 								  height + y * size,
-								  height + (y + 1) * size,
+								  height + y3 * size,
 								  bitmap + y*size);
 				}
 			}
@@ -179,15 +193,63 @@ namespace spades {
 		
 		static SinCosTable sinCosTable;
 		
+		/** calls `f(i)` for each of `numItems` items on the calling thread
+		 * and on up to `numThreads - 1` dispatch threads.
+		 * wave tanks are run by dispatch threads themselves, so the caller
+		 * never waits for a helper to start; helpers that start after all
+		 * of the items were taken return immediately. */
+		template<class F>
+		static void RunWaveTankJobs(int numItems, int numThreads, F f) {
+			struct State {
+				std::atomic<int> next;
+				std::atomic<int> done;
+				std::mutex mutex;
+				std::condition_variable cond;
+			};
+			auto state = std::make_shared<State>();
+			state->next = 0;
+			state->done = 0;
+			
+			auto work = [state, numItems, f]() {
+				int count = 0;
+				int i;
+				while((i = state->next.fetch_add(1)) < numItems){
+					f(i);
+					count++;
+				}
+				if(count > 0 && state->done.fetch_add(count) + count == numItems){
+					std::lock_guard<std::mutex> lock(state->mutex);
+					state->cond.notify_all();
+				}
+			};
+			
+			numThreads = std::min(numThreads, numItems);
+			for(int i = 1; i < numThreads; i++){
+				auto *dispatch = new FunctionDispatch<decltype(work)>(work);
+				dispatch->Start();
+				dispatch->Release();
+			}
+			work();
+			
+			std::unique_lock<std::mutex> lock(state->mutex);
+			state->cond.wait(lock, [&] { return state->done == numItems; });
+		}
+		
+		/** Inverse FFT wave solver.
+		 * The heightfield is real, so only the rows 0...size/2 of the
+		 * spectrum are stored. The rows are transformed along x first, and
+		 * then two real columns are obtained from each complex transform
+		 * along y. The radix-2 butterflies are done on four sequences at
+		 * once, each of which occupies one SIMD lane. */
 		class GLWaterRenderer::FFTWaveTank: public IWaveTank {
 			enum {
-				SizeBits = 7,
-				Size = 1 << SizeBits,
-				SizeHalf = Size / 2
+				NumLanes = 4,
+				MaxSize = 1024,
+				/** the spectrum and the slopes are scaled so that tanks of
+				 * any size look like the original 128x128 one. */
+				ReferenceSize = 128,
+				RowsPerBitmapJob = 32
 			};
-			kiss_fft_cfg fft;
-			
-			typedef kiss_fft_cpx Complex;
 			
 			struct Cell {
 				float magnitude;
@@ -198,34 +260,202 @@ namespace spades {
 				float m10, m11;
 			};
 			
-			Cell cells[SizeHalf+1][Size];
+			int sizeHalf;
+			int numThreads;
 			
-			Complex spectrum[SizeHalf+1][Size];
+			/** rows 0...sizeHalf of the spectrum. */
+			std::vector<Cell> cells;
 			
-			Complex temp1[Size];
-			Complex temp2[Size];
-			Complex temp3[Size][Size];
+			std::vector<float> twiddleReal, twiddleImag;
+			std::vector<int> bitReversal;
 			
-			float height[Size][Size];
+			/** rows 0...sizeHalf transformed along x. */
+			std::vector<float> rowsReal, rowsImag;
+			
+			/** indexed by [x][y]. */
+			std::vector<float> height;
+			
+			/** in-place transform of four bit-reversed sequences.
+			 * element `i` of lane `l` is at `[i * NumLanes + l]`. */
+			void Butterflies(float *re, float *im) {
+				for(int len = 2; len <= size; len <<= 1){
+					int half = len >> 1;
+					int step = size / len;
+					for(int j = 0; j < half; j++){
+						float wr = twiddleReal[j * step];
+						float wi = twiddleImag[j * step];
+#if ENABLE_WAVE_SSE
+						__m128 wr4 = _mm_set1_ps(wr);
+						__m128 wi4 = _mm_set1_ps(wi);
+						for(int s = j; s < size; s += len){
+							float *ar = re + s * NumLanes, *ai = im + s * NumLanes;
+							float *br = ar + half * NumLanes, *bi = ai + half * NumLanes;
+							__m128 xr = _mm_loadu_ps(br), xi = _mm_loadu_ps(bi);
+							__m128 vr = _mm_sub_ps(_mm_mul_ps(xr, wr4), _mm_mul_ps(xi, wi4));
+							__m128 vi = _mm_add_ps(_mm_mul_ps(xr, wi4), _mm_mul_ps(xi, wr4));
+							__m128 ur = _mm_loadu_ps(ar), ui = _mm_loadu_ps(ai);
+							_mm_storeu_ps(ar, _mm_add_ps(ur, vr));
+							_mm_storeu_ps(ai, _mm_add_ps(ui, vi));
+							_mm_storeu_ps(br, _mm_sub_ps(ur, vr));
+							_mm_storeu_ps(bi, _mm_sub_ps(ui, vi));
+						}
+#else
+						for(int s = j; s < size; s += len){
+							float *ar = re + s * NumLanes, *ai = im + s * NumLanes;
+							float *br = ar + half * NumLanes, *bi = ai + half * NumLanes;
+							for(int l = 0; l < NumLanes; l++){
+								float vr = br[l] * wr - bi[l] * wi;
+								float vi = br[l] * wi + bi[l] * wr;
+								float ur = ar[l], ui = ai[l];
+								ar[l] = ur + vr; ai[l] = ui + vi;
+								br[l] = ur - vr; bi[l] = ui - vi;
+							}
+						}
+#endif
+					}
+				}
+			}
+			
+			/** advances and transforms rows `batch * NumLanes`... */
+			void TransformRows(int batch) {
+				float re[MaxSize * NumLanes];
+				float im[MaxSize * NumLanes];
+				
+				for(int l = 0; l < NumLanes; l++){
+					int y = batch * NumLanes + l;
+					if(y > sizeHalf){
+						for(int x = 0; x < size; x++){
+							re[x * NumLanes + l] = 0.f;
+							im[x * NumLanes + l] = 0.f;
+						}
+						continue;
+					}
+					
+					Cell *row = cells.data() + y * size;
+					for(int x = 0; x < size; x++){
+						Cell& cell = row[x];
+						uint32_t dphase;
+						dphase = (uint32_t)(cell.phasePerSecond * dt);
+						cell.phase += dphase;
+						
+						unsigned int phase = cell.phase >> 16;
+						float c, s;
+						sinCosTable.Compute(phase, s, c);
+						
+						float u, v;
+						u = c * cell.m00 + s * cell.m01;
+						v = c * cell.m10 + s * cell.m11;
+						
+						int idx = bitReversal[x] * NumLanes + l;
+						re[idx] = u * cell.magnitude;
+						im[idx] = v * cell.magnitude;
+					}
+				}
+				
+				Butterflies(re, im);
+				
+				for(int l = 0; l < NumLanes; l++){
+					int y = batch * NumLanes + l;
+					if(y > sizeHalf)
+						break;
+					float *outReal = rowsReal.data() + y * size;
+					float *outImag = rowsImag.data() + y * size;
+					for(int x = 0; x < size; x++){
+						outReal[x] = re[x * NumLanes + l];
+						outImag[x] = im[x * NumLanes + l];
+					}
+				}
+			}
+			
+			/** transforms columns `batch * NumLanes * 2`... along y.
+			 * columns A and B are packed into one sequence A + iB, and
+			 * since both of them are Hermitian, the real and imaginary
+			 * parts of the result are the heights of A and B. */
+			void TransformColumns(int batch) {
+				float re[MaxSize * NumLanes];
+				float im[MaxSize * NumLanes];
+				
+				for(int l = 0; l < NumLanes; l++){
+					int xa = (batch * NumLanes + l) * 2;
+					int xb = xa + 1;
+					for(int y = 0; y < size; y++){
+						int yy = y <= sizeHalf ? y : size - y;
+						float ar = rowsReal[yy * size + xa];
+						float ai = rowsImag[yy * size + xa];
+						float br = rowsReal[yy * size + xb];
+						float bi = rowsImag[yy * size + xb];
+						if(y == 0 || y == sizeHalf){
+							ai = 0.f; bi = 0.f;
+						}else if(y > sizeHalf){
+							ai = -ai; bi = -bi;
+						}
+						
+						int idx = bitReversal[y] * NumLanes + l;
+						re[idx] = ar - bi;
+						im[idx] = ai + br;
+					}
+				}
+				
+				Butterflies(re, im);
+				
+				for(int l = 0; l < NumLanes; l++){
+					int xa = (batch * NumLanes + l) * 2;
+					float *outA = height.data() + xa * size;
+					float *outB = outA + size;
+					for(int y = 0; y < size; y++){
+						outA[y] = re[y * NumLanes + l];
+						outB[y] = im[y * NumLanes + l];
+					}
+				}
+			}
 			
 		public:
-			FFTWaveTank(): IWaveTank(Size){
-				fft = kiss_fft_alloc(Size, 1, NULL, NULL);
+			FFTWaveTank(int size): IWaveTank(size){
+				SPAssert(size >= 32 && size <= MaxSize);
+				SPAssert((size & (size - 1)) == 0);
+				
+				sizeHalf = size / 2;
+				numThreads = std::max((int)r_waterNumThreads, 1);
+				slopeScale *= (float)size / (float)ReferenceSize;
+				
+				cells.resize((sizeHalf + 1) * size);
+				rowsReal.resize((sizeHalf + 1) * size);
+				rowsImag.resize((sizeHalf + 1) * size);
+				height.resize(size * size);
+				
+				// exp(+2 pi i k / size) for the inverse transform
+				twiddleReal.resize(sizeHalf);
+				twiddleImag.resize(sizeHalf);
+				for(int i = 0; i < sizeHalf; i++){
+					double ang = (double)i / (double)size * M_PI * 2.;
+					twiddleReal[i] = (float)cos(ang);
+					twiddleImag[i] = (float)sin(ang);
+				}
+				
+				bitReversal.resize(size);
+				for(int i = 0; i < size; i++){
+					int r = 0;
+					for(int b = 1; b < size; b <<= 1){
+						r <<= 1;
+						if(i & b) r |= 1;
+					}
+					bitReversal[i] = r;
+				}
 				
-				for(int x = 0; x < Size; x++){
-					for(int y = 0; y <= SizeHalf; y++){
-						Cell& cell = cells[y][x];
+				for(int x = 0; x < size; x++){
+					for(int y = 0; y <= sizeHalf; y++){
+						Cell& cell = cells[y * size + x];
 						if(x == 0 && y == 0){
 							cell.magnitude = 0;
 							cell.phasePerSecond = 0.f;
 							cell.phase = 0;
 						}else{
-							int cx = std::min(x, Size-x);
+							int cx = std::min(x, size-x);
 							float dist = (float)sqrtf(cx*cx+y*y);
-							float mag = 0.8f / dist / (float)Size;
+							float mag = 0.8f / dist / (float)ReferenceSize;
 							mag /= dist;
 							
-							float scal = dist / (float)SizeHalf;
+							float scal = dist / (float)sizeHalf;
 							scal *= scal;
 							mag *= expf(-scal * 4.f);
 							
@@ -242,65 +472,18 @@ namespace spades {
 					}
 				}
 			}
-			virtual ~FFTWaveTank(){
-				kiss_fft_free(fft);
-			}
 			
 			virtual void Run() {
-				// advance cells
-				for(int x = 0; x < Size; x++){
-					for(int y = 0; y <= SizeHalf; y++){
-						Cell& cell = cells[y][x];
-						uint32_t dphase;
-						dphase = (uint32_t)(cell.phasePerSecond * dt);
-						cell.phase += dphase;
-						
-						unsigned int phase = cell.phase >> 16;
-						float c, s;
-						sinCosTable.Compute(phase, s, c);
-						
-						float u, v;
-						u = c * cell.m00 + s * cell.m01;
-						v = c * cell.m10 + s * cell.m11;
-						
-						spectrum[y][x].r = u * cell.magnitude;
-						spectrum[y][x].i = v * cell.magnitude;
-					}
-				}
-				
-				// rfft
-				for(int y = 0; y <= SizeHalf; y++){
-					for(int x = 0; x < Size; x++)
-						temp1[x] = spectrum[y][x];
-					
-					kiss_fft(fft, temp1, temp2);
-					
-					if(y == 0){
-						for(int x = 0; x < Size; x++){
-							temp3[x][0] = temp2[x];
-						}
-					}else if(y == SizeHalf){
-						for(int x = 0; x < Size; x++){
-							temp3[x][SizeHalf].r = temp2[x].r;
-							temp3[x][SizeHalf].i = 0.f;
-						}
-					}else{
-						for(int x = 0; x < Size; x++){
-							temp3[x][y] = temp2[x];
-							temp3[x][Size-y].r = temp2[x].r;
-							temp3[x][Size-y].i = -temp2[x].i;
-						}
-					}
-				}
-				for(int x = 0; x < Size; x++){
-					kiss_fft(fft, temp3[x], temp2);
-					for(int y = 0; y < Size; y++){
-						height[x][y] = temp2[y].r;
-					}
-				}
-				
-				MakeBitmap((float *)height);
-				
+				RunWaveTankJobs((sizeHalf + NumLanes) / NumLanes, numThreads,
+								[this](int i) { TransformRows(i); });
+				RunWaveTankJobs(size / (NumLanes * 2), numThreads,
+								[this](int i) { TransformColumns(i); });
+				RunWaveTankJobs(size / RowsPerBitmapJob, numThreads,
+								[this](int i) {
+									MakeBitmapRows(height.data(),
+												   i * RowsPerBitmapJob,
+												   (i + 1) * RowsPerBitmapJob);
+								});
 			}
 			
 		};
@@ -495,6 +678,34 @@ namespace spades {
 		
 #pragma mark - Water Renderer
 		
+		static int GetWaveTankSize() {
+			// must be a power of two
+			int size = 32;
+			while(size < 1024 && size * 2 <= (int)r_waterResolution)
+				size <<= 1;
+			return size;
+		}
+		
+		void GLWaterRenderer::RunWaveTankBenchmark(int numSteps) {
+			SPADES_MARK_FUNCTION();
+			
+			numSteps = std::max(numSteps, 1);
+			SPLog("Running wave tank benchmark (%d step(s) per size, %d thread(s), %s)",
+				  numSteps, std::max((int)r_waterNumThreads, 1),
+				  ENABLE_WAVE_SSE ? "SSE" : "scalar");
+			for(int size = 64; size <= 1024; size <<= 1){
+				FFTWaveTank tank(size);
+				tank.SetTimeStep(1.f / 60.f);
+				tank.Run(); // warm up
+				
+				Stopwatch sw;
+				for(int i = 0; i < numSteps; i++)
+					tank.Run();
+				double t = sw.GetTime() / (double)numSteps;
+				SPLog("  %4dx%-4d %8.3fms/step", size, size, t * 1000.);
+			}
+		}
+		
 		void GLWaterRenderer::PreloadShaders(spades::draw::GLRenderer *renderer) {
 			if((int)r_water >= 2)
 				renderer->RegisterProgram("Shaders/Water2.program");
@@ -584,10 +795,14 @@ namespace spades {
 								  IGLDevice::BGRA, IGLDevice::UnsignedByte,
 								  bitmap.data());
 			
+			if((int)r_waterBenchmark > 0)
+				RunWaveTankBenchmark(r_waterBenchmark);
+			
 			// create wave tank simlation
 			size_t numLayers = ((int)r_water >= 2) ? 3 : 1;
+			int tankSize = GetWaveTankSize();
 			for(size_t i = 0; i < numLayers; i++){
-				waveTanks.push_back(new FFTWaveTank());//new StandardWaveTank(256);
+				waveTanks.push_back(new FFTWaveTank(tankSize));//new StandardWaveTank(256);
 			
 				waveTextures.push_back(device->GenTexture());
 				device->BindTexture(IGLDevice::Texture2D, waveTextures[i]);
@@ -74,6 +74,10 @@ namespace spades {
 			
 			static void PreloadShaders(GLRenderer *);
 			
+			/** measures the time taken by a step of the wave
+			 * simulation for each tank size, and logs it. */
+			static void RunWaveTankBenchmark(int numSteps);
+			
 			void Render();
 			
 			void Update(float dt);
@@ -26,14 +26,22 @@
 #include <Core/Exception.h>
 #include <Core/Debug.h>
 #include "SWMapRenderer.h"
+#include "SWUtils.h"
 
 
 namespace spades {
 	namespace draw {
+		enum {
+			/** rows are generated in parallel when at least this many
+			 * rows have to be updated. */
+			MinParallelFlatMapRows = 32
+		};
+		
 		SWFlatMapRenderer::SWFlatMapRenderer(SWRenderer *r,
 											 client::GameMap *map):
 		map(map), r(r), needsUpdate(true),
-		w(map->Width()), h(map->Height()){
+		w(map->Width()), h(map->Height()),
+		dirtyMinY(0), dirtyMaxY(map->Height() - 1){
 			SPADES_MARK_FUNCTION();
 			
 			if(w & 31) {
@@ -56,6 +64,7 @@ namespace spades {
 		
 		void SWFlatMapRenderer::Update(bool firstTime) {
 			SPADES_MARK_FUNCTION();
+			int minY, maxY;
 			{
 				std::lock_guard<std::mutex> lock(updateInfoLock);
 				
@@ -64,57 +73,89 @@ namespace spades {
 				needsUpdate = false;
 				updateMap.swap(updateMap2);
 				std::fill(updateMap.begin(), updateMap.end(), 0);
+				minY = dirtyMinY;
+				maxY = dirtyMaxY;
+				dirtyMinY = h;
+				dirtyMaxY = -1;
 			}
-			auto *outPixels = img->GetRawBitmap();
 			
-			auto *mapRenderer = r->mapRenderer.get();
+			if(minY > maxY)
+				return;
+			
+			int numRows = maxY - minY + 1;
+			if(numRows >= MinParallelFlatMapRows) {
+				InvokeParallel2([&](unsigned int th, unsigned int numThreads) {
+					int y1 = minY + numRows * th / numThreads;
+					int y2 = minY + numRows * (th + 1) / numThreads;
+					if(y1 < y2)
+						GenerateRows(y1, y2 - 1);
+				});
+			}else{
+				GenerateRows(minY, maxY);
+			}
+			
+			if(firstTime)
+				return;
 			
-			int idx = 0;
-			for(int y = 0; y < h; y++) {
-				for(int x = 0; x < w; x += 32) {
-					uint32_t upd = updateMap2[idx];
-					if(upd) {
-						for(int i = 0; i < 32; i++) {
-							if(upd & 1) {
-								auto c = GeneratePixel(x + i, y);
-								outPixels[i] = c;
-								if(!firstTime){
-									mapRenderer->UpdateRle(x+i, y);
-									mapRenderer->UpdateRle((x+i+1)&(w-1), y);
-									mapRenderer->UpdateRle((x+i-1)&(w-1), y);
-									mapRenderer->UpdateRle(x+i, (y+1)&(h-1));
-									mapRenderer->UpdateRle(x+i, (y-1)&(h-1));
-								}
-							}
-							upd >>= 1;
-						}
-						//updateMap[idx] = 0;
+			// SWMapRenderer's RLE invalidation isn't thread-safe,
+			// so this is done after the pixels are generated
+			auto *mapRenderer = r->mapRenderer.get();
+			const int wordsPerRow = w >> 5;
+			for(int y = minY; y <= maxY; y++) {
+				const uint32_t *upd = updateMap2.data() + y * wordsPerRow;
+				for(int wx = 0; wx < wordsPerRow; wx++) {
+					uint32_t bits = upd[wx];
+					for(int x = wx << 5; bits; x++, bits >>= 1) {
+						if(!(bits & 1))
+							continue;
+						// neighbors share the faces
+						mapRenderer->InvalidateRle(x, y);
+						mapRenderer->InvalidateRle((x+1)&(w-1), y);
+						mapRenderer->InvalidateRle((x-1)&(w-1), y);
+						mapRenderer->InvalidateRle(x, (y+1)&(h-1));
+						mapRenderer->InvalidateRle(x, (y-1)&(h-1));
 					}
-					outPixels += 32;
-					idx++;
 				}
 			}
+			
+			mapRenderer->FlushRleUpdates();
 		}
 		
-		uint32_t SWFlatMapRenderer::GeneratePixel(int x, int y) {
-			const int depth = map->Depth();
-			for(int z = 0; z < depth; z++) {
-				if(map->IsSolid(x, y, z)) {
-					uint32_t col = map->GetColor(x, y, z);
-					col = (col & 0xff00) |
-					((col & 0xff) << 16) |
-					((col & 0xff0000) >> 16);
-					col |= 0xff000000;
-					return col;
+		void SWFlatMapRenderer::GenerateRows(int minY, int maxY) {
+			auto *outPixels = img->GetRawBitmap();
+			const int wordsPerRow = w >> 5;
+			for(int y = minY; y <= maxY; y++) {
+				const uint32_t *upd = updateMap2.data() + y * wordsPerRow;
+				auto *out = outPixels + y * w;
+				for(int wx = 0; wx < wordsPerRow; wx++) {
+					uint32_t bits = upd[wx];
+					for(int x = wx << 5; bits; x++, bits >>= 1) {
+						if(bits & 1)
+							out[x] = GeneratePixel(x, y);
+					}
 				}
 			}
-			return 0; // shouldn't reach here for valid maps
+		}
+		
+		uint32_t SWFlatMapRenderer::GeneratePixel(int x, int y) {
+			int z = map->GetTopmostSolid(x, y);
+			if(z >= map->Depth())
+				return 0; // shouldn't reach here for valid maps
+			
+			uint32_t col = map->GetColor(x, y, z);
+			col = (col & 0xff00) |
+			((col & 0xff) << 16) |
+			((col & 0xff0000) >> 16);
+			col |= 0xff000000;
+			return col;
 		}
 		
 		void SWFlatMapRenderer::SetNeedsUpdate(int x, int y) {
 			std::lock_guard<std::mutex> lock(updateInfoLock);
 			needsUpdate = true;
 			updateMap[(x + y * w) >> 5] |= 1 << (x & 31);
+			dirtyMinY = std::min(dirtyMinY, y);
+			dirtyMaxY = std::max(dirtyMaxY, y);
 		}
 	}
 }
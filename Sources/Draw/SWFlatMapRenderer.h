@@ -40,9 +40,12 @@ namespace spades {
 			std::mutex updateInfoLock;
 			std::vector<uint32_t> updateMap;
 			std::vector<uint32_t> updateMap2;
+			/** range of rows that have any bit set in updateMap. */
+			int dirtyMinY, dirtyMaxY;
 			bool volatile needsUpdate;
 			
 			uint32_t GeneratePixel(int x, int y);
+			void GenerateRows(int minY, int maxY);
 		public:
 			SWFlatMapRenderer(SWRenderer *r, client::GameMap *);
 			~SWFlatMapRenderer();
@@ -96,6 +96,13 @@ namespace spades {
 			}
 		}
 		
+		void SWImageManager::RegisterPreloadedImage(const std::string &name,
+													Bitmap *bmp) {
+			if(images.find(name) != images.end())
+				return;
+			images.insert(std::make_pair(name, CreateImage(bmp)));
+		}
+		
 		SWImage *SWImageManager::CreateImage(Bitmap *vm) {
 			return new SWImage(vm);
 		}
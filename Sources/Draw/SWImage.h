@@ -63,6 +63,7 @@ namespace spades {
 			~SWImageManager();
 			
 			SWImage *RegisterImage(const std::string&);
+			void RegisterPreloadedImage(const std::string&, Bitmap *);
 			SWImage *CreateImage(Bitmap *);
 		};
 	}
@@ -21,12 +21,19 @@
 #include "SWImageRenderer.h"
 #include <Core/Bitmap.h>
 #include "SWImage.h"
+#include "SWUtils.h"
+#include <atomic>
 
 namespace spades {
 	namespace draw {
 		SWImageRenderer::SWImageRenderer(SWFeatureLevel lvl):
+		depthBuffer(nullptr),
 		shader(ShaderType::Image),
-		featureLevel(lvl){
+		featureLevel(lvl),
+		pixelsDrawn(0),
+		trianglesDrawn(0),
+		clipMinX(0), clipMinY(0),
+		clipMaxX(0), clipMaxY(0){
 			
 		}
 		
@@ -35,6 +42,9 @@ namespace spades {
 		}
 		
 		void SWImageRenderer::SetFramebuffer(spades::Bitmap *bmp) {
+			// queued polygons belong to the old framebuffer
+			if(frame) Flush();
+			
 			this->frame = bmp;
 			if(bmp) {
 				fbSize4 = MakeVector4(static_cast<float>(bmp->GetWidth()) * .5f,
@@ -43,10 +53,14 @@ namespace spades {
 				fbCenter4 = MakeVector4(static_cast<float>(bmp->GetWidth()) * .5f,
 										static_cast<float>(bmp->GetHeight()) * .5f,
 										0.f, 0.f);
+				clipMinX = 0; clipMinY = 0;
+				clipMaxX = bmp->GetWidth();
+				clipMaxY = bmp->GetHeight();
 			}
 		}
 		
 		void SWImageRenderer::SetDepthBuffer(float *f) {
+			if(frame) Flush();
 			depthBuffer = f;
 		}
 		
@@ -421,8 +435,9 @@ namespace spades {
 					SPAssert(x1 < x2);
 					int width = x2 - x1;
 					SWImageGouraudInterpolator<level> vary(vary1, vary2, width);
-					int minX = std::max(x1, 0);
-					int maxX = std::min(x2, fbW);
+					int minX = std::max(x1, r.clipMinX);
+					int maxX = std::min(x2, r.clipMaxX);
+					if(minX >= maxX) return;
 					vary.MoveNext(minX - x1);
 					out += minX;
 					if(depthTest) {
@@ -451,15 +466,19 @@ namespace spades {
 				
 				Interpolator longSpanX(x1, x3, y3 - y1);
 				SWImageGouraudInterpolator<level> longSpan(v1, v3, y3 - y1);
+				// the long span is shared by both halves, so its row is tracked
+				// separately in case the first half is clipped
+				int longSpanY = y1;
 				{
 					Interpolator shortSpanX(x1, x2, y2 - y1);
 					SWImageGouraudInterpolator<level> shortSpan(v1, v2, y2 - y1);
-					int minY = std::max(0, y1);
-					int maxY = std::min(fbH, y2);
+					int minY = std::max(r.clipMinY, y1);
+					int maxY = std::min(r.clipMaxY, y2);
 					shortSpanX.MoveNext(minY - y1);
 					shortSpan.MoveNext(minY - y1);
-					longSpanX.MoveNext(minY - y1);
-					longSpan.MoveNext(minY - y1);
+					longSpanX.MoveNext(minY - longSpanY);
+					longSpan.MoveNext(minY - longSpanY);
+					longSpanY = std::max(minY, maxY);
 					for(int y = minY; y < maxY; y++) {
 						int lineX1 = shortSpanX.GetCurrent();
 						auto line1 = shortSpan.GetCurrent();
@@ -482,12 +501,13 @@ namespace spades {
 				{
 					Interpolator shortSpanX(x2, x3, y3 - y2);
 					SWImageGouraudInterpolator<level> shortSpan(v2, v3, y3 - y2);
-					int minY = std::max(0, y2);
-					int maxY = std::min(fbH, y3);
+					int minY = std::max(r.clipMinY, y2);
+					int maxY = std::min(r.clipMaxY, y3);
 					shortSpanX.MoveNext(minY - y2);
 					shortSpan.MoveNext(minY - y2);
-					longSpanX.MoveNext(minY - y2);
-					longSpan.MoveNext(minY - y2);
+					longSpanX.MoveNext(minY - longSpanY);
+					longSpan.MoveNext(minY - longSpanY);
+					longSpanY = std::max(minY, maxY);
 					for(int y = minY; y < maxY; y++) {
 						int lineX1 = shortSpanX.GetCurrent();
 						auto line1 = shortSpan.GetCurrent();
@@ -781,8 +801,9 @@ namespace spades {
 					SPAssert(x1 < x2);
 					int width = x2 - x1;
 					SWImageGouraudInterpolator<SWFeatureLevel::SSE2> vary(vary1, vary2, width);
-					int minX = std::max(x1, 0);
-					int maxX = std::min(x2, fbW);
+					int minX = std::max(x1, r.clipMinX);
+					int maxX = std::min(x2, r.clipMaxX);
+					if(minX >= maxX) return;
 					r.pixelsDrawn += maxX - minX;
 					vary.MoveNext(minX - x1);
 					out += minX;
@@ -865,15 +886,19 @@ namespace spades {
 				
 				Interpolator longSpanX(x1, x3, y3 - y1);
 				SWImageGouraudInterpolator<SWFeatureLevel::SSE2> longSpan(v1, v3, y3 - y1);
+				// the long span is shared by both halves, so its row is tracked
+				// separately in case the first half is clipped
+				int longSpanY = y1;
 				{
 					Interpolator shortSpanX(x1, x2, y2 - y1);
 					SWImageGouraudInterpolator<SWFeatureLevel::SSE2> shortSpan(v1, v2, y2 - y1);
-					int minY = std::max(0, y1);
-					int maxY = std::min(fbH, y2);
+					int minY = std::max(r.clipMinY, y1);
+					int maxY = std::min(r.clipMaxY, y2);
 					shortSpanX.MoveNext(minY - y1);
 					shortSpan.MoveNext(minY - y1);
-					longSpanX.MoveNext(minY - y1);
-					longSpan.MoveNext(minY - y1);
+					longSpanX.MoveNext(minY - longSpanY);
+					longSpan.MoveNext(minY - longSpanY);
+					longSpanY = std::max(minY, maxY);
 					for(int y = minY; y < maxY; y++) {
 						int lineX1 = shortSpanX.GetCurrent();
 						auto line1 = shortSpan.GetCurrent();
@@ -896,12 +921,13 @@ namespace spades {
 				{
 					Interpolator shortSpanX(x2, x3, y3 - y2);
 					SWImageGouraudInterpolator<SWFeatureLevel::SSE2> shortSpan(v2, v3, y3 - y2);
-					int minY = std::max(0, y2);
-					int maxY = std::min(fbH, y3);
+					int minY = std::max(r.clipMinY, y2);
+					int maxY = std::min(r.clipMaxY, y3);
 					shortSpanX.MoveNext(minY - y2);
 					shortSpan.MoveNext(minY - y2);
-					longSpanX.MoveNext(minY - y2);
-					longSpan.MoveNext(minY - y2);
+					longSpanX.MoveNext(minY - longSpanY);
+					longSpan.MoveNext(minY - longSpanY);
+					longSpanY = std::max(minY, maxY);
 					for(int y = minY; y < maxY; y++) {
 						int lineX1 = shortSpanX.GetCurrent();
 						auto line1 = shortSpan.GetCurrent();
@@ -1103,8 +1129,9 @@ namespace spades {
 					}
 					SPAssert(x1 < x2);
 					//int width = x2 - x1;
-					int minX = std::max(x1, 0);
-					int maxX = std::min(x2, fbW);
+					int minX = std::max(x1, r.clipMinX);
+					int maxX = std::min(x2, r.clipMaxX);
+					if(minX >= maxX) return;
 					r.pixelsDrawn += maxX - minX;
 					out += minX;
 					if(depthTest) {
@@ -1146,15 +1173,19 @@ namespace spades {
 				
 				Interpolator longSpanX(x1, x3, y3 - y1);
 				SWImageGouraudInterpolator<SWFeatureLevel::SSE2> longSpan(v1, v3, y3 - y1);
+				// the long span is shared by both halves, so its row is tracked
+				// separately in case the first half is clipped
+				int longSpanY = y1;
 				{
 					Interpolator shortSpanX(x1, x2, y2 - y1);
 					SWImageGouraudInterpolator<SWFeatureLevel::SSE2> shortSpan(v1, v2, y2 - y1);
-					int minY = std::max(0, y1);
-					int maxY = std::min(fbH, y2);
+					int minY = std::max(r.clipMinY, y1);
+					int maxY = std::min(r.clipMaxY, y2);
 					shortSpanX.MoveNext(minY - y1);
 					shortSpan.MoveNext(minY - y1);
-					longSpanX.MoveNext(minY - y1);
-					longSpan.MoveNext(minY - y1);
+					longSpanX.MoveNext(minY - longSpanY);
+					longSpan.MoveNext(minY - longSpanY);
+					longSpanY = std::max(minY, maxY);
 					for(int y = minY; y < maxY; y++) {
 						int lineX1 = shortSpanX.GetCurrent();
 						auto line1 = shortSpan.GetCurrent();
@@ -1177,12 +1208,13 @@ namespace spades {
 				{
 					Interpolator shortSpanX(x2, x3, y3 - y2);
 					SWImageGouraudInterpolator<SWFeatureLevel::SSE2> shortSpan(v2, v3, y3 - y2);
-					int minY = std::max(0, y2);
-					int maxY = std::min(fbH, y3);
+					int minY = std::max(r.clipMinY, y2);
+					int maxY = std::min(r.clipMaxY, y3);
 					shortSpanX.MoveNext(minY - y2);
 					shortSpan.MoveNext(minY - y2);
-					longSpanX.MoveNext(minY - y2);
-					longSpan.MoveNext(minY - y2);
+					longSpanX.MoveNext(minY - longSpanY);
+					longSpan.MoveNext(minY - longSpanY);
+					longSpanY = std::max(minY, maxY);
 					for(int y = minY; y < maxY; y++) {
 						int lineX1 = shortSpanX.GetCurrent();
 						auto line1 = shortSpan.GetCurrent();
@@ -1232,6 +1264,26 @@ namespace spades {
 		
 #pragma mark - Intermediates
 		
+		template<
+		SWFeatureLevel featureLvl,
+		bool depthTest,
+		bool solidFill
+		>
+		void SWImageRenderer::EmitPolygon(SWImage *img,
+										  const Vertex& v1,
+										  const Vertex& v2,
+										  const Vertex& v3,
+										  SWImageRenderer& r) {
+			// screen-space polygon is ready. rasterized by Flush.
+			r.triangles.emplace_back();
+			auto& t = r.triangles.back();
+			t.img = img;
+			t.v1 = v1;
+			t.v2 = v2;
+			t.v3 = v3;
+			t.rasterize = &PolygonRenderer<featureLvl, false, false, depthTest, solidFill>::DrawPolygonInternal;
+		}
+		
 		template<
 		SWFeatureLevel featureLvl,
 		bool depthTest,
@@ -1249,8 +1301,7 @@ namespace spades {
 				vv1.position = (vv1.position * r.fbSize4) + r.fbCenter4;
 				vv2.position = (vv2.position * r.fbSize4) + r.fbCenter4;
 				vv3.position = (vv3.position * r.fbSize4) + r.fbCenter4;
-				PolygonRenderer<featureLvl, false, false, depthTest, solidFill>::DrawPolygonInternal(img,
-																   vv1, vv2, vv3, r);
+				EmitPolygon<featureLvl, depthTest, solidFill>(img, vv1, vv2, vv3, r);
 			}
 		};
 		
@@ -1430,6 +1481,15 @@ namespace spades {
 											const Vertex& v2,
 											const Vertex& v3,
 											SWImageRenderer& r) {
+				if(!needTransform && !ndc) {
+					// already in screen space
+					if(img == nullptr || img->IsWhiteImage()) {
+						EmitPolygon<level, depthTest, true>(img, v1, v2, v3, r);
+					}else{
+						EmitPolygon<level, depthTest, false>(img, v1, v2, v3, r);
+					}
+					return;
+				}
 				if(img == nullptr || img->IsWhiteImage()) {
 					PolygonRenderer<level, needTransform, ndc, depthTest, true>::DrawPolygonInternal(img,
 																									  v1, v2, v3, r);
@@ -1488,6 +1548,89 @@ namespace spades {
 					break;
 			}
 		}
+		
+		void SWImageRenderer::Flush() {
+			SPADES_MARK_FUNCTION();
+			
+			if(triangles.empty())
+				return;
+			SPAssert(frame != nullptr);
+			
+			trianglesDrawn += triangles.size();
+			
+			int numThreads = r_swNumThreads;
+			if(numThreads <= 1 || triangles.size() < MinTrianglesForBinning) {
+				for(auto& t: triangles) {
+					t.rasterize(t.img, t.v1, t.v2, t.v3, *this);
+				}
+				triangles.clear();
+				return;
+			}
+			
+			// bin the triangles
+			const int fbW = frame->GetWidth();
+			const int fbH = frame->GetHeight();
+			const int tilesX = (fbW + TileSize - 1) / TileSize;
+			const int tilesY = (fbH + TileSize - 1) / TileSize;
+			const int numTiles = tilesX * tilesY;
+			tileTriangles.resize(numTiles);
+			for(auto& tile: tileTriangles)
+				tile.clear();
+			
+			for(std::size_t i = 0; i < triangles.size(); i++) {
+				const auto& t = triangles[i];
+				// same rounding as the rasterizer
+				int x1 = static_cast<int>(t.v1.position.x);
+				int y1 = static_cast<int>(t.v1.position.y);
+				int x2 = static_cast<int>(t.v2.position.x);
+				int y2 = static_cast<int>(t.v2.position.y);
+				int x3 = static_cast<int>(t.v3.position.x);
+				int y3 = static_cast<int>(t.v3.position.y);
+				int minX = std::max(std::min(std::min(x1, x2), x3), 0);
+				int minY = std::max(std::min(std::min(y1, y2), y3), 0);
+				int maxX = std::min(std::max(std::max(x1, x2), x3), fbW - 1);
+				int maxY = std::min(std::max(std::max(y1, y2), y3), fbH - 1);
+				if(minX > maxX || minY > maxY)
+					continue;
+				
+				for(int ty = minY / TileSize; ty <= maxY / TileSize; ty++)
+					for(int tx = minX / TileSize; tx <= maxX / TileSize; tx++)
+						tileTriangles[tx + ty * tilesX].push_back(static_cast<uint32_t>(i));
+			}
+			
+			// tiles don't overlap, so each tile can be drawn
+			// without synchronization
+			std::atomic<int> nextTile(0);
+			std::atomic<unsigned long long> pixels(0);
+			InvokeParallel2([&](unsigned int, unsigned int) {
+				SWImageRenderer r(featureLevel);
+				r.SetFramebuffer(frame);
+				r.SetDepthBuffer(depthBuffer);
+				
+				int tile;
+				while((tile = nextTile.fetch_add(1)) < numTiles) {
+					const auto& list = tileTriangles[tile];
+					if(list.empty())
+						continue;
+					
+					int tx = tile % tilesX, ty = tile / tilesX;
+					r.clipMinX = tx * TileSize;
+					r.clipMinY = ty * TileSize;
+					r.clipMaxX = std::min(r.clipMinX + TileSize, fbW);
+					r.clipMaxY = std::min(r.clipMinY + TileSize, fbH);
+					
+					for(auto index: list) {
+						auto& t = triangles[index];
+						t.rasterize(t.img, t.v1, t.v2, t.v3, r);
+					}
+				}
+				
+				pixels.fetch_add(r.pixelsDrawn);
+			});
+			pixelsDrawn += pixels;
+			
+			triangles.clear();
+		}
 	}
 }
 
@@ -23,6 +23,8 @@
 #include <Core/Math.h>
 #include <Core/RefCountedObject.h>
 #include "SWFeatureLevel.h"
+#include <vector>
+#include <stdint.h>
 
 namespace spades {
 	class Bitmap;
@@ -41,6 +43,25 @@ namespace spades {
 				Sprite
 			};
 		private:
+			enum {
+				TileSize = 64,
+				/** smaller batches are drawn by the calling thread. */
+				MinTrianglesForBinning = 16
+			};
+			
+			typedef void (*RasterizeFunc)(SWImage *,
+										  const Vertex&,
+										  const Vertex&,
+										  const Vertex&,
+										  SWImageRenderer&);
+			
+			/** screen-space triangle waiting for Flush. */
+			struct Triangle {
+				Handle<SWImage> img;
+				Vertex v1, v2, v3;
+				RasterizeFunc rasterize;
+			};
+			
 			Handle<Bitmap> frame;
 			float *depthBuffer;
 			ShaderType shader;
@@ -50,6 +71,14 @@ namespace spades {
 			Matrix4 matrix;
 			SWFeatureLevel featureLevel;
 			unsigned long long pixelsDrawn;
+			unsigned long long trianglesDrawn;
+			
+			/** rasterization is limited to this rectangle. */
+			int clipMinX, clipMinY, clipMaxX, clipMaxY;
+			
+			std::vector<Triangle> triangles;
+			/** indices of the triangles that overlap each tile. */
+			std::vector<std::vector<uint32_t>> tileTriangles;
 			
 			template<SWFeatureLevel, bool, bool, bool, bool>
 			struct PolygonRenderer;
@@ -60,6 +89,12 @@ namespace spades {
 			template<bool, bool, bool>
 			struct PolygonRenderer2;
 			
+			template<SWFeatureLevel, bool, bool>
+			static void EmitPolygon(SWImage *,
+									const Vertex&,
+									const Vertex&,
+									const Vertex&,
+									SWImageRenderer&);
 			
 		public:
 			SWImageRenderer(SWFeatureLevel);
@@ -72,13 +107,21 @@ namespace spades {
 			
 			void SetShaderType(ShaderType);
 			
+			/** queues a polygon. polygons are rasterized by Flush. */
 			void DrawPolygon(SWImage *img,
 							 const Vertex& v1,
 							 const Vertex& v2,
 							 const Vertex& v3);
 			
+			/** rasterizes the queued polygons. the screen is divided into
+			 * tiles which are drawn in parallel, and polygons in each tile
+			 * are drawn in the order they were queued. must be called
+			 * before the framebuffer is accessed by anything else. */
+			void Flush();
+			
 			unsigned long long GetPixelsDrawn() { return pixelsDrawn; }
-			void ResetPixelStatistics() { pixelsDrawn = 0; }
+			unsigned long long GetTrianglesDrawn() { return trianglesDrawn; }
+			void ResetPixelStatistics() { pixelsDrawn = 0; trianglesDrawn = 0; }
 		};
 	}
 }
@@ -27,14 +27,20 @@
 #include <Core/MiniHeap.h>
 #include <Core/Settings.h>
 #include <Core/ConcurrentDispatch.h>
+#include <Core/FrameProfiler.h>
 #include <Core/Stopwatch.h>
 #include "SWUtils.h"
 
-SPADES_SETTING(r_swUndersampling, "0");
-
 namespace spades {
 	namespace draw {
 		
+		enum {
+			/** invalidated columns are rebuilt in parallel if there are
+			 * at least this many. */
+			MinParallelRleColumns = 256,
+			/** the RLE heap is compacted when it has more free regions. */
+			MaxRleFreeRegions = 1024
+		};
 		
 		
 		// special tan function whose value is finite.
@@ -122,29 +128,41 @@ namespace spades {
 		rleHeap(m->Width() * m->Height() * 64),
 		level(level),
 		w(m->Width()), h(m->Height()),
-		renderer(r){
+		renderer(r),
+		rleBytes(0),
+		rleGeneration(0),
+		numRleColumnsUpdated(0),
+		numRleCompactions(0){
 			rle.resize(w * h);
 			rleLen.resize(w * h);
+			dirtyRleMap.resize((w * h + 31) / 32);
 			
 			Stopwatch sw;
 			sw.Reset();
 			SPLog("Building RLE map...");
 			
-			int idx = 0;
-			for(int y = 0; y < h; y++)
-				for(int x = 0; x < w; x++) {
-					BuildRle(x, y, rleBuf);
-					
-					auto ref = rleHeap.Alloc(rleBuf.size() * sizeof(RleData));
-					short *ptr = rleHeap.Dereference<short>(ref);
-					std::memcpy(ptr, rleBuf.data(), rleBuf.size() * sizeof(RleData));
-					
-					rle[idx] = ref;
-					rleLen[idx] = rleBuf.size() * sizeof(RleData);
-					
-					idx++;
+			std::vector<int> columns(w * h);
+			for(int i = 0; i < w * h; i++)
+				columns[i] = i;
+			BuildRleChunks(columns);
+			
+			// each chunk is copied to the heap at once
+			for(auto& chunk: rleChunks) {
+				if(chunk.data.empty())
+					continue;
+				auto ref = rleHeap.Alloc(chunk.data.size() * sizeof(RleData));
+				RleData *ptr = rleHeap.Dereference<RleData>(ref);
+				std::memcpy(ptr, chunk.data.data(), chunk.data.size() * sizeof(RleData));
+				
+				for(size_t i = 0; i + 1 < chunk.offsets.size(); i++) {
+					int idx = columns[chunk.first + i];
+					rle[idx] = ref + chunk.offsets[i] * sizeof(RleData);
+					rleLen[idx] = (chunk.offsets[i + 1] - chunk.offsets[i]) * sizeof(RleData);
 				}
-			SPLog("RLE map created in %.6f seconds", sw.GetTime());
+				rleBytes += chunk.data.size() * sizeof(RleData);
+			}
+			SPLog("RLE map created in %.6f seconds (%d bytes)",
+				  sw.GetTime(), static_cast<int>(rleBytes));
 		}
 		
 		SWMapRenderer::~SWMapRenderer() {
@@ -217,11 +235,39 @@ namespace spades {
 			}
 		}
 		
+		void SWMapRenderer::BuildRleChunks(const std::vector<int> &columns) {
+			SPADES_MARK_FUNCTION();
+			
+			// InvokeParallel2 uses up to 32 threads
+			rleChunks.resize(32);
+			for(auto& chunk: rleChunks) {
+				chunk.data.clear();
+				chunk.offsets.clear();
+			}
+			
+			InvokeParallel2([&](unsigned int th, unsigned int numThreads) {
+				size_t start = columns.size() * th / numThreads;
+				size_t end = columns.size() * (th + 1) / numThreads;
+				auto& chunk = rleChunks[th];
+				chunk.first = start;
+				
+				std::vector<RleData> buf;
+				for(size_t i = start; i < end; i++) {
+					int idx = columns[i];
+					BuildRle(idx % w, idx / w, buf);
+					chunk.offsets.push_back(chunk.data.size());
+					chunk.data.insert(chunk.data.end(), buf.begin(), buf.end());
+				}
+				chunk.offsets.push_back(chunk.data.size());
+			});
+		}
+		
 		void SWMapRenderer::UpdateRle(int x, int y) {
 			int idx = x + y * w;
 			BuildRle(x, y, rleBuf);
 			
 			rleHeap.Free(rle[idx], rleLen[idx]);
+			rleBytes -= rleLen[idx];
 			
 			auto ref = rleHeap.Alloc(rleBuf.size() * sizeof(RleData));
 			short *ptr = rleHeap.Dereference<short>(ref);
@@ -229,6 +275,111 @@ namespace spades {
 			
 			rle[idx] = ref;
 			rleLen[idx] = rleBuf.size() * sizeof(RleData);
+			rleBytes += rleLen[idx];
+			numRleColumnsUpdated++;
+			rleGeneration++;
+		}
+		
+		void SWMapRenderer::InvalidateRle(int x, int y) {
+			int idx = x + y * w;
+			uint32_t bit = 1U << (idx & 31);
+			if(dirtyRleMap[idx >> 5] & bit)
+				return;
+			dirtyRleMap[idx >> 5] |= bit;
+			dirtyRleColumns.push_back(idx);
+		}
+		
+		void SWMapRenderer::FlushRleUpdates() {
+			SPADES_MARK_FUNCTION();
+			
+			if(dirtyRleColumns.empty())
+				return;
+			
+			if(dirtyRleColumns.size() < MinParallelRleColumns) {
+				for(int idx: dirtyRleColumns) {
+					UpdateRle(idx % w, idx / w);
+				}
+			}else{
+				BuildRleChunks(dirtyRleColumns);
+				
+				// heap isn't thread-safe
+				for(auto& chunk: rleChunks) {
+					for(size_t i = 0; i + 1 < chunk.offsets.size(); i++) {
+						int idx = dirtyRleColumns[chunk.first + i];
+						size_t len = (chunk.offsets[i + 1] - chunk.offsets[i]) * sizeof(RleData);
+						
+						rleHeap.Free(rle[idx], rleLen[idx]);
+						rleBytes -= rleLen[idx];
+						
+						auto ref = rleHeap.Alloc(len);
+						RleData *ptr = rleHeap.Dereference<RleData>(ref);
+						std::memcpy(ptr, chunk.data.data() + chunk.offsets[i], len);
+						
+						rle[idx] = ref;
+						rleLen[idx] = len;
+						rleBytes += len;
+					}
+				}
+				numRleColumnsUpdated += dirtyRleColumns.size();
+				rleGeneration++;
+			}
+			
+			for(int idx: dirtyRleColumns) {
+				dirtyRleMap[idx >> 5] &= ~(1U << (idx & 31));
+			}
+			dirtyRleColumns.clear();
+			
+			// MiniHeap::Free is linear in the number of free regions,
+			// so the heap is compacted before it gets too fragmented
+			auto stats = rleHeap.GetStatistics();
+			size_t fragmented = stats.freeBytes - stats.largestFreeRegion;
+			if(stats.numFreeRegions > MaxRleFreeRegions ||
+			   fragmented > stats.size / 4) {
+				CompactRle();
+			}
+		}
+		
+		void SWMapRenderer::CompactRle() {
+			SPADES_MARK_FUNCTION();
+			
+			Stopwatch sw;
+			auto oldStats = rleHeap.GetStatistics();
+			
+			// keep some space for the future updates
+			MiniHeap newHeap(std::max(oldStats.size, rleBytes + rleBytes / 4));
+			
+			// columns are stored in the order they are accessed
+			// to improve the locality
+			auto ref = newHeap.Alloc(rleBytes);
+			auto *src = rleHeap.Dereference<RleData>(0);
+			auto *dest = newHeap.Dereference<RleData>(ref);
+			for(size_t i = 0; i < rle.size(); i++) {
+				std::memcpy(dest, src + rle[i], rleLen[i]);
+				rle[i] = ref;
+				ref += rleLen[i];
+				dest += rleLen[i];
+			}
+			
+			rleHeap = std::move(newHeap);
+			numRleCompactions++;
+			
+			SPLog("RLE heap compacted in %.3fms (%d free regions, %d bytes were fragmented)",
+				  sw.GetTime() * 1000.,
+				  static_cast<int>(oldStats.numFreeRegions),
+				  static_cast<int>(oldStats.freeBytes - oldStats.largestFreeRegion));
+		}
+		
+		SWMapRenderer::RleStatistics SWMapRenderer::GetRleStatistics() {
+			RleStatistics stats;
+			stats.heap = rleHeap.GetStatistics();
+			stats.rleBytes = rleBytes;
+			stats.numColumnsUpdated = numRleColumnsUpdated;
+			stats.numCompactions = numRleCompactions;
+			return stats;
+		}
+		
+		void SWMapRenderer::ResetRleStatistics() {
+			numRleColumnsUpdated = 0;
 		}
 		
 		
@@ -1072,7 +1223,8 @@ namespace spades {
 		
 		template<SWFeatureLevel flevel>
 		void SWMapRenderer::RenderInner(const client::SceneDefinition &def,
-								   Bitmap *frame, float *depthBuffer) {
+								   Bitmap *frame, float *depthBuffer,
+								   int under) {
 			
 			sceneDef = def;
 			frameBuf = frame;
@@ -1130,8 +1282,6 @@ namespace spades {
 				
 				numLines = static_cast<size_t>((yawMax - yawMin) / interval);
 				
-				int under = r_swUndersampling;
-				under = std::max(std::min(under, 4), 1);
 				numLines /= under;
 				
 				if(numLines < 8) numLines = 8;
@@ -1166,6 +1316,7 @@ namespace spades {
 			{
 				unsigned int nlines = static_cast<unsigned int>(numLines);
 				InvokeParallel2([&](unsigned int th, unsigned int numThreads) {
+					SPADES_PROFILE_ZONE("SWMapRenderer::BuildLine");
 					unsigned int start = th * nlines / numThreads;
 					unsigned int end = (th+1) * nlines / numThreads;
 					
@@ -1175,9 +1326,8 @@ namespace spades {
 				});
 			}
 			
-			int under = r_swUndersampling;
-			
 			InvokeParallel2([&](unsigned int th, unsigned int numThreads) {
+				SPADES_PROFILE_ZONE("SWMapRenderer::RenderFinal");
 				
 				if(under <= 1){
 					RenderFinal<flevel, 1>(yawMin, yawMax,
@@ -1200,25 +1350,30 @@ namespace spades {
 			depthBuf = nullptr;
 		}
 		
-		void SWMapRenderer::Render(const client::SceneDefinition &def,
-								   Bitmap *frame, float *depthBuffer) {
+		bool SWMapRenderer::Render(const client::SceneDefinition &def,
+								   Bitmap *frame, float *depthBuffer,
+								   int undersampling) {
 			if(!frame) SPInvalidArgument("frame");
 			if(!depthBuffer) SPInvalidArgument("depthBuffer");
 			
+			// RenderFinal supports 1, 2 and 4
+			undersampling = undersampling <= 1 ? 1 : undersampling <= 2 ? 2 : 4;
+			
 			auto p = def.viewOrigin.Floor();
 			if(map->IsSolidWrapped(p.x, p.y, p.z)) {
-				return;
+				return false;
 			}
 			
 #if ENABLE_SSE2
 			if(static_cast<int>(level) >= static_cast<int>(SWFeatureLevel::SSE2)) {
-				RenderInner<SWFeatureLevel::SSE2>(def, frame, depthBuffer);
-				return;
-			}
+				RenderInner<SWFeatureLevel::SSE2>(def, frame, depthBuffer, undersampling);
+			}else
 #endif
+			RenderInner<SWFeatureLevel::None>(def, frame, depthBuffer, undersampling);
 			
-			RenderInner<SWFeatureLevel::None>(def, frame, depthBuffer);
-			
+			// RenderFinal draws 8x8 blocks
+			return (frame->GetWidth() & 7) == 0 &&
+			(frame->GetHeight() & 7) == 0;
 		}
 	}
 }
@@ -39,9 +39,32 @@ namespace spades {
 	namespace draw {
 		class SWRenderer;
 		class SWMapRenderer {
+		public:
+			struct RleStatistics {
+				MiniHeap::Statistics heap;
+				/** bytes used by the RLE data. */
+				size_t rleBytes;
+				/** number of columns rebuilt since the last call to
+				 * ResetRleStatistics. */
+				size_t numColumnsUpdated;
+				size_t numCompactions;
+			};
+			
+		private:
 			struct Line;
 			struct LinePixel;
 			
+			typedef int8_t RleData;
+			
+			/** RLE data built by one thread. */
+			struct RleChunk {
+				/** index of the first column in the list being built. */
+				size_t first;
+				std::vector<RleData> data;
+				/** start of each column in `data`, and the end of the last one. */
+				std::vector<size_t> offsets;
+			};
+			
 			int w, h;
 			SWRenderer *renderer;
 			
@@ -56,15 +79,30 @@ namespace spades {
 			
 			int lineResolution;
 			
-			typedef int8_t RleData;
 			std::vector<RleData> rleBuf;
 			
 			MiniHeap rleHeap;
+			size_t rleBytes;
+			/** incremented every time RLE is modified. */
+			uint64_t rleGeneration;
+			
+			/** columns whose RLE has to be rebuilt. */
+			std::vector<int> dirtyRleColumns;
+			/** one bit for each column, set if it's in dirtyRleColumns. */
+			std::vector<uint32_t> dirtyRleMap;
+			std::vector<RleChunk> rleChunks;
+			
+			size_t numRleColumnsUpdated;
+			size_t numRleCompactions;
 			
 			template<SWFeatureLevel level>
 			void BuildLine(Line& line,
 						   float minPitch, float maxPitch);
 			void BuildRle(int x, int y, std::vector<RleData>&);
+			/** builds RLE of the columns in parallel into rleChunks. */
+			void BuildRleChunks(const std::vector<int>& columns);
+			/** rebuilds the heap with the columns packed in order. */
+			void CompactRle();
 			
 			template<SWFeatureLevel level, int undersamp>
 			void RenderFinal(float yawMin, float yawMax,
@@ -73,17 +111,36 @@ namespace spades {
 			
 			template<SWFeatureLevel level>
 			void RenderInner(const client::SceneDefinition&,
-						Bitmap *fb, float *depthBuffer);
+						Bitmap *fb, float *depthBuffer,
+						int undersampling);
 		public:
 			SWMapRenderer(SWRenderer *r,
 						  client::GameMap *,
 						  SWFeatureLevel level);
 			~SWMapRenderer();
 			
-			void Render(const client::SceneDefinition&,
-						Bitmap *fb, float *depthBuffer);
+			/** @param undersampling horizontal undersampling factor
+			 *        (1, 2, or 4).
+			 * @return true if every pixel of the color and depth buffer
+			 * was written. */
+			bool Render(const client::SceneDefinition&,
+						Bitmap *fb, float *depthBuffer,
+						int undersampling);
 			
+			/** rebuilds RLE of the column immediately. */
 			void UpdateRle(int x, int y);
+			/** schedules the rebuild of the column's RLE.
+			 * it's done by FlushRleUpdates. */
+			void InvalidateRle(int x, int y);
+			/** rebuilds all columns invalidated since the last call. */
+			void FlushRleUpdates();
+			
+			/** the rendered image doesn't change unless this value
+			 * or the scene definition changes. */
+			uint64_t GetRleGeneration() const { return rleGeneration; }
+			
+			RleStatistics GetRleStatistics();
+			void ResetRleStatistics();
 		};
 	}
 }
@@ -118,6 +118,13 @@ namespace spades {
 			}
 		}
 		
+		void SWModelManager::RegisterPreloadedModel(const std::string &name,
+													VoxelModel *vm) {
+			if(models.find(name) != models.end())
+				return;
+			models.insert(std::make_pair(name, CreateModel(vm)));
+		}
+		
 		SWModel *SWModelManager::CreateModel(spades::VoxelModel *vm) {
 			return new SWModel(vm);
 		}
@@ -57,6 +57,7 @@ namespace spades {
 			~SWModelManager();
 			
 			SWModel *RegisterModel(const std::string&);
+			void RegisterPreloadedModel(const std::string&, VoxelModel *);
 			SWModel *CreateModel(VoxelModel *);
 		};
 	}
@@ -25,11 +25,12 @@
 #include "SWRenderer.h"
 #include <Core/Math.h>
 #include <Core/Debug.h>
+#include <atomic>
 
 namespace spades {
 	namespace draw {
 		SWModelRenderer::SWModelRenderer(SWRenderer *r, SWFeatureLevel level):
-		r(r), level(level){
+		r(r), level(level), queueLength(0){
 			
 		}
 		
@@ -50,8 +51,9 @@ namespace spades {
 		static ZVals zvals;
 		
 		template<SWFeatureLevel lvl>
-		void SWModelRenderer::RenderInner(spades::draw::SWModel *model,
-									 const client::ModelRenderParam &param) {
+		void SWModelRenderer::ProjectInner(spades::draw::SWModel *model,
+										   const client::ModelRenderParam &param,
+										   std::vector<Splat>& splats) {
 			auto& mat = param.matrix;
 			auto origin = mat.GetOrigin();
 			auto axis1 = mat.GetAxis(0);
@@ -133,10 +135,8 @@ namespace spades {
 			}
 			
 			Bitmap *fbmp = r->fb;
-			auto *fb = fbmp->GetPixels();
 			int fw = fbmp->GetWidth();
 			int fh = fbmp->GetHeight();
-			auto *db = r->depthBuffer.data();
 			
 			Matrix4 viewproj = r->GetProjectionViewMatrix();
 			Vector4 ndc2scrscale = {fw * 0.5f, -fh * 0.5f, 1.f, 1.f};
@@ -212,10 +212,6 @@ namespace spades {
 						maxX = std::min(maxX, fw);
 						maxY = std::min(maxY, fh);
 						
-						auto *fb2 = fb + (minX + minY * fw);
-						auto *db2 = db + (minX + minY * fw);
-						int w = maxX - minX;
-						
 						uint32_t color = data & 0xffffff;
 						if(color == 0)
 							color = customColor;
@@ -243,23 +239,14 @@ namespace spades {
 							color = ((c1&0xff0000) | (c2&0xff00ff00)) >> 8;
 						}
 						
-						for(int yy = minY; yy < maxY; yy++){
-							auto *fb3 = fb2;
-							auto *db3 = db2;
-							
-							for(int xx = w; xx > 0; xx--) {
-								if(zval < *db3) {
-									*db3 = zval;
-									*fb3 = color;
-								}
-								fb3++; db3++;
-							}
-							
-							fb2 += fw;
-							db2 += fw;
-						}
-						
-						
+						Splat splat;
+						splat.minX = minX;
+						splat.minY = minY;
+						splat.maxX = maxX;
+						splat.maxY = maxY;
+						splat.depth = zval;
+						splat.color = color;
+						splats.push_back(splat);
 					}
 					v2 += tAxis2;
 				}
@@ -268,16 +255,117 @@ namespace spades {
 		}
 		
 		
-		void SWModelRenderer::Render(spades::draw::SWModel *model,
-									 const client::ModelRenderParam &param) {
+		void SWModelRenderer::Project(QueuedModel& m) {
+			m.splats.clear();
 #if ENABLE_SSE2
 			if(static_cast<int>(level) >= static_cast<int>(SWFeatureLevel::SSE2)) {
-				RenderInner<SWFeatureLevel::SSE2>(model, param);
+				ProjectInner<SWFeatureLevel::SSE2>(m.model, m.param, m.splats);
 			}else
 #endif
-				RenderInner<SWFeatureLevel::None>(model, param);
+				ProjectInner<SWFeatureLevel::None>(m.model, m.param, m.splats);
+		}
+		
+		void SWModelRenderer::DrawSplats(const std::vector<Splat>& splats,
+										 int bandMinY, int bandMaxY) {
+			Bitmap *fbmp = r->fb;
+			auto *fb = fbmp->GetPixels();
+			int fw = fbmp->GetWidth();
+			auto *db = r->depthBuffer.data();
+			
+			for(const auto& splat: splats) {
+				int minY = std::max(splat.minY, bandMinY);
+				int maxY = std::min(splat.maxY, bandMaxY);
+				if(minY >= maxY) continue;
+				
+				auto *fb2 = fb + (splat.minX + minY * fw);
+				auto *db2 = db + (splat.minX + minY * fw);
+				int w = splat.maxX - splat.minX;
+				float zval = splat.depth;
+				uint32_t color = splat.color;
+				
+				for(int yy = minY; yy < maxY; yy++){
+					auto *fb3 = fb2;
+					auto *db3 = db2;
+					
+					for(int xx = w; xx > 0; xx--) {
+						if(zval < *db3) {
+							*db3 = zval;
+							*fb3 = color;
+						}
+						fb3++; db3++;
+					}
+					
+					fb2 += fw;
+					db2 += fw;
+				}
+			}
+		}
+		
+		void SWModelRenderer::Render(spades::draw::SWModel *model,
+									 const client::ModelRenderParam &param) {
+			Add(model, param);
+			Flush();
+		}
+		
+		void SWModelRenderer::Add(spades::draw::SWModel *model,
+								  const client::ModelRenderParam &param) {
+			if(queueLength == queue.size())
+				queue.emplace_back();
+			auto& m = queue[queueLength++];
+			m.model = model;
+			m.param = param;
+		}
+		
+		void SWModelRenderer::Flush() {
+			SPADES_MARK_FUNCTION();
+			
+			if(queueLength == 0)
+				return;
+			
+			int fh = r->fb->GetHeight();
+			int numThreads = r_swNumThreads;
+			
+			if(numThreads <= 1) {
+				for(std::size_t i = 0; i < queueLength; i++) {
+					Project(queue[i]);
+					DrawSplats(queue[i].splats, 0, fh);
+				}
+			}else{
+				// project the models. splats of each model are
+				// kept in its own buffer, so the order is preserved.
+				std::atomic<std::size_t> nextModel(0);
+				InvokeParallel2([&](unsigned int, unsigned int) {
+					std::size_t i;
+					while((i = nextModel.fetch_add(1)) < queueLength) {
+						Project(queue[i]);
+					}
+				});
+				
+				// draw the splats. every thread owns a set of rows and
+				// draws all splats in the submission order, so each pixel is
+				// depth-tested in the same order as the serial path.
+				int numBands = numThreads * 4;
+				int bandHeight = (fh + numBands - 1) / numBands;
+				bandHeight = std::max<int>(bandHeight, MinBandHeight);
+				numBands = (fh + bandHeight - 1) / bandHeight;
+				
+				std::atomic<int> nextBand(0);
+				InvokeParallel2([&](unsigned int, unsigned int) {
+					int band;
+					while((band = nextBand.fetch_add(1)) < numBands) {
+						int minY = band * bandHeight;
+						int maxY = std::min(minY + bandHeight, fh);
+						for(std::size_t i = 0; i < queueLength; i++) {
+							DrawSplats(queue[i].splats, minY, maxY);
+						}
+					}
+				});
+			}
+			
+			for(std::size_t i = 0; i < queueLength; i++) {
+				queue[i].model = nullptr;
+			}
+			queueLength = 0;
 		}
 	}
 }
-
-
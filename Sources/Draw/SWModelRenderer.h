@@ -22,6 +22,9 @@
 
 #include "SWFeatureLevel.h"
 #include <Client/IRenderer.h>
+#include <Core/RefCountedObject.h>
+#include <vector>
+#include <stdint.h>
 
 namespace spades {
 	namespace draw {
@@ -29,18 +32,54 @@ namespace spades {
 		class SWRenderer;
 		class SWModelRenderer {
 			friend class SWRenderer;
+			
+			enum {
+				/** minimum height of the row bands drawn by each thread. */
+				MinBandHeight = 8
+			};
+			
+			/** a projected voxel. covers [minX, maxX) x [minY, maxY). */
+			struct Splat {
+				int minX, minY, maxX, maxY;
+				float depth;
+				uint32_t color;
+			};
+			
+			struct QueuedModel {
+				Handle<SWModel> model;
+				client::ModelRenderParam param;
+				std::vector<Splat> splats;
+			};
+			
 			SWRenderer *r;
 			SWFeatureLevel level;
 			
+			/** models added since the last flush. elements are kept
+			 * to reuse the splat buffers. */
+			std::vector<QueuedModel> queue;
+			std::size_t queueLength;
+			
 			template<SWFeatureLevel>
-			void RenderInner(SWModel *model,
-						const client::ModelRenderParam& param);
+			void ProjectInner(SWModel *model,
+							  const client::ModelRenderParam& param,
+							  std::vector<Splat>& splats);
+			void Project(QueuedModel&);
+			void DrawSplats(const std::vector<Splat>&, int minY, int maxY);
 		public:
 			SWModelRenderer(SWRenderer *, SWFeatureLevel level);
 			~SWModelRenderer();
 			
 			void Render(SWModel *model,
 						  const client::ModelRenderParam& param);
+			
+			/** queues the model. queued models are rendered by Flush
+			 * in the order they were added. */
+			void Add(SWModel *model,
+					 const client::ModelRenderParam& param);
+			
+			/** renders the queued models using r_swNumThreads threads.
+			 * the result is the same as rendering them one by one. */
+			void Flush();
 		};
 	}
 }
@@ -29,15 +29,23 @@
 #include <array>
 #include <algorithm>
 #include <Core/Settings.h>
+#include <Core/FrameProfiler.h>
 #include "SWFlatMapRenderer.h"
 #include "SWMapRenderer.h"
 #include <fenv.h>
 #include "SWModelRenderer.h"
 
 #include "SWUtils.h"
+#include <atomic>
+#include <cstring>
 
 SPADES_SETTING(r_swStatistics, "0");
 SPADES_SETTING(r_swNumThreads, "4");
+SPADES_SETTING(r_swSpriteBenchmark, "0");
+SPADES_SETTING(r_swUndersampling, "0");
+SPADES_SETTING(r_swAdaptiveUndersampling, "0");
+SPADES_SETTING(r_swTargetFrameTime, "33");
+SPADES_SETTING(r_swReuseStaticFrame, "0");
 
 namespace spades {
 	namespace draw {
@@ -53,11 +61,21 @@ namespace spades {
 		drawColorAlphaPremultiplied(MakeVector4(1,1,1,1)),
 		legacyColorPremultiply(false),
 		lastTime(0),
+		benchmarkTime(0.),
+		benchmarkPixels(0),
+		benchmarkFrames(0),
+		benchmarkBytes(0),
+		bytesTouched(0),
+		adaptiveUndersampling(1),
+		averageFrameTime(0.),
+		framesSinceUndersamplingChange(0),
 		duringSceneRendering(false),
 		featureLevel(level){
 			
 			SPADES_MARK_FUNCTION();
 			
+			mapLayerCache.valid = false;
+			
 			if(port == nullptr) {
 				SPRaise("Port is null.");
 			}
@@ -129,6 +147,7 @@ namespace spades {
 			
 			SetGameMap(nullptr);
 			
+			benchmarkImage = nullptr;
 			imageRenderer.reset();
 			flatMapRenderer.reset();
 			
@@ -164,6 +183,20 @@ namespace spades {
 			return modelManager->CreateModel(model);
 		}
 		
+		void SWRenderer::RegisterPreloadedImage(const char *filename,
+												spades::Bitmap *bmp) {
+			SPADES_MARK_FUNCTION();
+			EnsureValid();
+			imageManager->RegisterPreloadedImage(filename, bmp);
+		}
+		
+		void SWRenderer::RegisterPreloadedModel(const char *filename,
+												spades::VoxelModel *model) {
+			SPADES_MARK_FUNCTION();
+			EnsureInitialized();
+			modelManager->RegisterPreloadedModel(filename, model);
+		}
+		
 		void SWRenderer::SetGameMap(client::GameMap *map) {
 			SPADES_MARK_FUNCTION();
 			if(map)
@@ -173,6 +206,7 @@ namespace spades {
 			
 			flatMapRenderer.reset();
 			mapRenderer.reset();
+			mapLayerCache.valid = false;
 			
 			if(this->map)
 				this->map->RemoveListener(this);
@@ -267,88 +301,57 @@ namespace spades {
 			
 		}
 		
-		template<SWFeatureLevel>
-		void SWRenderer::ApplyDynamicLight(const DynamicLight &light) {
-			int fw = this->fb->GetWidth();
-			int fh = this->fb->GetHeight();
-			
-			float fovX = tanf(sceneDef.fovX * 0.5f);
-			float fovY = tanf(sceneDef.fovY * 0.5f);
+		namespace {
+			enum {
+				/** size of the tiles lighting and fog are applied to.
+				 * must be a multiple of 4 (the size of the fog block). */
+				CompositeTileSize = 32
+			};
 			
-			float dvx = -fovX * 2.f / static_cast<float>(fw);
-			float dvy = -fovY * 2.f / static_cast<float>(fh);
+			/** a dynamic light transformed into the view space. */
+			struct ViewSpaceLight {
+				Vector3 center;
+				float invRadius2;
+				int r, g, b;
+				int minX, minY, maxX, maxY;
+			};
 			
-			int minX = light.minX;
-			int minY = light.minY;
-			int maxX = light.maxX;
-			int maxY = light.maxY;
-			int lightHeight = maxY - minY;
-			
-			SPAssert(minX >= 0);
-			SPAssert(minY >= 0);
-			SPAssert(maxX <= fw);
-			SPAssert(maxY <= fh);
-			
-			Vector3 lightCenter;
-			Vector3 diff = light.param.origin - sceneDef.viewOrigin;
-			lightCenter.x = Vector3::Dot(diff, sceneDef.viewAxis[0]);
-			lightCenter.y = Vector3::Dot(diff, sceneDef.viewAxis[1]);
-			lightCenter.z = Vector3::Dot(diff, sceneDef.viewAxis[2]);
-			
-			int lightR = ToFixedFactor8(light.param.color.x);
-			int lightG = ToFixedFactor8(light.param.color.y);
-			int lightB = ToFixedFactor8(light.param.color.z);
-			
-			float invRadius2 = 1.f / (light.param.radius * light.param.radius);
-			
-			InvokeParallel2([=](unsigned int threadId, unsigned int numThreads) {
-				int startY = lightHeight * threadId / numThreads;
-				int endY = lightHeight * (threadId + 1) / numThreads;
-				startY += minY;
-				endY += minY;
-				
-				auto *fb = this->fb->GetPixels();
-				float *db = depthBuffer.data();
-				fb += startY * fw + minX;
-				db += startY * fw + minX;
-				
-				float vy = fovY + dvy * startY;
-				float vx = fovX + dvx * minX;
-				
-				int lightWidth = maxX - minX;
-				
-				for(int y = startY; y < endY; y++) {
-					float vx2 = vx;
-					auto *fb2 = fb;
-					auto *db2 = db;
-					
-					for(int x = lightWidth; x > 0; x--) {
-						Vector3 pos;
-						
-						pos.z = *db2;
-						pos.x = vx2 * pos.z;
-						pos.y = vy  * pos.z;
+			/** lights a span of pixels with the given lights.
+			 * the lights are applied in the given order. */
+			template<SWFeatureLevel>
+			struct DynamicLightSpan {
+				static void Apply(uint32_t *fb, const float *db, int count,
+								  float vx, float dvx, float vy,
+								  const ViewSpaceLight *lights,
+								  const int *indices, int numLights) {
+					for(int x = 0; x < count; x++) {
+						Vector3 viewPos;
+						viewPos.z = db[x];
+						viewPos.x = vx * viewPos.z;
+						viewPos.y = vy * viewPos.z;
 						
-						pos -= lightCenter;
-						
-						float dist = pos.GetPoweredLength();
-						dist *= invRadius2;
-						
-						if(dist < 1.f) {
+						uint32_t color = fb[x];
+						for(int i = 0; i < numLights; i++) {
+							const ViewSpaceLight& light = lights[indices[i]];
+							Vector3 pos = viewPos - light.center;
+							
+							float dist = pos.GetPoweredLength();
+							dist *= light.invRadius2;
+							if(dist >= 1.f) continue;
+							
 							float strength = 1.f - dist;
 							strength *= strength;
 							strength *= 256.f;
 							
 							int factor = static_cast<int>(strength);
 							
-							int actualLightR = lightR * factor;
-							int actualLightG = lightG * factor;
-							int actualLightB = lightB * factor;
+							int actualLightR = light.r * factor;
+							int actualLightG = light.g * factor;
+							int actualLightB = light.b * factor;
 							
-							auto srcColor = *fb2;
-							auto srcColorR = (srcColor >> 16) & 0xff;
-							auto srcColorG = (srcColor >> 8) & 0xff;
-							auto srcColorB = srcColor & 0xff;
+							auto srcColorR = (color >> 16) & 0xff;
+							auto srcColorG = (color >> 8) & 0xff;
+							auto srcColorB = color & 0xff;
 							
 							actualLightR *= srcColorR;
 							actualLightG *= srcColorG;
@@ -362,62 +365,115 @@ namespace spades {
 							destColorG = std::min<uint32_t>(destColorG+srcColorG, 255);
 							destColorB = std::min<uint32_t>(destColorB+srcColorB, 255);
 							
-							uint32_t destColor = destColorB |
+							color = destColorB |
 							(destColorG<<8) | (destColorR<<16);
+						}
+						fb[x] = color;
+						
+						vx += dvx;
+					}
+				}
+			};
+			
+#if ENABLE_SSE2
+			template<>
+			struct DynamicLightSpan<SWFeatureLevel::SSE2> {
+				static void Apply(uint32_t *fb, const float *db, int count,
+								  float vx, float dvx, float vy,
+								  const ViewSpaceLight *lights,
+								  const int *indices, int numLights) {
+					auto vx4 = _mm_setr_ps(vx, vx + dvx, vx + dvx * 2.f, vx + dvx * 3.f);
+					auto dvx4 = _mm_set1_ps(dvx * 4.f);
+					auto vy4 = _mm_set1_ps(vy);
+					auto one = _mm_set1_ps(1.f);
+					auto maxColor = _mm_set1_ps(255.f);
+					auto channelMask = _mm_set1_epi32(0xff);
+					// (light * factor * color) >> 16 never exceeds 2^24, so
+					// it's computed exactly with single precision floats
+					auto scale = _mm_set1_ps(1.f / 65536.f);
+					
+					int x = 0;
+					for(; x + 4 <= count; x += 4) {
+						auto posZ = _mm_loadu_ps(db + x);
+						auto posX = _mm_mul_ps(vx4, posZ);
+						auto posY = _mm_mul_ps(vy4, posZ);
+						vx4 = _mm_add_ps(vx4, dvx4);
+						
+						auto color = _mm_loadu_si128(reinterpret_cast<__m128i *>(fb + x));
+						auto colorR = _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(color, 16), channelMask));
+						auto colorG = _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(color, 8), channelMask));
+						auto colorB = _mm_cvtepi32_ps(_mm_and_si128(color, channelMask));
+						auto lit = _mm_setzero_ps();
+						
+						for(int i = 0; i < numLights; i++) {
+							const ViewSpaceLight& light = lights[indices[i]];
+							auto dx = _mm_sub_ps(posX, _mm_set1_ps(light.center.x));
+							auto dy = _mm_sub_ps(posY, _mm_set1_ps(light.center.y));
+							auto dz = _mm_sub_ps(posZ, _mm_set1_ps(light.center.z));
+							auto dist = _mm_mul_ps(dx, dx);
+							dist = _mm_add_ps(dist, _mm_mul_ps(dy, dy));
+							dist = _mm_add_ps(dist, _mm_mul_ps(dz, dz));
+							dist = _mm_mul_ps(dist, _mm_set1_ps(light.invRadius2));
+							
+							auto inside = _mm_cmplt_ps(dist, one);
+							if(_mm_movemask_ps(inside) == 0)
+								continue;
+							lit = _mm_or_ps(lit, inside);
 							
-							*fb2 = destColor;
+							auto strength = _mm_sub_ps(one, dist);
+							strength = _mm_mul_ps(strength, strength);
+							strength = _mm_mul_ps(strength, _mm_set1_ps(256.f));
+							auto factor = _mm_cvtepi32_ps(_mm_cvttps_epi32(strength));
+							factor = _mm_and_ps(factor, inside);
+							
+							auto lightR = _mm_mul_ps(factor, _mm_set1_ps(static_cast<float>(light.r)));
+							auto lightG = _mm_mul_ps(factor, _mm_set1_ps(static_cast<float>(light.g)));
+							auto lightB = _mm_mul_ps(factor, _mm_set1_ps(static_cast<float>(light.b)));
+							lightR = _mm_cvtepi32_ps(_mm_cvttps_epi32(_mm_mul_ps(_mm_mul_ps(lightR, colorR), scale)));
+							lightG = _mm_cvtepi32_ps(_mm_cvttps_epi32(_mm_mul_ps(_mm_mul_ps(lightG, colorG), scale)));
+							lightB = _mm_cvtepi32_ps(_mm_cvttps_epi32(_mm_mul_ps(_mm_mul_ps(lightB, colorB), scale)));
+							colorR = _mm_min_ps(_mm_add_ps(colorR, lightR), maxColor);
+							colorG = _mm_min_ps(_mm_add_ps(colorG, lightG), maxColor);
+							colorB = _mm_min_ps(_mm_add_ps(colorB, lightB), maxColor);
 						}
 						
-						vx2 += dvx;
-						fb2++; db2++;
+						// lit pixels lose the alpha channel just like the scalar version
+						auto result = _mm_slli_epi32(_mm_cvttps_epi32(colorR), 16);
+						result = _mm_or_si128(result, _mm_slli_epi32(_mm_cvttps_epi32(colorG), 8));
+						result = _mm_or_si128(result, _mm_cvttps_epi32(colorB));
+						auto litMask = _mm_castps_si128(lit);
+						result = _mm_or_si128(_mm_and_si128(litMask, result),
+											  _mm_andnot_si128(litMask, color));
+						_mm_storeu_si128(reinterpret_cast<__m128i *>(fb + x), result);
 					}
 					
-					vy += dvy;
-					fb += fw;
-					db += fw;
+					if(x < count) {
+						DynamicLightSpan<SWFeatureLevel::None>::Apply
+						(fb + x, db + x, count - x, vx + dvx * static_cast<float>(x), dvx, vy,
+						 lights, indices, numLights);
+					}
 				}
-			});
-		}
-		
-		template<SWFeatureLevel level>
-		void SWRenderer::ApplyFog() {
-			int fw = this->fb->GetWidth();
-			int fh = this->fb->GetHeight();
-			
-			float fovX = tanf(sceneDef.fovX * 0.5f);
-			float fovY = tanf(sceneDef.fovY * 0.5f);
-			
-			float dvx = -fovX * 2.f / static_cast<float>(fw / 4);
-			float dvy = -fovY * 2.f / static_cast<float>(fh / 4);
-			
-			int fogR = ToFixed8(fogColor.x);
-			int fogG = ToFixed8(fogColor.y);
-			int fogB = ToFixed8(fogColor.z);
-			uint32_t fog1 = static_cast<uint32_t>(fogB + fogR * 0x10000);
-			uint32_t fog2 = static_cast<uint32_t>(fogG * 0x100);
+			};
+#endif
 			
-			float scale = 255.f / fogDistance;
+			struct FogParam {
+				uint32_t fog1, fog2; // for None
+				int r, g, b; // for SSE2
+				float scale;
+			};
 			
-			InvokeParallel2([&](unsigned int threadId, unsigned int numThreads) {
-				int startY = fh * threadId / numThreads;
-				int endY = fh * (threadId + 1) / numThreads;
-				startY &= ~3;
-				endY &= ~3;
-				
-				float vy = fovY;
-				auto *fb = this->fb->GetPixels();
-				float *db = depthBuffer.data();
-				
-				vy += dvy * (startY >> 2);
-				fb += fw * startY;
-				db += fw * startY;
-				
-				for(int y = startY; y < endY; y += 4) {
-					float vx = fovX;
-					
-					for(int x = 0; x < fw; x += 4) {
+			/** applies the fog to a horizontal row of 4x4 pixel blocks.
+			 * the fog factor is computed once for each block. */
+			template<SWFeatureLevel>
+			struct FogBlockRow {
+				static void Apply(uint32_t *fb, const float *db, int fw,
+								  int numBlocks, float vx, float dvx, float vy,
+								  const FogParam& param) {
+					uint32_t fog1 = param.fog1;
+					uint32_t fog2 = param.fog2;
+					for(int x = 0; x < numBlocks * 4; x += 4) {
 						float depthScale = (1.f + vx*vx+vy*vy);
-						depthScale *= fastRSqrt(depthScale) * scale;
+						depthScale *= fastRSqrt(depthScale) * param.scale;
 						auto *fb2 = fb + x;
 						auto *db2 = db + x;
 						for(int by = 0; by < 4; by++) {
@@ -451,56 +507,20 @@ namespace spades {
 						
 						vx += dvx;
 					}
-					
-					vy += dvy;
-					fb += fw * 4;
-					db += fw * 4;
 				}
-			});
-			
+			};
 			
-		} // ApplyFog()
-		
 #if ENABLE_SSE2
-		
-		template<>
-		void SWRenderer::ApplyFog<SWFeatureLevel::SSE2>() {
-			int fw = this->fb->GetWidth();
-			int fh = this->fb->GetHeight();
-			
-			float fovX = tanf(sceneDef.fovX * 0.5f);
-			float fovY = tanf(sceneDef.fovY * 0.5f);
-			
-			float dvx = -fovX * 2.f / static_cast<float>(fw / 4);
-			float dvy = -fovY * 2.f / static_cast<float>(fh / 4);
-			
-			int fogR = ToFixed8(fogColor.x);
-			int fogG = ToFixed8(fogColor.y);
-			int fogB = ToFixed8(fogColor.z);
-			__m128i fog = _mm_setr_epi16(fogB, fogG, fogR, 0, fogB, fogG, fogR, 0);
-			
-			float scale = 255.f / fogDistance;
-			
-			InvokeParallel2([&](unsigned int threadId, unsigned int numThreads) {
-				int startY = fh * threadId / numThreads;
-				int endY = fh * (threadId + 1) / numThreads;
-				startY &= ~3;
-				endY &= ~3;
-				
-				float vy = fovY;
-				auto *fb = this->fb->GetPixels();
-				float *db = depthBuffer.data();
-				
-				vy += dvy * (startY >> 2);
-				fb += fw * startY;
-				db += fw * startY;
-				
-				for(int y = startY; y < endY; y += 4) {
-					float vx = fovX;
-					
-					for(int x = 0; x < fw; x += 4) {
+			template<>
+			struct FogBlockRow<SWFeatureLevel::SSE2> {
+				static void Apply(uint32_t *fb, const float *db, int fw,
+								  int numBlocks, float vx, float dvx, float vy,
+								  const FogParam& param) {
+					__m128i fog = _mm_setr_epi16(param.b, param.g, param.r, 0,
+												 param.b, param.g, param.r, 0);
+					for(int x = 0; x < numBlocks * 4; x += 4) {
 						float depthScale = (1.f + vx*vx+vy*vy);
-						depthScale *= fastRSqrt(depthScale) * scale;
+						depthScale *= fastRSqrt(depthScale) * param.scale;
 						auto depthScale4 = _mm_set1_ps(depthScale);
 						
 						auto *fb2 = fb + x;
@@ -554,17 +574,187 @@ namespace spades {
 						
 						vx += dvx;
 					}
+				}
+			};
+#endif
+		}
+		
+		template<SWFeatureLevel level>
+		void SWRenderer::ApplyLightingAndFog() {
+			SPADES_MARK_FUNCTION();
+			
+			int fw = this->fb->GetWidth();
+			int fh = this->fb->GetHeight();
+			
+			float fovX = tanf(sceneDef.fovX * 0.5f);
+			float fovY = tanf(sceneDef.fovY * 0.5f);
+			
+			float dvx = -fovX * 2.f / static_cast<float>(fw);
+			float dvy = -fovY * 2.f / static_cast<float>(fh);
+			
+			// fog is computed for each 4x4 block
+			float fogDvx = -fovX * 2.f / static_cast<float>(fw / 4);
+			float fogDvy = -fovY * 2.f / static_cast<float>(fh / 4);
+			int fogHeight = fh & ~3;
+			
+			FogParam fog;
+			fog.r = ToFixed8(fogColor.x);
+			fog.g = ToFixed8(fogColor.y);
+			fog.b = ToFixed8(fogColor.z);
+			fog.fog1 = static_cast<uint32_t>(fog.b + fog.r * 0x10000);
+			fog.fog2 = static_cast<uint32_t>(fog.g * 0x100);
+			fog.scale = 255.f / fogDistance;
+			
+			int tilesX = (fw + CompositeTileSize - 1) / CompositeTileSize;
+			int tilesY = (fh + CompositeTileSize - 1) / CompositeTileSize;
+			int numTiles = tilesX * tilesY;
+			lightTiles.resize(numTiles);
+			for(auto& tile: lightTiles)
+				tile.clear();
+			
+			// transform lights into the view space and bin them.
+			// each tile has its lights in the order they were added.
+			std::vector<ViewSpaceLight> viewLights;
+			viewLights.reserve(lights.size());
+			for(const auto& light: lights) {
+				SPAssert(light.minX >= 0);
+				SPAssert(light.minY >= 0);
+				SPAssert(light.maxX <= fw);
+				SPAssert(light.maxY <= fh);
+				if(light.minX >= light.maxX || light.minY >= light.maxY)
+					continue;
+				
+				ViewSpaceLight l;
+				Vector3 diff = light.param.origin - sceneDef.viewOrigin;
+				l.center.x = Vector3::Dot(diff, sceneDef.viewAxis[0]);
+				l.center.y = Vector3::Dot(diff, sceneDef.viewAxis[1]);
+				l.center.z = Vector3::Dot(diff, sceneDef.viewAxis[2]);
+				l.invRadius2 = 1.f / (light.param.radius * light.param.radius);
+				l.r = ToFixedFactor8(light.param.color.x);
+				l.g = ToFixedFactor8(light.param.color.y);
+				l.b = ToFixedFactor8(light.param.color.z);
+				l.minX = light.minX; l.minY = light.minY;
+				l.maxX = light.maxX; l.maxY = light.maxY;
+				
+				int index = static_cast<int>(viewLights.size());
+				viewLights.push_back(l);
+				
+				int minTX = light.minX / CompositeTileSize;
+				int minTY = light.minY / CompositeTileSize;
+				int maxTX = (light.maxX - 1) / CompositeTileSize;
+				int maxTY = (light.maxY - 1) / CompositeTileSize;
+				for(int ty = minTY; ty <= maxTY; ty++)
+					for(int tx = minTX; tx <= maxTX; tx++)
+						lightTiles[tx + ty * tilesX].push_back(index);
+			}
+			
+			// lighting and fog are done in a single pass so that
+			// each tile is read from the memory only once.
+			std::atomic<int> nextTile(0);
+			std::atomic<unsigned long long> litPixels(0);
+			InvokeParallel2([&](unsigned int, unsigned int) {
+				auto *fb = this->fb->GetPixels();
+				float *db = depthBuffer.data();
+				unsigned long long numLitPixels = 0;
+				
+				int tile;
+				while((tile = nextTile.fetch_add(1)) < numTiles) {
+					int tx = tile % tilesX, ty = tile / tilesX;
+					int tileMinX = tx * CompositeTileSize;
+					int tileMinY = ty * CompositeTileSize;
+					int tileMaxX = std::min(tileMinX + CompositeTileSize, fw);
+					int tileMaxY = std::min(tileMinY + CompositeTileSize, fh);
+					
+					const auto& indices = lightTiles[tile];
+					// each light only touches its own rectangle. lights are
+					// applied one after another to the running color, so
+					// applying them one at a time in the same order gives
+					// exactly the same result.
+					for(const int& index: indices) {
+						const auto& light = viewLights[index];
+						int minX = std::max(light.minX, tileMinX);
+						int minY = std::max(light.minY, tileMinY);
+						int maxX = std::min(light.maxX, tileMaxX);
+						int maxY = std::min(light.maxY, tileMaxY);
+						if(minX >= maxX || minY >= maxY)
+							continue;
+						
+						float vx = fovX + dvx * static_cast<float>(minX);
+						for(int y = minY; y < maxY; y++) {
+							float vy = fovY + dvy * static_cast<float>(y);
+							DynamicLightSpan<level>::Apply(fb + y * fw + minX,
+														   db + y * fw + minX,
+														   maxX - minX, vx, dvx, vy,
+														   viewLights.data(),
+														   &index, 1);
+						}
+						numLitPixels += (maxX - minX) * (maxY - minY);
+					}
 					
-					vy += dvy;
-					fb += fw * 4;
-					db += fw * 4;
+					int numBlocks = (tileMaxX - tileMinX) >> 2;
+					float vx = fovX + fogDvx * static_cast<float>(tileMinX >> 2);
+					for(int y = tileMinY; y < std::min(tileMaxY, fogHeight); y += 4) {
+						float vy = fovY + fogDvy * static_cast<float>(y >> 2);
+						FogBlockRow<level>::Apply(fb + y * fw + tileMinX,
+												  db + y * fw + tileMinX,
+												  fw, numBlocks, vx, fogDvx, vy, fog);
+					}
 				}
+				
+				litPixels.fetch_add(numLitPixels);
 			});
 			
-			
-		} // ApplyFog()
+			// color read and written, depth read
+			bytesTouched += static_cast<unsigned long long>(fw) * fh * 12;
+			// lit pixels are in the cache when the fog is applied
+			bytesTouched += static_cast<unsigned long long>(litPixels) * 12;
+		}
 		
+		template<SWFeatureLevel level>
+		void SWRenderer::ClearScene() {
+			SPADES_MARK_FUNCTION();
+			
+			int fw = this->fb->GetWidth();
+			int fh = this->fb->GetHeight();
+			uint32_t color = static_cast<uint32_t>(ToFixed8(fogColor.z) |
+												   (ToFixed8(fogColor.y) << 8) |
+												   (ToFixed8(fogColor.x) << 16));
+			
+			// the depth is large enough for the fog to hide everything
+			float depth = fogDistance * 2.f;
+			
+			InvokeParallel2([&](unsigned int threadId, unsigned int numThreads) {
+				int startY = fh * threadId / numThreads;
+				int endY = fh * (threadId + 1) / numThreads;
+				uint32_t *fb = this->fb->GetPixels() + startY * fw;
+				float *db = depthBuffer.data() + startY * fw;
+				int count = (endY - startY) * fw;
+				int i = 0;
+#if ENABLE_SSE2
+				if(level == SWFeatureLevel::SSE2) {
+					// nobody reads these before the models are drawn,
+					// so they don't have to be in the cache
+					for(; i < count && (reinterpret_cast<uintptr_t>(fb + i) & 15); i++) {
+						fb[i] = color;
+						db[i] = depth;
+					}
+					if((reinterpret_cast<uintptr_t>(db + i) & 15) == 0) {
+						auto color4 = _mm_set1_epi32(static_cast<int>(color));
+						auto depth4 = _mm_set1_ps(depth);
+						for(; i + 4 <= count; i += 4) {
+							_mm_stream_si128(reinterpret_cast<__m128i *>(fb + i), color4);
+							_mm_stream_ps(db + i, depth4);
+						}
+						_mm_sfence();
+					}
+				}
 #endif
+				std::fill(fb + i, fb + count, color);
+				std::fill(db + i, db + count, depth);
+			});
+			
+			bytesTouched += static_cast<unsigned long long>(fw) * fh * 8;
+		}
 		
 		
 		
@@ -771,48 +961,217 @@ namespace spades {
 			return c;
 		}
 		
+		void SWRenderer::AddBenchmarkSprites(int count) {
+			SPADES_MARK_FUNCTION();
+			
+			if(!benchmarkImage) {
+				// soft round blob, similar to a smoke particle
+				const int size = 64;
+				Handle<Bitmap> bmp(new Bitmap(size, size), false);
+				uint32_t *pixels = bmp->GetPixels();
+				for(int y = 0; y < size; y++)
+					for(int x = 0; x < size; x++) {
+						float dx = (static_cast<float>(x) + .5f) / (size * .5f) - 1.f;
+						float dy = (static_cast<float>(y) + .5f) / (size * .5f) - 1.f;
+						float a = std::max(1.f - (dx * dx + dy * dy), 0.f);
+						pixels[x + y * size] = 0xffffffU | (static_cast<uint32_t>(ToFixed8(a)) << 24);
+					}
+				benchmarkImage.Set(imageManager->CreateImage(bmp), false);
+			}
+			
+			// sprites are placed in front of the camera so that each
+			// pixel on the screen is covered many times
+			auto front = sceneDef.viewAxis[2];
+			auto right = sceneDef.viewAxis[0];
+			auto up = sceneDef.viewAxis[1];
+			for(int i = 0; i < count; i++) {
+				float dist = 3.f + static_cast<float>(i % 8) * .5f;
+				float ox = static_cast<float>((i * 7) % 11) / 10.f - .5f;
+				float oy = static_cast<float>((i * 5) % 13) / 12.f - .5f;
+				
+				sprites.push_back(Sprite());
+				auto& spr = sprites.back();
+				spr.img = benchmarkImage;
+				spr.center = sceneDef.viewOrigin + front * dist +
+				(right * ox + up * oy) * dist;
+				spr.radius = dist * .6f;
+				spr.rotation = static_cast<float>(i);
+				spr.color = MakeVector4(.3f, .3f, .3f, .3f);
+			}
+		}
+		
+		int SWRenderer::GetUndersampling() {
+			if(r_swAdaptiveUndersampling)
+				return adaptiveUndersampling;
+			int under = r_swUndersampling;
+			return std::max(std::min(under, 4), 1);
+		}
+		
+		void SWRenderer::UpdateAdaptiveUndersampling(double frameTime) {
+			if(averageFrameTime == 0.)
+				averageFrameTime = frameTime;
+			averageFrameTime += (frameTime - averageFrameTime) * .1;
+			
+			if(!r_swAdaptiveUndersampling) {
+				adaptiveUndersampling = GetUndersampling();
+				framesSinceUndersamplingChange = 0;
+				return;
+			}
+			
+			// wait for the average to settle
+			if(++framesSinceUndersamplingChange < 30)
+				return;
+			
+			double target = static_cast<double>(r_swTargetFrameTime) * .001;
+			int newLevel = adaptiveUndersampling;
+			if(averageFrameTime > target * 1.1) {
+				newLevel = std::min(adaptiveUndersampling * 2, 4);
+			}else if(averageFrameTime < target * .5) {
+				// only the map rendering gets faster with undersampling,
+				// so this has a large margin to avoid oscillation
+				newLevel = std::max(adaptiveUndersampling / 2, 1);
+			}
+			
+			if(newLevel != adaptiveUndersampling) {
+				if(r_swStatistics) {
+					SPLog("Adaptive undersampling: %d -> %d (average frame time: %.2fms)",
+						  adaptiveUndersampling, newLevel, averageFrameTime * 1000.);
+				}
+				adaptiveUndersampling = newLevel;
+				framesSinceUndersamplingChange = 0;
+			}
+		}
+		
+		bool SWRenderer::CanReuseMapLayer(int undersampling) {
+			const auto& cache = mapLayerCache;
+			if(!cache.valid)
+				return false;
+			if(cache.width != fb->GetWidth() || cache.height != fb->GetHeight())
+				return false;
+			if(cache.undersampling != undersampling)
+				return false;
+			if(cache.rleGeneration != mapRenderer->GetRleGeneration())
+				return false;
+			
+			const auto& a = cache.sceneDef;
+			const auto& b = sceneDef;
+			if(a.fovX != b.fovX || a.fovY != b.fovY ||
+			   a.zNear != b.zNear || a.zFar != b.zFar)
+				return false;
+			if(a.viewOrigin.x != b.viewOrigin.x ||
+			   a.viewOrigin.y != b.viewOrigin.y ||
+			   a.viewOrigin.z != b.viewOrigin.z)
+				return false;
+			for(int i = 0; i < 3; i++) {
+				if(a.viewAxis[i].x != b.viewAxis[i].x ||
+				   a.viewAxis[i].y != b.viewAxis[i].y ||
+				   a.viewAxis[i].z != b.viewAxis[i].z)
+					return false;
+			}
+			return true;
+		}
+		
 		void SWRenderer::EndScene() {
 			EnsureInitialized();
 			EnsureSceneStarted();
+			SPADES_PROFILE_ZONE("SWRenderer::EndScene");
 			
-			// clear scene
-			std::fill(fb->GetPixels(), fb->GetPixels() +
-					  fb->GetWidth() * fb->GetHeight(),
-					  ConvertColor32(MakeVector4(fogColor.x, fogColor.y, fogColor.z, 1.f)));
-			std::fill(fb->GetPixels(), fb->GetPixels() +
-					  fb->GetWidth() * fb->GetHeight(),
-					  0x7f7f7f);
+			// 2D images drawn before the scene
+			imageRenderer->Flush();
 			
-			// draw map
+			// draw map. the map renderer overwrites the whole frame,
+			// so the frame is cleared only when it didn't
+			bool mapDrawn = false;
 			if(mapRenderer){
+				SPADES_PROFILE_ZONE("Map");
+				
 				// flat map renderer sends 'Update RLE' to map renderer.
 				// rendering map before this leads to the corrupted renderer image.
 				flatMapRenderer->Update();
-				mapRenderer->Render(sceneDef, fb, depthBuffer.data());
+				
+				int undersampling = GetUndersampling();
+				std::size_t numPixels = fb->GetWidth() * fb->GetHeight();
+				if(r_swReuseStaticFrame && CanReuseMapLayer(undersampling)) {
+					std::memcpy(fb->GetPixels(), mapLayerCache.color.data(),
+								numPixels * sizeof(uint32_t));
+					std::memcpy(depthBuffer.data(), mapLayerCache.depth.data(),
+								numPixels * sizeof(float));
+					mapDrawn = true;
+					
+					// cache read
+					bytesTouched += numPixels * 8;
+				}else{
+					mapDrawn = mapRenderer->Render(sceneDef, fb, depthBuffer.data(),
+												   undersampling);
+					mapLayerCache.valid = false;
+					if(mapDrawn && r_swReuseStaticFrame) {
+						auto& cache = mapLayerCache;
+						cache.color.assign(fb->GetPixels(), fb->GetPixels() + numPixels);
+						cache.depth.assign(depthBuffer.begin(), depthBuffer.end());
+						cache.sceneDef = sceneDef;
+						cache.width = fb->GetWidth();
+						cache.height = fb->GetHeight();
+						cache.undersampling = undersampling;
+						cache.rleGeneration = mapRenderer->GetRleGeneration();
+						cache.valid = true;
+						
+						// cache written
+						bytesTouched += numPixels * 8;
+					}else if(!r_swReuseStaticFrame) {
+						// release the memory
+						std::vector<uint32_t>().swap(mapLayerCache.color);
+						std::vector<float>().swap(mapLayerCache.depth);
+					}
+				}
 			}
 			
-			// draw models
-			for(auto& m: models) {
-				modelRenderer->Render(m.model,
-									  m.param);
+			if(mapDrawn) {
+				// color and depth written
+				bytesTouched += static_cast<unsigned long long>(fb->GetWidth()) *
+				fb->GetHeight() * 8;
+			}else{
+#if ENABLE_SSE2
+				if(static_cast<int>(featureLevel) >= static_cast<int>(SWFeatureLevel::SSE2))
+					ClearScene<SWFeatureLevel::SSE2>();
+				else
+#endif
+				ClearScene<SWFeatureLevel::None>();
 			}
-			models.clear();
 			
-			// deferred lighting
-			for(const auto& light: lights) {
-				ApplyDynamicLight<SWFeatureLevel::None>(light);
+			// draw models
+			{
+				SPADES_PROFILE_ZONE("Models");
+				for(auto& m: models) {
+					modelRenderer->Add(m.model,
+									   m.param);
+				}
+				modelRenderer->Flush();
+				models.clear();
 			}
-			lights.clear();
 			
+			// deferred lighting and fog
+			{
+				SPADES_PROFILE_ZONE("Lighting and Fog");
 #if ENABLE_SSE2
-			if(static_cast<int>(featureLevel) >= static_cast<int>(SWFeatureLevel::SSE2))
-				ApplyFog<SWFeatureLevel::SSE2>();
-			else
+				if(static_cast<int>(featureLevel) >= static_cast<int>(SWFeatureLevel::SSE2))
+					ApplyLightingAndFog<SWFeatureLevel::SSE2>();
+				else
 #endif
-			ApplyFog<SWFeatureLevel::None>();
+				ApplyLightingAndFog<SWFeatureLevel::None>();
+				lights.clear();
+			}
 			
 			// render sprites
 			{
+				SPADES_PROFILE_ZONE("Sprites");
+				
+				int numBenchmarkSprites = r_swSpriteBenchmark;
+				if(numBenchmarkSprites > 0)
+					AddBenchmarkSprites(numBenchmarkSprites);
+				
+				Stopwatch spriteStopwatch;
+				auto pixelsBefore = imageRenderer->GetPixelsDrawn();
+				
 				imageRenderer->SetShaderType(SWImageRenderer::ShaderType::Sprite);
 				imageRenderer->SetMatrix(projectionViewMatrix);
 				imageRenderer->SetZRange(sceneDef.zNear, sceneDef.zFar);
@@ -850,7 +1209,33 @@ namespace spades {
 					v3.position = x3;
 					imageRenderer->DrawPolygon(spr.img, v1, v2, v3);
 				}
+				imageRenderer->Flush();
 				sprites.clear();
+				
+				// color read and written, depth read
+				auto spritePixels = imageRenderer->GetPixelsDrawn() - pixelsBefore;
+				bytesTouched += spritePixels * 12;
+				
+				if(numBenchmarkSprites > 0) {
+					benchmarkTime += spriteStopwatch.GetTime();
+					benchmarkPixels += spritePixels;
+					benchmarkBytes += bytesTouched;
+					if(++benchmarkFrames >= 60) {
+						SPLog("Sprite benchmark: %d sprites, %.3fms per frame, "
+							  "%.1f Mpixels/s, %.2fMB touched per frame (%d threads)",
+							  numBenchmarkSprites,
+							  benchmarkTime / benchmarkFrames * 1000.,
+							  static_cast<double>(benchmarkPixels) / benchmarkTime / 1.e+6,
+							  static_cast<double>(benchmarkBytes) / benchmarkFrames / 1.e+6,
+							  (int)r_swNumThreads);
+						benchmarkTime = 0.;
+						benchmarkPixels = 0;
+						benchmarkBytes = 0;
+						benchmarkFrames = 0;
+					}
+				}else{
+					benchmarkFrames = 0;
+				}
 			}
 			
 			// render debug lines
@@ -1108,6 +1493,16 @@ namespace spades {
 			imageRenderer->DrawPolygon(img, vtx[1], vtx[3], vtx[2]);
 			
 		}
+		
+		void SWRenderer::DrawImages(client::IImage *image,
+									const client::ImageQuad *quads,
+									size_t numQuads) {
+			SPADES_MARK_FUNCTION();
+			
+			// rasterization dominates the cost here
+			for(size_t i = 0; i < numQuads; i++)
+				DrawImage(image, quads[i].outRect, quads[i].inRect);
+		}
 
 		void SWRenderer::DrawFlatGameMap(const spades::AABB2 &outRect, const spades::AABB2 &inRect) {
 			SPADES_MARK_FUNCTION();
@@ -1132,15 +1527,43 @@ namespace spades {
 			SPADES_MARK_FUNCTION();
 			EnsureValid();
 			EnsureSceneNotStarted();
+			SPADES_PROFILE_ZONE("SWRenderer::Flip");
+			
+			imageRenderer->Flush();
+			
+			UpdateAdaptiveUndersampling(renderStopwatch.GetTime());
 			
 			if(r_swStatistics) {
 				double dur = renderStopwatch.GetTime();
 				SPLog("==== SWRenderer Statistics ====");
 				SPLog("Elapsed Time: %.3fus", dur * 1000000.0);
 				SPLog("Polygon pixels drawn: %llu", imageRenderer->GetPixelsDrawn());
+				SPLog("Polygons drawn: %llu", imageRenderer->GetTrianglesDrawn());
+				SPLog("Framebuffer bytes touched: %llu (%.2fMB)", bytesTouched,
+					  static_cast<double>(bytesTouched) / 1.e+6);
+				if(mapRenderer) {
+					auto rle = mapRenderer->GetRleStatistics();
+					size_t fragmented = rle.heap.freeBytes - rle.heap.largestFreeRegion;
+					SPLog("RLE heap: %.2fMB, %.2fMB used, %d free region(s), "
+						  "%.1f%% of free space fragmented",
+						  static_cast<double>(rle.heap.size) / 1.e+6,
+						  static_cast<double>(rle.rleBytes) / 1.e+6,
+						  static_cast<int>(rle.heap.numFreeRegions),
+						  rle.heap.freeBytes ?
+						  static_cast<double>(fragmented) * 100. / rle.heap.freeBytes : 0.);
+					SPLog("RLE columns updated: %d, compactions: %d",
+						  static_cast<int>(rle.numColumnsUpdated),
+						  static_cast<int>(rle.numCompactions));
+					SPLog("Undersampling: %d%s (average frame time: %.2fms)",
+						  GetUndersampling(),
+						  r_swAdaptiveUndersampling ? " (adaptive)" : "",
+						  averageFrameTime * 1000.);
+					mapRenderer->ResetRleStatistics();
+				}
 			}
 			
 			imageRenderer->ResetPixelStatistics();
+			bytesTouched = 0;
 			renderStopwatch.Reset();
 			/*
 			{
@@ -1166,6 +1589,8 @@ namespace spades {
 			EnsureValid();
 			EnsureSceneNotStarted();
 			
+			imageRenderer->Flush();
+			
 			int w = fb->GetWidth();
 			int h = fb->GetHeight();
 			uint32_t *inPix = fb->GetPixels();
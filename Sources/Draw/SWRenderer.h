@@ -95,6 +95,9 @@ namespace spades {
 				int minX, maxX, minY, maxY;
 			};
 			std::vector<DynamicLight> lights;
+			/** indices of the lights overlapping each tile.
+			 * kept to reuse the buffers. */
+			std::vector<std::vector<int>> lightTiles;
 			
 			bool inited;
 			bool sceneUsedInThisFrame;
@@ -123,6 +126,39 @@ namespace spades {
 			
 			Stopwatch renderStopwatch;
 			
+			// sprite overdraw benchmark (r_swSpriteBenchmark)
+			Handle<SWImage> benchmarkImage;
+			double benchmarkTime;
+			unsigned long long benchmarkPixels;
+			int benchmarkFrames;
+			unsigned long long benchmarkBytes;
+			void AddBenchmarkSprites(int count);
+			
+			/** estimated number of bytes of the color and depth buffer
+			 * read or written by the scene passes since the last Flip. */
+			unsigned long long bytesTouched;
+			
+			// undersampling level chosen by r_swAdaptiveUndersampling
+			int adaptiveUndersampling;
+			double averageFrameTime;
+			int framesSinceUndersamplingChange;
+			void UpdateAdaptiveUndersampling(double frameTime);
+			int GetUndersampling();
+			
+			/** output of the map renderer, reused while the view and
+			 * the map don't change (r_swReuseStaticFrame). */
+			struct MapLayerCache {
+				bool valid;
+				client::SceneDefinition sceneDef;
+				int width, height;
+				int undersampling;
+				uint64_t rleGeneration;
+				std::vector<uint32_t> color;
+				std::vector<float> depth;
+			};
+			MapLayerCache mapLayerCache;
+			bool CanReuseMapLayer(int undersampling);
+			
 			bool duringSceneRendering;
 			
 			void BuildProjectionMatrix();
@@ -141,10 +177,10 @@ namespace spades {
 			void SetFramebuffer(Bitmap *);
 			
 			template<SWFeatureLevel>
-			void ApplyFog();
+			void ClearScene();
 			
 			template<SWFeatureLevel>
-			void ApplyDynamicLight(const DynamicLight&);
+			void ApplyLightingAndFog();
 			
 		protected:
 			virtual ~SWRenderer();
@@ -160,6 +196,10 @@ namespace spades {
 			
 			virtual client::IImage *CreateImage(Bitmap *);
 			virtual client::IModel *CreateModel(VoxelModel *);
+			
+			virtual void RegisterPreloadedImage(const char *filename, Bitmap *);
+			virtual void RegisterPreloadedModel(const char *filename, VoxelModel *);
+			
 			/*
 			GLProgram *RegisterProgram(const std::string& name);
 			GLShader *RegisterShader(const std::string& name);
@@ -195,6 +235,7 @@ namespace spades {
 			virtual void DrawImage(client::IImage *, const Vector2& outTopLeft, const AABB2& inRect);
 			virtual void DrawImage(client::IImage *, const AABB2& outRect, const AABB2& inRect);
 			virtual void DrawImage(client::IImage *, const Vector2& outTopLeft, const Vector2& outTopRight, const Vector2& outBottomLeft, const AABB2& inRect);
+			virtual void DrawImages(client::IImage *, const client::ImageQuad *, size_t numQuads);
 			
 			virtual void DrawFlatGameMap(const AABB2& outRect, const AABB2& inRect);
 			
@@ -28,6 +28,7 @@
 #include <Core/Settings.h>
 #include <Core/ConcurrentDispatch.h>
 #include <Core/Thread.h>
+#include <Core/SamplingProfiler.h>
 #include <Core/ZipFileSystem.h>
 #include <Core/ServerAddress.h>
 #include "Runner.h"
@@ -151,6 +152,7 @@ class ThreadQuantumSetter {
 
 #endif
 
+SPADES_SETTING(core_samplingProfiler, "0");
 SPADES_SETTING(cg_lastQuickConnectHost, "");
 SPADES_SETTING(cg_protocolVersion, "");
 SPADES_SETTING(cg_playerName, "");
@@ -432,6 +434,11 @@ int main(int argc, char ** argv)
 		// load preferences.
 		spades::Settings::GetInstance()->Load();
 		pumpEvents();
+		
+		// sampling interval in milliseconds
+		if((int)core_samplingProfiler > 0) {
+			spades::SamplingProfiler::Start(core_samplingProfiler);
+		}
 
 		// dump CPU info (for debugging?)
 		{
@@ -503,8 +510,14 @@ int main(int argc, char ** argv)
 				}
 
 				if(spades::FileManager::FileExists(name.c_str())) {
-					spades::IStream *stream = spades::FileManager::OpenForReading(name.c_str());
-					spades::ZipFileSystem *fs = new spades::ZipFileSystem(stream);
+					spades::ZipFileSystem *fs;
+					std::string path = spades::FileManager::GetPhysicalPath(name.c_str());
+					if(!path.empty()) {
+						fs = new spades::ZipFileSystem(path);
+					}else{
+						spades::IStream *stream = spades::FileManager::OpenForReading(name.c_str());
+						fs = new spades::ZipFileSystem(stream);
+					}
 					if(name[0] == '_' && false) { // last resort for #198
 						SPLog("Pak Registered: %s (marked as 'important')\n", name.c_str());
 						fssImportant.push_back(fs);
@@ -591,7 +604,8 @@ int main(int argc, char ** argv)
 		std::string msg = ex.what();
 		msg = _Tr("Main", "A serious error caused OpenSpades to stop working:\n\n{0}\n\nSee SystemMessages.log for more details.", msg);
 
-		SPLog("[!] Terminating due to the fatal error: %s", ex.what());
+		SPLogError("[!] Terminating due to the fatal error: %s", ex.what());
+		spades::AsyncLog::Flush();
 
 		SDL_InitSubSystem(SDL_INIT_VIDEO);
 		if(SDL_ShowSimpleMessageBox(SDL_MESSAGEBOX_ERROR, _Tr("Main", "OpenSpades Fatal Error").c_str(), msg.c_str(), nullptr)) {
@@ -601,6 +615,8 @@ int main(int argc, char ** argv)
 
 	}
 
+	spades::SamplingProfiler::Stop("SamplingProfile.txt");
+
     return 0;
 }
 
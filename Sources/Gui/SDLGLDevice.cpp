@@ -343,6 +343,8 @@ ReportError(err, __LINE__, __PRETTY_FUNCTION__); \
 					return (const char *)glGetString(GL_VERSION);
 				case ShadingLanguageVersion:
 					return (const char *)glGetString(GL_SHADING_LANGUAGE_VERSION);
+				case Extensions:
+					return (const char *)glGetString(GL_EXTENSIONS);
 				default: SPInvalidEnum("type", type);
 			}
 		}
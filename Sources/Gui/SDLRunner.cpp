@@ -26,14 +26,17 @@
 #include "SDLRunner.h"
 
 #include <Draw/GLRenderer.h>
+#include <Draw/GLRecordingDevice.h>
 #include <Client/Client.h>
 #include <Audio/ALDevice.h>
 #include <Audio/YsrDevice.h>
 #include <Audio/NullDevice.h>
+#include <Audio/SWAudioDevice.h>
 #include <ctype.h>
 #include <Core/Debug.h>
 #include <Core/Settings.h>
 #include <Core/ConcurrentDispatch.h>
+#include <Core/FrameProfiler.h>
 #include <Core/Math.h>
 #include <Draw/SWRenderer.h>
 #include <Draw/SWPort.h>
@@ -46,6 +49,7 @@ SPADES_SETTING(r_depthBits, "16");
 SPADES_SETTING(r_vsync, "1");
 SPADES_SETTING(r_allowSoftwareRendering, "0");
 SPADES_SETTING(r_renderer, "gl");
+SPADES_SETTING(r_recordGLCalls, "0");
 #ifdef __APPLE__
 SPADES_SETTING(s_audioDriver, "ysr");
 #else
@@ -68,10 +72,12 @@ namespace spades {
 				return new audio::ALDevice();
 			}else if(EqualsIgnoringCase(s_audioDriver, "ysr")) {
 				return new audio::YsrDevice();
+			}else if(EqualsIgnoringCase(s_audioDriver, "sw")) {
+				return new audio::SWAudioDevice();
 			}else if(EqualsIgnoringCase(s_audioDriver, "null")) {
 				return new audio::NullDevice();
 			}else{
-				SPRaise("Unknown audio driver name: %s (openal or ysr expected)", s_audioDriver.CString());
+				SPRaise("Unknown audio driver name: %s (openal, ysr, or sw expected)", s_audioDriver.CString());
 			}
 		}
 		
@@ -212,8 +218,10 @@ namespace spades {
 					
 					Uint32 dt = SDL_GetTicks() - ot;
 					ot += dt;
-					if((int32_t)dt > 0)
+					if((int32_t)dt > 0) {
 						view->RunFrame((float)dt / 1000.f);
+						FrameProfiler::MarkFrame();
+					}
 					
 					if(view->WantsToBeClosed()){
 						view->Closing();
@@ -397,7 +405,11 @@ namespace spades {
 			switch(GetRendererType()) {
 				case RendererType::GL:
 				{
-					Handle<SDLGLDevice> glDevice(new SDLGLDevice(wnd), false);
+					Handle<draw::IGLDevice> glDevice(new SDLGLDevice(wnd), false);
+					if(r_recordGLCalls){
+						// counts the draw calls shown by r_debugTiming
+						glDevice.Set(new draw::GLRecordingDevice(glDevice), false);
+					}
 					return new draw::GLRenderer(glDevice);
 				}
 				case RendererType::SW: